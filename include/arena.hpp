@@ -0,0 +1,9 @@
+#ifndef ARENA_HPP
+#define ARENA_HPP
+
+#include "lua_object.hpp"
+#include <memory>
+
+LuaObject* create_arena_library();
+
+#endif // ARENA_HPP
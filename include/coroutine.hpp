@@ -2,46 +2,102 @@
 #define COROUTINE_HPP
 
 #include "lua_object.hpp"
-#include <thread>
-#include <mutex>
-#include <condition_variable>
 #include <memory>
 #include <vector>
 #include <exception>
 
+// Backend selection:
+//   default                 - stackful coroutines switched in user space on pooled, guard-paged stacks
+//                             (hand-written switch on x86-64 ELF, ucontext elsewhere or with LUAX_COROUTINE_UCONTEXT)
+//   LUAX_COROUTINE_THREADS  - one OS thread per coroutine with a mutex/condvar handshake
+#ifdef LUAX_COROUTINE_THREADS
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#endif
+
+// Worker threads used by coroutine.create_parallel (0 = hardware concurrency).
+// Can be overridden at run time with the LUAX_WORKERS environment variable.
+#ifndef LUAX_PARALLEL_WORKERS
+#define LUAX_PARALLEL_WORKERS 0
+#endif
+
+// Usable stack per coroutine (excluding the guard page). Pages are only committed when touched.
+#ifndef LUAX_COROUTINE_STACK_SIZE
+#define LUAX_COROUTINE_STACK_SIZE (256 * 1024)
+#endif
+
+// State of a coroutine.create_parallel task, shared with the worker that runs it
+struct LuaParallelTask;
+
 class LuaCoroutine : public LuaRefCounted {
 public:
 	enum class Status { SUSPENDED, RUNNING, DEAD };
 
 	LuaCallable* func;
 	Status status = Status::SUSPENDED;
+	bool error_occurred = false;
+	bool terminate = false;
+
+#ifdef LUAX_COROUTINE_THREADS
 	std::thread worker;
-	
+
 	std::mutex mtx;
 	std::condition_variable cv;
 
 	// Memory exclusively owned and mutated by the worker thread
 	LuaValueVector args;
 	LuaValueVector results;
-	bool error_occurred = false;
-	
+
 	// Synchronization states
 	bool started = false;
-	bool terminate = false;
 	bool results_copied = false;
 
 	// Handover pointers (read-only for the receiving thread)
 	const LuaValue* in_args_ptr = nullptr;
 	size_t in_args_size = 0;
-	
+
 	const LuaValue* out_args_ptr = nullptr;
 	size_t out_args_size = 0;
 
-	LuaCoroutine(LuaCallable* f);
+	void run();
+#else
+	// Values handed across a resume/yield switch (resume args in, yield/return values out)
+	LuaValueVector transfer;
+
+	// Stack region (guard page included) and saved machine contexts.
+	// Both contexts live inside the stack region, so a coroutine costs no extra allocation.
+	char* stack = nullptr;
+	void* context = nullptr;
+	void* caller_context = nullptr;
+
+	// Coroutine that was running when this one was resumed
+	LuaCoroutine* previous = nullptr;
+
+	// Each coroutine owns its return-buffer stack; it is swapped in while the coroutine runs
+	LuaRetBufStack ret_bufs;
+	// Likewise its innermost arena.run scope, so the resumer never allocates from it
+	LuaArena* arena = nullptr;
+
+#ifdef LUAX_PROFILE
+	// Shadow stack for the sampler, likewise swapped in while the coroutine runs
+	LuaProfileStack profile_stack;
+#endif
+
+	static void entry(LuaCoroutine* co);
+	void switch_in();
+	void switch_out();
+#endif
+
+	// Non-null for coroutine.create_parallel: resume() queues the body on the worker pool
+	std::unique_ptr<LuaParallelTask> task;
+
+	LuaCoroutine(LuaCallable* f, bool parallel = false);
 	~LuaCoroutine();
 
-	void run();
 	void resume(const LuaValue* args, size_t n_args, LuaValueVector& out);
+	void start_parallel(const LuaValue* args, size_t n_args, LuaValueVector& out);
+	void await(LuaValueVector& out);
 	static void yield(const LuaValue* args, size_t n_args, LuaValueVector& out);
 };
 
@@ -53,7 +109,9 @@ void coroutine_yield(const LuaValue* args, size_t n_args, LuaValueVector& out);
 void coroutine_status(const LuaValue* args, size_t n_args, LuaValueVector& out);
 void coroutine_running(const LuaValue* args, size_t n_args, LuaValueVector& out);
 void coroutine_wrap(const LuaValue* args, size_t n_args, LuaValueVector& out);
+void coroutine_create_parallel(const LuaValue* args, size_t n_args, LuaValueVector& out);
+void coroutine_await(const LuaValue* args, size_t n_args, LuaValueVector& out);
 
 LuaObject* create_coroutine_library();
 
-#endif
\ No newline at end of file
+#endif
@@ -7,26 +7,78 @@
 #include <string>
 #include <vector>
 #include <memory>
+#include <mutex>
+#include <cstdio>
+
+// Default size of a file's write buffer; file:setvbuf(mode, size) changes it
+constexpr size_t LUA_FILE_BUFFER_SIZE = 64 * 1024;
 
 class LuaFile : public LuaObject {
 public:
 	FILE* file_handle;
 	bool is_closed;
 	bool is_popen; // Track if opened via popen
+	// Regular files opened with the "m" mode flag (e.g. "rm") are read through a private
+	// read-only mapping instead of stdio; map_pos is the read position within it
+	const char* map_data = nullptr;
+	size_t map_size = 0;
+	mutable size_t map_pos = 0;
+	// Writes are collected here and reach the descriptor in one writev when the buffer fills,
+	// a line ends (line mode) or the call returns (no buffering); strings at least
+	// write_buf_size long are handed to writev without being copied
+	std::string write_buf;
+	size_t write_buf_size = LUA_FILE_BUFFER_SIZE;
+	int write_mode = _IOFBF;
+	std::mutex write_mtx;
+	// io.popen(cmd, "rn") / "wn": the pipe is non-blocking and an operation that would block
+	// waits in the reactor (reactor.hpp), parking the running coroutine. Reads are buffered in
+	// read_buf instead of stdio, and close reaps child_pid without blocking the thread
+	bool nonblocking = false;
+	std::string read_buf;
+	size_t read_pos = 0;
+	size_t read_base = 0; // stream offset of read_buf[0]
+	bool read_eof = false;
+	bool flushing = false; // a non-blocking flush is waiting for the pipe
+	bool write_failed = false; // such a flush lost data other writers had appended meanwhile
+	int child_pid = -1;
 
 	LuaFile(const std::string& filename, const std::string& mode);
 	LuaFile(FILE* f, bool is_popen_mode = false); // Constructor for existing FILE*
 	~LuaFile() override;
 
 	void close(const LuaValue* args, size_t n_args, LuaValueVector& out);
-	void flush(const LuaValue* args, size_t n_args, LuaValueVector& out) const;
+	void flush(const LuaValue* args, size_t n_args, LuaValueVector& out);
 	void lines(const LuaValue* args, size_t n_args, LuaValueVector& out);
-	void read(const LuaValue* args, size_t n_args, LuaValueVector& out) const;
-	void seek(const LuaValue* args, size_t n_args, LuaValueVector& out) const;
-	void setvbuf(const LuaValue* args, size_t n_args, LuaValueVector& out) const;
+	void read(const LuaValue* args, size_t n_args, LuaValueVector& out);
+	void seek(const LuaValue* args, size_t n_args, LuaValueVector& out);
+	void setvbuf(const LuaValue* args, size_t n_args, LuaValueVector& out);
 	void write(const LuaValue* args, size_t n_args, LuaValueVector& out);
+
+	// Appends values as io.write does (print_line: tab separated, newline terminated, as print
+	// does) and applies the buffering mode; false if a write to the descriptor failed
+	bool write_values(const LuaValue* values, size_t n, bool print_line = false, const LuaValue* rest = nullptr, size_t n_rest = 0);
+	bool flush_buffer();
+
+private:
+	bool flush_locked(std::string_view tail = {});
+	bool flush_nonblocking_locked(std::string_view tail);
+	bool fill_read_buf();
+	void read_nonblocking(const std::string& format, LuaValueVector& out);
+	int close_child(bool may_wait);
+	bool append_locked(const LuaValue& value);
+	void map_file();
+	void unmap_file();
+	std::string_view mapped_rest() const;
+	LuaValue read_mapped_line(bool keep_newline) const;
+	void read_mapped(const std::string& format, LuaValueVector& out) const;
 };
 
+// print: tab separated values and a newline on the buffered stdout handle (rest follows args)
+void luax_print(const LuaValue* args, size_t n_args, const LuaValue* rest = nullptr, size_t n_rest = 0);
+
+// Writes out the stdout and stderr buffers; runs at exit and before subprocesses start
+void luax_flush_output();
+
 // Function to create the 'io' library table
 LuaObject* create_io_library();
 
@@ -38,7 +90,9 @@ void io_lines(const LuaValue* args, size_t n_args, LuaValueVector& out);
 void io_open(const LuaValue* args, size_t n_args, LuaValueVector& out);
 void io_output(const LuaValue* args, size_t n_args, LuaValueVector& out);
 void io_popen(const LuaValue* args, size_t n_args, LuaValueVector& out);
+void io_poll(const LuaValue* args, size_t n_args, LuaValueVector& out);
 void io_read(const LuaValue* args, size_t n_args, LuaValueVector& out);
+void io_run(const LuaValue* args, size_t n_args, LuaValueVector& out);
 void io_tmpfile(const LuaValue* args, size_t n_args, LuaValueVector& out);
 void io_type(const LuaValue* args, size_t n_args, LuaValueVector& out);
 void io_write(const LuaValue* args, size_t n_args, LuaValueVector& out);
@@ -0,0 +1,110 @@
+#ifndef LUA_HASH_MAP_HPP
+#define LUA_HASH_MAP_HPP
+
+#include "lua_value.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <utility>
+
+// Hash part of a table: open addressing with Swiss-table style control bytes.
+// Slots ({key, value}, 16 bytes) live inline in one allocation behind the control bytes;
+// lookups compare 16 control bytes at a time (SSE2 when available) before touching a slot.
+//
+// Keys are kept in canonical form (strings inline or interned, integral floats as integers),
+// so hashing and comparing a key only looks at its raw bits.
+//
+// Removing a key releases it and its value. When the slot's group still has an empty byte, no
+// probe sequence has passed through the group and the slot simply becomes empty again; only a
+// slot in a full group becomes a tombstone, which the next rehash drops. Either way the slot
+// remembers the key's bits without owning them, so next() can continue from a field that was
+// cleared during traversal (empty slots that never held a key hold zero bits, which no canonical
+// key has). Iteration follows slot order, which stays stable until an insertion triggers a
+// rehash. Every live slot holds a non-nil value.
+class LuaHashMap {
+public:
+	struct Slot {
+		LuaValue first;
+		LuaValue second;
+	};
+
+	template <bool Const>
+	class Iterator {
+		using MapPtr = std::conditional_t<Const, const LuaHashMap*, LuaHashMap*>;
+		using SlotRef = std::conditional_t<Const, const Slot&, Slot&>;
+		using SlotPtr = std::conditional_t<Const, const Slot*, Slot*>;
+		MapPtr map;
+		size_t index;
+	public:
+		Iterator(MapPtr m, size_t i) : map(m), index(i) {}
+		operator Iterator<true>() const { return Iterator<true>(map, index); }
+		SlotRef operator*() const { return map->slots[index]; }
+		SlotPtr operator->() const { return &map->slots[index]; }
+		Iterator& operator++() {
+			index = map->next_live(index + 1);
+			return *this;
+		}
+		bool operator==(const Iterator& o) const { return index == o.index; }
+		bool operator!=(const Iterator& o) const { return index != o.index; }
+		size_t slot_index() const { return index; }
+	};
+	using iterator = Iterator<false>;
+	using const_iterator = Iterator<true>;
+
+	LuaHashMap() = default;
+	~LuaHashMap();
+	LuaHashMap(const LuaHashMap&) = delete;
+	LuaHashMap& operator=(const LuaHashMap&) = delete;
+
+	iterator begin() { return iterator(this, next_live(0)); }
+	iterator end() { return iterator(this, capacity); }
+	const_iterator begin() const { return const_iterator(this, next_live(0)); }
+	const_iterator end() const { return const_iterator(this, capacity); }
+
+	// Live entries only
+	iterator find(const LuaValue& key) { return iterator(this, find_index(canonical_raw(key))); }
+	iterator find(std::string_view key) { return iterator(this, find_index(canonical_raw(key))); }
+	// Also finds removed keys; used to resume a traversal
+	iterator find_slot(const LuaValue& key) { return iterator(this, find_dead_index(canonical_raw(key))); }
+
+	// Stores value under key; nil removes the key
+	void set(const LuaValue& key, const LuaValue& value);
+	// Inserts only if the key is missing; nil values are not stored
+	std::pair<iterator, bool> emplace(const LuaValue& key, const LuaValue& value);
+	size_t erase(const LuaValue& key);
+
+	void reserve(size_t n);
+	void clear();
+	size_t size() const { return live; }
+	size_t slot_count() const { return capacity; }
+
+private:
+	static constexpr int8_t CTRL_EMPTY = -128;
+	static constexpr int8_t CTRL_DELETED = -2; // tombstone; live slots hold a 7-bit hash
+	static constexpr size_t GROUP = 16;
+
+	int8_t* ctrl = nullptr; // capacity control bytes, then the slots
+	Slot* slots = nullptr;
+	size_t capacity = 0;    // 0 or a power of two >= GROUP
+	size_t used = 0;        // occupied slots, tombstones included
+	size_t live = 0;        // entries
+	size_t erased = 0;      // removals since the last rehash or clear; slots may remember their keys
+
+	static size_t mix(size_t h) {
+		h ^= h >> 33;
+		h *= 0xff51afd7ed558ccdULL;
+		h ^= h >> 33;
+		return h;
+	}
+
+	static uint64_t canonical_raw(const LuaValue& key);
+	static uint64_t canonical_raw(std::string_view key);
+	size_t find_index(uint64_t raw) const;
+	size_t find_dead_index(uint64_t raw) const;
+	size_t insert_index(size_t h);
+	size_t insert(const LuaValue& key, uint64_t raw);
+	void rehash(size_t new_capacity);
+	size_t next_live(size_t from) const;
+};
+
+#endif // LUA_HASH_MAP_HPP
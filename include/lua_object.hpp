@@ -5,12 +5,17 @@
 #include <string_view>
 #include <utility>
 #include <vector>
+#include <deque>
 #include <unordered_map>
 #include <memory>
 #include <functional>
+#include <optional>
 #include <stdexcept>
 #include "lua_value.hpp"
 #include "pool_allocator.hpp"
+#include "lua_hash_map.hpp"
+#include "lua_shape.hpp"
+#include "lua_profile.hpp"
 #include <cmath>
 #include <algorithm>
 #include <iostream>
@@ -19,16 +24,74 @@
 // Forward declaration
 class LuaObject;
 
-struct LuaString : public LuaRefCounted {
-    std::string str;
-    LuaString(std::string_view s) : str(s) {}
+// Cycle collector entry points (lib/gc.cpp). Automatic steps run at table allocation,
+// the only point where no object is half-built or half-destroyed.
+extern thread_local bool luax_gc_step_requested;
+void luax_gc_auto_step();
+double luax_gc_count_kb();
+bool luax_gc_step(size_t max_roots);
+void luax_gc_collect();
+
+// String intern pool counters. hits/misses refer to the per-thread lookup cache;
+// inserts counts strings added to the shared pool.
+struct LuaInternStats {
+	uint64_t hits = 0;
+	uint64_t misses = 0;
+	uint64_t inserts = 0;
+	uint64_t evictions = 0; // cache misses that replaced another string
+	size_t entries = 0;
+	size_t bytes = 0;
+	size_t shards = 0;
+	size_t cache_size = 0; // calling thread's cache
+};
+LuaInternStats luax_intern_stats();
 
-    void* operator new(std::size_t size) {
-        return LuaObjectPool::allocate(size);
+// Table counters for debug.memstats; per thread, like the pool counters
+struct LuaTableStats {
+	std::ptrdiff_t tables = 0;     // live LuaObjects
+	std::ptrdiff_t hash_bytes = 0; // hash part storage
+};
+extern thread_local LuaTableStats luax_table_stats;
+
+// Allocator, intern pool and table report; written at exit when LUAX_MEMSTATS is set
+void luax_dump_memstats(std::ostream& os);
+
+// Heap string: header and characters share one allocation (the characters follow the
+// header and are NUL-terminated). Strings of up to STRING_INLINE_MAX bytes never get here.
+struct LuaString : public LuaRefCounted {
+    // Whether every byte is below 0x80, found by the utf8 library on first use; fits in the
+    // padding after the refcount
+    enum : uint8_t { ASCII_UNKNOWN, ASCII_YES, ASCII_NO };
+    mutable uint8_t ascii = ASCII_UNKNOWN;
+    size_t len;
+    size_t capacity;
+    mutable size_t hash = 0; // 0 = not computed yet
+
+    static LuaString* create(std::string_view s, size_t capacity = 0);
+
+    char* chars() { return reinterpret_cast<char*>(this + 1); }
+    const char* chars() const { return reinterpret_cast<const char*>(this + 1); }
+    std::string_view view() const { return std::string_view(chars(), len); }
+
+    size_t get_hash() const {
+        if (hash == 0) [[unlikely]] hash = std::hash<std::string_view>{}(view());
+        return hash;
     }
-    void operator delete(void* ptr, std::size_t size) noexcept {
-        LuaObjectPool::deallocate(ptr, size);
+
+    // Appends in place when the capacity allows; otherwise returns a larger copy
+    // (the caller owns the old string). Only valid while the string is unshared.
+    LuaString* append(std::string_view tail);
+    LuaString* prepend(std::string_view head);
+
+    void operator delete(LuaString* p, std::destroying_delete_t) {
+        size_t bytes = alloc_size(p->capacity);
+        p->~LuaString();
+        LuaObjectPool::deallocate(p, bytes);
     }
+
+private:
+    LuaString(size_t l, size_t cap) : len(l), capacity(cap) {}
+    static size_t alloc_size(size_t cap) { return sizeof(LuaString) + cap + 1; }
 };
 
 // Virtual Base Class for all callable entities (Functions, Closures, C++ built-ins)
@@ -45,79 +108,188 @@ struct LuaCallable : public LuaRefCounted {
 	virtual LuaValue call3(LuaValueVector& out, const LuaValue& a1, const LuaValue& a2, const LuaValue& a3);
 };
 
+// --- Closure Tracing ---
+// Lambdas emitted for Lua functions that capture outer locals start with
+//     if (args == luax_gc_visit_args) [[unlikely]] { luax_trace_captures(n_args, captures...); return; }
+// Called with the sentinel, they report what they captured instead of running. Closures built
+// by make_lua_closure/make_specialized_closure are containers for the cycle collector and
+// trace themselves this way; gc_clear destroys the lambdas, which drops every capture.
+inline const LuaValue luax_gc_visit_args[1] = {};
+
+inline void luax_trace_capture(std::vector<const LuaRefCounted*>& out, const LuaValue& v) {
+	if (const LuaRefCounted* rc = v.counted_ref()) out.push_back(rc);
+}
+
+// Captures that hold no LuaValue (scalars, direct-call lambdas) are not traced
+template <typename T>
+inline void luax_trace_capture(std::vector<const LuaRefCounted*>&, const T&) {}
+
+// Box of a local function that refers to itself: the closure captures the box, the box holds the closure
+class LuaUpvalue final : public LuaRefCounted {
+public:
+	LuaValue value;
+	LuaUpvalue() { gc_container = true; }
+	void gc_trace(std::vector<const LuaRefCounted*>& children) const override { luax_trace_capture(children, value); }
+	void gc_clear() override { LuaValue v = std::move(value); }
+};
+
+// Owning handle, captured by value in the generated lambdas
+class LuaUpvalueRef {
+	LuaUpvalue* box;
+public:
+	LuaUpvalueRef() : box(new LuaUpvalue()) { box->retain(); }
+	LuaUpvalueRef(const LuaUpvalueRef& o) : box(o.box) { if (box) box->retain(); }
+	LuaUpvalueRef(LuaUpvalueRef&& o) noexcept : box(o.box) { o.box = nullptr; }
+	LuaUpvalueRef& operator=(const LuaUpvalueRef&) = delete;
+	~LuaUpvalueRef() { if (box) box->release(); }
+	LuaValue& operator*() const { return box->value; }
+	LuaValue* operator->() const { return &box->value; }
+	const LuaUpvalue* get() const { return box; }
+};
+
+inline void luax_trace_capture(std::vector<const LuaRefCounted*>& out, const LuaUpvalueRef& u) {
+	if (u.get()) out.push_back(u.get());
+}
+
+template <typename... Caps>
+inline void luax_trace_captures(size_t children, const Caps&... caps) {
+	auto& out = *reinterpret_cast<std::vector<const LuaRefCounted*>*>(children);
+	(luax_trace_capture(out, caps), ...);
+}
+
+// Named at the top of the fixed-arity entries, so they capture what the variadic entry reports
+template <typename... Caps>
+inline void luax_hold_captures(const Caps&...) {}
+
+template <typename F>
+inline void luax_trace_lambda(const F& f, std::vector<const LuaRefCounted*>& children) {
+	LuaValueVector unused;
+	const_cast<F&>(f)(luax_gc_visit_args, reinterpret_cast<size_t>(&children), unused);
+}
+
 // Generic template to wrap ANY lambda/callable without std::function overhead
 template <typename F>
 struct LuaLambdaCallable final : public LuaCallable {
-	F func;
-	LuaLambdaCallable(F&& f) : func(std::forward<F>(f)) {}
+	std::optional<F> func; // Empty only after gc_clear
+	template <typename G>
+	LuaLambdaCallable(G&& f, bool traced = false) : func(std::forward<G>(f)) { gc_container = traced; }
 
 	void call(const LuaValue* args, size_t n_args, LuaValueVector& out_result) override {
-		func(args, n_args, out_result);
+		(*func)(args, n_args, out_result);
+	}
+	void gc_trace(std::vector<const LuaRefCounted*>& children) const override {
+		if (gc_container && func) luax_trace_lambda(*func, children);
 	}
+	void gc_clear() override { if (gc_container) func.reset(); }
 };
 
 template <typename F>
 inline LuaCallable* make_lua_callable(F&& f) {
-    return new LuaLambdaCallable<F>(std::forward<F>(f));
+    return new LuaLambdaCallable<std::decay_t<F>>(std::forward<F>(f));
 }
 
-// Specialized templates for functions with known arity to provide direct overrides
+// For generated lambdas carrying the capture hook
+template <typename F>
+inline LuaCallable* make_lua_closure(F&& f) {
+    return new LuaLambdaCallable<std::decay_t<F>>(std::forward<F>(f), true);
+}
+
+// Specialized templates for functions with known arity to provide direct overrides.
+// Generated fixed-arity entries capture the same locals as the variadic one, which reports
+// them once per copy.
+template <typename FVar, typename FSpec>
+struct LuaSpecializedBase : public LuaCallable {
+	std::optional<FVar> f_var;
+	std::optional<FSpec> f_spec; // Both empty only after gc_clear
+	template <typename V, typename S>
+	LuaSpecializedBase(V&& v, S&& s, bool traced) : f_var(std::forward<V>(v)), f_spec(std::forward<S>(s)) { gc_container = traced; }
+	void call(const LuaValue* args, size_t n, LuaValueVector& out) override { (*f_var)(args, n, out); }
+	void gc_trace(std::vector<const LuaRefCounted*>& children) const override {
+		if (!gc_container || !f_var) return;
+		luax_trace_lambda(*f_var, children);
+		luax_trace_lambda(*f_var, children);
+	}
+	void gc_clear() override {
+		if (!gc_container) return;
+		f_var.reset();
+		f_spec.reset();
+	}
+};
+
 template <size_t Arity, typename FVar, typename... FExt>
 struct LuaSpecializedCallable;
 
 template <typename FVar, typename F0>
-struct LuaSpecializedCallable<0, FVar, F0> final : public LuaCallable {
-	FVar f_var; F0 f0;
-	LuaSpecializedCallable(FVar&& v, F0&& s) : f_var(std::forward<FVar>(v)), f0(std::forward<F0>(s)) {}
-	void call(const LuaValue* args, size_t n, LuaValueVector& out) override { f_var(args, n, out); }
-	LuaValue call0(LuaValueVector& /*out*/) override { return f0(); }
+struct LuaSpecializedCallable<0, FVar, F0> final : public LuaSpecializedBase<FVar, F0> {
+	using LuaSpecializedBase<FVar, F0>::LuaSpecializedBase;
+	LuaValue call0(LuaValueVector& /*out*/) override { return (*this->f_spec)(); }
 };
 
 template <typename FVar, typename F1>
-struct LuaSpecializedCallable<1, FVar, F1> final : public LuaCallable {
-	FVar f_var; F1 f1;
-	LuaSpecializedCallable(FVar&& v, F1&& s) : f_var(std::forward<FVar>(v)), f1(std::forward<F1>(s)) {}
-	void call(const LuaValue* args, size_t n, LuaValueVector& out) override { f_var(args, n, out); }
-	LuaValue call1(LuaValueVector& /*out*/, const LuaValue& a1) override { return f1(a1); }
+struct LuaSpecializedCallable<1, FVar, F1> final : public LuaSpecializedBase<FVar, F1> {
+	using LuaSpecializedBase<FVar, F1>::LuaSpecializedBase;
+	LuaValue call1(LuaValueVector& /*out*/, const LuaValue& a1) override { return (*this->f_spec)(a1); }
 };
 
 template <typename FVar, typename F2>
-struct LuaSpecializedCallable<2, FVar, F2> final : public LuaCallable {
-	FVar f_var; F2 f2;
-	LuaSpecializedCallable(FVar&& v, F2&& s) : f_var(std::forward<FVar>(v)), f2(std::forward<F2>(s)) {}
-	void call(const LuaValue* args, size_t n, LuaValueVector& out) override { f_var(args, n, out); }
-	LuaValue call2(LuaValueVector& /*out*/, const LuaValue& a1, const LuaValue& a2) override { return f2(a1, a2); }
+struct LuaSpecializedCallable<2, FVar, F2> final : public LuaSpecializedBase<FVar, F2> {
+	using LuaSpecializedBase<FVar, F2>::LuaSpecializedBase;
+	LuaValue call2(LuaValueVector& /*out*/, const LuaValue& a1, const LuaValue& a2) override { return (*this->f_spec)(a1, a2); }
 };
 
 template <typename FVar, typename F3>
-struct LuaSpecializedCallable<3, FVar, F3> final : public LuaCallable {
-	FVar f_var; F3 f3;
-	LuaSpecializedCallable(FVar&& v, F3&& s) : f_var(std::forward<FVar>(v)), f3(std::forward<F3>(s)) {}
-	void call(const LuaValue* args, size_t n, LuaValueVector& out) override { f_var(args, n, out); }
-	LuaValue call3(LuaValueVector& /*out*/, const LuaValue& a1, const LuaValue& a2, const LuaValue& a3) override { return f3(a1, a2, a3); }
+struct LuaSpecializedCallable<3, FVar, F3> final : public LuaSpecializedBase<FVar, F3> {
+	using LuaSpecializedBase<FVar, F3>::LuaSpecializedBase;
+	LuaValue call3(LuaValueVector& /*out*/, const LuaValue& a1, const LuaValue& a2, const LuaValue& a3) override { return (*this->f_spec)(a1, a2, a3); }
 };
 
 template <size_t Arity, typename FVar, typename FSpec>
 inline LuaCallable* make_specialized_callable(FVar&& v, FSpec&& s) {
-    return new LuaSpecializedCallable<Arity, FVar, FSpec>(std::forward<FVar>(v), std::forward<FSpec>(s));
+    return new LuaSpecializedCallable<Arity, std::decay_t<FVar>, std::decay_t<FSpec>>(std::forward<FVar>(v), std::forward<FSpec>(s), false);
 }
 
+template <size_t Arity, typename FVar, typename FSpec>
+inline LuaCallable* make_specialized_closure(FVar&& v, FSpec&& s) {
+    return new LuaSpecializedCallable<Arity, std::decay_t<FVar>, std::decay_t<FSpec>>(std::forward<FVar>(v), std::forward<FSpec>(s), true);
+}
+
+// Metamethods a metatable caches; the order matches the names in lua_object.cpp
+enum LuaMetamethod : uint8_t {
+	TM_INDEX, TM_NEWINDEX, TM_CALL, TM_LEN, TM_EQ, TM_LT, TM_LE, TM_CONCAT,
+	TM_ADD, TM_SUB, TM_MUL, TM_DIV, TM_MOD, TM_POW, TM_UNM, TM_IDIV,
+	TM_BAND, TM_BOR, TM_BXOR, TM_SHL, TM_SHR, TM_BNOT,
+	TM_TOSTRING, TM_PAIRS, TM_IPAIRS, TM_CLOSE, TM_GC, TM_MODE, TM_NAME, TM_METATABLE,
+	TM_COUNT
+};
+
+// Built the first time a table is used as a metatable. Slots point at the table's own
+// values, so the cache is only valid while its version matches the table's props_version.
+struct LuaMetaCache {
+	uint32_t version = 0;
+	uint32_t present = 0; // bit per LuaMetamethod with a non-nil value
+	const LuaValue* slots[TM_COUNT] = {};
+};
+
 // LuaObject Definition
 class LuaObject : public LuaRefCounted {
 public:
     void* operator new(std::size_t size) {
+        if (luax_gc_step_requested) [[unlikely]] luax_gc_auto_step();
+        ++luax_table_stats.tables;
         return LuaObjectPool::allocate(size);
     }
     void operator delete(void* ptr, std::size_t size) noexcept {
+        --luax_table_stats.tables;
         LuaObjectPool::deallocate(ptr, size);
     }
 
-	struct MetamethodRef {
-		const LuaValue* index;
-		const LuaValue* newindex;
-	};
-	
-	virtual ~LuaObject() = default;
+	LuaObject() { gc_container = true; }
+	virtual ~LuaObject() {
+		if (metatable) metatable->release();
+	}
+
+	void gc_trace(std::vector<const LuaRefCounted*>& children) const override;
+	void gc_clear() override;
 	
 	// Hybrid storage: small vector for few properties, map for many.
 	struct PropPair {
@@ -125,17 +297,19 @@ public:
 		LuaValue second;
 	};
 	std::vector<PropPair, PoolAllocator<PropPair>> small_props;
-	using PropMap = std::unordered_map<LuaValue, LuaValue, LuaValueHash, LuaValueEq, PoolAllocator<std::pair<const LuaValue, LuaValue>>>;
+	using PropMap = LuaHashMap;
 	std::unique_ptr<PropMap> properties;
 	
+	const LuaShape* shape = LuaShape::empty(); // layout of small_props; uncached once properties is used
+	
 	std::vector<LuaValue, PoolAllocator<LuaValue>> array_part;
-	LuaObject* metatable = nullptr;
+	LuaObject* metatable = nullptr; // retained; set through set_metatable
 	
 	static const size_t SMALL_TABLE_THRESHOLD = 8; // Shrink threshold to keep small_props small
 
 	static LuaValue intern_key(const LuaValue& v) {
-		if (v.index() == INDEX_STRING) return intern(v.get<std::string_view>());
-		if (v.index() == INDEX_STRING_VIEW) return intern(v.get<std::string_view>());
+		// Short strings are already canonical inline values; LuaValue(string_view) interns the rest
+		if (is_counted_string(v.raw_data())) return LuaValue(v.get<std::string_view>());
 		return v;
 	}
 
@@ -188,37 +362,44 @@ public:
 	void set_item(const char* key, const LuaValue& value) { set_item(std::string_view(key), value); }
 	void set_item(const LuaValue& key, const LuaValueVector& value);
 
+	// Constant-key field access through a per-site inline cache; key must be canonical
+	inline LuaValue get_field(const LuaValue& key, LuaFieldCache& ic);
+	inline void set_field(const LuaValue& key, const LuaValue& value, LuaFieldCache& ic);
+
 	// General high-performance helpers (Phase 2)
 	void table_insert(const LuaValue& value);
 	void table_insert(long long pos, const LuaValue& value);
-
-	// Metamethod and property cache
-	LuaValue cached_index;
-	LuaValue cached_newindex;
-	bool metamethods_initialized{false}; 
-	
-	// Inside class LuaObject:
-	inline MetamethodRef get_cached_metamethods() {
-		if (!metamethods_initialized) {
-			ensure_metamethods();
-		}
-		return { &cached_index, &cached_newindex };
+	// Capacity for narr array slots and nhash other keys; contents are unchanged
+	void reserve(size_t narr, size_t nhash = 0);
+	// Stores values[0..n) at start, start + 1, ...; continuing the array part takes one bulk
+	// insert. The move version leaves the values nil.
+	void copy_into_array(long long start, const LuaValue* values, size_t n);
+	void move_into_array(long long start, LuaValue* values, size_t n);
+
+	// Bumped by every change to small_props or properties other than overwriting a
+	// non-nil value in place
+	uint32_t props_version = 0;
+	std::unique_ptr<LuaMetaCache> meta_cache;
+
+	// Metamethods of this table as a metatable (raw lookups, as in Lua)
+	const LuaMetaCache& metamethods() {
+		if (!meta_cache || meta_cache->version != props_version) [[unlikely]] build_meta_cache();
+		return *meta_cache;
 	}
-
-	void ensure_metamethods() {
-		if (metamethods_initialized) return;
-		if (metatable) {
-			cached_index = metatable->get_prop("__index");
-			cached_newindex = metatable->get_prop("__newindex");
-		} else {
-			cached_index = LuaValue();
-			cached_newindex = LuaValue();
-		}
-		metamethods_initialized = true;
+	bool has_metamethod(LuaMetamethod m) { return (metamethods().present >> m) & 1; }
+	// Null when absent; the pointer is invalidated by the next change to this table
+	const LuaValue* find_metamethod(LuaMetamethod m) {
+		const LuaMetaCache& c = metamethods();
+		return ((c.present >> m) & 1) ? c.slots[m] : nullptr;
 	}
-
-	void invalidate_metamethods() {
-		metamethods_initialized = false;
+	LuaValue get_metamethod(LuaMetamethod m) {
+		const LuaValue* v = find_metamethod(m);
+		return v ? *v : LuaValue();
+	}
+	// For identity checks; 0 when absent
+	uint64_t metamethod_raw(LuaMetamethod m) {
+		const LuaValue* v = find_metamethod(m);
+		return v ? v->raw_data() : 0;
 	}
 
 	// Internal property accessors
@@ -235,12 +416,17 @@ public:
 	void set_prop(const char* key, const LuaValue& value) { set_prop(std::string_view(key), value); }
 
 	void set_metatable(LuaObject* mt);
+	// Recomputes shape after small_props lost an entry
+	void reshape();
 
 	static std::string_view intern(std::string_view sv);
 	static const LuaValue& get_single_char(unsigned char c);
 private:
 	// Internal version that tracks depth to prevent Segfaults
 	LuaValue get_item_internal(const LuaValue& key, int depth);
+	LuaValue get_field_miss(const LuaValue& key, LuaFieldCache& ic);
+	void set_field_miss(const LuaValue& key, const LuaValue& value, LuaFieldCache& ic);
+	void build_meta_cache();
 };
 
 extern LuaObject* _G;
@@ -289,7 +475,8 @@ inline double get_double(const LuaValue& value) {
 inline long long get_integer(const LuaValue& value) {
 	uint64_t raw = value.raw_data();
 	if ((raw & TAG_MASK) == TAG_INTEGER) [[likely]] {
-		return static_cast<long long>(raw & PAYLOAD_MASK);
+		// Sign-extend the 48-bit payload
+		return static_cast<long long>((raw & PAYLOAD_MASK) << 16) >> 16;
 	}
 	size_t idx = value.index();
 	if (idx == INDEX_INTEGER) return value.get<long long>();
@@ -351,6 +538,7 @@ inline LuaCallable* get_callable(const LuaValue& value) {
 	if (idx == INDEX_FUNCTION) [[likely]] return value.get<LuaCallable*>();
 
 	if (idx == INDEX_CFUNCTION) [[likely]] {
+		LUAX_PROFILE_COUNT(LUA_PROFILE_CFUNCTION_SHIM);
 		thread_local LuaCFunctionShim shim;
 		shim.ptr = value.get<LuaCFunction>().ptr;
 		return &shim;
@@ -359,9 +547,9 @@ inline LuaCallable* get_callable(const LuaValue& value) {
 	if (idx == INDEX_OBJECT) [[unlikely]] {
 		auto* obj = value.get<LuaObject*>();
 		if (obj && obj->metatable) {
-			LuaValue call_handler = obj->metatable->get_item("__call");
-			if (call_handler.index() == INDEX_FUNCTION || call_handler.index() == INDEX_CFUNCTION) {
-				return get_callable(call_handler);
+			const LuaValue* call_handler = obj->metatable->find_metamethod(TM_CALL);
+			if (call_handler && (call_handler->index() == INDEX_FUNCTION || call_handler->index() == INDEX_CFUNCTION)) {
+				return get_callable(*call_handler);
 			}
 		}
 	}
@@ -500,12 +688,19 @@ inline LuaValue lua_get_member(const LuaObject*& base, const char* key) { return
 
 inline LuaValue lua_get_member(LuaObject* base, const std::string& key) { return lua_get_member(base, std::string_view(key)); }
 inline LuaValue lua_get_member(LuaObject* base, const char* key) { return lua_get_member(base, std::string_view(key)); }
+// Constant-key reads emitted by the translator; ic is the call site's inline cache
+LuaValue lua_get_member(const LuaValue& base, const LuaValue& key, LuaFieldCache& ic);
+LuaValue lua_get_member(LuaObject* base, const LuaValue& key, LuaFieldCache& ic);
 LuaValue lua_get_length(const LuaValue& val); 
 
 // General High-Performance Helpers (Phase 2)
 // These are designed for broad usage, not just transpiler tailoring.
 void lua_table_insert(const LuaValue& t, const LuaValue& v);
 void lua_table_insert(const LuaValue& t, long long pos, const LuaValue& v);
+// Capacity hints from loops over first..last that store t[i] or append to t; they never
+// change contents, and values that are not tables are ignored
+void lua_table_reserve_range(const LuaValue& t, long long first, long long last);
+void lua_table_reserve_append(const LuaValue& t, long long first, long long last);
 void lua_string_byte(const LuaValue& str, long long i, long long j, LuaValueVector& out);
 LuaValue lua_string_sub(const LuaValue& str, long long i, long long j);
 
@@ -540,8 +735,8 @@ inline void call_lua_value(const LuaValue& callable, const LuaValue* args, size_
 	size_t idx = callable.index();
 	if (idx == INDEX_OBJECT) [[unlikely]] {
 		const auto& obj = callable.get<LuaObject*>();
-		if (obj && obj->metatable) {
-			LuaValue call_handler = obj->metatable->get_item("__call");
+		if (obj && obj->metatable && obj->metatable->has_metamethod(TM_CALL)) {
+			LuaValue call_handler = obj->metatable->get_metamethod(TM_CALL);
 			if (is_lua_truthy(call_handler)) {
 				if (n_args <= 7) [[likely]] {
 					LuaValue stack_args[8];
@@ -844,6 +1039,13 @@ inline bool lua_greater_equals(long long a, const LuaValue& b) { return !lua_les
 inline bool lua_greater_equals(const LuaValue& a, int b) { return !lua_less_than(a, static_cast<long long>(b)); }
 inline bool lua_greater_equals(int a, const LuaValue& b) { return !lua_less_than(static_cast<long long>(a), b); }
 
+// Copies s into a refcounted string; unlike LuaValue(std::string_view), never interns, so it
+// suits per-record data such as lines read from a file
+LuaValue lua_make_string(std::string_view s);
+// Takes the first reference to a LuaString created with room for its contents; strings of up
+// to STRING_INLINE_MAX bytes must be inline values instead
+LuaValue lua_adopt_string(LuaString* s);
+
 LuaValue lua_concat(const LuaValue& a, const LuaValue& b);
 LuaValue lua_concat(LuaValue&& a, const LuaValue& b);
 LuaValue lua_concat(const LuaValue& a, LuaValue&& b); 
@@ -862,6 +1064,16 @@ LuaValue lua_concat(T1&& a, T2&& b, T3&& c, Ts&&... rest) {
 	return lua_concat_multiple(arr, sizeof...(rest) + 3);
 }
 
+// acc = acc .. parts...: appends in place when acc holds the only reference to its
+// string, growing it geometrically, so accumulating in a loop stays linear
+LuaValue lua_concat_into(LuaValue&& acc, const LuaValue* parts, size_t n_parts);
+
+template <typename... Ts>
+LuaValue lua_concat_append(LuaValue&& acc, Ts&&... parts) {
+	const LuaValue arr[] = { LuaValue(std::forward<Ts>(parts))... };
+	return lua_concat_into(std::move(acc), arr, sizeof...(parts));
+}
+
 inline LuaValue as_view(const LuaValue& v) {
 	if ((v.raw_data() & TAG_MASK) == TAG_STRING) {
 		return LuaValue(std::string_view(v.get<std::string_view>()));
@@ -1040,13 +1252,11 @@ inline LuaValue lua_get_length(const LuaValue& val) {
 	if (val.index() == INDEX_STRING) return static_cast<long long>(val.get<std::string_view>().length());
 	if (val.index() == INDEX_OBJECT) {
 		auto* obj = val.get<LuaObject*>();
-		if (obj->metatable) {
-			auto len_meta = obj->metatable->get_item("__len");
-			if (!len_meta.is_nil()) {
-				LuaValueVector res;
-				call_lua_value(len_meta, &val, 1, res);
-				return res.empty() ? LuaValue() : res[0];
-			}
+		if (obj->metatable && obj->metatable->has_metamethod(TM_LEN)) {
+			LuaValue len_meta = obj->metatable->get_metamethod(TM_LEN);
+			LuaValueVector res;
+			call_lua_value(len_meta, &val, 1, res);
+			return res.empty() ? LuaValue() : res[0];
 		}
 		return static_cast<long long>(obj->array_part.size());
 	}
@@ -1057,20 +1267,39 @@ inline long long lua_get_length_int(const LuaValue& val) {
 	if (val.index() == INDEX_STRING) return static_cast<long long>(val.get<std::string_view>().length());
 	if (val.index() == INDEX_OBJECT) {
 		auto* obj = val.get<LuaObject*>();
-		if (obj->metatable) {
-			auto len_meta = obj->metatable->get_item("__len");
-			if (!len_meta.is_nil()) {
-				LuaValueVector res;
-				call_lua_value(len_meta, &val, 1, res);
-				LuaValue ret = res.empty() ? LuaValue() : res[0];
-				return static_cast<long long>(to_double(ret));
-			}
+		if (obj->metatable && obj->metatable->has_metamethod(TM_LEN)) {
+			LuaValue len_meta = obj->metatable->get_metamethod(TM_LEN);
+			LuaValueVector res;
+			call_lua_value(len_meta, &val, 1, res);
+			LuaValue ret = res.empty() ? LuaValue() : res[0];
+			return static_cast<long long>(to_double(ret));
 		}
 		return static_cast<long long>(obj->array_part.size());
 	}
 	throw std::runtime_error("attempt to get length of a " + get_lua_type_name(val) + " value");
 }
 
+// Array-only tables the translator keeps in a local LuaValue[n] instead of a LuaObject
+inline long long lua_stack_array_length(const LuaValue* items, long long n) {
+	while (n > 0 && items[n - 1].is_nil()) --n;
+	return n;
+}
+
+inline LuaValue lua_stack_array_get(const LuaValue* items, long long n, long long key) {
+	return (key >= 1 && key <= n) ? items[key - 1] : LuaValue();
+}
+
+inline LuaValue lua_stack_array_get(const LuaValue* items, long long n, const LuaValue& key) {
+	if (key.index() == INDEX_INTEGER) return lua_stack_array_get(items, n, key.get<long long>());
+	if (key.index() == INDEX_DOUBLE) {
+		double d = key.get<double>();
+		if (d >= 1.0 && d <= static_cast<double>(n) && d == static_cast<double>(static_cast<long long>(d))) {
+			return items[static_cast<long long>(d) - 1];
+		}
+	}
+	return LuaValue();
+}
+
 inline LuaValue lua_get_member(const LuaValue& base, const LuaValue& key) {
 	uint64_t raw = base.raw_data();
 	if ((raw & TAG_MASK) == TAG_OBJECT) [[likely]] {
@@ -1108,6 +1337,21 @@ inline LuaValue lua_get_member(LuaObject* base, std::string_view key) {
 	return LuaValue();
 }
 
+inline LuaValue lua_get_member(const LuaValue& base, const LuaValue& key, LuaFieldCache& ic) {
+	uint64_t raw = base.raw_data();
+	if ((raw & TAG_MASK) == TAG_OBJECT) [[likely]] {
+		return reinterpret_cast<LuaObject*>(raw & PAYLOAD_MASK)->get_field(key, ic);
+	}
+	return lua_get_member(base, key);
+}
+
+inline LuaValue lua_get_member(LuaObject* base, const LuaValue& key, LuaFieldCache& ic) {
+	if (base) [[likely]] {
+		return base->get_field(key, ic);
+	}
+	return LuaValue();
+}
+
 inline LuaValue lua_get_member(const LuaValue& base, long long key) {
 	uint64_t raw = base.raw_data();
 	if ((raw & TAG_MASK) == TAG_OBJECT) [[likely]] {
@@ -1132,6 +1376,38 @@ inline LuaValue get_return_value(LuaValueVector&& results, size_t index) {
 	}
 }
 
+template <size_t N>
+inline LuaValue get_return_value(LuaValuePack<N>& results, size_t index) {
+	if (index < N) [[likely]] {
+		return std::move(results[index]);
+	} else {
+		return LuaValue();
+	}
+}
+
+// select(n, ...) over the varargs of the current function: args[first..n_args)
+inline size_t lua_select_index(size_t n_args, size_t first, long long n) {
+	long long count = n_args > first ? static_cast<long long>(n_args - first) : 0;
+	if (n < 0) {
+		n = count + n + 1;
+		if (n < 1) [[unlikely]] throw std::runtime_error("bad argument #1 to 'select' (index out of range)");
+	} else if (n == 0) [[unlikely]] {
+		throw std::runtime_error("bad argument #1 to 'select' (index out of range)");
+	}
+	return first + static_cast<size_t>(n) - 1;
+}
+
+inline LuaValue lua_select_vararg(const LuaValue* args, size_t n_args, size_t first, long long n) {
+	size_t i = lua_select_index(n_args, first, n);
+	return i < n_args ? args[i] : LuaValue();
+}
+
+inline void lua_select_varargs(const LuaValue* args, size_t n_args, size_t first, long long n, LuaValueVector& out) {
+	size_t i = lua_select_index(n_args, first, n);
+	if (i < n_args) out.assign(args + i, args + n_args);
+	else out.clear();
+}
+
 // Logic operators
 template <typename T, typename F>
 LuaValue lua_logical_or(T&& left, F&& right_provider) {
@@ -1158,15 +1434,38 @@ struct LuaRetBufGuard {
 	~LuaRetBufGuard() { luax_release_ret_buf(); }
 };
 
+// A saved return-buffer stack; stackful coroutines swap theirs in while running
+struct LuaRetBufStack {
+	std::deque<LuaValueVector> bufs;
+	size_t depth = 0;
+};
+
+void luax_swap_ret_buf_stack(LuaRetBufStack& other);
+
 void luax_flush_thread_pool();
 
+// Switches a value and everything reachable through its tables and traced closures to
+// thread-safe refcounting. Only does work with LUAX_REFCOUNT_BIASED; the walk does not stop at
+// values that are already shared, so it also covers what was stored into them since.
+#ifdef LUAX_REFCOUNT_BIASED
+void luax_mark_shared(const LuaValue& value);
+#else
+inline void luax_mark_shared(const LuaValue&) {}
+#endif
+
+inline void luax_mark_shared(const LuaValue* values, size_t n) {
+	for (size_t i = 0; i < n; ++i) luax_mark_shared(values[i]);
+}
+
 template <> inline std::string_view LuaValue::get<std::string_view>() const {
     if ((data & TAG_MASK) == TAG_STRING) {
         uint64_t ptr_val = data & PAYLOAD_MASK;
-        if (ptr_val & 1ULL) {
-            return *reinterpret_cast<const std::string*>(ptr_val & ~1ULL);
+        if (ptr_val & STRING_INLINE_BIT) {
+            return std::string_view(reinterpret_cast<const char*>(&data), (ptr_val >> 40) & 7);
+        } else if (ptr_val & STRING_INTERNED_BIT) {
+            return *reinterpret_cast<const std::string*>(ptr_val & ~STRING_INTERNED_BIT);
         } else {
-            return reinterpret_cast<LuaString*>(ptr_val)->str;
+            return reinterpret_cast<const LuaString*>(ptr_val)->view();
         }
     }
     return "";
@@ -1224,9 +1523,8 @@ inline bool lua_equals(const LuaValue& a, const LuaValue& b) {
 			return (s1.data() == s2.data() && s1.size() == s2.size()) || (s1 == s2);
 		}
 		case INDEX_STRING: {
-			uint64_t a_ptr = a.raw_data() & PAYLOAD_MASK;
-			uint64_t b_ptr = b.raw_data() & PAYLOAD_MASK;
-			if (a_ptr == b_ptr) return true;
+			// Inline and interned strings are canonical: different bits mean different strings
+			if (!is_counted_string(ra) && !is_counted_string(rb)) return false;
 			return a.get<std::string_view>() == b.get<std::string_view>();
 		}
 		case INDEX_OBJECT:  return a.get<LuaObject*>() == b.get<LuaObject*>();
@@ -1248,8 +1546,8 @@ inline LuaValue LuaObject::get_item(const LuaValue& key) {
 	if (tag == TAG_INTEGER) [[likely]] {
 		return get_item(key.get<long long>());
 	}
-	// Fast path: interned string key (pooled bit set) -> direct raw comparison in small_props
-	if (tag == TAG_STRING && (raw & 1ULL)) [[likely]] {
+	// Fast path: canonical (inline or interned) string key -> direct raw comparison in small_props
+	if (tag == TAG_STRING && !is_counted_string(raw)) [[likely]] {
 		if (!properties) [[likely]] {
 			for (auto& p : small_props) {
 				if (p.first.raw_data() == raw) return p.second;
@@ -1269,13 +1567,43 @@ inline LuaValue LuaObject::get_item(std::string_view key) {
 	LuaValue* val_ptr = find_prop(key);
 	if (val_ptr && val_ptr->index() != INDEX_NIL) return *val_ptr;
 
-	// If no metatable exists, we can stop immediately
-	if (!metatable) return LuaValue();
+	// Without __index there is nothing more to find
+	if (!metatable || !metatable->has_metamethod(TM_INDEX)) return LuaValue();
 
 	// Fall back to metatable check via get_item_internal (rare)
 	return get_item_internal(LuaValue(key), 0);
 }
 
+// A shape match means small_props has the cached layout, so the slot needs no key check.
+// A nil slot (a field assigned nil in a constructor) still takes the slow path.
+inline LuaValue LuaObject::get_field(const LuaValue& key, LuaFieldCache& ic) {
+	if (shape == ic.shape) [[likely]] {
+		if (!ic.holder) {
+			const LuaValue& v = small_props[ic.index].second;
+			if (!v.is_nil()) [[likely]] return v;
+		} else if (metatable && metatable->metamethod_raw(TM_INDEX) == (TAG_OBJECT | reinterpret_cast<uint64_t>(ic.holder)) &&
+				ic.holder->shape == ic.holder_shape) {
+			// The holder is only dereferenced once __index proves it is still alive.
+			// The receiver's shape proves the key is not one of its own fields
+			const LuaValue& v = ic.holder->small_props[ic.index].second;
+			if (!v.is_nil()) [[likely]] return v;
+		}
+	}
+	return get_field_miss(key, ic);
+}
+
+inline void LuaObject::set_field(const LuaValue& key, const LuaValue& value, LuaFieldCache& ic) {
+	// Overwriting an existing field never involves __newindex
+	if (shape == ic.shape && !ic.holder && !value.is_nil()) [[likely]] {
+		LuaValue& slot = small_props[ic.index].second;
+		if (!slot.is_nil()) [[likely]] {
+			slot = value;
+			return;
+		}
+	}
+	set_field_miss(key, value, ic);
+}
+
 inline LuaValue LuaObject::get_item(long long idx) {
 	// Check Array Part directly
 	if (idx >= 1 && idx <= (long long)array_part.size()) {
@@ -1288,8 +1616,8 @@ inline LuaValue LuaObject::get_item(long long idx) {
 	LuaValue* val_ptr = find_prop(key);
 	if (val_ptr && val_ptr->index() != INDEX_NIL) return *val_ptr;
 
-	// If no metatable exists, stop
-	if (!metatable) return LuaValue();
+	// Without __index there is nothing more to find
+	if (!metatable || !metatable->has_metamethod(TM_INDEX)) return LuaValue();
 
 	return get_item_internal(key, 0);
 }
@@ -0,0 +1,82 @@
+#ifndef LUA_PROFILE_HPP
+#define LUA_PROFILE_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <iosfwd>
+
+// Profiling support for programs translated with --profile (built with LUAX_PROFILE).
+// Every generated function has one static site; each entry pushes it on the calling
+// thread's shadow stack, which a SIGPROF sampler copies into a preallocated buffer.
+
+struct LuaProfileSite {
+	const char* name;
+	const char* file;
+	int line;
+	std::atomic<uint64_t> calls{0};
+	LuaProfileSite* next = nullptr; // registry of all sites, for the exit report
+
+	LuaProfileSite(const char* name, const char* file, int line);
+};
+
+constexpr int LUA_PROFILE_MAX_DEPTH = 256;
+
+// Frames past LUA_PROFILE_MAX_DEPTH are counted but not recorded
+struct LuaProfileStack {
+	const LuaProfileSite* frames[LUA_PROFILE_MAX_DEPTH] = {};
+	int depth = 0;
+	// Stack of the code that resumed this coroutine; the sampler reports it first
+	const LuaProfileStack* parent = nullptr;
+};
+
+// Null until the thread enters its first profiled function
+extern constinit thread_local LuaProfileStack* luax_profile_stack;
+LuaProfileStack* luax_profile_thread_stack();
+
+// Slow paths counted in profiled builds
+enum LuaProfileCounter {
+	LUA_PROFILE_METAMETHOD_FALLBACK, // __index lookups after a raw miss
+	LUA_PROFILE_CFUNCTION_SHIM,      // C functions called through LuaCFunctionShim
+	LUA_PROFILE_COUNTER_COUNT
+};
+extern std::atomic<uint64_t> luax_profile_counters[LUA_PROFILE_COUNTER_COUNT];
+
+#ifdef LUAX_PROFILE
+#define LUAX_PROFILE_COUNT(c) luax_profile_counters[c].fetch_add(1, std::memory_order_relaxed)
+#else
+#define LUAX_PROFILE_COUNT(c) ((void)0)
+#endif
+
+struct LuaProfileScope {
+	LuaProfileStack* stack;
+
+	explicit LuaProfileScope(LuaProfileSite& site) : stack(luax_profile_stack) {
+		if (!stack) [[unlikely]] stack = luax_profile_thread_stack();
+		site.calls.fetch_add(1, std::memory_order_relaxed);
+		if (stack->depth < LUA_PROFILE_MAX_DEPTH) stack->frames[stack->depth] = &site;
+		// The sampler runs on this thread, so ordering against the handler is all that is needed
+		std::atomic_signal_fence(std::memory_order_release);
+		stack->depth++;
+	}
+	~LuaProfileScope() { stack->depth--; }
+
+	LuaProfileScope(const LuaProfileScope&) = delete;
+	LuaProfileScope& operator=(const LuaProfileScope&) = delete;
+};
+
+// Coroutine switches: entering makes s the thread's shadow stack, chained under the
+// resumer's, and returns the stack to restore when the coroutine yields or returns
+LuaProfileStack* luax_profile_enter_stack(LuaProfileStack* s);
+void luax_profile_leave_stack(LuaProfileStack* previous);
+
+// Starts the sampler (LUAX_PROFILE_HZ samples per second of CPU time, default 1000)
+void luax_profile_start();
+
+// Stops the sampler and writes <prefix>.folded (flame graph stacks) and <prefix>.txt
+// (call counts and counters), with the prefix from LUAX_PROFILE_OUT (default "luax-profile")
+void luax_profile_report();
+
+// Per-function call counts and slow-path counters
+void luax_profile_dump_counts(std::ostream& os);
+
+#endif // LUA_PROFILE_HPP
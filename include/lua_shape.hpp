@@ -0,0 +1,54 @@
+#ifndef LUA_SHAPE_HPP
+#define LUA_SHAPE_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+class LuaObject;
+
+// Hidden class of a table's small property list: the sequence of keys in small_props.
+// Tables that gained the same keys in the same order share one shape, so a shape
+// pointer plus a slot index is enough to locate a field without comparing keys.
+//
+// Shapes form a transition tree rooted at the empty shape. They are never freed (a
+// cached pointer can never be reused for a different layout), and the tree is bounded:
+// once it hits its size or fan-out limit, tables fall back to the uncached shape, which
+// no inline cache ever records. Tables whose fields moved to the hash part are uncached too.
+//
+// Transitions are published with a CAS, so tables owned by different threads can
+// extend the tree concurrently.
+class LuaShape {
+public:
+	static const LuaShape* empty() { return &EMPTY; }
+	static const LuaShape* uncached() { return &UNCACHED; }
+
+	// Shape after appending key (a canonical raw key) to this layout
+	const LuaShape* add(uint64_t key_raw) const;
+
+	bool cacheable() const { return this != &UNCACHED; }
+	uint32_t size() const { return count; }
+
+	constexpr LuaShape() = default;
+
+private:
+	static const LuaShape EMPTY;
+	static const LuaShape UNCACHED;
+
+	uint64_t key = 0;          // key added by the transition into this shape
+	uint32_t count = 0;        // number of keys
+	const LuaShape* next_sibling = nullptr;
+	mutable std::atomic<const LuaShape*> first_child{nullptr};
+};
+
+// Per-site inline cache for a constant-key field access. holder is null for a field of
+// the table itself; otherwise the field lives in the table's __index table, which is
+// only trusted while the receiver still refers to that exact table.
+struct LuaFieldCache {
+	const LuaShape* shape = nullptr;
+	const LuaObject* holder = nullptr;
+	const LuaShape* holder_shape = nullptr;
+	uint32_t index = 0;
+};
+
+#endif // LUA_SHAPE_HPP
@@ -7,12 +7,16 @@
 #include <cstring>
 #include <cstdint>
 #include <variant>
+#include <atomic>
+#include <bit>
+#include <vector>
 
 // Forward declarations for types used in LuaValue
 class LuaObject;
 struct LuaCallable;
 class LuaCoroutine;
 struct LuaString;
+class LuaRefCounted;
 
 // Fast C function dispatch type
 typedef void (*LuaCFunctionPtr)(const void*, size_t, void*);
@@ -53,17 +57,108 @@ enum LuaTag : uint64_t {
     TAG_CFUNC    = 0xFFFFULL << 48
 };
 
+// String payloads (TAG_STRING):
+//   bit 47 set - up to STRING_INLINE_MAX bytes stored in the value itself: characters in
+//                bytes 0-4 (zero padded), length in bits 40-42. User-space pointers never use bit 47.
+//   bit 0 set  - pointer to an interned std::string; never freed, so not counted
+//   otherwise  - pointer to a refcounted LuaString
+constexpr uint64_t STRING_INLINE_BIT = 1ULL << 47;
+constexpr uint64_t STRING_INTERNED_BIT = 1ULL;
+constexpr size_t STRING_INLINE_MAX = 5;
+static_assert(std::endian::native == std::endian::little, "inline strings assume a little-endian payload");
+
+// True for TAG_STRING values backed by a refcounted LuaString
+inline bool is_counted_string(uint64_t raw) {
+    return (raw & TAG_MASK) == TAG_STRING && !(raw & (STRING_INLINE_BIT | STRING_INTERNED_BIT));
+}
+
+// Cycle collector hooks (lib/gc.cpp)
+void luax_gc_possible_root(const LuaRefCounted* obj);
+void luax_gc_unbuffer(const LuaRefCounted* obj);
+
+// Reference counting modes (define at most one when building the runtime):
+//   default               - plain counter; values must not be shared between threads
+//   LUAX_REFCOUNT_ATOMIC  - every retain/release is an atomic read-modify-write
+//   LUAX_REFCOUNT_BIASED  - plain updates while an object is owned by a single thread;
+//                           once it escapes (luax_mark_shared) updates become atomic
 class LuaRefCounted {
+#if defined(LUAX_REFCOUNT_ATOMIC)
+    mutable std::atomic<int> ref_count{0};
+public:
+    virtual ~LuaRefCounted() = default;
+    void retain() const { ref_count.fetch_add(1, std::memory_order_relaxed); }
+    void release() const {
+        if (ref_count.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            delete this;
+        }
+    }
+    int get_ref_count() const { return ref_count.load(std::memory_order_relaxed); }
+    bool mark_shared() const { return false; }
+#elif defined(LUAX_REFCOUNT_BIASED)
+    static constexpr int SHARED_BIT = 1 << 30;
+    mutable int ref_count{0};
+public:
+    virtual ~LuaRefCounted() = default;
+    void retain() const {
+        std::atomic_ref<int> rc(ref_count);
+        int v = rc.load(std::memory_order_relaxed);
+        if (!(v & SHARED_BIT)) [[likely]] rc.store(v + 1, std::memory_order_relaxed);
+        else rc.fetch_add(1, std::memory_order_relaxed);
+    }
+    void release() const {
+        std::atomic_ref<int> rc(ref_count);
+        int v = rc.load(std::memory_order_relaxed);
+        if (!(v & SHARED_BIT)) [[likely]] {
+            if (--v == 0) delete this;
+            else rc.store(v, std::memory_order_relaxed);
+        }
+        else if (rc.fetch_sub(1, std::memory_order_acq_rel) == (SHARED_BIT | 1)) {
+            delete this;
+        }
+    }
+    int get_ref_count() const {
+        return std::atomic_ref<int>(ref_count).load(std::memory_order_relaxed) & ~SHARED_BIT;
+    }
+    // Called by the owning thread before the object is published; returns false if already shared
+    bool mark_shared() const {
+        std::atomic_ref<int> rc(ref_count);
+        if (rc.load(std::memory_order_relaxed) & SHARED_BIT) return false;
+        rc.fetch_or(SHARED_BIT, std::memory_order_release);
+        return true;
+    }
+#else
     mutable int ref_count{0};
 public:
     virtual ~LuaRefCounted() = default;
     void retain() const { ++ref_count; }
     void release() const {
         if (--ref_count == 0) {
+            if (gc_buffered) [[unlikely]] luax_gc_unbuffer(this);
             delete this;
         }
+        else if (gc_container) {
+            // A buffered candidate is recoloured so the next step traces it again
+            if (gc_buffered) gc_color = GC_PURPLE;
+            else luax_gc_possible_root(this);
+        }
     }
     int get_ref_count() const { return ref_count; }
+    bool mark_shared() const { return false; }
+#endif
+
+    // Cycle collection (trial deletion). Only containers are traced; everything else is a leaf.
+    // Children are reported through gc_trace; gc_clear drops all outgoing references.
+    virtual void gc_trace(std::vector<const LuaRefCounted*>& /*children*/) const {}
+    virtual void gc_clear() {}
+
+protected:
+    enum GcColor : uint8_t { GC_BLACK = 0, GC_GRAY, GC_WHITE, GC_PURPLE };
+    // Packed into the padding after ref_count, so objects do not grow
+    mutable uint32_t gc_color : 2 {0};
+    mutable uint32_t gc_buffered : 1 {0};
+    uint32_t gc_container : 1 {0};
+    mutable uint32_t gc_slot : 28 {0}; // position in the collector's root buffer while buffered
+    friend class LuaCycleCollector;
 };
 
 class LuaValue {
@@ -74,7 +169,7 @@ class LuaValue {
         uint64_t tag = data & TAG_MASK;
         if (tag >= TAG_STRING && tag <= TAG_CORO) {
             uint64_t ptr_val = data & PAYLOAD_MASK;
-            if (tag == TAG_STRING && (ptr_val & 1ULL)) return; // Static/pooled string, no retain
+            if (tag == TAG_STRING && (ptr_val & (STRING_INLINE_BIT | STRING_INTERNED_BIT))) return; // Inline or pooled, no retain
             auto* ptr = reinterpret_cast<LuaRefCounted*>(ptr_val);
             if (ptr) ptr->retain();
         }
@@ -85,7 +180,7 @@ class LuaValue {
         uint64_t tag = data & TAG_MASK;
         if (tag >= TAG_STRING && tag <= TAG_CORO) {
             uint64_t ptr_val = data & PAYLOAD_MASK;
-            if (tag == TAG_STRING && (ptr_val & 1ULL)) return; // Static/pooled string, no release
+            if (tag == TAG_STRING && (ptr_val & (STRING_INLINE_BIT | STRING_INTERNED_BIT))) return; // Inline or pooled, no release
             auto* ptr = reinterpret_cast<LuaRefCounted*>(ptr_val);
             if (ptr) ptr->release();
         }
@@ -173,6 +268,15 @@ public:
     bool operator!=(const LuaValue& other) const { return !(*this == other); }
 
     uint64_t raw_data() const { return data; }
+    // The counted object this value holds a reference to, or null
+    const LuaRefCounted* counted_ref() const {
+        if (data < NAN_MASK) return nullptr;
+        uint64_t tag = data & TAG_MASK;
+        if (tag < TAG_STRING || tag > TAG_CORO) return nullptr;
+        uint64_t ptr_val = data & PAYLOAD_MASK;
+        if (tag == TAG_STRING && (ptr_val & (STRING_INLINE_BIT | STRING_INTERNED_BIT))) return nullptr;
+        return reinterpret_cast<const LuaRefCounted*>(ptr_val);
+    }
     static LuaValue from_raw(uint64_t d) { LuaValue v; v.data = d; return v; }
 };
 
@@ -192,8 +296,15 @@ struct LuaValueEq {
 
 #include "pool_allocator.hpp"
 #include <vector>
+#include <array>
+#include <span>
 
 using LuaValueVector = std::vector<LuaValue, PoolAllocator<LuaValue>>;
+// Arguments forwarded without copying, e.g. the caller's `...`
+using LuaValueSpan = std::span<const LuaValue>;
+// Results of a function that always returns exactly N values
+template <size_t N>
+using LuaValuePack = std::array<LuaValue, N>;
 typedef void (*LuaCFunctionTyped)(const LuaValue*, size_t, LuaValueVector&);
 
 // Declarations of specializations to avoid instantiation order issues
@@ -1,10 +1,13 @@
 #pragma once
 
 #include <cstddef>
+#include <cstdint>
 #include <memory>
 #include <new>
 #include <type_traits>
 #include <array>
+#include <atomic>
+#include <vector>
 
 #if defined(__GNUC__) || defined(__clang__)
 	#define LUA_POOL_LIKELY(x)   __builtin_expect(!!(x), 1)
@@ -14,43 +17,93 @@
 	#define LUA_POOL_UNLIKELY(x) (x)
 #endif
 
+class LuaArena;
+struct LuaPoolStats;
+
+// Per-thread free lists over slab pages. Blocks of up to 1024 bytes are carved from
+// PAGE_SIZE-aligned pages with a bump pointer, so a free-list miss costs a pointer
+// increment instead of a malloc. Slab pages are never returned to the OS: a block freed
+// on another thread simply joins that thread's free list, and the free lists of a thread
+// that exits are handed to a shared depot for reuse.
 class LuaObjectPool {
 public:
 	// Increased alignment to max_align_t to ensure safety for all standard types
 	static constexpr std::size_t ALIGNMENT = alignof(std::max_align_t);
 	static constexpr std::size_t BUCKET_COUNT = 8;
 	static constexpr std::size_t BUCKET_SIZES[BUCKET_COUNT] = {32, 64, 96, 128, 192, 256, 512, 1024};
+	static constexpr std::size_t PAGE_SIZE = 64 * 1024;
+	static constexpr std::size_t PAGE_HEADER = 64;
+
+	// First bytes of every page
+	struct PageHeader {
+		bool arena = false;
+		// Arena pages only: blocks not yet freed, plus one while the arena holds the page
+		std::atomic<std::ptrdiff_t> refs{0};
+	};
 
 	[[nodiscard]] static void* allocate(std::size_t n) {
-		// Fallback to global new if TLS is dead or size is too large
-		if (LUA_POOL_UNLIKELY(is_destroyed() || n > BUCKET_SIZES[BUCKET_COUNT - 1])) {
+		// Large blocks go straight to the global allocator
+		if (LUA_POOL_UNLIKELY(n > BUCKET_SIZES[BUCKET_COUNT - 1])) {
+			if (!is_destroyed()) {
+				auto& pool = get_thread_pool();
+				pool.bytes_in_use += n;
+				pool.large_bytes += n;
+				++pool.large_allocs;
+			}
 			return ::operator new(n);
 		}
 
 		const std::size_t index = get_bucket_index(n);
+		if (LUA_POOL_UNLIKELY(is_destroyed())) return depot_allocate(index);
+
 		auto& pool = get_thread_pool();
-		
+		pool.bytes_in_use += BUCKET_SIZES[index];
+		++pool.allocs[index];
+		if (LUA_POOL_UNLIKELY(pool.arena != nullptr)) return arena_allocate(pool.arena, n);
+
 		if (pool.buckets[index] != nullptr) {
 			FreeNode* node = pool.buckets[index];
 			pool.buckets[index] = node->next;
+			--pool.free_blocks[index];
 			return static_cast<void*>(node);
 		}
-
-		// Allocate a new chunk of the specific bucket size
-		return ::operator new(BUCKET_SIZES[index]);
+		return refill(pool, index);
 	}
 
 	static void deallocate(void* p, std::size_t n) noexcept {
 		if (LUA_POOL_UNLIKELY(!p)) return;
 
-		// If TLS is destroyed, we cannot access the buckets; return to OS
-		if (LUA_POOL_UNLIKELY(is_destroyed() || n > BUCKET_SIZES[BUCKET_COUNT - 1])) {
+		if (LUA_POOL_UNLIKELY(n > BUCKET_SIZES[BUCKET_COUNT - 1])) {
+			if (!is_destroyed()) {
+				auto& pool = get_thread_pool();
+				pool.bytes_in_use -= n;
+				pool.large_bytes -= n;
+				++pool.large_frees;
+			}
 			::operator delete(p);
 			return;
 		}
 
 		const std::size_t index = get_bucket_index(n);
+		// Arena blocks are never reused individually; only their page count drops
+		if (LUA_POOL_UNLIKELY(arenas_used.load(std::memory_order_relaxed)) && page_of(p)->arena) {
+			if (!is_destroyed()) {
+				auto& pool = get_thread_pool();
+				pool.bytes_in_use -= BUCKET_SIZES[index];
+				++pool.frees[index];
+			}
+			release_arena_block(p);
+			return;
+		}
+		if (LUA_POOL_UNLIKELY(is_destroyed())) {
+			depot_deallocate(p, index);
+			return;
+		}
+
 		auto& pool = get_thread_pool();
+		pool.bytes_in_use -= BUCKET_SIZES[index];
+		++pool.frees[index];
+		++pool.free_blocks[index];
 
 		// Intrusive linked list: Store the 'next' pointer in the freed memory itself
 		FreeNode* node = static_cast<FreeNode*>(p);
@@ -58,23 +111,25 @@ public:
 		pool.buckets[index] = node;
 	}
 
-	// Restored cleanup method
-	static void cleanup() noexcept {
-		if (LUA_POOL_UNLIKELY(is_destroyed())) return;
-		
-		auto& pool = get_thread_pool();
-		for (std::size_t i = 0; i < BUCKET_COUNT; ++i) {
-			FreeNode* current = pool.buckets[i];
-			while (current) {
-				FreeNode* next = current->next;
-				::operator delete(current);
-				current = next;
-			}
-			pool.buckets[i] = nullptr;
-		}
+	// Bytes currently handed out by this thread's pool (may go negative when
+	// objects allocated on another thread are freed here)
+	static std::ptrdiff_t bytes_in_use() noexcept {
+		if (LUA_POOL_UNLIKELY(is_destroyed())) return 0;
+		return get_thread_pool().bytes_in_use;
+	}
+
+	static LuaPoolStats stats();
+
+	// Hands this thread's free blocks to the shared depot; called before a thread exits
+	static void cleanup() noexcept;
+
+	static PageHeader* page_of(void* p) noexcept {
+		return reinterpret_cast<PageHeader*>(reinterpret_cast<std::uintptr_t>(p) & ~(PAGE_SIZE - 1));
 	}
 
 private:
+	friend class LuaArena;
+
 	struct FreeNode {
 		FreeNode* next;
 	};
@@ -82,21 +137,39 @@ private:
 	struct ThreadPool {
 		// Using raw pointers for a free-list to avoid std::vector overhead
 		FreeNode* buckets[BUCKET_COUNT]{nullptr};
+		// Unused tail of the current slab page of each bucket
+		char* bump[BUCKET_COUNT]{nullptr};
+		char* bump_end[BUCKET_COUNT]{nullptr};
+		std::ptrdiff_t bytes_in_use = 0;
+		LuaArena* arena = nullptr; // innermost entered arena
+
+		// Counters for LuaPoolStats
+		std::uint64_t allocs[BUCKET_COUNT]{};
+		std::uint64_t frees[BUCKET_COUNT]{};
+		std::size_t free_blocks[BUCKET_COUNT]{};
+		std::uint64_t large_allocs = 0;
+		std::uint64_t large_frees = 0;
+		std::ptrdiff_t large_bytes = 0;
 
 		~ThreadPool() {
 			is_destroyed() = true;
-			for (std::size_t i = 0; i < BUCKET_COUNT; ++i) {
-				FreeNode* current = buckets[i];
-				while (current) {
-					FreeNode* next = current->next;
-					::operator delete(current);
-					current = next;
-				}
-				buckets[i] = nullptr;
-			}
+			cleanup_pool(*this);
 		}
 	};
 
+	static inline std::atomic<bool> arenas_used{false};
+
+	static void* refill(ThreadPool& pool, std::size_t index);
+	static void* arena_allocate(LuaArena* arena, std::size_t n);
+	static void release_arena_block(void* p) noexcept;
+	static void* depot_allocate(std::size_t index);
+	static void depot_deallocate(void* p, std::size_t index) noexcept;
+	static void cleanup_pool(ThreadPool& pool) noexcept;
+	static void* new_page();
+	static void free_page(PageHeader* page) noexcept;
+	static void* acquire_arena_page();
+	static void release_arena_page(PageHeader* page) noexcept;
+
 	static inline std::size_t get_bucket_index(std::size_t n) noexcept {
 		// Manual unrolling/branching is faster than a loop for 8 constants.
 		// This effectively creates a small search tree.
@@ -120,6 +193,69 @@ private:
 	}
 };
 
+// Allocator counters. Size classes, free lists and large blocks are per thread (the
+// calling thread's view; frees of blocks from other threads count where they happen);
+// page counts are process-wide.
+struct LuaPoolStats {
+	struct Bucket {
+		std::size_t size = 0;
+		std::uint64_t allocs = 0;
+		std::uint64_t frees = 0;
+		std::size_t free_blocks = 0; // length of the free list
+	};
+	Bucket buckets[LuaObjectPool::BUCKET_COUNT];
+	std::uint64_t large_allocs = 0;
+	std::uint64_t large_frees = 0;
+	std::ptrdiff_t large_bytes = 0;
+	std::ptrdiff_t bytes_in_use = 0;
+	std::size_t slab_pages = 0;
+	std::size_t arena_pages = 0; // spare pages included
+	std::size_t spare_pages = 0;
+	std::size_t depot_blocks = 0;
+	std::size_t page_size = 0;
+};
+
+// Bump-pointer region for request-scoped work. While an arena is entered, small pool
+// allocations on the entering thread are carved from the arena's own pages, back to back.
+// Freeing such a block never touches a free list. reset() gives the pages up in one go:
+// each page is recycled once its last block is freed, so a value that outlives the scope
+// stays valid.
+class LuaArena {
+public:
+	LuaArena() { LuaObjectPool::arenas_used.store(true, std::memory_order_relaxed); }
+	~LuaArena() {
+		leave();
+		reset();
+	}
+	LuaArena(const LuaArena&) = delete;
+	LuaArena& operator=(const LuaArena&) = delete;
+
+	// Scopes nest: leave() restores the arena that was active before enter()
+	void enter();
+	void leave();
+	void reset();
+
+	// Installs arena as the calling thread's active one and returns the previous one.
+	// Coroutines swap their own in while they run, so a scope never spans a yield.
+	static LuaArena* exchange_active(LuaArena* arena);
+
+	std::size_t page_count() const { return pages.size(); }
+	std::size_t bytes_allocated() const { return allocated; }
+
+private:
+	friend class LuaObjectPool;
+
+	void* allocate(std::size_t n);
+	void close_page();
+
+	std::vector<LuaObjectPool::PageHeader*> pages;
+	char* bump = nullptr;
+	char* end = nullptr;
+	std::size_t page_blocks = 0; // blocks carved from the current page
+	std::size_t allocated = 0;
+	LuaArena* previous = nullptr;
+};
+
 template <typename T>
 struct PoolAllocator {
 	using value_type = T;
@@ -143,4 +279,4 @@ struct PoolAllocator {
 template <typename T, typename U>
 inline bool operator==(const PoolAllocator<T>&, const PoolAllocator<U>&) noexcept { return true; }
 template <typename T, typename U>
-inline bool operator!=(const PoolAllocator<T>&, const PoolAllocator<U>&) noexcept { return false; }
\ No newline at end of file
+inline bool operator!=(const PoolAllocator<T>&, const PoolAllocator<U>&) noexcept { return false; }
@@ -0,0 +1,27 @@
+#ifndef REACTOR_HPP
+#define REACTOR_HPP
+
+#include <cstddef>
+
+// Readiness reactor behind non-blocking io handles (io.popen(cmd, "rn") / "wn"), one per thread
+// (epoll on Linux, poll elsewhere). An operation that would block inside a coroutine parks the
+// coroutine on its descriptor and yields to the resumer with no values; io.poll resumes it once
+// the descriptor is ready and the operation is retried. Outside a coroutine, the wait runs the
+// reactor itself, so parked coroutines keep going while the main line waits for its descriptor.
+
+// Waits until fd is readable (or writable): parks the running coroutine, or polls the reactor
+// from the main line. Spurious wakeups are possible; callers retry their operation.
+void luax_wait_fd(int fd, bool write);
+
+// Wakes everything waiting on fd and drops it from the reactor; call before closing fd
+void luax_reactor_forget(int fd);
+
+// Waits up to timeout_ms (-1: until something is ready) and resumes the parked coroutines
+// whose descriptors are ready. Errors raised by a resumed coroutine are rethrown here.
+// Returns the number of coroutines resumed.
+size_t luax_reactor_poll(int timeout_ms);
+
+// Coroutines currently parked on a descriptor
+size_t luax_reactor_pending();
+
+#endif // REACTOR_HPP
@@ -4,11 +4,36 @@
 #include "lua_object.hpp"
 #include "lua_value.hpp"
 #include <memory>
+#include <string_view>
+
+namespace LuaPattern { struct Program; }
+namespace LuaPack { struct Format; }
+
+// A pattern compiled once; generated code declares one for each constant pattern.
+// Dynamic patterns go through a per-thread cache of compiled programs instead.
+struct LuaCompiledPattern {
+	std::string_view source;
+	std::shared_ptr<const LuaPattern::Program> program; // null if the pattern is malformed
+
+	explicit LuaCompiledPattern(std::string_view pattern);
+	// Throws the pattern's error if it is malformed
+	const LuaPattern::Program& get() const;
+};
+
+// A string.pack format parsed once, for constant formats in generated code
+struct LuaPackFormat {
+	std::string_view source;
+	std::shared_ptr<const LuaPack::Format> format; // null if the format is invalid
+
+	explicit LuaPackFormat(std::string_view format_string);
+	const LuaPack::Format& get() const;
+};
 
 // Creates the 'string' library table
 LuaObject* create_string_library();
 
 // String library functions - exposed for direct use
+void string_buffer(const LuaValue* args, size_t n_args, LuaValueVector& out);
 void string_byte(const LuaValue* args, size_t n_args, LuaValueVector& out);
 void string_char(const LuaValue* args, size_t n_args, LuaValueVector& out);
 void string_dump(const LuaValue* args, size_t n_args, LuaValueVector& out);
@@ -23,6 +48,7 @@ void string_pack(const LuaValue* args, size_t n_args, LuaValueVector& out);
 void string_packsize(const LuaValue* args, size_t n_args, LuaValueVector& out);
 void string_rep(const LuaValue* args, size_t n_args, LuaValueVector& out);
 void string_reverse(const LuaValue* args, size_t n_args, LuaValueVector& out);
+void string_scan(const LuaValue* args, size_t n_args, LuaValueVector& out);
 void string_sub(const LuaValue* args, size_t n_args, LuaValueVector& out);
 void string_unpack(const LuaValue* args, size_t n_args, LuaValueVector& out);
 void string_upper(const LuaValue* args, size_t n_args, LuaValueVector& out);
@@ -32,5 +58,13 @@ void lua_string_match(const LuaValue& str, const LuaValue& pattern, LuaValueVect
 void lua_string_find(const LuaValue& str, const LuaValue& pattern, LuaValueVector& out);
 void lua_string_gsub(const LuaValue& str, const LuaValue& pattern, const LuaValue& replacement,
                      LuaValueVector& out);
+void lua_string_gmatch(const LuaValue& str, const LuaValue& pattern, LuaValueVector& out);
+void lua_string_match(const LuaValue& str, const LuaCompiledPattern& pattern, LuaValueVector& out);
+void lua_string_find(const LuaValue& str, const LuaCompiledPattern& pattern, LuaValueVector& out);
+void lua_string_gsub(const LuaValue& str, const LuaCompiledPattern& pattern, const LuaValue& replacement,
+                     LuaValueVector& out);
+void lua_string_gmatch(const LuaValue& str, const LuaCompiledPattern& pattern, LuaValueVector& out);
+void lua_string_unpack(const LuaPackFormat& format, const LuaValue& data, const LuaValue& init, LuaValueVector& out);
+long long lua_string_packsize(const LuaPackFormat& format);
 
 #endif // STRING_HPP
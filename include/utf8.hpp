@@ -6,4 +6,19 @@
 
 LuaObject* create_utf8_library();
 
+// Lowered `for p, c in utf8.codes(s)`: the subject is checked once, then each step decodes the
+// character at byte pos into code and returns the position after it (errors as utf8.codes does)
+std::string_view lua_utf8_codes_subject(const LuaValue& s);
+size_t lua_utf8_codes_step(std::string_view s, size_t pos, long long& code);
+
+inline size_t lua_utf8_codes_next(std::string_view s, size_t pos, long long& code) {
+	unsigned char c = static_cast<unsigned char>(s[pos]);
+	// ASCII not followed by a stray continuation byte
+	if (c < 0x80 && (pos + 1 == s.size() || (static_cast<unsigned char>(s[pos + 1]) & 0xC0) != 0x80)) [[likely]] {
+		code = c;
+		return pos + 1;
+	}
+	return lua_utf8_codes_step(s, pos, code);
+}
+
 #endif
@@ -0,0 +1,27 @@
+#include "arena.hpp"
+#include "lua_object.hpp"
+#include <stdexcept>
+
+// arena.run(f, ...): calls f with an arena entered on this thread, then resets it.
+// Tables and strings built during the call are carved from the arena's pages; whatever
+// is still referenced afterwards (including the results) keeps its page alive.
+void arena_run(const LuaValue* args, size_t n_args, LuaValueVector& out) {
+	if (n_args < 1) [[unlikely]] throw std::runtime_error("bad argument #1 to 'run' (function expected)");
+
+	struct Scope {
+		LuaArena arena;
+		Scope() { arena.enter(); }
+		~Scope() { arena.leave(); }
+	} scope;
+	call_lua_value(args[0], args + 1, n_args - 1, out);
+}
+
+LuaObject* create_arena_library() {
+	static LuaObject* arena_lib;
+	if (arena_lib) return arena_lib;
+
+	arena_lib = new LuaObject();
+	arena_lib->set("run", LUA_C_FUNC(arena_run));
+
+	return arena_lib;
+}
@@ -1,19 +1,243 @@
 #include "coroutine.hpp"
 #include <stdexcept>
+#include <atomic>
+#include <cstdlib>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#ifndef LUAX_COROUTINE_THREADS
+#include <sys/mman.h>
+#include <unistd.h>
+#if !(defined(__x86_64__) && defined(__ELF__)) || defined(LUAX_COROUTINE_UCONTEXT)
+#include <ucontext.h>
+#endif
+#endif
 
 thread_local LuaCoroutine* current_coroutine = nullptr;
 
 // Internal exception used to safely unwind the C++ stack 
 // if the coroutine is garbage-collected while suspended.
-struct CoroutineTerminated : public std::exception {};
+// Deliberately not a std::exception so pcall cannot swallow it.
+struct CoroutineTerminated {};
+
+// ==========================================
+// Parallel tasks (coroutine.create_parallel)
+// ==========================================
+// A fixed pool of workers, each owning a deque. Workers pop their own deque LIFO and
+// steal FIFO from the others when it runs dry. Tasks submitted from outside the pool are
+// spread round-robin; tasks submitted from inside a task stay on the submitting worker.
+// Threads blocked in await() help by running queued tasks instead of sleeping.
+//
+// Tasks really run at the same time, so create_parallel is only available when refcounts
+// are synchronized (--refcount atomic or biased); a plain build also runs the cycle collector,
+// which must not see objects another thread is using. Concurrently running tasks must still
+// not share mutable tables or closures; arguments and results are handed over by copy.
+
+struct LuaParallelTask {
+	LuaCallable* func; // retained by the owning coroutine
+	LuaValueVector args;
+	LuaValueVector results;
+	bool error_occurred = false;
+	std::atomic<bool> done{false};
+
+	explicit LuaParallelTask(LuaCallable* f) : func(f) {}
+
+	void execute() {
+		try {
+			func->call(args.data(), args.size(), results);
+		}
+		catch (const std::exception& e) {
+			results.assign({ LuaValue(std::string(e.what())) });
+			error_occurred = true;
+		}
+		catch (...) {
+			results.assign({ LuaValue(std::string_view("unknown error")) });
+			error_occurred = true;
+		}
+		luax_mark_shared(results.data(), results.size());
+	}
+};
+
+namespace {
+	constexpr size_t NOT_A_WORKER = static_cast<size_t>(-1);
+	thread_local size_t worker_index = NOT_A_WORKER;
 
-LuaCoroutine::LuaCoroutine(LuaCallable* f) : func(f) {
+	class TaskScheduler {
+	public:
+		static TaskScheduler& instance() {
+			static TaskScheduler scheduler;
+			return scheduler;
+		}
+
+		void submit(LuaParallelTask* task) {
+			size_t target = (worker_index != NOT_A_WORKER)
+				                ? worker_index
+				                : next_queue.fetch_add(1, std::memory_order_relaxed) % queues.size();
+			{
+				std::lock_guard<std::mutex> lock(queues[target]->mtx);
+				queues[target]->tasks.push_back(task);
+			}
+			pending.fetch_add(1, std::memory_order_release);
+			{ std::lock_guard<std::mutex> lock(sleep_mtx); }
+			work_cv.notify_one();
+		}
+
+		void wait(LuaParallelTask* task) {
+			while (!task->done.load(std::memory_order_acquire)) {
+				if (LuaParallelTask* other = take(worker_index)) {
+					run(other);
+					continue;
+				}
+				std::unique_lock<std::mutex> lock(sleep_mtx);
+				done_cv.wait(lock, [&] {
+					return task->done.load(std::memory_order_acquire) || pending.load(std::memory_order_acquire) > 0;
+				});
+			}
+		}
+
+	private:
+		struct WorkerQueue {
+			std::mutex mtx;
+			std::deque<LuaParallelTask*> tasks;
+		};
+
+		std::vector<std::unique_ptr<WorkerQueue>> queues;
+		std::vector<std::thread> workers;
+		std::atomic<size_t> pending{0};
+		std::atomic<size_t> next_queue{0};
+		std::mutex sleep_mtx;
+		std::condition_variable work_cv; // wakes idle workers
+		std::condition_variable done_cv; // wakes awaiting threads
+		bool stopping = false;
+
+		TaskScheduler() {
+			size_t count = LUAX_PARALLEL_WORKERS;
+			if (const char* env = std::getenv("LUAX_WORKERS")) count = std::strtoul(env, nullptr, 10);
+			if (count == 0) count = std::thread::hardware_concurrency();
+			if (count == 0) count = 1;
+
+			for (size_t i = 0; i < count; ++i) queues.push_back(std::make_unique<WorkerQueue>());
+			for (size_t i = 0; i < count; ++i) workers.emplace_back(&TaskScheduler::worker_loop, this, i);
+		}
+
+		~TaskScheduler() {
+			{
+				std::lock_guard<std::mutex> lock(sleep_mtx);
+				stopping = true;
+			}
+			work_cv.notify_all();
+			for (auto& w : workers) w.join();
+		}
+
+		// Own deque from the back, otherwise steal from the front of the others
+		LuaParallelTask* take(size_t self) {
+			size_t n = queues.size();
+			if (self != NOT_A_WORKER) {
+				auto& q = *queues[self];
+				std::lock_guard<std::mutex> lock(q.mtx);
+				if (!q.tasks.empty()) {
+					LuaParallelTask* task = q.tasks.back();
+					q.tasks.pop_back();
+					pending.fetch_sub(1, std::memory_order_relaxed);
+					return task;
+				}
+			}
+			size_t start = (self != NOT_A_WORKER) ? self + 1 : next_queue.load(std::memory_order_relaxed);
+			for (size_t k = 0; k < n; ++k) {
+				auto& q = *queues[(start + k) % n];
+				std::lock_guard<std::mutex> lock(q.mtx);
+				if (!q.tasks.empty()) {
+					LuaParallelTask* task = q.tasks.front();
+					q.tasks.pop_front();
+					pending.fetch_sub(1, std::memory_order_relaxed);
+					return task;
+				}
+			}
+			return nullptr;
+		}
+
+		void run(LuaParallelTask* task) {
+			task->execute();
+			task->done.store(true, std::memory_order_release);
+			{ std::lock_guard<std::mutex> lock(sleep_mtx); }
+			done_cv.notify_all();
+		}
+
+		void worker_loop(size_t index) {
+			worker_index = index;
+			while (true) {
+				if (LuaParallelTask* task = take(index)) {
+					run(task);
+					continue;
+				}
+				std::unique_lock<std::mutex> lock(sleep_mtx);
+				work_cv.wait(lock, [this] { return stopping || pending.load(std::memory_order_acquire) > 0; });
+				if (stopping) break;
+			}
+			luax_flush_thread_pool();
+		}
+	};
+}
+
+LuaCoroutine::LuaCoroutine(LuaCallable* f, bool parallel) : func(f) {
 	if (func) func->retain();
-	// Start the persistent worker thread
-	worker = std::thread(&LuaCoroutine::run, this);
+	if (parallel) task = std::make_unique<LuaParallelTask>(func);
+#ifdef LUAX_COROUTINE_THREADS
+	else {
+		// Start the persistent worker thread
+		luax_mark_shared(LuaValue(func));
+		worker = std::thread(&LuaCoroutine::run, this);
+	}
+#endif
 }
 
+void LuaCoroutine::start_parallel(const LuaValue* start_args, size_t n_start_args, LuaValueVector& out) {
+	if (status != Status::SUSPENDED) {
+		out.assign({ LuaValue(false), LuaValue(std::string_view("cannot resume non-suspended coroutine")) });
+		return;
+	}
+	task->args.assign(start_args, start_args + n_start_args);
+
+	// Everything the task can reach from here is touched by another thread from now on
+	luax_mark_shared(task->args.data(), task->args.size());
+	luax_mark_shared(LuaValue(func));
+	luax_mark_shared(LuaValue(_G));
+	status = Status::RUNNING;
+	TaskScheduler::instance().submit(task.get());
+	out.assign({ LuaValue(true) });
+}
+
+void LuaCoroutine::await(LuaValueVector& out) {
+	if (status == Status::SUSPENDED) {
+		out.assign({ LuaValue(false), LuaValue(std::string_view("cannot await a coroutine that was not started")) });
+		return;
+	}
+	if (status == Status::RUNNING) {
+		TaskScheduler::instance().wait(task.get());
+		status = Status::DEAD;
+	}
+
+	if (task->error_occurred) {
+		out.assign({ LuaValue(false), task->results.empty() ? LuaValue() : task->results[0] });
+	} else {
+		out.reserve(task->results.size() + 1);
+		out.assign({ LuaValue(true) });
+		out.insert(out.end(), task->results.begin(), task->results.end());
+	}
+}
+
+#ifdef LUAX_COROUTINE_THREADS
+
+// ==========================================
+// Thread backend
+// ==========================================
+
 LuaCoroutine::~LuaCoroutine() {
+	// A queued or running parallel task still uses func and its own buffers
+	if (task && status == Status::RUNNING) TaskScheduler::instance().wait(task.get());
+
 	// Signal the worker thread to terminate and wake it up
 	{
 		std::lock_guard<std::mutex> lock(mtx);
@@ -49,6 +273,7 @@ void LuaCoroutine::run() {
 			// Normal completion
 			std::unique_lock<std::mutex> lock(mtx);
 			results = std::move(exec_results);
+			luax_mark_shared(results.data(), results.size());
 			out_args_ptr = results.data();
 			out_args_size = results.size();
 			status = Status::DEAD;
@@ -137,6 +362,7 @@ void LuaCoroutine::resume(const LuaValue* resume_args, size_t n_resume_args, Lua
 	}
 
 	// Provide pointers for the worker thread to copy
+	luax_mark_shared(resume_args, n_resume_args);
 	in_args_ptr = resume_args;
 	in_args_size = n_resume_args;
 	status = Status::RUNNING;
@@ -175,6 +401,7 @@ void LuaCoroutine::yield(const LuaValue* yield_args, size_t n_args, LuaValueVect
 	
 	// Allocate results on the Worker Thread
 	self->results.assign(yield_args, yield_args + n_args);
+	luax_mark_shared(self->results.data(), self->results.size());
 	self->out_args_ptr = self->results.data();
 	self->out_args_size = self->results.size();
 	self->status = Status::SUSPENDED;
@@ -196,6 +423,286 @@ void LuaCoroutine::yield(const LuaValue* yield_args, size_t n_args, LuaValueVect
 	self->results.clear(); // Safely clear old yield results
 }
 
+#else
+
+// ==========================================
+// Stackful backend
+// ==========================================
+
+#if defined(__x86_64__) && defined(__ELF__) && !defined(LUAX_COROUTINE_UCONTEXT)
+
+// Saves callee-saved registers and the SSE/x87 control words on the current stack,
+// stores the stack pointer into *save_sp and continues on restore_sp.
+extern "C" void luax_coro_switch(void** save_sp, void* restore_sp);
+// First frame of a fresh stack: calls r13(r12).
+extern "C" void luax_coro_trampoline();
+
+asm(R"(
+	.text
+	.p2align 4
+	.globl luax_coro_switch
+	.hidden luax_coro_switch
+	.type luax_coro_switch, @function
+luax_coro_switch:
+	pushq %rbp
+	pushq %rbx
+	pushq %r12
+	pushq %r13
+	pushq %r14
+	pushq %r15
+	subq $8, %rsp
+	stmxcsr (%rsp)
+	fnstcw 4(%rsp)
+	movq %rsp, (%rdi)
+	movq %rsi, %rsp
+	ldmxcsr (%rsp)
+	fldcw 4(%rsp)
+	addq $8, %rsp
+	popq %r15
+	popq %r14
+	popq %r13
+	popq %r12
+	popq %rbx
+	popq %rbp
+	ret
+	.size luax_coro_switch, .-luax_coro_switch
+
+	.p2align 4
+	.globl luax_coro_trampoline
+	.hidden luax_coro_trampoline
+	.type luax_coro_trampoline, @function
+luax_coro_trampoline:
+	movq %r12, %rdi
+	callq *%r13
+	ud2
+	.size luax_coro_trampoline, .-luax_coro_trampoline
+)");
+
+static constexpr size_t CONTEXT_RESERVE = 0;
+
+static void init_context(LuaCoroutine* co, char* stack_lo, char* stack_hi) {
+	(void)stack_lo;
+	auto top = reinterpret_cast<uintptr_t>(stack_hi) & ~uintptr_t(15);
+	auto* frame = reinterpret_cast<uint64_t*>(top) - 10;
+	frame[0] = 0x1F80 | (uint64_t(0x037F) << 32); // default MXCSR / x87 control word
+	frame[1] = 0; // r15
+	frame[2] = 0; // r14
+	frame[3] = reinterpret_cast<uint64_t>(&LuaCoroutine::entry); // r13
+	frame[4] = reinterpret_cast<uint64_t>(co); // r12
+	frame[5] = 0; // rbx
+	frame[6] = 0; // rbp
+	frame[7] = reinterpret_cast<uint64_t>(&luax_coro_trampoline); // return address
+	co->context = frame;
+}
+
+void LuaCoroutine::switch_in() { luax_coro_switch(&caller_context, context); }
+void LuaCoroutine::switch_out() { luax_coro_switch(&context, caller_context); }
+
+#else
+
+// Portable fallback: both ucontext_t records sit at the top of the stack region.
+static constexpr size_t CONTEXT_RESERVE = (2 * sizeof(ucontext_t) + 63) & ~size_t(63);
+
+static void ucontext_entry(unsigned int hi, unsigned int lo) {
+	LuaCoroutine::entry(reinterpret_cast<LuaCoroutine*>((uintptr_t(hi) << 32) | uintptr_t(lo)));
+}
+
+static void init_context(LuaCoroutine* co, char* stack_lo, char* stack_hi) {
+	auto* uc = reinterpret_cast<ucontext_t*>(stack_hi);
+	co->context = uc;
+	co->caller_context = uc + 1;
+	getcontext(uc);
+	uc->uc_stack.ss_sp = stack_lo;
+	uc->uc_stack.ss_size = stack_hi - stack_lo;
+	uc->uc_link = nullptr;
+	auto bits = reinterpret_cast<uintptr_t>(co);
+	makecontext(uc, reinterpret_cast<void (*)()>(ucontext_entry), 2,
+	            static_cast<unsigned int>(bits >> 32), static_cast<unsigned int>(bits));
+}
+
+void LuaCoroutine::switch_in() {
+	swapcontext(static_cast<ucontext_t*>(caller_context), static_cast<ucontext_t*>(context));
+}
+
+void LuaCoroutine::switch_out() {
+	swapcontext(static_cast<ucontext_t*>(context), static_cast<ucontext_t*>(caller_context));
+}
+
+#endif
+
+// --- Stack Pool ---
+// Stacks are mmap'd with a PROT_NONE guard page below them, so an overflow faults
+// instead of silently corrupting the neighbouring stack. Freed stacks are kept per thread.
+
+namespace {
+	constexpr size_t MAX_POOLED_STACKS = 256;
+
+	size_t page_size() {
+		static const size_t size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+		return size;
+	}
+
+	size_t stack_region_size() {
+		size_t page = page_size();
+		size_t usable = (LUAX_COROUTINE_STACK_SIZE + CONTEXT_RESERVE + page - 1) & ~(page - 1);
+		return usable + page;
+	}
+
+	struct StackPool {
+		std::vector<char*> free_stacks;
+		bool destroyed = false;
+
+		~StackPool() {
+			for (char* s : free_stacks) munmap(s, stack_region_size());
+			destroyed = true;
+		}
+	};
+
+	StackPool& stack_pool() {
+		thread_local StackPool pool;
+		return pool;
+	}
+
+	char* acquire_stack() {
+		auto& pool = stack_pool();
+		if (!pool.destroyed && !pool.free_stacks.empty()) {
+			char* s = pool.free_stacks.back();
+			pool.free_stacks.pop_back();
+			return s;
+		}
+
+		size_t size = stack_region_size();
+		void* mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		if (mem == MAP_FAILED) throw std::runtime_error("cannot allocate coroutine stack");
+		mprotect(mem, page_size(), PROT_NONE);
+		return static_cast<char*>(mem);
+	}
+
+	void release_stack(char* s) {
+		auto& pool = stack_pool();
+		if (!pool.destroyed && pool.free_stacks.size() < MAX_POOLED_STACKS) {
+			pool.free_stacks.push_back(s);
+			return;
+		}
+		munmap(s, stack_region_size());
+	}
+
+	// Runs co until it yields, returns or unwinds.
+	void run_slice(LuaCoroutine* co) {
+		co->previous = current_coroutine;
+		current_coroutine = co;
+		co->status = LuaCoroutine::Status::RUNNING;
+
+		luax_swap_ret_buf_stack(co->ret_bufs);
+		LuaArena* resumer_arena = LuaArena::exchange_active(co->arena);
+#ifdef LUAX_PROFILE
+		LuaProfileStack* resumer_stack = luax_profile_enter_stack(&co->profile_stack);
+#endif
+		co->switch_in();
+#ifdef LUAX_PROFILE
+		luax_profile_leave_stack(resumer_stack);
+#endif
+		co->arena = LuaArena::exchange_active(resumer_arena);
+		luax_swap_ret_buf_stack(co->ret_bufs);
+
+		current_coroutine = co->previous;
+		co->previous = nullptr;
+
+		if (co->status == LuaCoroutine::Status::DEAD && co->stack) {
+			release_stack(co->stack);
+			co->stack = nullptr;
+		}
+	}
+}
+
+LuaCoroutine::~LuaCoroutine() {
+	// A queued or running parallel task still uses func and its own buffers
+	if (task && status == Status::RUNNING) TaskScheduler::instance().wait(task.get());
+
+	// Suspended mid-body: resume once more so yield() throws and the frames unwind
+	if (stack && status == Status::SUSPENDED) {
+		terminate = true;
+		run_slice(this);
+	}
+	if (stack) release_stack(stack);
+	if (func) func->release();
+}
+
+void LuaCoroutine::entry(LuaCoroutine* co) {
+	try {
+		LuaValueVector args = std::move(co->transfer);
+		LuaValueVector results;
+		co->func->call(args.data(), args.size(), results);
+		co->transfer = std::move(results);
+	}
+	catch (const CoroutineTerminated&) {
+		co->transfer.clear();
+	}
+	catch (const std::exception& e) {
+		co->transfer.assign({ LuaValue(std::string(e.what())) });
+		co->error_occurred = true;
+	}
+	catch (...) {
+		co->transfer.assign({ LuaValue(std::string_view("unknown error")) });
+		co->error_occurred = true;
+	}
+
+	co->status = Status::DEAD;
+	co->switch_out();
+	__builtin_unreachable();
+}
+
+void LuaCoroutine::resume(const LuaValue* resume_args, size_t n_resume_args, LuaValueVector& out) {
+	if (status == Status::DEAD) {
+		out.assign({ LuaValue(false), LuaValue(std::string_view("cannot resume dead coroutine")) });
+		return;
+	}
+	if (status == Status::RUNNING) {
+		out.assign({ LuaValue(false), LuaValue(std::string_view("cannot resume non-suspended coroutine")) });
+		return;
+	}
+
+	// Stacks are taken lazily so coroutines that are never resumed stay cheap
+	if (!stack) {
+		stack = acquire_stack();
+		char* hi = stack + stack_region_size() - CONTEXT_RESERVE;
+		init_context(this, stack + page_size(), hi);
+	}
+
+	transfer.assign(resume_args, resume_args + n_resume_args);
+
+	// The body may drop the last reference to us while it runs
+	retain();
+	run_slice(this);
+
+	if (error_occurred) {
+		out.assign({ LuaValue(false), transfer.empty() ? LuaValue() : transfer[0] });
+	} else {
+		out.reserve(transfer.size() + 1);
+		out.assign({ LuaValue(true) });
+		out.insert(out.end(), transfer.begin(), transfer.end());
+	}
+	transfer.clear();
+	release();
+}
+
+void LuaCoroutine::yield(const LuaValue* yield_args, size_t n_args, LuaValueVector& out) {
+	LuaCoroutine* self = current_coroutine;
+	if (!self) throw std::runtime_error("attempt to yield from outside a coroutine");
+
+	self->transfer.assign(yield_args, yield_args + n_args);
+	self->status = Status::SUSPENDED;
+	self->switch_out();
+
+	// If garbage collected while suspended, unwind the C++ stack gracefully
+	if (self->terminate) throw CoroutineTerminated();
+
+	out.swap(self->transfer);
+	self->transfer.clear();
+}
+
+#endif
+
 // --- Bindings ---
 
 void coroutine_create(const LuaValue* args, size_t n_args, LuaValueVector& out) {
@@ -216,7 +723,8 @@ void coroutine_resume(const LuaValue* args, size_t n_args, LuaValueVector& out)
 		switch (args[0].index()) {
 			case INDEX_COROUTINE: {
 				auto co = args[0].get<LuaCoroutine*>();
-				co->resume(n_args > 1 ? args + 1 : nullptr, n_args > 1 ? n_args - 1 : 0, out);
+				if (co->task) co->start_parallel(n_args > 1 ? args + 1 : nullptr, n_args > 1 ? n_args - 1 : 0, out);
+				else co->resume(n_args > 1 ? args + 1 : nullptr, n_args > 1 ? n_args - 1 : 0, out);
 				return;
 			}
 			default:
@@ -235,7 +743,11 @@ void coroutine_status(const LuaValue* args, size_t n_args, LuaValueVector& out)
 		switch (args[0].index()) {
 			case INDEX_COROUTINE: {
 				auto co = args[0].get<LuaCoroutine*>();
-				const char* s = (co->status == LuaCoroutine::Status::DEAD) ? "dead" : "suspended";
+				const char* s = "suspended";
+				if (co->status == LuaCoroutine::Status::DEAD) s = "dead";
+				else if (co->task && co->status == LuaCoroutine::Status::RUNNING)
+					s = co->task->done.load(std::memory_order_acquire) ? "dead" : "running";
+				else if (co->status == LuaCoroutine::Status::RUNNING) s = (co == current_coroutine) ? "running" : "normal";
 				out.push_back(LuaValue(std::string_view(s)));
 				return;
 			}
@@ -247,7 +759,8 @@ void coroutine_status(const LuaValue* args, size_t n_args, LuaValueVector& out)
 }
 
 void coroutine_running(const LuaValue*, size_t, LuaValueVector& out) {
-	out.assign({ LuaValue(), (current_coroutine == nullptr) });
+	if (current_coroutine) out.assign({ LuaValue(current_coroutine), false });
+	else out.assign({ LuaValue(), true });
 }
 
 void coroutine_wrap(const LuaValue* args, size_t n_args, LuaValueVector& out) {
@@ -274,6 +787,38 @@ void coroutine_wrap(const LuaValue* args, size_t n_args, LuaValueVector& out) {
 	})));
 }
 
+void coroutine_create_parallel(const LuaValue* args, size_t n_args, LuaValueVector& out) {
+#if !defined(LUAX_REFCOUNT_ATOMIC) && !defined(LUAX_REFCOUNT_BIASED)
+	throw std::runtime_error("coroutine.create_parallel needs a build with --refcount atomic or biased");
+#endif
+	if (n_args > 0) {
+		switch (args[0].index()) {
+			case INDEX_FUNCTION:
+				out.push_back(LuaValue(new LuaCoroutine(args[0].get<LuaCallable*>(), true)));
+				return;
+			default:
+				break;
+		}
+	}
+	throw std::runtime_error("function expected");
+}
+
+void coroutine_await(const LuaValue* args, size_t n_args, LuaValueVector& out) {
+	if (n_args > 0) {
+		switch (args[0].index()) {
+			case INDEX_COROUTINE: {
+				auto co = args[0].get<LuaCoroutine*>();
+				if (!co->task) break;
+				co->await(out);
+				return;
+			}
+			default:
+				break;
+		}
+	}
+	throw std::runtime_error("parallel coroutine expected");
+}
+
 LuaObject* create_coroutine_library() {
 	auto lib = new LuaObject();
 	lib->set("create", LUA_C_FUNC(coroutine_create));
@@ -282,5 +827,7 @@ LuaObject* create_coroutine_library() {
 	lib->set("status", LUA_C_FUNC(coroutine_status));
 	lib->set("running", LUA_C_FUNC(coroutine_running));
 	lib->set("wrap", LUA_C_FUNC(coroutine_wrap));
+	lib->set("create_parallel", LUA_C_FUNC(coroutine_create_parallel));
+	lib->set("await", LUA_C_FUNC(coroutine_await));
 	return lib;
 }
\ No newline at end of file
@@ -1,6 +1,7 @@
 #include "debug.hpp"
 #include "lua_object.hpp"
 #include <stdexcept>
+#include <ostream>
 
 void debug_debug(const LuaValue* args, size_t n_args, LuaValueVector& out) {
 	throw std::runtime_error("debug.debug is not supported in the translated environment.");
@@ -66,6 +67,113 @@ void debug_upvaluejoin(const LuaValue* args, size_t n_args, LuaValueVector& out)
 	throw std::runtime_error("debug.upvaluejoin is not supported in the translated environment.");
 }
 
+// debug.internstats() -> table with the string intern pool counters
+void debug_internstats(const LuaValue* args, size_t n_args, LuaValueVector& out) {
+	LuaInternStats stats = luax_intern_stats();
+	auto* t = new LuaObject();
+	t->set("hits", LuaValue(static_cast<long long>(stats.hits)));
+	t->set("misses", LuaValue(static_cast<long long>(stats.misses)));
+	t->set("inserts", LuaValue(static_cast<long long>(stats.inserts)));
+	t->set("evictions", LuaValue(static_cast<long long>(stats.evictions)));
+	t->set("entries", LuaValue(static_cast<long long>(stats.entries)));
+	t->set("bytes", LuaValue(static_cast<long long>(stats.bytes)));
+	t->set("shards", LuaValue(static_cast<long long>(stats.shards)));
+	t->set("cachesize", LuaValue(static_cast<long long>(stats.cache_size)));
+	out.assign({LuaValue(t)});
+}
+
+static LuaValue stat_value(std::ptrdiff_t v) { return LuaValue(static_cast<long long>(v)); }
+
+// Sizes of the parts of one table
+static LuaObject* table_memstats(LuaObject* t) {
+	auto* r = new LuaObject();
+	r->set("array", stat_value(t->array_part.size()));
+	r->set("arraybytes", stat_value(t->array_part.capacity() * sizeof(LuaValue)));
+	r->set("small", stat_value(t->small_props.size()));
+	r->set("smallbytes", stat_value(t->small_props.capacity() * sizeof(LuaObject::PropPair)));
+	size_t hash_slots = t->properties ? t->properties->slot_count() : 0;
+	r->set("hash", stat_value(t->properties ? t->properties->size() : 0));
+	r->set("hashslots", stat_value(hash_slots));
+	r->set("hashbytes", stat_value(hash_slots * (1 + sizeof(LuaHashMap::Slot))));
+	return r;
+}
+
+// debug.memstats([t]) -> allocator, intern pool and table counters of the calling thread,
+// or the part sizes of table t
+void debug_memstats(const LuaValue* args, size_t n_args, LuaValueVector& out) {
+	if (n_args > 0 && args[0].index() == INDEX_OBJECT) {
+		out.assign({LuaValue(table_memstats(args[0].get<LuaObject*>()))});
+		return;
+	}
+
+	LuaPoolStats pool = LuaObjectPool::stats();
+	auto* t = new LuaObject();
+	t->set("inuse", stat_value(pool.bytes_in_use));
+	t->set("pagesize", stat_value(pool.page_size));
+	t->set("slabpages", stat_value(pool.slab_pages));
+	t->set("arenapages", stat_value(pool.arena_pages));
+	t->set("sparepages", stat_value(pool.spare_pages));
+	t->set("depotblocks", stat_value(pool.depot_blocks));
+
+	auto* buckets = new LuaObject();
+	for (size_t i = 0; i < LuaObjectPool::BUCKET_COUNT; ++i) {
+		const auto& b = pool.buckets[i];
+		auto live = static_cast<std::ptrdiff_t>(b.allocs - b.frees);
+		auto* bt = new LuaObject();
+		bt->set("size", stat_value(b.size));
+		bt->set("allocs", stat_value(b.allocs));
+		bt->set("frees", stat_value(b.frees));
+		bt->set("live", stat_value(live));
+		bt->set("livebytes", stat_value(live * static_cast<std::ptrdiff_t>(b.size)));
+		bt->set("free", stat_value(b.free_blocks));
+		buckets->set_item(static_cast<long long>(i + 1), bt);
+	}
+	t->set("buckets", buckets);
+
+	auto* large = new LuaObject();
+	large->set("allocs", stat_value(pool.large_allocs));
+	large->set("frees", stat_value(pool.large_frees));
+	large->set("bytes", stat_value(pool.large_bytes));
+	t->set("large", large);
+
+	t->set("tables", stat_value(luax_table_stats.tables));
+	t->set("hashbytes", stat_value(luax_table_stats.hash_bytes));
+
+	LuaInternStats intern = luax_intern_stats();
+	auto* it = new LuaObject();
+	it->set("entries", stat_value(intern.entries));
+	it->set("bytes", stat_value(intern.bytes));
+	t->set("intern", it);
+
+	out.assign({LuaValue(t)});
+}
+
+void luax_dump_memstats(std::ostream& os) {
+	LuaPoolStats pool = LuaObjectPool::stats();
+	LuaInternStats intern = luax_intern_stats();
+	os << "luax memstats: " << pool.bytes_in_use << " bytes in use, "
+		<< luax_table_stats.tables << " tables (" << luax_table_stats.hash_bytes << " hash bytes)\n";
+	auto column = [&os](long long v, size_t width) {
+		std::string s = std::to_string(v);
+		os << std::string(s.size() < width ? width - s.size() : 1, ' ') << s;
+	};
+	os << "    size      allocs       frees        live        free\n";
+	for (const auto& b : pool.buckets) {
+		column(static_cast<long long>(b.size), 8);
+		column(static_cast<long long>(b.allocs), 12);
+		column(static_cast<long long>(b.frees), 12);
+		column(static_cast<long long>(b.allocs - b.frees), 12);
+		column(static_cast<long long>(b.free_blocks), 12);
+		os << "\n";
+	}
+	os << "  large: " << pool.large_allocs << " allocs, " << pool.large_frees << " frees, "
+		<< pool.large_bytes << " bytes\n";
+	os << "  pages: " << pool.slab_pages << " slab, " << pool.arena_pages << " arena ("
+		<< pool.spare_pages << " spare) of " << pool.page_size << " bytes; "
+		<< pool.depot_blocks << " blocks in the depot\n";
+	os << "  intern: " << intern.entries << " strings, " << intern.bytes << " bytes\n";
+}
+
 LuaObject* create_debug_library() {
 	static LuaObject* debug_lib;
 	if (debug_lib) return debug_lib;
@@ -75,6 +183,8 @@ LuaObject* create_debug_library() {
 	debug_lib->set("getuservalue", LUA_C_FUNC(debug_getuservalue));
 	debug_lib->set("gethook", LUA_C_FUNC(debug_gethook));
 	debug_lib->set("getinfo", LUA_C_FUNC(debug_getinfo));
+	debug_lib->set("internstats", LUA_C_FUNC(debug_internstats));
+	debug_lib->set("memstats", LUA_C_FUNC(debug_memstats));
 	debug_lib->set("getlocal", LUA_C_FUNC(debug_getlocal));
 	debug_lib->set("getmetatable", LUA_C_FUNC(debug_getmetatable));
 	debug_lib->set("getregistry", LUA_C_FUNC(debug_getregistry));
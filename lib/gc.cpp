@@ -0,0 +1,314 @@
+#include "lua_object.hpp"
+#include <vector>
+#include <algorithm>
+
+// --- Cycle Collector ---
+// Synchronous trial deletion (Bacon & Rajan, "Concurrent Cycle Collection in Reference
+// Counted Systems", 2001). Reference counting still frees acyclic garbage immediately; a
+// container whose count drops to a non-zero value is only remembered as a candidate root.
+// A step takes a slice of candidates, subtracts all internal references reachable from
+// them and frees whatever is left at zero.
+//
+// Containers are tables, generated closures (through their captured values) and the boxes
+// of self-referencing local functions. Other refcounted values are leaves, which is always
+// safe: a reference the collector cannot see just keeps its target alive.
+//
+// The collector needs exclusive access to the counts, so it only operates in the default
+// (single-threaded) refcount mode.
+
+#if !defined(LUAX_REFCOUNT_ATOMIC) && !defined(LUAX_REFCOUNT_BIASED)
+#define LUAX_GC_ENABLED 1
+#endif
+
+thread_local bool luax_gc_step_requested = false;
+thread_local LuaTableStats luax_table_stats;
+
+class LuaCycleCollector {
+public:
+	enum Color : uint8_t {
+		BLACK = LuaRefCounted::GC_BLACK,
+		GRAY = LuaRefCounted::GC_GRAY,
+		WHITE = LuaRefCounted::GC_WHITE,
+		PURPLE = LuaRefCounted::GC_PURPLE
+	};
+
+	static constexpr size_t STEP_ROOTS = 1024;
+	static constexpr size_t MIN_THRESHOLD = 4096;
+	static constexpr size_t MAX_THRESHOLD = 1 << 20;
+	static constexpr size_t MAX_ROOTS = (1u << 28) - 1; // gc_slot width
+
+	// Each buffered object stores its index here, so unlinking is a swap with the last entry
+	std::vector<const LuaRefCounted*> roots;
+	size_t threshold = MIN_THRESHOLD;
+	bool running = true;
+	bool collecting = false;
+
+	~LuaCycleCollector() { is_destroyed() = true; }
+
+	static LuaCycleCollector& instance() {
+		thread_local LuaCycleCollector collector;
+		return collector;
+	}
+
+	// Statics (cached globals and constants) are released after the thread's collector is gone
+	static bool& is_destroyed() noexcept {
+		thread_local bool destroyed = false;
+		return destroyed;
+	}
+
+	void possible_root(const LuaRefCounted* obj) {
+		// Every decrement to a non-zero count makes the object a candidate again (PURPLE), even
+		// when it is still buffered: a step may have coloured it since it was buffered.
+		// A full buffer leaves the object untracked: it can leak a cycle, never free a live object.
+		obj->gc_color = PURPLE;
+		if (obj->gc_buffered || roots.size() >= MAX_ROOTS) return;
+		obj->gc_buffered = true;
+		obj->gc_slot = static_cast<uint32_t>(roots.size());
+		roots.push_back(obj);
+		if (running && roots.size() >= threshold) luax_gc_step_requested = true;
+	}
+
+	void unbuffer(const LuaRefCounted* obj) {
+		size_t slot = obj->gc_slot;
+		const LuaRefCounted* last = roots.back();
+		roots[slot] = last;
+		last->gc_slot = static_cast<uint32_t>(slot);
+		roots.pop_back();
+		obj->gc_buffered = false;
+	}
+
+#ifdef LUAX_GC_ENABLED
+	// Processes up to max_roots candidates; returns the number of objects reclaimed.
+	size_t step(size_t max_roots) {
+		if (collecting || roots.empty()) return 0;
+		collecting = true;
+
+		// The oldest candidates leave the buffer; the newest move into their slots
+		size_t n = std::min(max_roots, roots.size());
+		std::vector<const LuaRefCounted*> slice(roots.begin(), roots.begin() + n);
+		for (auto* s : slice) s->gc_buffered = false;
+		size_t keep = roots.size() - n;
+		for (size_t i = 0; i < std::min(n, keep); ++i) {
+			roots[i] = roots[roots.size() - 1 - i];
+			roots[i]->gc_slot = static_cast<uint32_t>(i);
+		}
+		roots.resize(keep);
+
+		for (auto* s : slice) {
+			if (s->gc_color == PURPLE) mark_gray(s);
+		}
+		for (auto* s : slice) scan(s);
+
+		std::vector<const LuaRefCounted*> garbage;
+		for (auto* s : slice) collect_white(s, garbage);
+
+		// Turn the trial counts back into real ones, then break the cycles with ordinary
+		// releases. The extra reference keeps every member alive until all are cleared.
+		for (auto* w : garbage) {
+			for_each_child(w, [](const LuaRefCounted* c) { ++c->ref_count; });
+			++w->ref_count;
+		}
+		for (auto* w : garbage) const_cast<LuaRefCounted*>(w)->gc_clear();
+		for (auto* w : garbage) w->release();
+
+		collecting = false;
+		return garbage.size();
+	}
+#else
+	size_t step(size_t) { return 0; }
+#endif
+
+private:
+	std::vector<const LuaRefCounted*> stack;
+	std::vector<const LuaRefCounted*> scratch;
+
+	template <typename F>
+	void for_each_child(const LuaRefCounted* obj, F&& f) {
+		scratch.clear();
+		obj->gc_trace(scratch);
+		for (auto* c : scratch) {
+			if (c->gc_container) f(c);
+		}
+	}
+
+#ifdef LUAX_GC_ENABLED
+	void mark_gray(const LuaRefCounted* root) {
+		if (root->gc_color == GRAY) return;
+		root->gc_color = GRAY;
+		stack.push_back(root);
+		while (!stack.empty()) {
+			auto* x = stack.back();
+			stack.pop_back();
+			for_each_child(x, [this](const LuaRefCounted* c) {
+				--c->ref_count;
+				if (c->gc_color != GRAY) {
+					c->gc_color = GRAY;
+					stack.push_back(c);
+				}
+			});
+		}
+	}
+
+	void scan_black(const LuaRefCounted* root) {
+		root->gc_color = BLACK;
+		std::vector<const LuaRefCounted*> work{root};
+		while (!work.empty()) {
+			auto* x = work.back();
+			work.pop_back();
+			for_each_child(x, [&work](const LuaRefCounted* c) {
+				++c->ref_count;
+				if (c->gc_color != BLACK) {
+					c->gc_color = BLACK;
+					work.push_back(c);
+				}
+			});
+		}
+	}
+
+	void scan(const LuaRefCounted* root) {
+		stack.push_back(root);
+		while (!stack.empty()) {
+			auto* x = stack.back();
+			stack.pop_back();
+			if (x->gc_color != GRAY) continue;
+			if (x->ref_count > 0) {
+				scan_black(x);
+				continue;
+			}
+			x->gc_color = WHITE;
+			for_each_child(x, [this](const LuaRefCounted* c) { stack.push_back(c); });
+		}
+	}
+
+	void collect_white(const LuaRefCounted* root, std::vector<const LuaRefCounted*>& garbage) {
+		stack.push_back(root);
+		while (!stack.empty()) {
+			auto* x = stack.back();
+			stack.pop_back();
+			if (x->gc_color != WHITE) continue;
+			x->gc_color = BLACK;
+			garbage.push_back(x);
+			for_each_child(x, [this](const LuaRefCounted* c) { stack.push_back(c); });
+		}
+	}
+#endif
+};
+
+void luax_gc_possible_root(const LuaRefCounted* obj) {
+	if (LuaCycleCollector::is_destroyed()) [[unlikely]] return;
+	LuaCycleCollector::instance().possible_root(obj);
+}
+
+// Once the collector is gone its buffer is too
+void luax_gc_unbuffer(const LuaRefCounted* obj) {
+	if (LuaCycleCollector::is_destroyed()) [[unlikely]] return;
+	LuaCycleCollector::instance().unbuffer(obj);
+}
+
+void luax_gc_auto_step() {
+	luax_gc_step_requested = false;
+	if (LuaCycleCollector::is_destroyed()) [[unlikely]] return;
+	auto& gc = LuaCycleCollector::instance();
+	if (!gc.running || gc.collecting) return;
+
+	// Back off while the candidates keep turning out to be live
+	size_t freed = gc.step(LuaCycleCollector::STEP_ROOTS);
+	if (freed == 0) gc.threshold = std::min(gc.threshold * 2, LuaCycleCollector::MAX_THRESHOLD);
+	else gc.threshold = std::max(gc.threshold / 2, LuaCycleCollector::MIN_THRESHOLD);
+	if (gc.roots.size() >= gc.threshold) luax_gc_step_requested = true;
+}
+
+bool luax_gc_step(size_t max_roots) {
+	auto& gc = LuaCycleCollector::instance();
+	gc.step(max_roots ? max_roots : LuaCycleCollector::STEP_ROOTS);
+	return gc.roots.empty();
+}
+
+void luax_gc_collect() {
+	auto& gc = LuaCycleCollector::instance();
+	// Freeing a cycle can expose new candidates; repeat until a pass reclaims nothing
+	while (!gc.roots.empty() && gc.step(gc.roots.size()) > 0) {}
+}
+
+// Pool memory of this thread plus the characters held by the intern pool
+double luax_gc_count_kb() {
+	return static_cast<double>(LuaObjectPool::bytes_in_use() + static_cast<std::ptrdiff_t>(luax_intern_stats().bytes)) / 1024.0;
+}
+
+// --- Table Tracing ---
+
+void LuaObject::gc_trace(std::vector<const LuaRefCounted*>& children) const {
+	auto add = [&children](const LuaValue& v) {
+		uint64_t raw = v.raw_data();
+		uint64_t tag = raw & TAG_MASK;
+		if (raw >= NAN_MASK && (tag == TAG_OBJECT || tag == TAG_FUNCTION) && (raw & PAYLOAD_MASK)) {
+			children.push_back(reinterpret_cast<const LuaRefCounted*>(raw & PAYLOAD_MASK));
+		}
+	};
+
+	for (const auto& p : small_props) {
+		add(p.first);
+		add(p.second);
+	}
+	if (properties) {
+		for (const auto& [k, v] : *properties) {
+			add(k);
+			add(v);
+		}
+	}
+	for (const auto& v : array_part) add(v);
+	if (metatable) children.push_back(metatable);
+}
+
+void LuaObject::gc_clear() {
+	// Move everything out first so releases that cascade back here see an empty table
+	auto props = std::move(small_props);
+	auto map = std::move(properties);
+	shape = LuaShape::empty();
+	auto arr = std::move(array_part);
+	++props_version;
+	LuaObject* mt = metatable;
+	metatable = nullptr;
+	if (mt) mt->release();
+}
+
+// collectgarbage([opt [, arg]])
+void lua_collectgarbage(const LuaValue* args, size_t n_args, LuaValueVector& out) {
+	std::string opt = (n_args > 0 && args[0].index() != INDEX_NIL) ? to_cpp_string(args[0]) : "collect";
+	auto& gc = LuaCycleCollector::instance();
+	out.clear();
+
+	if (opt == "collect") {
+		luax_gc_collect();
+		out.push_back(0LL);
+	}
+	else if (opt == "step") {
+		// The step size is measured in batches of 64 candidate roots
+		long long n = (n_args > 1) ? get_long_long(args[1]) : 0;
+		out.push_back(luax_gc_step(n > 0 ? static_cast<size_t>(n) * 64 : 0));
+	}
+	else if (opt == "count") {
+		out.push_back(luax_gc_count_kb());
+	}
+	else if (opt == "stop") {
+		gc.running = false;
+		luax_gc_step_requested = false;
+		out.push_back(0LL);
+	}
+	else if (opt == "restart") {
+		gc.running = true;
+		out.push_back(0LL);
+	}
+	else if (opt == "isrunning") {
+		out.push_back(gc.running);
+	}
+	else if (opt == "incremental" || opt == "generational") {
+		out.push_back(LuaValue(std::string_view("incremental")));
+	}
+	else if (opt == "setpause" || opt == "setstepmul") {
+		out.push_back(0LL);
+	}
+	else {
+		throw std::runtime_error("bad argument #1 to 'collectgarbage' (invalid option '" + opt + "')");
+	}
+}
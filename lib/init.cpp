@@ -4,6 +4,7 @@
 #include <iostream>
 #include <vector>
 
+#include "arena.hpp"
 #include "coroutine.hpp"
 #include "debug.hpp"
 #include "io.hpp"
@@ -78,15 +79,13 @@ void lua_pcall(const LuaValue* args, size_t n_args, LuaValueVector& out) {
 }
 
 void lua_print(const LuaValue* args, size_t n_args, LuaValueVector& out) {
-    for (size_t i = 0; i < n_args; i++) {
-        std::cout << to_cpp_string(args[i]) << (i == n_args - 1 ? "" : "\t");
-    }
-    std::cout << std::endl;
+    luax_print(args, n_args);
     out.assign({LuaValue()});
 }
 
 static LuaObject* create_initial_global() {
 	auto* globals = new LuaObject();
+	globals->retain(); // owned by the _G pointer for the lifetime of the program
 	
 	globals->set("assert", LUA_C_FUNC(lua_assert));
 	globals->set("collectgarbage", LUA_C_FUNC(lua_collectgarbage));
@@ -120,6 +119,7 @@ static LuaObject* create_initial_global() {
 	globals->set("coroutine", create_coroutine_library());
 	globals->set("utf8", create_utf8_library());
 	globals->set("debug", create_debug_library());
+	globals->set("arena", create_arena_library());
 	globals->set("_G", globals);
 	
 	globals->set("print", LUA_C_FUNC(lua_print));
@@ -135,4 +135,7 @@ void init_G(int argc, char* argv[]) {
 		arg->set_item((double)(i), std::string(argv[i]));
 	}
 	_G->set("arg", arg);
+#ifdef LUAX_PROFILE
+	luax_profile_start();
+#endif
 }
@@ -1,9 +1,16 @@
 #include "io.hpp"
+#include "coroutine.hpp"
+#include "reactor.hpp"
 #include <iostream>
 #include <cstdio>
 #include <vector>
 #include <cstring> // For strerror
 #include <cerrno>
+#include <cctype>
+#include <cstdlib>
+#include <exception>
+#include <algorithm>
+#include <cmath>
 
 // Platform specific for popen
 #ifdef _WIN32
@@ -11,6 +18,16 @@
 #define pclose _pclose
 #else
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <spawn.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+extern char** environ;
 #endif
 
 // Global file handles for stdin, stdout, stderr
@@ -54,15 +71,25 @@ auto make_file_method = [](auto method_ptr) {
 
 // LuaFile constructor: Opens the file and registers all methods on itself.
 LuaFile::LuaFile(const std::string& filename, const std::string& mode) : is_popen(false) {
-	file_handle = std::fopen(filename.c_str(), mode.c_str());
+	std::string stdio_mode = mode;
+	stdio_mode.erase(std::remove(stdio_mode.begin(), stdio_mode.end(), 'm'), stdio_mode.end());
+	file_handle = std::fopen(filename.c_str(), stdio_mode.c_str());
 	is_closed = (file_handle == nullptr);
+	if (!is_closed && stdio_mode.find_first_of("wa+") == std::string::npos && stdio_mode.size() < mode.size()) {
+		map_file();
+	}
 }
 
 LuaFile::LuaFile(FILE* f, bool is_popen_mode) : file_handle(f), is_closed(false), is_popen(is_popen_mode) {}
 
 LuaFile::~LuaFile() {
+	unmap_file();
 	if (!is_closed && file_handle) {
-		if (is_popen) {
+		flush_buffer();
+		if (child_pid >= 0) {
+			close_child(false);
+		}
+		else if (is_popen) {
 			pclose(file_handle);
 		}
 		else if (file_handle != stdin && file_handle != stdout && file_handle != stderr) {
@@ -77,8 +104,13 @@ void LuaFile::close(const LuaValue* args, size_t n_args, LuaValueVector& out) {
 		return;
 	}
 
+	unmap_file();
+	bool flushed = flush_buffer();
 	int res = 0;
-	if (is_popen) {
+	if (child_pid >= 0) {
+		res = close_child(true);
+	}
+	else if (is_popen) {
 		res = pclose(file_handle);
 	}
 	else {
@@ -87,7 +119,7 @@ void LuaFile::close(const LuaValue* args, size_t n_args, LuaValueVector& out) {
 	is_closed = true;
 	file_handle = nullptr;
 
-	if (res == 0) {
+	if (res == 0 && flushed) {
 		out.assign({true});
 	}
 	else {
@@ -95,12 +127,56 @@ void LuaFile::close(const LuaValue* args, size_t n_args, LuaValueVector& out) {
 	}
 }
 
-void LuaFile::flush(const LuaValue* args, size_t n_args, LuaValueVector& out) const {
+// Closes a pipe made by spawn_pipe and reaps its command, returning the command's wait status.
+// With may_wait, the exit is awaited through a pidfd in the reactor where the kernel has them,
+// so a coroutine closing the pipe parks instead of blocking the thread
+int LuaFile::close_child(bool may_wait) {
+	int res = 0;
+#ifndef _WIN32
+	luax_reactor_forget(fileno(file_handle));
+	res = std::fclose(file_handle);
+	is_closed = true;
+	file_handle = nullptr;
+	pid_t pid = static_cast<pid_t>(child_pid);
+	child_pid = -1;
+
+	int status = 0;
+	pid_t reaped = 0;
+#if defined(__linux__) && defined(SYS_pidfd_open)
+	int pidfd = may_wait ? static_cast<int>(syscall(SYS_pidfd_open, pid, 0)) : -1;
+	if (pidfd >= 0) {
+		struct PidFd {
+			int fd;
+			~PidFd() {
+				luax_reactor_forget(fd);
+				::close(fd);
+			}
+		} guard{pidfd};
+		try {
+			while ((reaped = waitpid(pid, &status, WNOHANG)) == 0 || (reaped < 0 && errno == EINTR)) {
+				if (reaped == 0) luax_wait_fd(pidfd, false);
+			}
+		}
+		catch (...) {
+			waitpid(pid, &status, 0);
+			throw;
+		}
+	}
+#else
+	(void)may_wait;
+#endif
+	while (reaped == 0 || (reaped < 0 && errno == EINTR)) reaped = waitpid(pid, &status, 0);
+	if (res == 0) res = reaped < 0 ? -1 : status;
+#endif
+	return res;
+}
+
+void LuaFile::flush(const LuaValue* args, size_t n_args, LuaValueVector& out) {
 	if (is_closed) {
 		out.assign({LuaValue(), LuaValue(std::string_view("attempt to use a closed file"))});
 		return;
 	}
-	if (std::fflush(file_handle) == 0) {
+	if (flush_buffer() && std::fflush(file_handle) == 0) {
 		out.assign({true});
 	}
 	else {
@@ -108,7 +184,172 @@ void LuaFile::flush(const LuaValue* args, size_t n_args, LuaValueVector& out) co
 	}
 }
 
-void LuaFile::read(const LuaValue* args, size_t n_args, LuaValueVector& out) const {
+// Maps the whole file when it is a non-empty regular file; anything else keeps using stdio
+void LuaFile::map_file() {
+#ifndef _WIN32
+	struct stat st;
+	int fd = fileno(file_handle);
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0) return;
+	void* p = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+	if (p == MAP_FAILED) return;
+	madvise(p, static_cast<size_t>(st.st_size), MADV_SEQUENTIAL);
+	map_data = static_cast<const char*>(p);
+	map_size = static_cast<size_t>(st.st_size);
+	map_pos = 0;
+#endif
+}
+
+void LuaFile::unmap_file() {
+#ifndef _WIN32
+	if (map_data) munmap(const_cast<char*>(map_data), map_size);
+#endif
+	map_data = nullptr;
+	map_size = 0;
+}
+
+std::string_view LuaFile::mapped_rest() const {
+	if (map_pos >= map_size) return {};
+	return std::string_view(map_data + map_pos, map_size - map_pos);
+}
+
+// Formats over bytes already in memory (a mapping, or the read buffer of a non-blocking pipe):
+// rest starts at pos, which is moved past what was consumed
+
+// Next line, or nil at the end; memchr finds the newline a vector at a time
+static LuaValue read_line_in(std::string_view rest, size_t& pos, bool keep_newline) {
+	if (rest.empty()) return LuaValue();
+	auto* nl = static_cast<const char*>(std::memchr(rest.data(), '\n', rest.size()));
+	size_t len = nl ? static_cast<size_t>(nl - rest.data()) : rest.size();
+	pos += nl ? len + 1 : len;
+	return lua_make_string(rest.substr(0, nl && keep_newline ? len + 1 : len));
+}
+
+static void read_format_in(std::string_view rest, size_t& pos, const std::string& format, LuaValueVector& out) {
+	if (format == "*l" || format == "*L") {
+		out.assign({read_line_in(rest, pos, format == "*L")});
+	}
+	else if (format == "*a" || format == "*all") {
+		pos += rest.size();
+		if (rest.empty()) out.assign({LuaValue()});
+		else out.assign({lua_make_string(rest)});
+	}
+	else if (format == "*n") {
+		// Same syntax as the fscanf path; strtod needs a terminated copy of the number
+		size_t skip = 0;
+		while (skip < rest.size() && std::isspace(static_cast<unsigned char>(rest[skip]))) skip++;
+		char buffer[256];
+		size_t len = std::min(rest.size() - skip, sizeof(buffer) - 1);
+		std::memcpy(buffer, rest.data() + skip, len);
+		buffer[len] = '\0';
+		char* end;
+		double num = std::strtod(buffer, &end);
+		pos += skip + static_cast<size_t>(end - buffer);
+		if (end == buffer) out.assign({LuaValue()});
+		else out.assign({num});
+	}
+	else { // Read bytes
+		long long num_bytes = 0;
+		try {
+			num_bytes = std::stoll(format);
+		}
+		catch (...) {
+			out.assign({LuaValue(), LuaValue(std::string_view("invalid read format"))});
+			return;
+		}
+
+		if (rest.empty()) {
+			out.assign({LuaValue()});
+			return;
+		}
+		size_t len = std::min(rest.size(), static_cast<size_t>(std::max(num_bytes, 0LL)));
+		pos += len;
+		out.assign({lua_make_string(rest.substr(0, len))});
+	}
+}
+
+LuaValue LuaFile::read_mapped_line(bool keep_newline) const {
+	return read_line_in(mapped_rest(), map_pos, keep_newline);
+}
+
+void LuaFile::read_mapped(const std::string& format, LuaValueVector& out) const {
+	read_format_in(mapped_rest(), map_pos, format, out);
+}
+
+// Appends what the pipe holds to read_buf, waiting while it is empty; false at end of file,
+// on a read error, or when the handle was closed during the wait. Also returns once another
+// reader of the handle has appended during the wait, so the caller looks at the buffer again
+bool LuaFile::fill_read_buf() {
+	if (read_pos > 0 && read_pos * 2 >= read_buf.size()) {
+		read_buf.erase(0, read_pos);
+		read_base += read_pos;
+		read_pos = 0;
+	}
+#ifndef _WIN32
+	size_t received = read_base + read_buf.size();
+	char chunk[16 * 1024];
+	while (!is_closed) {
+		int fd = fileno(file_handle);
+		ssize_t n = ::read(fd, chunk, sizeof(chunk));
+		if (n > 0) {
+			read_buf.append(chunk, static_cast<size_t>(n));
+			return true;
+		}
+		if (n == 0) {
+			read_eof = true;
+			return false;
+		}
+		if (errno == EINTR) continue;
+		if (errno != EAGAIN && errno != EWOULDBLOCK) return false;
+		luax_wait_fd(fd, false);
+		if (read_base + read_buf.size() != received) return true;
+	}
+#endif
+	return false;
+}
+
+// Reads until read_buf holds what format needs (everything for "a") or the pipe is at end
+// of file, then takes the result from the buffer as from a mapping
+void LuaFile::read_nonblocking(const std::string& format, LuaValueVector& out) {
+	// Stream offset searched for a newline so far. Other readers of the handle move read_pos
+	// and compact read_buf while this one waits, so it is not kept relative to either.
+	size_t scanned = 0;
+	auto enough = [&] {
+		std::string_view rest = std::string_view(read_buf).substr(read_pos);
+		if (format == "*a" || format == "*all") return false;
+		if (format == "*l" || format == "*L") {
+			size_t from = std::max(scanned, read_base + read_pos) - read_base;
+			bool found = std::memchr(read_buf.data() + from, '\n', read_buf.size() - from) != nullptr;
+			scanned = read_base + read_buf.size();
+			return found;
+		}
+		if (format == "*n") {
+			// The number ends at the first space after it, and none is longer than the strtod buffer
+			size_t i = 0;
+			while (i < rest.size() && std::isspace(static_cast<unsigned char>(rest[i]))) i++;
+			while (i < rest.size() && !std::isspace(static_cast<unsigned char>(rest[i]))) i++;
+			return i < rest.size() || rest.size() >= 255;
+		}
+		char* end;
+		long long n = std::strtoll(format.c_str(), &end, 10);
+		if (end == format.c_str()) return true; // reported by read_format_in
+		return rest.size() >= static_cast<size_t>(std::max(n, 1LL));
+	};
+	while (!read_eof && !enough()) {
+		if (!fill_read_buf()) break;
+	}
+	if (is_closed) {
+		out.assign({LuaValue(), LuaValue(std::string_view("attempt to use a closed file"))});
+		return;
+	}
+	read_format_in(std::string_view(read_buf).substr(read_pos), read_pos, format, out);
+	if (read_pos == read_buf.size()) {
+		read_buf.clear();
+		read_base += read_pos;
+		read_pos = 0;
+	}
+}
+
+void LuaFile::read(const LuaValue* args, size_t n_args, LuaValueVector& out) {
 	if (is_closed) {
 		out.assign({LuaValue(), LuaValue(std::string_view("attempt to use a closed file"))});
 		return;
@@ -117,7 +358,21 @@ void LuaFile::read(const LuaValue* args, size_t n_args, LuaValueVector& out) con
 	// Lua syntax: file:read(...) or file:read() (defaults to "*l")
 	// args[0] is self. args[1] is first arg.
 	std::string format = n_args >= 2 ? to_cpp_string(args[1]) : "*l";
+	// Lua 5.4 spells the formats without the '*'
+	if (!format.empty() && std::isalpha(static_cast<unsigned char>(format[0]))) format.insert(0, 1, '*');
+
+	if (map_data) {
+		read_mapped(format, out);
+		return;
+	}
+	// Pending writes come first on update streams, and prompts appear before stdin blocks
+	if (this == io_stdin_handle) luax_flush_output();
+	flush_buffer();
 
+	if (nonblocking) {
+		read_nonblocking(format, out);
+		return;
+	}
 	if (format == "*n") { // Read number
 		double num;
 		if (fscanf(file_handle, "%lf", &num) == 1) {
@@ -199,12 +454,12 @@ void LuaFile::read(const LuaValue* args, size_t n_args, LuaValueVector& out) con
 			out.assign({LuaValue()});
 		}
 		else {
-			out.assign({std::string(buffer.data())});
+			out.assign({std::string(buffer.data(), read_count)});
 		}
 	}
 }
 
-void LuaFile::seek(const LuaValue* args, size_t n_args, LuaValueVector& out) const {
+void LuaFile::seek(const LuaValue* args, size_t n_args, LuaValueVector& out) {
 	if (is_closed) {
 		out.assign({LuaValue(), LuaValue(std::string_view("attempt to use a closed file"))});
 		return;
@@ -217,6 +472,18 @@ void LuaFile::seek(const LuaValue* args, size_t n_args, LuaValueVector& out) con
 	if (whence == "set") origin = SEEK_SET;
 	else if (whence == "end") origin = SEEK_END;
 
+	if (map_data) {
+		long long base = origin == SEEK_SET ? 0 : origin == SEEK_END ? static_cast<long long>(map_size) : static_cast<long long>(map_pos);
+		if (base + offset < 0) {
+			out.assign({LuaValue(), LuaValue(std::string_view("seek failed"))});
+			return;
+		}
+		map_pos = static_cast<size_t>(base + offset);
+		out.assign({static_cast<long long>(map_pos)});
+		return;
+	}
+
+	flush_buffer();
 	if (std::fseek(file_handle, offset, origin) == 0) {
 		long long pos = std::ftell(file_handle);
 		out.assign({pos});
@@ -226,7 +493,7 @@ void LuaFile::seek(const LuaValue* args, size_t n_args, LuaValueVector& out) con
 	}
 }
 
-void LuaFile::setvbuf(const LuaValue* args, size_t n_args, LuaValueVector& out) const {
+void LuaFile::setvbuf(const LuaValue* args, size_t n_args, LuaValueVector& out) {
 	out.clear();
 	if (is_closed) {
 		out.push_back(LuaValue());
@@ -235,13 +502,18 @@ void LuaFile::setvbuf(const LuaValue* args, size_t n_args, LuaValueVector& out)
 	}
 
 	std::string mode_str = to_cpp_string(args[1]);
-	long long size = n_args >= 3 ? get_long_long(args[2]) : 1024;
+	long long size = n_args >= 3 ? get_long_long(args[2]) : static_cast<long long>(LUA_FILE_BUFFER_SIZE);
 
 	int mode = _IOFBF;
 	if (mode_str == "no") mode = _IONBF;
 	else if (mode_str == "line") mode = _IOLBF;
 
-	if (std::setvbuf(file_handle, nullptr, mode, size) == 0) {
+	// Output is buffered by LuaX, so the mode and size apply to write_buf
+	std::lock_guard<std::mutex> lock(write_mtx);
+	if (flush_locked()) {
+		write_mode = mode;
+		write_buf_size = static_cast<size_t>(std::max(size, 1LL));
+		if (write_buf.capacity() > write_buf_size) write_buf.shrink_to_fit();
 		out.push_back(true);
 	}
 	else {
@@ -259,25 +531,162 @@ void LuaFile::write(const LuaValue* args, size_t n_args, LuaValueVector& out) {
 	}
 
 	// args[0] is self. Write args[1]...args[N]
-	for (size_t i = 1; i < n_args; ++i) {
-		const auto& arg = args[i];
-		if (arg.index() == INDEX_STRING || arg.index() == INDEX_STRING_VIEW) {
-			auto sv = arg.get<std::string_view>();
-			if (sv.size() > 0 && std::fwrite(sv.data(), 1, sv.size(), file_handle) != sv.size()) {
-				out.push_back(LuaValue());
-				out.push_back(LuaValue(std::string_view("write failed")));
-				return;
+	if (n_args > 1 && !write_values(args + 1, n_args - 1)) {
+		out.push_back(LuaValue());
+		out.push_back(LuaValue(std::string_view("write failed")));
+		return;
+	}
+	out.push_back(this);
+}
+
+// Sends write_buf and then tail to the descriptor, looping over short writes
+bool LuaFile::flush_locked(std::string_view tail) {
+	if (write_buf.empty() && tail.empty()) return true;
+	if (nonblocking) return flush_nonblocking_locked(tail);
+	// Anything stdio still holds goes first; for update streams this also drops read-ahead
+	bool ok = std::fflush(file_handle) == 0;
+#ifdef _WIN32
+	if (!write_buf.empty() && std::fwrite(write_buf.data(), 1, write_buf.size(), file_handle) != write_buf.size()) ok = false;
+	if (!tail.empty() && std::fwrite(tail.data(), 1, tail.size(), file_handle) != tail.size()) ok = false;
+	if (std::fflush(file_handle) != 0) ok = false;
+#else
+	struct iovec iov[2] = {
+		{write_buf.data(), write_buf.size()},
+		{const_cast<char*>(tail.data()), tail.size()}
+	};
+	struct iovec* v = write_buf.empty() ? iov + 1 : iov;
+	int count = (write_buf.empty() || tail.empty()) ? 1 : 2;
+	int fd = fileno(file_handle);
+	while (count > 0) {
+		ssize_t written = ::writev(fd, v, count);
+		if (written < 0) {
+			if (errno == EINTR) continue;
+			ok = false;
+			break;
+		}
+		size_t n = static_cast<size_t>(written);
+		while (count > 0 && n >= v->iov_len) {
+			n -= v->iov_len;
+			v++;
+			count--;
+		}
+		if (count > 0) {
+			v->iov_base = static_cast<char*>(v->iov_base) + n;
+			v->iov_len -= n;
+		}
+	}
+#endif
+	write_buf.clear();
+	return ok;
+}
+
+// Like flush_locked, waiting in the reactor whenever the pipe is full. write_mtx is released
+// during the wait; writers that arrive meanwhile only append to write_buf, and this flush sends
+// what they added after its own data
+bool LuaFile::flush_nonblocking_locked(std::string_view tail) {
+	if (flushing) {
+		write_buf.append(tail);
+		return true;
+	}
+	bool ok = true;
+#ifndef _WIN32
+	struct Flushing {
+		bool& flag;
+		explicit Flushing(bool& f) : flag(f) { flag = true; }
+		~Flushing() { flag = false; }
+	} in_progress(flushing);
+
+	auto send = [&](std::string_view data) {
+		size_t done = 0;
+		while (ok && done < data.size()) {
+			if (is_closed) {
+				ok = false;
+				break;
 			}
-		} else {
-			std::string s = to_cpp_string(arg);
-			if (s.size() > 0 && std::fwrite(s.data(), 1, s.size(), file_handle) != s.size()) {
-				out.push_back(LuaValue());
-				out.push_back(LuaValue(std::string_view("write failed")));
-				return;
+			int fd = fileno(file_handle);
+			ssize_t written = ::write(fd, data.data() + done, data.size() - done);
+			if (written >= 0) {
+				done += static_cast<size_t>(written);
+				continue;
+			}
+			if (errno == EINTR) continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK) {
+				ok = false;
+				break;
 			}
+			write_mtx.unlock();
+			struct Relock {
+				std::mutex& m;
+				~Relock() { m.lock(); }
+			} relock{write_mtx};
+			luax_wait_fd(fd, true);
 		}
+	};
+
+	std::string pending;
+	bool appended = false;
+	while (ok && (!write_buf.empty() || !tail.empty())) {
+		pending.swap(write_buf);
+		send(pending);
+		pending.clear();
+		send(tail);
+		tail = {};
+		appended = !write_buf.empty();
 	}
-	out.push_back(this);
+	if (!ok && (appended || !write_buf.empty())) write_failed = true;
+#endif
+	write_buf.clear();
+	return ok;
+}
+
+// Explicit flushes (flush, close, seek) also wait for a non-blocking flush parked in another
+// coroutine, which still holds the data it took from write_buf, and report data it lost
+bool LuaFile::flush_buffer() {
+	std::unique_lock<std::mutex> lock(write_mtx);
+	while (flushing && !is_closed) {
+		int fd = fileno(file_handle);
+		lock.unlock();
+		luax_wait_fd(fd, true);
+		lock.lock();
+	}
+	bool ok = flush_locked();
+	if (write_failed) {
+		write_failed = false;
+		ok = false;
+	}
+	return ok;
+}
+
+// Numbers are formatted straight into write_buf; long strings bypass it
+bool LuaFile::append_locked(const LuaValue& value) {
+	if (value.index() == INDEX_STRING) {
+		auto sv = value.get<std::string_view>();
+		if (sv.size() >= write_buf_size) return flush_locked(sv);
+		write_buf.append(sv);
+	}
+	else {
+		append_to_string(value, write_buf);
+	}
+	return write_buf.size() < write_buf_size || flush_locked();
+}
+
+bool LuaFile::write_values(const LuaValue* values, size_t n, bool print_line, const LuaValue* rest, size_t n_rest) {
+	std::lock_guard<std::mutex> lock(write_mtx);
+	if (write_buf.capacity() < write_buf_size) write_buf.reserve(write_buf_size);
+	size_t line_start = write_buf.size();
+	bool ok = true;
+	for (size_t i = 0; i < n + n_rest; ++i) {
+		if (print_line && i > 0) write_buf.push_back('\t');
+		ok = append_locked(i < n ? values[i] : rest[i - n]) && ok;
+		if (write_buf.size() < line_start) line_start = 0; // flushed
+	}
+	if (print_line) write_buf.push_back('\n');
+
+	if (write_mode == _IONBF || write_buf.size() >= write_buf_size) return flush_locked() && ok;
+	if (write_mode == _IOLBF && std::memchr(write_buf.data() + line_start, '\n', write_buf.size() - line_start)) {
+		return flush_locked() && ok;
+	}
+	return ok;
 }
 
 void LuaFile::lines(const LuaValue* args, size_t n_args, LuaValueVector& out) {
@@ -286,6 +695,8 @@ void LuaFile::lines(const LuaValue* args, size_t n_args, LuaValueVector& out) {
 		return;
 	}
 
+	flush_buffer();
+
 	// The iterator function for file:lines()
 	auto iterator_func = make_lua_callable(
 		[self_obj = this](const LuaValue* _, size_t __, LuaValueVector& iter_out) {
@@ -295,6 +706,14 @@ void LuaFile::lines(const LuaValue* args, size_t n_args, LuaValueVector& out) {
 					iter_out.assign({LuaValue()});
 					return;
 				}
+				if (self->map_data) {
+					iter_out.assign({self->read_mapped_line(false)});
+					return;
+				}
+				if (self->nonblocking) {
+					self->read_nonblocking("*l", iter_out);
+					return;
+				}
 				char buffer[4096];
 				if (std::fgets(buffer, sizeof(buffer), self->file_handle)) {
 					std::string line(buffer);
@@ -327,10 +746,67 @@ void io_open(const LuaValue* args, size_t n_args, LuaValueVector& out) {
 	out.assign({file_to_value(file_obj)});
 }
 
+#ifndef _WIN32
+// io.popen(cmd, "rn") / "wn": runs cmd under /bin/sh with our end of the pipe non-blocking.
+// Both ends are close-on-exec, so commands do not inherit each other's pipes and a reader
+// sees end of file as soon as its own command exits
+static LuaFile* spawn_pipe(const std::string& command, bool write) {
+	int fds[2];
+#ifdef __linux__
+	if (pipe2(fds, O_CLOEXEC) != 0) return nullptr;
+#else
+	if (pipe(fds) != 0) return nullptr;
+	fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+	fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+#endif
+	int ours = write ? fds[1] : fds[0];
+	int theirs = write ? fds[0] : fds[1];
+
+	posix_spawn_file_actions_t actions;
+	posix_spawn_file_actions_init(&actions);
+	posix_spawn_file_actions_adddup2(&actions, theirs, write ? STDIN_FILENO : STDOUT_FILENO);
+	const char* argv[] = {"sh", "-c", command.c_str(), nullptr};
+	pid_t pid;
+	int rc = posix_spawn(&pid, "/bin/sh", &actions, nullptr, const_cast<char* const*>(argv), environ);
+	posix_spawn_file_actions_destroy(&actions);
+	::close(theirs);
+	if (rc != 0) {
+		::close(ours);
+		errno = rc;
+		return nullptr;
+	}
+
+	fcntl(ours, F_SETFL, fcntl(ours, F_GETFL) | O_NONBLOCK);
+	FILE* f = fdopen(ours, write ? "w" : "r");
+	if (!f) {
+		::close(ours);
+		waitpid(pid, nullptr, 0);
+		return nullptr;
+	}
+	auto* file = new LuaFile(f, true);
+	file->nonblocking = true;
+	file->child_pid = pid;
+	return file;
+}
+#endif
+
 void io_popen(const LuaValue* args, size_t n_args, LuaValueVector& out) {
 	std::string command = to_cpp_string(args[0]);
 	std::string mode = n_args >= 2 ? to_cpp_string(args[1]) : "r";
 
+	luax_flush_output(); // the command's output must follow ours
+#ifndef _WIN32
+	if (mode.find('n') != std::string::npos) {
+		LuaFile* file_obj = spawn_pipe(command, mode.find('w') != std::string::npos);
+		if (!file_obj) {
+			out.assign({LuaValue(), "popen failed: " + std::string(std::strerror(errno))});
+			return;
+		}
+		file_obj->set_metatable(file_metatable);
+		out.assign({file_to_value(file_obj)});
+		return;
+	}
+#endif
 	FILE* f = popen(command.c_str(), mode.c_str());
 	if (!f) {
 		out.assign({LuaValue(), "popen failed: " + std::string(std::strerror(errno))});
@@ -342,6 +818,36 @@ void io_popen(const LuaValue* args, size_t n_args, LuaValueVector& out) {
 	out.assign({file_to_value(file_obj)});
 }
 
+// io.poll([timeout]): resumes the coroutines parked on non-blocking pipes that became ready,
+// first waiting up to timeout seconds for one (until one is ready when nil, not at all for 0).
+// Returns how many coroutines are still parked
+void io_poll(const LuaValue* args, size_t n_args, LuaValueVector& out) {
+	int timeout_ms = -1;
+	if (n_args > 0 && !args[0].is_nil()) {
+		double seconds = get_double(args[0]);
+		timeout_ms = seconds <= 0 ? 0 : static_cast<int>(std::min(std::ceil(seconds * 1000), 2147483647.0));
+	}
+	luax_reactor_poll(timeout_ms);
+	out.assign({static_cast<long long>(luax_reactor_pending())});
+}
+
+// io.run(f, ...): starts each function in a coroutine, then polls until no coroutine is parked
+void io_run(const LuaValue* args, size_t n_args, LuaValueVector& out) {
+	LuaValueVector res;
+	for (size_t i = 0; i < n_args; ++i) {
+		coroutine_create(args + i, 1, res);
+		LuaValue co = res[0];
+		res.clear();
+		coroutine_resume(&co, 1, res);
+		if (!res.empty() && res[0].index() == INDEX_BOOLEAN && !res[0].get<bool>()) {
+			throw std::runtime_error(res.size() > 1 ? to_cpp_string(res[1]) : "unknown error");
+		}
+		res.clear();
+	}
+	while (luax_reactor_pending() > 0) luax_reactor_poll(-1);
+	out.clear();
+}
+
 void io_tmpfile(const LuaValue* args, size_t n_args, LuaValueVector& out) {
 	FILE* f = std::tmpfile();
 	if (!f) {
@@ -483,6 +989,19 @@ void io_read(const LuaValue* args, size_t n_args, LuaValueVector& out) {
 }
 
 void io_write(const LuaValue* args, size_t n_args, LuaValueVector& out) {
+	// A LuaFile is written directly, without building an argument vector for its method
+	if (auto* f = dynamic_cast<LuaFile*>(current_output_file)) [[likely]] {
+		if (f->is_closed) {
+			out.assign({LuaValue(), LuaValue(std::string_view("attempt to use a closed file"))});
+		}
+		else if (n_args > 0 && !f->write_values(args, n_args)) {
+			out.assign({LuaValue(), LuaValue(std::string_view("write failed"))});
+		}
+		else {
+			out.assign({current_output_file});
+		}
+		return;
+	}
 	auto write_func_val = current_output_file->get("write");
 	switch (write_func_val.index()) {
 		case INDEX_FUNCTION: {
@@ -499,6 +1018,22 @@ void io_write(const LuaValue* args, size_t n_args, LuaValueVector& out) {
 	out.assign({LuaValue(), LuaValue(std::string_view("output file is not writable"))});
 }
 
+void luax_print(const LuaValue* args, size_t n_args, const LuaValue* rest, size_t n_rest) {
+	if (io_stdout_handle->is_closed) [[unlikely]] return;
+	io_stdout_handle->write_values(args, n_args, true, rest, n_rest);
+}
+
+void print_value(const LuaValue& value) {
+	if (io_stdout_handle->is_closed) [[unlikely]] return;
+	io_stdout_handle->write_values(&value, 1);
+}
+
+void luax_flush_output() {
+	for (LuaFile* f : {io_stdout_handle, io_stderr_handle}) {
+		if (f && !f->is_closed) f->flush_buffer();
+	}
+}
+
 void io_flush(const LuaValue* args, size_t n_args, LuaValueVector& out) {
 	auto flush_func_val = current_output_file->get("flush");
 	switch (flush_func_val.index()) {
@@ -534,7 +1069,8 @@ void io_lines(const LuaValue* args, size_t n_args, LuaValueVector& out) {
 		}
 	}
 	else {
-		// io.lines(filename) -> open file and iterate
+		// io.lines(filename) -> open file and iterate. Reads go through stdio: a mapping would fault
+		// (SIGBUS) if the file is truncated while it is read, as log rotation with copytruncate does.
 		LuaValue open_args[] = {filename_val, LuaValue(std::string_view("r"))};
 		LuaValueVector open_res;
 		io_open(open_args, 2, open_res);
@@ -555,10 +1091,10 @@ void io_lines(const LuaValue* args, size_t n_args, LuaValueVector& out) {
 					if (!iter_res.empty() && iter_res[0].index() == INDEX_FUNCTION) {
 						auto original_iter = iter_res[0].get<LuaCallable*>();
 
-						// Wrap the iterator to close the file on nil
+						// Wrap the iterator to close the file on nil; the wrapper holds references to both
 						auto iter_wrapper = make_lua_callable(
-							[original_iter, file_obj](const LuaValue* w_args, size_t w_n_args,
-													  LuaValueVector& w_out) {
+							[original_iter, file_obj, iter_ref = iter_res[0], file_ref = open_res[0]](
+								const LuaValue* w_args, size_t w_n_args, LuaValueVector& w_out) {
 								// Call original iterator
 								original_iter->call(w_args, w_n_args, w_out);
 
@@ -604,18 +1140,35 @@ LuaObject* create_io_library() {
 			{LuaValue(std::string_view("lines")), make_file_method(&LuaFile::lines)}
 		});
 		file_metatable->set("__index", file_metatable);
+		file_metatable->retain(); // referenced from the static pointer
 	}
 
 	// Set up standard file handles
 	io_stdin_handle = new LuaFile(stdin, false);
+	io_stdin_handle->retain();
 	io_stdin_handle->set_metatable(file_metatable);
 
 	io_stdout_handle = new LuaFile(stdout, false);
+	io_stdout_handle->retain();
 	io_stdout_handle->set_metatable(file_metatable);
 
 	io_stderr_handle = new LuaFile(stderr, false);
+	io_stderr_handle->retain();
 	io_stderr_handle->set_metatable(file_metatable);
 
+	// Same defaults as C stdio: stdout is line buffered on a terminal, stderr is unbuffered
+#ifndef _WIN32
+	if (isatty(fileno(stdout))) io_stdout_handle->write_mode = _IOLBF;
+#endif
+	io_stderr_handle->write_mode = _IONBF;
+	std::atexit(luax_flush_output);
+	// An uncaught error still shows the output written before it
+	static std::terminate_handler previous_terminate = std::set_terminate([] {
+		luax_flush_output();
+		if (previous_terminate) previous_terminate();
+		std::abort();
+	});
+
 	current_input_file = static_cast<LuaObject*>(io_stdin_handle);
 	current_output_file = static_cast<LuaObject*>(io_stdout_handle);
 
@@ -626,8 +1179,10 @@ LuaObject* create_io_library() {
 	io_lib->set("lines", LUA_C_FUNC(io_lines));
 	io_lib->set("open", LUA_C_FUNC(io_open));
 	io_lib->set("output", LUA_C_FUNC(io_output));
+	io_lib->set("poll", LUA_C_FUNC(io_poll));
 	io_lib->set("popen", LUA_C_FUNC(io_popen));
 	io_lib->set("read", LUA_C_FUNC(io_read));
+	io_lib->set("run", LUA_C_FUNC(io_run));
 	io_lib->set("tmpfile", LUA_C_FUNC(io_tmpfile));
 	io_lib->set("type", LUA_C_FUNC(io_type));
 	io_lib->set("write", LUA_C_FUNC(io_write));
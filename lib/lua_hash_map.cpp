@@ -0,0 +1,216 @@
+#include "lua_object.hpp"
+#include <new>
+#include <cstring>
+#include <bit>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+// Bit i set when control byte i of the group equals b
+inline uint32_t group_match(const int8_t* group, int8_t b) {
+#if defined(__SSE2__)
+	__m128i ctrl = _mm_load_si128(reinterpret_cast<const __m128i*>(group));
+	return static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(b), ctrl)));
+#else
+	uint32_t mask = 0;
+	for (int i = 0; i < 16; ++i) mask |= static_cast<uint32_t>(group[i] == b) << i;
+	return mask;
+#endif
+}
+
+} // namespace
+
+uint64_t LuaHashMap::canonical_raw(const LuaValue& key) {
+	uint64_t raw = key.raw_data();
+	if (raw < NAN_MASK) {
+		double d = key.get<double>();
+		if (d >= -140737488355328.0 && d < 140737488355328.0) { // int48 range of TAG_INTEGER
+			long long l = static_cast<long long>(d);
+			if (static_cast<double>(l) == d) return TAG_INTEGER | (static_cast<uint64_t>(l) & PAYLOAD_MASK);
+		}
+		return raw;
+	}
+	if (is_counted_string(raw)) [[unlikely]] return canonical_raw(key.get<std::string_view>());
+	return raw;
+}
+
+uint64_t LuaHashMap::canonical_raw(std::string_view key) {
+	return LuaValue(key).raw_data();
+}
+
+LuaHashMap::~LuaHashMap() {
+	clear();
+	if (ctrl) {
+		LuaObjectPool::deallocate(ctrl, capacity * (1 + sizeof(Slot)));
+		luax_table_stats.hash_bytes -= static_cast<std::ptrdiff_t>(capacity * (1 + sizeof(Slot)));
+	}
+}
+
+size_t LuaHashMap::find_index(uint64_t raw) const {
+	if (capacity == 0) return capacity;
+	size_t h = mix(raw);
+	int8_t h2 = static_cast<int8_t>(h & 0x7F);
+	size_t group_mask = capacity / GROUP - 1;
+	size_t g = (h >> 7) & group_mask;
+
+	// Triangular probing over groups visits every group once
+	for (size_t step = 1;; ++step) {
+		const int8_t* group = ctrl + g * GROUP;
+		for (uint32_t m = group_match(group, h2); m; m &= m - 1) {
+			size_t i = g * GROUP + std::countr_zero(m);
+			if (slots[i].first.raw_data() == raw) return i;
+		}
+		if (group_match(group, CTRL_EMPTY)) return capacity;
+		if (step > group_mask) return capacity;
+		g = (g + step) & group_mask;
+	}
+}
+
+// Same probe sequence, also comparing the bits a removed key left in a tombstone or empty slot.
+// A key has at most one slot, live or dead.
+size_t LuaHashMap::find_dead_index(uint64_t raw) const {
+	if (capacity == 0) return capacity;
+	size_t h = mix(raw);
+	int8_t h2 = static_cast<int8_t>(h & 0x7F);
+	size_t group_mask = capacity / GROUP - 1;
+	size_t g = (h >> 7) & group_mask;
+
+	for (size_t step = 1;; ++step) {
+		const int8_t* group = ctrl + g * GROUP;
+		uint32_t empty = group_match(group, CTRL_EMPTY);
+		for (uint32_t m = group_match(group, h2) | group_match(group, CTRL_DELETED) | empty; m; m &= m - 1) {
+			size_t i = g * GROUP + std::countr_zero(m);
+			if (slots[i].first.raw_data() == raw) return i;
+		}
+		if (empty) return capacity;
+		if (step > group_mask) return capacity;
+		g = (g + step) & group_mask;
+	}
+}
+
+// First empty slot on the probe sequence of h; marks it occupied
+size_t LuaHashMap::insert_index(size_t h) {
+	size_t group_mask = capacity / GROUP - 1;
+	size_t g = (h >> 7) & group_mask;
+	for (size_t step = 1;; ++step) {
+		uint32_t m = group_match(ctrl + g * GROUP, CTRL_EMPTY);
+		if (m) {
+			size_t i = g * GROUP + std::countr_zero(m);
+			ctrl[i] = static_cast<int8_t>(h & 0x7F);
+			++used;
+			return i;
+		}
+		g = (g + step) & group_mask;
+	}
+}
+
+// New slot for a key that is not in the map; the caller stores a non-nil value.
+// A slot that still remembers the same key is revived, so next() never sees two slots for one key.
+size_t LuaHashMap::insert(const LuaValue& key, uint64_t raw) {
+	// Keep at most 7/8 of the slots occupied so every probe sequence ends at an empty slot.
+	// The rehash is sized by the live entries, so it also drops the tombstones.
+	bool full = (used + 1) * 8 > capacity * 7;
+	size_t i = erased ? find_dead_index(raw) : capacity;
+	if (i != capacity && (ctrl[i] == CTRL_DELETED || !full)) {
+		if (ctrl[i] == CTRL_EMPTY) ++used;
+		ctrl[i] = static_cast<int8_t>(mix(raw) & 0x7F);
+	} else {
+		if (full) rehash(std::max<size_t>(GROUP, std::bit_ceil((live + 1) * 2)));
+		i = insert_index(mix(raw));
+	}
+	// Canonical strings and numbers are not counted; anything else is the key itself
+	::new (&slots[i]) Slot{raw == key.raw_data() ? key : LuaValue::from_raw(raw), LuaValue()};
+	++live;
+	return i;
+}
+
+void LuaHashMap::set(const LuaValue& key, const LuaValue& value) {
+	if (value.is_nil()) {
+		erase(key);
+		return;
+	}
+	uint64_t raw = canonical_raw(key);
+	size_t i = find_index(raw);
+	if (i == capacity) i = insert(key, raw);
+	slots[i].second = value;
+}
+
+std::pair<LuaHashMap::iterator, bool> LuaHashMap::emplace(const LuaValue& key, const LuaValue& value) {
+	uint64_t raw = canonical_raw(key);
+	size_t i = find_index(raw);
+	if (i != capacity || value.is_nil()) return {iterator(this, i), false};
+	i = insert(key, raw);
+	slots[i].second = value;
+	return {iterator(this, i), true};
+}
+
+size_t LuaHashMap::erase(const LuaValue& key) {
+	uint64_t raw = canonical_raw(key);
+	size_t i = find_index(raw);
+	if (i == capacity) return 0;
+	// A group with an empty byte never ended a probe sequence, so the slot can be empty again.
+	// The slot keeps the key's bits only for comparison; the key itself is released here.
+	if (group_match(ctrl + i / GROUP * GROUP, CTRL_EMPTY)) {
+		ctrl[i] = CTRL_EMPTY;
+		--used;
+	} else {
+		ctrl[i] = CTRL_DELETED;
+	}
+	++erased;
+	slots[i].~Slot();
+	::new (&slots[i].first) LuaValue(LuaValue::from_raw(raw)); // never destroyed
+	--live;
+	return 1;
+}
+
+void LuaHashMap::reserve(size_t n) {
+	size_t needed = std::max<size_t>(GROUP, std::bit_ceil(n + n / 7 + 1));
+	if (needed > capacity) rehash(needed);
+}
+
+void LuaHashMap::rehash(size_t new_capacity) {
+	int8_t* old_ctrl = ctrl;
+	Slot* old_slots = slots;
+	size_t old_capacity = capacity;
+
+	void* mem = LuaObjectPool::allocate(new_capacity * (1 + sizeof(Slot)));
+	luax_table_stats.hash_bytes += static_cast<std::ptrdiff_t>((new_capacity - old_capacity) * (1 + sizeof(Slot)));
+	ctrl = static_cast<int8_t*>(mem);
+	slots = reinterpret_cast<Slot*>(ctrl + new_capacity);
+	std::memset(ctrl, CTRL_EMPTY, new_capacity);
+	std::memset(static_cast<void*>(slots), 0, new_capacity * sizeof(Slot)); // zero bits match no key
+	capacity = new_capacity;
+	used = 0;
+	erased = 0;
+
+	// Live entries move over in slot order; tombstones are dropped here
+	for (size_t i = 0; i < old_capacity; ++i) {
+		if (old_ctrl[i] < 0) continue;
+		Slot& s = old_slots[i];
+		size_t j = insert_index(mix(s.first.raw_data()));
+		::new (&slots[j]) Slot{std::move(s.first), std::move(s.second)};
+		s.~Slot();
+	}
+	if (old_ctrl) LuaObjectPool::deallocate(old_ctrl, old_capacity * (1 + sizeof(Slot)));
+}
+
+void LuaHashMap::clear() {
+	for (size_t i = 0; i < capacity; ++i) {
+		if (ctrl[i] >= 0) slots[i].~Slot();
+		ctrl[i] = CTRL_EMPTY;
+	}
+	if (capacity) std::memset(static_cast<void*>(slots), 0, capacity * sizeof(Slot));
+	used = 0;
+	live = 0;
+	erased = 0;
+}
+
+size_t LuaHashMap::next_live(size_t from) const {
+	for (size_t i = from; i < capacity; ++i) {
+		if (ctrl[i] >= 0) return i;
+	}
+	return capacity;
+}
@@ -1,4 +1,5 @@
 #include "lua_object.hpp"
+#include <array>
 #include <iostream>
 #include <cmath>
 #include <sstream>
@@ -7,9 +8,14 @@
 #include <iomanip>
 #include <limits>
 #include <charconv>
+#include <cstring>
+#include <cstdlib>
 #include <deque>
 #include "coroutine.hpp" // Ensure full definition of LuaCoroutine is available
 #include <unordered_set>
+#include <shared_mutex>
+#include <mutex>
+#include <atomic>
 
 const std::string* intern_string_ptr(std::string_view sv);
 
@@ -21,15 +27,91 @@ LuaValue::LuaValue(LuaObject* obj) : data(TAG_OBJECT | (reinterpret_cast<uint64_
 LuaValue::LuaValue(LuaCallable* func) : data(TAG_FUNCTION | (reinterpret_cast<uint64_t>(func) & PAYLOAD_MASK)) { retain(); }
 LuaValue::LuaValue(LuaCoroutine* coro) : data(TAG_CORO | (reinterpret_cast<uint64_t>(coro) & PAYLOAD_MASK)) { retain(); }
 
+static inline uint64_t inline_string_raw(std::string_view sv) {
+    uint64_t chars = 0;
+    std::memcpy(&chars, sv.data(), sv.size());
+    return TAG_STRING | STRING_INLINE_BIT | (static_cast<uint64_t>(sv.size()) << 40) | chars;
+}
+
+static inline LuaValue adopt_string(LuaString* ls) {
+    ls->retain();
+    return LuaValue::from_raw(TAG_STRING | reinterpret_cast<uint64_t>(ls));
+}
+
 LuaValue::LuaValue(const std::string& s) {
-    auto* ls = new LuaString(s);
+    if (s.size() <= STRING_INLINE_MAX) {
+        data = inline_string_raw(s);
+        return;
+    }
+    auto* ls = LuaString::create(s);
     data = TAG_STRING | (reinterpret_cast<uint64_t>(ls) & PAYLOAD_MASK);
     ls->retain();
 }
 
+LuaValue lua_make_string(std::string_view s) {
+    if (s.size() <= STRING_INLINE_MAX) return LuaValue::from_raw(inline_string_raw(s));
+    return adopt_string(LuaString::create(s));
+}
+
+LuaValue lua_adopt_string(LuaString* s) {
+    return adopt_string(s);
+}
+
 LuaValue::LuaValue(std::string_view sv) {
+    if (sv.size() <= STRING_INLINE_MAX) {
+        data = inline_string_raw(sv);
+        return;
+    }
     const std::string* pooled = intern_string_ptr(sv);
-    data = TAG_STRING | (reinterpret_cast<uint64_t>(pooled) | 1ULL);
+    data = TAG_STRING | (reinterpret_cast<uint64_t>(pooled) | STRING_INTERNED_BIT);
+}
+
+// Canonical raw form of a string key: inline when short, otherwise the interned pointer
+static inline uint64_t canonical_string_raw(std::string_view sv) {
+    if (sv.size() <= STRING_INLINE_MAX) return inline_string_raw(sv);
+    return TAG_STRING | (reinterpret_cast<uint64_t>(intern_string_ptr(sv)) | STRING_INTERNED_BIT);
+}
+
+// ==========================================
+// LuaString
+// ==========================================
+
+LuaString* LuaString::create(std::string_view s, size_t cap) {
+    cap = std::max(cap, s.size());
+    void* mem = LuaObjectPool::allocate(alloc_size(cap));
+    auto* ls = ::new (mem) LuaString(s.size(), cap);
+    std::memcpy(ls->chars(), s.data(), s.size());
+    ls->chars()[s.size()] = '\0';
+    return ls;
+}
+
+LuaString* LuaString::append(std::string_view tail) {
+    size_t new_len = len + tail.size();
+    if (new_len <= capacity) {
+        std::memcpy(chars() + len, tail.data(), tail.size());
+        chars()[new_len] = '\0';
+        len = new_len;
+        hash = 0;
+        ascii = ASCII_UNKNOWN;
+        return this;
+    }
+    // Grow geometrically so repeated s = s .. x stays linear
+    LuaString* grown = create(view(), std::max(new_len, capacity * 2));
+    return grown->append(tail);
+}
+
+LuaString* LuaString::prepend(std::string_view head) {
+    size_t new_len = len + head.size();
+    if (new_len <= capacity) {
+        std::memmove(chars() + head.size(), chars(), len + 1);
+        std::memcpy(chars(), head.data(), head.size());
+        len = new_len;
+        hash = 0;
+        ascii = ASCII_UNKNOWN;
+        return this;
+    }
+    LuaString* grown = create(head, std::max(new_len, capacity * 2));
+    return grown->append(view());
 }
 
 size_t LuaValueHash::operator()(const LuaValue& v) const {
@@ -39,7 +121,9 @@ size_t LuaValueHash::operator()(const LuaValue& v) const {
         case INDEX_BOOLEAN: return std::hash<bool>{}(v.get<bool>());
         case INDEX_DOUBLE: 
         case INDEX_INTEGER: return std::hash<double>{}(v.get<double>());
-        case INDEX_STRING: return std::hash<std::string_view>{}(v.get<std::string_view>());
+        case INDEX_STRING:
+            if (is_counted_string(v.raw_data())) return reinterpret_cast<const LuaString*>(v.raw_data() & PAYLOAD_MASK)->get_hash();
+            return std::hash<std::string_view>{}(v.get<std::string_view>());
         case INDEX_OBJECT: return std::hash<void*>{}(v.get<LuaObject*>());
         case INDEX_FUNCTION: return std::hash<void*>{}(v.get<LuaCallable*>());
         case INDEX_COROUTINE: return std::hash<void*>{}(v.get<LuaCoroutine*>());
@@ -70,52 +154,138 @@ struct TransparentStringEq {
 	bool operator()(std::string_view lhs, std::string_view rhs) const { return lhs == rhs; }
 };
 
-static std::unordered_set<std::string, TransparentStringHash, TransparentStringEq>& get_string_pool() {
-	static std::unordered_set<std::string, TransparentStringHash, TransparentStringEq> pool;
-	return pool;
+// Interned strings are never freed, so their addresses can be stored uncounted in values.
+// The pool is split into shards with their own reader/writer lock; lookups are served from a
+// per-thread direct-mapped cache first, which grows while its miss rate stays high.
+namespace {
+
+constexpr size_t INTERN_SHARD_BITS = 6;
+constexpr size_t INTERN_SHARDS = 1 << INTERN_SHARD_BITS;
+
+struct alignas(64) InternShard {
+	std::shared_mutex mtx;
+	std::unordered_set<std::string, TransparentStringHash, TransparentStringEq> set;
+	size_t bytes = 0;
+};
+
+InternShard* get_intern_shards() {
+	static InternShard shards[INTERN_SHARDS];
+	return shards;
 }
 
-#include <mutex>
+std::atomic<uint64_t> intern_hits{0};
+std::atomic<uint64_t> intern_misses{0};
+std::atomic<uint64_t> intern_evictions{0};
+std::atomic<uint64_t> intern_inserts{0};
 
-static std::mutex& get_string_pool_mutex() {
-	static std::mutex mtx;
-	return mtx;
+const std::string* intern_lookup(std::string_view sv, size_t h) {
+	InternShard& shard = get_intern_shards()[h >> (64 - INTERN_SHARD_BITS)];
+	{
+		std::shared_lock lock(shard.mtx);
+		auto it = shard.set.find(sv);
+		if (it != shard.set.end()) return &(*it);
+	}
+	std::unique_lock lock(shard.mtx);
+	auto [it, inserted] = shard.set.emplace(sv);
+	if (inserted) {
+		shard.bytes += sv.size();
+		intern_inserts.fetch_add(1, std::memory_order_relaxed);
+	}
+	return &(*it);
 }
 
+struct InternCache {
+	static constexpr size_t MIN_SIZE = 256;
+	static constexpr size_t MAX_SIZE = 8192;
+	static constexpr uint32_t WINDOW = 4096;
+
+	struct Entry { size_t hash = 0; const std::string* val = nullptr; };
+	std::vector<Entry> entries = std::vector<Entry>(MIN_SIZE);
+	uint32_t lookups = 0;
+	uint32_t window_misses = 0;
+	uint64_t pending_hits = 0;
+
+	~InternCache() { flush(); }
+
+	void flush() {
+		if (pending_hits) intern_hits.fetch_add(pending_hits, std::memory_order_relaxed);
+		pending_hits = 0;
+	}
+
+	// Doubles the cache when more than 1/8 of a window missed (hot key set larger than the cache)
+	void adapt() {
+		if (window_misses > WINDOW / 8 && entries.size() < MAX_SIZE) {
+			std::vector<Entry> grown(entries.size() * 2);
+			for (const auto& e : entries) {
+				if (e.val) grown[e.hash & (grown.size() - 1)] = e;
+			}
+			entries.swap(grown);
+		}
+		lookups = 0;
+		window_misses = 0;
+		flush();
+	}
+};
+
+thread_local InternCache intern_cache;
+
+// Drops every interned string; only valid once no value refers to them (program exit)
+void intern_clear() {
+	auto* shards = get_intern_shards();
+	for (size_t i = 0; i < INTERN_SHARDS; ++i) {
+		std::unique_lock lock(shards[i].mtx);
+		shards[i].set.clear();
+		shards[i].bytes = 0;
+	}
+	std::fill(intern_cache.entries.begin(), intern_cache.entries.end(), InternCache::Entry{});
+}
+
+} // namespace
+
 const std::string* intern_string_ptr(std::string_view sv) {
 	if (sv.empty()) {
 		static const std::string empty;
 		return &empty;
 	}
-	
-	constexpr size_t CACHE_SIZE = 64; 
-	struct CacheEntry { std::string_view key; const std::string* val; };
-	thread_local CacheEntry cache[CACHE_SIZE] = {};
-	
+
+	auto& cache = intern_cache;
 	size_t h = std::hash<std::string_view>{}(sv);
-	size_t idx = h % CACHE_SIZE;
-	
-	if (cache[idx].key.data() == sv.data() && cache[idx].key.size() == sv.size()) [[likely]] 
-		return cache[idx].val;
-	if (cache[idx].key == sv) [[likely]] return cache[idx].val;
+	if (++cache.lookups == InternCache::WINDOW) [[unlikely]] cache.adapt();
+	auto& entry = cache.entries[h & (cache.entries.size() - 1)];
 
-	const std::string* pooled_ptr = nullptr;
-	{
-		std::lock_guard<std::mutex> lock(get_string_pool_mutex());
-		auto& pool = get_string_pool();
-		auto it = pool.find(sv);
-		if (it != pool.end()) {
-			pooled_ptr = &(*it);
-		} else {
-			auto [inserted_it, success] = pool.insert(std::string(sv));
-			pooled_ptr = &(*inserted_it);
+	if (entry.hash == h && entry.val) {
+		if (entry.val->data() == sv.data() || *entry.val == sv) [[likely]] {
+			++cache.pending_hits;
+			return entry.val;
 		}
 	}
-	
-	cache[idx] = {std::string_view(*pooled_ptr), pooled_ptr};
+
+	++cache.window_misses;
+	intern_misses.fetch_add(1, std::memory_order_relaxed);
+	if (entry.val) intern_evictions.fetch_add(1, std::memory_order_relaxed);
+	const std::string* pooled_ptr = intern_lookup(sv, h);
+	entry = {h, pooled_ptr};
 	return pooled_ptr;
 }
 
+LuaInternStats luax_intern_stats() {
+	intern_cache.flush();
+	LuaInternStats stats;
+	stats.hits = intern_hits.load(std::memory_order_relaxed);
+	stats.misses = intern_misses.load(std::memory_order_relaxed);
+	stats.inserts = intern_inserts.load(std::memory_order_relaxed);
+	stats.evictions = intern_evictions.load(std::memory_order_relaxed);
+	auto* shards = get_intern_shards();
+	for (size_t i = 0; i < INTERN_SHARDS; ++i) {
+		std::shared_lock lock(shards[i].mtx);
+		stats.entries += shards[i].set.size();
+		stats.bytes += shards[i].bytes;
+	}
+	stats.shards = INTERN_SHARDS;
+	stats.cache_size = intern_cache.entries.size();
+	return stats;
+}
+
 // Updated function in lua_object.cpp
 std::string_view LuaObject::intern(std::string_view sv) {
 	const std::string* ptr = intern_string_ptr(sv);
@@ -174,13 +344,17 @@ LuaObject* LuaObject::create(
 	auto* obj = new LuaObject();
 	if (props.size() > SMALL_TABLE_THRESHOLD) {
 		obj->properties = std::make_unique<PropMap>();
-		for (const auto& p : props) (*obj->properties)[intern_key(p.first)] = p.second;
+		for (const auto& p : props) obj->properties->set(intern_key(p.first), p.second);
+		obj->shape = LuaShape::uncached();
 	} else {
 		obj->small_props.reserve(props.size());
-		for (const auto& p : props) obj->small_props.push_back({intern_key(p.first), p.second});
+		for (const auto& p : props) {
+			obj->small_props.push_back({intern_key(p.first), p.second});
+			obj->shape = obj->shape->add(obj->small_props.back().first.raw_data());
+		}
 	}
 	obj->array_part.assign(arr.begin(), arr.end());
-	obj->metatable = mt;
+	if (mt) obj->set_metatable(mt);
 	return obj;
 }
 
@@ -193,8 +367,92 @@ void LuaObject::set(std::string_view key, const LuaValue& value) {
 }
 
 void LuaObject::set_metatable(LuaObject* mt) {
+	if (mt) {
+		mt->retain();
+		// Built here rather than on first use, while the class is usually still private to one thread
+		mt->metamethods();
+	}
+	if (metatable) metatable->release();
 	metatable = mt;
-	invalidate_metamethods();
+}
+
+static const char* const LUA_METAMETHOD_NAMES[TM_COUNT] = {
+	"__index", "__newindex", "__call", "__len", "__eq", "__lt", "__le", "__concat",
+	"__add", "__sub", "__mul", "__div", "__mod", "__pow", "__unm", "__idiv",
+	"__band", "__bor", "__bxor", "__shl", "__shr", "__bnot",
+	"__tostring", "__pairs", "__ipairs", "__close", "__gc", "__mode", "__name", "__metatable",
+};
+
+void LuaObject::build_meta_cache() {
+	static const auto keys = [] {
+		std::array<uint64_t, TM_COUNT> k{};
+		for (int m = 0; m < TM_COUNT; ++m) k[m] = canonical_string_raw(LUA_METAMETHOD_NAMES[m]);
+		return k;
+	}();
+
+	if (!meta_cache) meta_cache = std::make_unique<LuaMetaCache>();
+	LuaMetaCache& c = *meta_cache;
+	c.version = props_version;
+	c.present = 0;
+	for (int m = 0; m < TM_COUNT; ++m) {
+		const LuaValue* v = find_prop(LuaValue::from_raw(keys[m]));
+		c.slots[m] = v;
+		if (v && !v->is_nil()) c.present |= 1u << m;
+	}
+}
+
+void LuaObject::reshape() {
+	if (properties) {
+		shape = LuaShape::uncached();
+		return;
+	}
+	shape = LuaShape::empty();
+	for (const auto& p : small_props) shape = shape->add(p.first.raw_data());
+}
+
+LuaValue LuaObject::get_field_miss(const LuaValue& key, LuaFieldCache& ic) {
+	uint64_t raw = key.raw_data();
+	if (shape->cacheable()) {
+		bool own = false;
+		for (size_t i = 0; i < small_props.size(); ++i) {
+			if (small_props[i].first.raw_data() != raw) continue;
+			const LuaValue& v = small_props[i].second;
+			own = true;
+			if (v.is_nil()) break;
+			ic = {shape, nullptr, nullptr, static_cast<uint32_t>(i)};
+			return v;
+		}
+
+		// Not an own field: remember where __index found it, one level deep
+		const LuaValue* index_meta = (!own && metatable) ? metatable->find_metamethod(TM_INDEX) : nullptr;
+		if (index_meta) {
+			if (index_meta->index() == INDEX_OBJECT) {
+				LuaObject* holder = index_meta->get<LuaObject*>();
+				if (holder->shape->cacheable()) {
+					for (size_t i = 0; i < holder->small_props.size(); ++i) {
+						if (holder->small_props[i].first.raw_data() != raw) continue;
+						const LuaValue& v = holder->small_props[i].second;
+						if (v.is_nil()) break;
+						ic = {shape, holder, holder->shape, static_cast<uint32_t>(i)};
+						return v;
+					}
+				}
+			}
+		}
+	}
+	return get_item(key);
+}
+
+void LuaObject::set_field_miss(const LuaValue& key, const LuaValue& value, LuaFieldCache& ic) {
+	set(key, value);
+	if (value.is_nil() || !shape->cacheable()) return;
+	uint64_t raw = key.raw_data();
+	for (size_t i = 0; i < small_props.size(); ++i) {
+		if (small_props[i].first.raw_data() == raw) {
+			ic = {shape, nullptr, nullptr, static_cast<uint32_t>(i)};
+			return;
+		}
+	}
 }
 
 LuaValue LuaObject::get_item_internal(const LuaValue& key, int depth) {
@@ -217,8 +475,9 @@ LuaValue LuaObject::get_item_internal(const LuaValue& key, int depth) {
 	// If no metatable exists, we can stop immediately without checking atomics
 	if (!metatable) return LuaValue();
 
-	auto [idx_meta, _] = get_cached_metamethods();
-	if (idx_meta->index() == INDEX_NIL) return LuaValue();
+	const LuaValue* idx_meta = metatable->find_metamethod(TM_INDEX);
+	if (!idx_meta) return LuaValue();
+	LUAX_PROFILE_COUNT(LUA_PROFILE_METAMETHOD_FALLBACK);
 
 	switch (idx_meta->index()) {
 		case INDEX_OBJECT: {
@@ -226,7 +485,9 @@ LuaValue LuaObject::get_item_internal(const LuaValue& key, int depth) {
 			return next_obj->get_item_internal(key, depth + 1);
 		}
 		case INDEX_FUNCTION: {
-			auto* func = idx_meta->get<LuaCallable*>();
+			// Held for the call, which may replace the metatable's __index
+			LuaValue handler = *idx_meta;
+			auto* func = handler.get<LuaCallable*>();
 			LuaValue args[] = {this, key};
 			LuaValueVector results;
 			func->call(args, 2, results);
@@ -277,8 +538,8 @@ void LuaObject::set_item(const LuaValue& key, const LuaValue& value) {
 
 	// 3. Metatable
 	if (!key_exists) { // Only check metatable if key doesn't exist in current object
-		auto [_, next_meta] = get_cached_metamethods();
-		if (next_meta->index() != INDEX_NIL) {
+		const LuaValue* next_meta = metatable ? metatable->find_metamethod(TM_NEWINDEX) : nullptr;
+		if (next_meta) {
 		switch (next_meta->index()) {
 			case INDEX_OBJECT: {
 				auto* next_obj = next_meta->get<LuaObject*>();
@@ -286,7 +547,8 @@ void LuaObject::set_item(const LuaValue& key, const LuaValue& value) {
 				return;
 			}
 			case INDEX_FUNCTION: {
-				auto* func = next_meta->get<LuaCallable*>();
+				LuaValue handler = *next_meta;
+				auto* func = handler.get<LuaCallable*>();
 				LuaValue args[] = {this, key, value};
 				LuaValueVector results;
 				results.clear();
@@ -307,8 +569,8 @@ void LuaObject::set_item(std::string_view key, const LuaValue& value) {
 	bool key_exists = find_prop(key) != nullptr;
 
 	if (!key_exists) {
-		auto [_, next_meta] = get_cached_metamethods();
-		if (next_meta->index() != INDEX_NIL) {
+		const LuaValue* next_meta = metatable ? metatable->find_metamethod(TM_NEWINDEX) : nullptr;
+		if (next_meta) {
 		switch (next_meta->index()) {
 			case INDEX_OBJECT: {
 				auto* next_obj = next_meta->get<LuaObject*>();
@@ -316,7 +578,8 @@ void LuaObject::set_item(std::string_view key, const LuaValue& value) {
 				return;
 			}
 			case INDEX_FUNCTION: {
-				auto* func = next_meta->get<LuaCallable*>();
+				LuaValue handler = *next_meta;
+				auto* func = handler.get<LuaCallable*>();
 				LuaValue key_val = key; 
 				LuaValue args[] = {this, key_val, value};
 				LuaValueVector results;
@@ -363,7 +626,7 @@ void LuaObject::set_item(long long idx, const LuaValue& value) {
 	}
 
 	if (!found && metatable) {
-		LuaValue ni_meta = metatable->get_prop("__newindex");
+		LuaValue ni_meta = metatable->get_metamethod(TM_NEWINDEX);
 		switch (ni_meta.index()) {
 			case INDEX_OBJECT: {
 				auto* obj = ni_meta.get<LuaObject*>();
@@ -383,17 +646,19 @@ void LuaObject::set_item(long long idx, const LuaValue& value) {
 		}
 	}
 
+	++props_version;
 	if (properties) {
 		if (value.index() == INDEX_NIL) {
 			properties->erase(key);
 		} else {
-			(*properties)[key] = value;
+			properties->set(key, value);
 		}
 	} else {
 		for (auto it = small_props.begin(); it != small_props.end(); ++it) {
 			if (it->first.index() == INDEX_INTEGER && it->first.get<long long>() == idx) {
 				if (value.index() == INDEX_NIL) {
 					small_props.erase(it);
+					reshape();
 				} else {
 					it->second = value;
 				}
@@ -403,11 +668,13 @@ void LuaObject::set_item(long long idx, const LuaValue& value) {
 		if (value.index() != INDEX_NIL) {
 			if (small_props.size() >= SMALL_TABLE_THRESHOLD) {
 				properties = std::make_unique<LuaObject::PropMap>();
-				for (auto& p : small_props) (*properties)[p.first] = p.second;
+				for (auto& p : small_props) properties->set(p.first, p.second);
 				small_props.clear();
-				(*properties)[key] = value;
+				properties->set(key, value);
+				shape = LuaShape::uncached();
 			} else {
 				small_props.push_back({key, value});
+				shape = shape->add(key.raw_data());
 			}
 		}
 	}
@@ -421,9 +688,8 @@ LuaValue LuaObject::get_prop(const LuaValue& key) {
 		size_t key_idx = key.index();
 		if (key_idx == INDEX_STRING || key_idx == INDEX_STRING_VIEW) {
 			uint64_t target_raw = key.raw_data();
-			if (key_idx == INDEX_STRING_VIEW || (target_raw & 1ULL) == 0) {
-				const std::string* pooled_ptr = intern_string_ptr(key.get<std::string_view>());
-				target_raw = TAG_STRING | (reinterpret_cast<uint64_t>(pooled_ptr) | 1ULL);
+			if (key_idx == INDEX_STRING_VIEW || is_counted_string(target_raw)) {
+				target_raw = canonical_string_raw(key.get<std::string_view>());
 			}
 			for (auto& p : small_props) {
 				if (p.first.raw_data() == target_raw) return p.second;
@@ -438,15 +704,14 @@ LuaValue LuaObject::get_prop(const LuaValue& key) {
 }
 
 LuaValue LuaObject::get_prop(std::string_view key) {
-	const std::string* pooled_ptr = intern_string_ptr(key);
-	uint64_t target_raw = TAG_STRING | (reinterpret_cast<uint64_t>(pooled_ptr) | 1ULL);
+	uint64_t target_raw = canonical_string_raw(key);
 
 	for (auto& p : small_props) {
 		if (p.first.raw_data() == target_raw) return p.second;
 	}
 
 	if (properties) {
-		auto it = properties->find(std::string_view(*pooled_ptr));
+		auto it = properties->find(LuaValue::from_raw(target_raw));
 		if (it != properties->end()) return it->second;
 	}
 	return LuaValue();
@@ -462,9 +727,8 @@ LuaValue* LuaObject::find_prop(const LuaValue& key) {
 	size_t key_idx = key.index();
 	if (key_idx == INDEX_STRING || key_idx == INDEX_STRING_VIEW) {
 		uint64_t target_raw = key.raw_data();
-		if (key_idx == INDEX_STRING_VIEW || (target_raw & 1ULL) == 0) {
-			const std::string* pooled_ptr = intern_string_ptr(key.get<std::string_view>());
-			target_raw = TAG_STRING | (reinterpret_cast<uint64_t>(pooled_ptr) | 1ULL);
+		if (key_idx == INDEX_STRING_VIEW || is_counted_string(target_raw)) {
+			target_raw = canonical_string_raw(key.get<std::string_view>());
 		}
 		for (auto& p : small_props) {
 			if (p.first.raw_data() == target_raw) return &p.second;
@@ -479,15 +743,14 @@ LuaValue* LuaObject::find_prop(const LuaValue& key) {
 }
 
 LuaValue* LuaObject::find_prop(std::string_view key) {
-	const std::string* pooled_ptr = intern_string_ptr(key);
-	uint64_t target_raw = TAG_STRING | (reinterpret_cast<uint64_t>(pooled_ptr) | 1ULL);
+	uint64_t target_raw = canonical_string_raw(key);
 
 	for (auto& p : small_props) {
 		if (p.first.raw_data() == target_raw) return &p.second;
 	}
 
 	if (properties) [[unlikely]] {
-		auto it = properties->find(std::string_view(*pooled_ptr)); 
+		auto it = properties->find(LuaValue::from_raw(target_raw)); 
 		if (it != properties->end()) return &it->second;
 	}
 	return nullptr;
@@ -498,18 +761,18 @@ void LuaObject::set_prop(const LuaValue& key, const LuaValue& value) {
 	size_t key_idx = key.index();
 	uint64_t target_raw = key.raw_data();
 	if (key_idx == INDEX_STRING || key_idx == INDEX_STRING_VIEW) {
-		if (key_idx == INDEX_STRING_VIEW || (target_raw & 1ULL) == 0) {
-			const std::string* pooled_ptr = intern_string_ptr(key.get<std::string_view>());
-			target_raw = TAG_STRING | (reinterpret_cast<uint64_t>(pooled_ptr) | 1ULL);
+		if (key_idx == INDEX_STRING_VIEW || is_counted_string(target_raw)) {
+			target_raw = canonical_string_raw(key.get<std::string_view>());
 		}
 		interned_key = LuaValue::from_raw(target_raw);
 	}
+	++props_version;
 
 	if (properties) {
 		if (value.index() == INDEX_NIL) {
 			properties->erase(interned_key);
 		} else {
-			(*properties)[interned_key] = value;
+			properties->set(interned_key, value);
 		}
 		return;
 	}
@@ -518,6 +781,7 @@ void LuaObject::set_prop(const LuaValue& key, const LuaValue& value) {
 		if (it->first.raw_data() == target_raw) {
 			if (value.index() == INDEX_NIL) {
 				small_props.erase(it);
+				reshape();
 			} else {
 				it->second = value;
 			}
@@ -533,24 +797,24 @@ void LuaObject::set_prop(const LuaValue& key, const LuaValue& value) {
 			}
 			small_props.clear();
 			properties->emplace(std::move(interned_key), std::move(value));
+			shape = LuaShape::uncached();
 		} else {
 			small_props.push_back({interned_key, value});
+			shape = shape->add(target_raw);
 		}
 	}
 }
 
 void LuaObject::set_prop(std::string_view key, const LuaValue& value) {
-	const std::string* pooled_ptr = intern_string_ptr(key);
-	uint64_t target_raw = TAG_STRING | (reinterpret_cast<uint64_t>(pooled_ptr) | 1ULL);
+	uint64_t target_raw = canonical_string_raw(key);
 	LuaValue key_val = LuaValue::from_raw(target_raw);
+	++props_version;
 
 	if (properties) {
 		if (value.index() == INDEX_NIL) {
 			properties->erase(key_val);
 		} else {
-			auto it = properties->find(std::string_view(*pooled_ptr));
-			if (it != properties->end()) it->second = value;
-			else properties->emplace(key_val, value);
+			properties->set(key_val, value);
 		}
 		return;
 	}
@@ -559,6 +823,7 @@ void LuaObject::set_prop(std::string_view key, const LuaValue& value) {
 		if (it->first.raw_data() == target_raw) {
 			if (value.index() == INDEX_NIL) {
 				small_props.erase(it);
+				reshape();
 			} else {
 				it->second = value;
 			}
@@ -569,11 +834,13 @@ void LuaObject::set_prop(std::string_view key, const LuaValue& value) {
 	if (value.index() != INDEX_NIL) {
 		if (small_props.size() >= SMALL_TABLE_THRESHOLD) {
 			properties = std::make_unique<LuaObject::PropMap>();
-			for (auto& p : small_props) (*properties)[p.first] = p.second;
+			for (auto& p : small_props) properties->set(p.first, p.second);
 			small_props.clear();
-			(*properties)[key_val] = value;
+			properties->set(key_val, value);
+			shape = LuaShape::uncached();
 		} else {
 			small_props.push_back({key_val, value});
+			shape = shape->add(target_raw);
 		}
 	}
 }
@@ -595,6 +862,64 @@ void LuaObject::table_insert(long long pos, const LuaValue& value) {
 	}
 }
 
+void LuaObject::reserve(size_t narr, size_t nhash) {
+	if (narr > array_part.capacity()) array_part.reserve(narr);
+	if (nhash > 0) ++props_version;
+	if (nhash > SMALL_TABLE_THRESHOLD) {
+		// The table would outgrow small_props anyway, so it moves to the map now
+		if (!properties) {
+			properties = std::make_unique<LuaObject::PropMap>();
+			properties->reserve(nhash);
+			for (auto& p : small_props) properties->set(p.first, p.second);
+			small_props.clear();
+			shape = LuaShape::uncached();
+		} else {
+			properties->reserve(nhash);
+		}
+	} else if (!properties) {
+		small_props.reserve(nhash);
+	}
+}
+
+void LuaObject::copy_into_array(long long start, const LuaValue* values, size_t n) {
+	if (start == static_cast<long long>(array_part.size()) + 1) {
+		array_part.insert(array_part.end(), values, values + n);
+		// set_item never stores a trailing nil in the array part
+		while (!array_part.empty() && array_part.back().index() == INDEX_NIL) array_part.pop_back();
+		return;
+	}
+	for (size_t i = 0; i < n; ++i) set_item(start + static_cast<long long>(i), values[i]);
+}
+
+void LuaObject::move_into_array(long long start, LuaValue* values, size_t n) {
+	if (start == static_cast<long long>(array_part.size()) + 1) {
+		array_part.insert(array_part.end(), std::make_move_iterator(values), std::make_move_iterator(values + n));
+		while (!array_part.empty() && array_part.back().index() == INDEX_NIL) array_part.pop_back();
+		return;
+	}
+	for (size_t i = 0; i < n; ++i) set_item(start + static_cast<long long>(i), std::move(values[i]));
+}
+
+// Loop hints stay below 32 MB of slots, since the loop may exit early
+constexpr long long LUA_TABLE_RESERVE_HINT_MAX = 1LL << 22;
+
+void lua_table_reserve_range(const LuaValue& t, long long first, long long last) {
+	if (t.index() != INDEX_OBJECT) return;
+	auto* obj = t.get<LuaObject*>();
+	// Only a range that starts inside or right after the array part ends up in it
+	if (first < 1 || first > static_cast<long long>(obj->array_part.size()) + 1 || last < first) return;
+	obj->reserve(static_cast<size_t>(std::min(last, LUA_TABLE_RESERVE_HINT_MAX)));
+}
+
+void lua_table_reserve_append(const LuaValue& t, long long first, long long last) {
+	if (t.index() != INDEX_OBJECT || last < first) return;
+	auto* obj = t.get<LuaObject*>();
+	// Computed unsigned, since last - first can overflow
+	unsigned long long n = static_cast<unsigned long long>(last) - static_cast<unsigned long long>(first) + 1;
+	n = std::min(n, static_cast<unsigned long long>(LUA_TABLE_RESERVE_HINT_MAX));
+	obj->reserve(obj->array_part.size() + static_cast<size_t>(n));
+}
+
 void lua_table_insert(const LuaValue& t, const LuaValue& v) {
 	if (t.index() == INDEX_OBJECT) {
 		t.get<LuaObject*>()->table_insert(v);
@@ -670,10 +995,6 @@ std::string get_lua_type_name(const LuaValue& val) {
 	}
 }
 
-void print_value(const LuaValue& value) {
-	std::cout << to_cpp_string(value);
-}
-
 // ==========================================
 // Comparison Logic
 // ==========================================
@@ -718,7 +1039,7 @@ bool lua_less_than(const LuaValue& a, const LuaValue& b) {
 	if (a.index() == INDEX_OBJECT) {
 		auto t = a.get<LuaObject*>();
 		if (t->metatable) {
-			auto lt = t->metatable->get_item("__lt");
+			auto lt = t->metatable->get_metamethod(TM_LT);
 			if (lt.index() != INDEX_NIL) {
 				call_lua_value(lt, res, a, b);
 				return !res.empty() && is_lua_truthy(res[0]);
@@ -728,7 +1049,7 @@ bool lua_less_than(const LuaValue& a, const LuaValue& b) {
 	if (b.index() == INDEX_OBJECT) {
 		auto t = b.get<LuaObject*>();
 		if (t->metatable) {
-			auto lt = t->metatable->get_item("__lt");
+			auto lt = t->metatable->get_metamethod(TM_LT);
 			if (lt.index() != INDEX_NIL) {
 				call_lua_value(lt, res, a, b);
 				return !res.empty() && is_lua_truthy(res[0]);
@@ -776,7 +1097,7 @@ bool lua_less_equals(const LuaValue& a, const LuaValue& b) {
 		if (a.index() == INDEX_OBJECT) {
 			auto t = a.get<LuaObject*>();
 			if (t->metatable) {
-				auto le = t->metatable->get_item("__le");
+				auto le = t->metatable->get_metamethod(TM_LE);
 				if (le.index() != INDEX_NIL) {
 					call_lua_value(le, res, a, b);
 					return !res.empty() && is_lua_truthy(res[0]);
@@ -786,7 +1107,7 @@ bool lua_less_equals(const LuaValue& a, const LuaValue& b) {
 		if (b.index() == INDEX_OBJECT) {
 			auto t = b.get<LuaObject*>();
 			if (t->metatable) {
-				auto le = t->metatable->get_item("__le");
+				auto le = t->metatable->get_metamethod(TM_LE);
 				if (le.index() != INDEX_NIL) {
 					call_lua_value(le, res, a, b);
 					return !res.empty() && is_lua_truthy(res[0]);
@@ -809,7 +1130,7 @@ LuaValue lua_concat(const LuaValue& a, const LuaValue& b) {
 	if (a.index() == INDEX_OBJECT) {
 		auto* obj_a = a.get<LuaObject*>();
 		if (obj_a->metatable) {
-			auto concat = obj_a->metatable->get_item("__concat");
+			auto concat = obj_a->metatable->get_metamethod(TM_CONCAT);
 			if (concat.index() != INDEX_NIL) {
 				LuaValueVector res;
 				call_lua_value(concat, res, a, b);
@@ -820,7 +1141,7 @@ LuaValue lua_concat(const LuaValue& a, const LuaValue& b) {
 	if (b.index() == INDEX_OBJECT) {
 		auto* obj_b = b.get<LuaObject*>();
 		if (obj_b->metatable) {
-			auto concat = obj_b->metatable->get_item("__concat");
+			auto concat = obj_b->metatable->get_metamethod(TM_CONCAT);
 			if (concat.index() != INDEX_NIL) {
 				LuaValueVector res;
 				call_lua_value(concat, res, a, b);
@@ -836,50 +1157,69 @@ LuaValue lua_concat(const LuaValue& a, const LuaValue& b) {
 	return res;
 }
 
+// a holds the only reference to ls, so it can be extended in place
+static LuaValue append_in_place(LuaValue&& a, LuaString* ls, const LuaValue& b) {
+	size_t bi = b.index();
+	LuaString* res;
+	if (bi == INDEX_STRING || bi == INDEX_STRING_VIEW) {
+		res = ls->append(b.get<std::string_view>());
+	} else {
+		std::string tail;
+		append_to_string(b, tail);
+		res = ls->append(tail);
+	}
+	if (res == ls) return std::move(a);
+	return adopt_string(res); // a releases the old string
+}
+
 LuaValue lua_concat(LuaValue&& a, const LuaValue& b) {
-	if (a.index() == INDEX_STRING && (a.raw_data() & 1ULL) == 0) {
+	if (is_counted_string(a.raw_data())) {
 		auto* ls = reinterpret_cast<LuaString*>(a.raw_data() & PAYLOAD_MASK);
-		if (ls && ls->get_ref_count() == 1) {
-			append_to_string(b, ls->str);
-			return std::move(a);
-		}
+		if (ls->get_ref_count() == 1) return append_in_place(std::move(a), ls, b);
 	}
 	return lua_concat(static_cast<const LuaValue&>(a), b);
 }
 
 LuaValue lua_concat(const LuaValue& a, LuaValue&& b) {
-	if (b.index() == INDEX_STRING && (b.raw_data() & 1ULL) == 0) {
+	if (is_counted_string(b.raw_data())) {
 		auto* ls = reinterpret_cast<LuaString*>(b.raw_data() & PAYLOAD_MASK);
-		if (ls && ls->get_ref_count() == 1) {
+		if (ls->get_ref_count() == 1) {
 			std::string prefix;
 			append_to_string(a, prefix);
-			ls->str.insert(0, prefix);
-			return std::move(b);
+			LuaString* res = ls->prepend(prefix);
+			if (res == ls) return std::move(b);
+			return adopt_string(res);
 		}
 	}
 	return lua_concat(a, static_cast<const LuaValue&>(b));
 }
  
 LuaValue lua_concat(LuaValue&& a, LuaValue&& b) {
-	if (a.index() == INDEX_STRING && (a.raw_data() & 1ULL) == 0) {
+	if (is_counted_string(a.raw_data())) {
 		auto* ls = reinterpret_cast<LuaString*>(a.raw_data() & PAYLOAD_MASK);
-		if (ls && ls->get_ref_count() == 1) {
-			append_to_string(b, ls->str);
-			return std::move(a);
-		}
+		if (ls->get_ref_count() == 1) return append_in_place(std::move(a), ls, b);
 	}
 	return lua_concat(static_cast<const LuaValue&>(a), std::move(b));
 }
 
+// Bytes a value adds to a concatenation (an upper bound for numbers)
+static inline size_t concat_size(const LuaValue& v) {
+	size_t idx = v.index();
+	if (idx == INDEX_STRING || idx == INDEX_STRING_VIEW) return v.get<std::string_view>().size();
+	return 24;
+}
+
 LuaValue lua_concat_multiple(const LuaValue* args, size_t n_args) {
 	bool has_object = false;
+	size_t size = 0;
 	for (size_t i = 0; i < n_args; i++) {
 		if (args[i].index() == INDEX_OBJECT) { has_object = true; break; }
+		size += concat_size(args[i]);
 	}
 	
 	if (!has_object) {
 		std::string res;
-		res.reserve(n_args * 16);
+		res.reserve(size);
 		for (size_t i = 0; i < n_args; i++) {
 			append_to_string(args[i], res);
 		}
@@ -893,6 +1233,47 @@ LuaValue lua_concat_multiple(const LuaValue* args, size_t n_args) {
 	return cur;
 }
 
+LuaValue lua_concat_into(LuaValue&& acc, const LuaValue* parts, size_t n_parts) {
+	bool has_object = acc.index() == INDEX_OBJECT;
+	size_t extra = 0;
+	for (size_t i = 0; i < n_parts; i++) {
+		if (parts[i].index() == INDEX_OBJECT) has_object = true;
+		extra += concat_size(parts[i]);
+	}
+	if (has_object) {
+		// __concat is right-associative, so the in-place path does not apply
+		LuaValueVector all;
+		all.reserve(n_parts + 1);
+		all.push_back(std::move(acc));
+		all.insert(all.end(), parts, parts + n_parts);
+		return lua_concat_multiple(all.data(), all.size());
+	}
+
+	LuaValue cur = std::move(acc);
+	if (is_counted_string(cur.raw_data())) {
+		auto* ls = reinterpret_cast<LuaString*>(cur.raw_data() & PAYLOAD_MASK);
+		if (ls->get_ref_count() == 1) {
+			// Grow once for all the parts, then append them in place
+			if (ls->len + extra > ls->capacity) {
+				cur = adopt_string(LuaString::create(ls->view(), std::max(ls->len + extra, ls->capacity * 2)));
+			}
+			for (size_t i = 0; i < n_parts; i++) {
+				auto* target = reinterpret_cast<LuaString*>(cur.raw_data() & PAYLOAD_MASK);
+				cur = append_in_place(std::move(cur), target, parts[i]);
+			}
+			return cur;
+		}
+	}
+
+	std::string res;
+	// Slack so the next append to the result can happen in place
+	res.reserve((concat_size(cur) + extra) * 2);
+	append_to_string(cur, res);
+	for (size_t i = 0; i < n_parts; i++) append_to_string(parts[i], res);
+	if (res.size() <= STRING_INLINE_MAX) return LuaValue(res);
+	return adopt_string(LuaString::create(res, res.capacity()));
+}
+
 // ==========================================
 // Standard Library
 // ==========================================
@@ -1110,20 +1491,22 @@ void lua_next(const LuaValue* args, size_t n_args, LuaValueVector& out) {
 					return;
 				}
 			}
+			key_is_nil = true; // Move to hash part
 		}
-		key_is_nil = true; // Move to hash part
 	}
 
 	// 2. Hash Part - Upgrade to full map if using next() for simplicity of traversal
 	if (!table->properties) {
 		table->properties = std::make_unique<LuaObject::PropMap>();
-		for (auto& p : table->small_props) (*table->properties)[p.first] = p.second;
+		for (auto& p : table->small_props) table->properties->set(p.first, p.second);
 		table->small_props.clear();
+		table->shape = LuaShape::uncached();
+		++table->props_version;
 	}
 
 	auto it = table->properties->begin();
 	if (!key_is_nil) {
-		it = table->properties->find(key);
+		it = table->properties->find_slot(key);
 		if (it != table->properties->end()) ++it;
 		else throw std::runtime_error("invalid key to 'next'");
 	}
@@ -1147,7 +1530,7 @@ void lua_pairs(const LuaValue* args, size_t n_args, LuaValueVector& out) {
 	out.clear();
 
 	if (table->metatable) {
-		auto m = table->metatable->get_item("__pairs");
+		auto m = table->metatable->get_metamethod(TM_PAIRS);
 		if (m.index() == INDEX_FUNCTION) {
 			LuaValue arg_val = table;
 			m.get<LuaCallable*>()->call(&arg_val, 1, out);
@@ -1185,7 +1568,7 @@ void lua_ipairs(const LuaValue* args, size_t n_args, LuaValueVector& out) {
 	out.clear();
 
 	if (table->metatable) {
-		auto m = table->metatable->get_item("__ipairs");
+		auto m = table->metatable->get_metamethod(TM_IPAIRS);
 		if (m.index() == INDEX_FUNCTION) {
 			LuaValue arg_val = table;
 			m.get<LuaCallable*>()->call(&arg_val, 1, out);
@@ -1344,11 +1727,6 @@ void lua_dofile(const LuaValue* args, size_t n_args, LuaValueVector& out) {
 	throw std::runtime_error("dofile not supported");
 }
 
-void lua_collectgarbage(const LuaValue* args, size_t n_args, LuaValueVector& out) {
-	out.clear();
-	out.push_back(LuaValue());
-}
-
 thread_local std::deque<LuaValueVector> _func_ret_buf_stack;
 thread_local size_t _func_ret_buf_depth = 0;
 
@@ -1368,13 +1746,85 @@ void luax_release_ret_buf() {
 	}
 }
 
+void luax_swap_ret_buf_stack(LuaRetBufStack& other) {
+	// deque::swap keeps element addresses, so references held by suspended frames stay valid
+	_func_ret_buf_stack.swap(other.bufs);
+	std::swap(_func_ret_buf_depth, other.depth);
+}
+
+#ifdef LUAX_REFCOUNT_BIASED
+void luax_mark_shared(const LuaValue& value) {
+	// Iterative walk. Shared objects are walked again: values stored into a shared table after
+	// it was published (a global defined after the first task) still have biased counts.
+	// The seen set handles cycles.
+	std::unordered_set<const LuaRefCounted*> seen;
+	std::vector<LuaObject*> pending;
+	// Functions and upvalue boxes, walked through gc_trace: traced closures report what their captured
+	// locals hold, everything else reports nothing
+	std::vector<const LuaRefCounted*> traced;
+	std::vector<const LuaRefCounted*> children;
+	auto visit = [&seen, &pending, &traced](const LuaValue& v) {
+		uint64_t raw = v.raw_data();
+		if (raw < NAN_MASK) return;
+		uint64_t tag = raw & TAG_MASK;
+		uint64_t ptr_val = raw & PAYLOAD_MASK;
+		if (tag < TAG_STRING || tag > TAG_CORO || !ptr_val) return;
+		if (tag == TAG_STRING && (ptr_val & (STRING_INLINE_BIT | STRING_INTERNED_BIT))) return; // Not counted
+		auto* rc = reinterpret_cast<LuaRefCounted*>(ptr_val);
+		rc->mark_shared();
+		if (tag == TAG_STRING || !seen.insert(rc).second) return;
+		if (tag == TAG_OBJECT) pending.push_back(static_cast<LuaObject*>(rc));
+		else if (tag == TAG_FUNCTION) traced.push_back(rc);
+	};
+	auto visit_child = [&seen, &pending, &traced](const LuaRefCounted* rc) {
+		rc->mark_shared();
+		if (!seen.insert(rc).second) return;
+		if (auto* obj = dynamic_cast<const LuaObject*>(rc)) pending.push_back(const_cast<LuaObject*>(obj));
+		else traced.push_back(rc);
+	};
+
+	visit(value);
+	while (!pending.empty() || !traced.empty()) {
+		if (!traced.empty()) {
+			const LuaRefCounted* rc = traced.back();
+			traced.pop_back();
+			children.clear();
+			rc->gc_trace(children);
+			for (const LuaRefCounted* child : children) visit_child(child);
+			continue;
+		}
+		LuaObject* obj = pending.back();
+		pending.pop_back();
+		for (const auto& p : obj->small_props) {
+			visit(p.first);
+			visit(p.second);
+		}
+		if (obj->properties) {
+			for (const auto& [k, v] : *obj->properties) {
+				visit(k);
+				visit(v);
+			}
+		}
+		for (const auto& v : obj->array_part) visit(v);
+		if (obj->metatable) {
+			obj->metatable->mark_shared();
+			if (seen.insert(obj->metatable).second) pending.push_back(obj->metatable);
+		}
+	}
+}
+#endif
+
 void luax_flush_thread_pool() {
 	LuaObjectPool::cleanup();
 }
 
 void luax_cleanup() {
+#ifdef LUAX_PROFILE
+	luax_profile_report();
+#endif
+	if (const char* env = std::getenv("LUAX_MEMSTATS"); env && *env && *env != '0') luax_dump_memstats(std::cerr);
 	LuaObjectPool::cleanup();
-	get_string_pool().clear();
+	intern_clear();
 }
 LuaValue lua_get_member(LuaObject* base, long long key) {
 	if (!base) return LuaValue();
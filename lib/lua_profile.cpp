@@ -0,0 +1,161 @@
+#include "lua_profile.hpp"
+#include "lua_object.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <sys/time.h>
+#include <vector>
+
+constinit thread_local LuaProfileStack* luax_profile_stack = nullptr;
+std::atomic<uint64_t> luax_profile_counters[LUA_PROFILE_COUNTER_COUNT];
+
+namespace {
+	std::atomic<LuaProfileSite*> site_list{nullptr};
+
+	constinit thread_local LuaProfileStack thread_root_stack;
+
+	// Samples are [frame count, frames root to leaf...], appended by the signal handler.
+	// Allocated when profiling starts; the zero pages cost memory only once sampled into.
+	constexpr size_t SAMPLE_WORDS = size_t(1) << 22;
+	constexpr int MAX_CHAIN = 64; // nested coroutine resumes followed by the sampler
+	uintptr_t* sample_words = nullptr;
+	std::atomic<size_t> sample_pos{0};
+	std::atomic<uint64_t> samples_dropped{0};
+	bool started = false;
+
+	void on_sigprof(int) {
+		int saved_errno = errno;
+		const LuaProfileStack* chain[MAX_CHAIN];
+		int n_chain = 0;
+		size_t n_frames = 0;
+		for (const LuaProfileStack* s = luax_profile_stack; s && n_chain < MAX_CHAIN; s = s->parent) {
+			chain[n_chain++] = s;
+			n_frames += std::min(s->depth, LUA_PROFILE_MAX_DEPTH);
+		}
+		size_t at = sample_pos.fetch_add(n_frames + 1, std::memory_order_relaxed);
+		if (at + n_frames + 1 > SAMPLE_WORDS) {
+			samples_dropped.fetch_add(1, std::memory_order_relaxed);
+			errno = saved_errno;
+			return;
+		}
+		sample_words[at++] = n_frames + 1; // zero marks a sample that was never written
+		for (int c = n_chain - 1; c >= 0; c--) {
+			int depth = std::min(chain[c]->depth, LUA_PROFILE_MAX_DEPTH);
+			for (int i = 0; i < depth; i++) sample_words[at++] = reinterpret_cast<uintptr_t>(chain[c]->frames[i]);
+		}
+		errno = saved_errno;
+	}
+
+	std::string site_label(const LuaProfileSite* site) {
+		if (!site) return "?";
+		return std::string(site->name) + " (" + site->file + ":" + std::to_string(site->line) + ")";
+	}
+}
+
+LuaProfileSite::LuaProfileSite(const char* name, const char* file, int line) : name(name), file(file), line(line) {
+	next = site_list.load(std::memory_order_relaxed);
+	while (!site_list.compare_exchange_weak(next, this, std::memory_order_release, std::memory_order_relaxed)) {}
+}
+
+LuaProfileStack* luax_profile_thread_stack() {
+	luax_profile_stack = &thread_root_stack;
+	return &thread_root_stack;
+}
+
+LuaProfileStack* luax_profile_enter_stack(LuaProfileStack* s) {
+	LuaProfileStack* previous = luax_profile_stack ? luax_profile_stack : luax_profile_thread_stack();
+	s->parent = previous;
+	std::atomic_signal_fence(std::memory_order_release);
+	luax_profile_stack = s;
+	return previous;
+}
+
+void luax_profile_leave_stack(LuaProfileStack* previous) {
+	luax_profile_stack = previous;
+}
+
+void luax_profile_start() {
+	if (started) return;
+	// Kept until exit: a handler may still be running on another thread when the report starts
+	if (!sample_words) sample_words = static_cast<uintptr_t*>(std::calloc(SAMPLE_WORDS, sizeof(uintptr_t)));
+	if (!sample_words) throw std::runtime_error("cannot allocate the profile sample buffer");
+	started = true;
+
+	long hz = 1000;
+	if (const char* env = std::getenv("LUAX_PROFILE_HZ"); env && std::atol(env) > 0) hz = std::atol(env);
+
+	struct sigaction sa{};
+	sa.sa_handler = on_sigprof;
+	sa.sa_flags = SA_RESTART;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGPROF, &sa, nullptr);
+
+	itimerval timer{};
+	timer.it_interval.tv_sec = hz == 1 ? 1 : 0;
+	timer.it_interval.tv_usec = hz == 1 ? 0 : 1000000 / hz;
+	timer.it_value = timer.it_interval;
+	setitimer(ITIMER_PROF, &timer, nullptr);
+}
+
+void luax_profile_dump_counts(std::ostream& os) {
+	std::vector<const LuaProfileSite*> sites;
+	for (const LuaProfileSite* s = site_list.load(std::memory_order_acquire); s; s = s->next) {
+		if (s->calls.load(std::memory_order_relaxed)) sites.push_back(s);
+	}
+	std::sort(sites.begin(), sites.end(), [](const LuaProfileSite* a, const LuaProfileSite* b) {
+		return a->calls.load(std::memory_order_relaxed) > b->calls.load(std::memory_order_relaxed);
+	});
+
+	os << "calls:\n";
+	for (const LuaProfileSite* s : sites) os << "  " << s->calls.load(std::memory_order_relaxed) << "  " << site_label(s) << "\n";
+
+	LuaInternStats intern = luax_intern_stats();
+	os << "slow paths:\n";
+	os << "  metamethod fallbacks: " << luax_profile_counters[LUA_PROFILE_METAMETHOD_FALLBACK].load() << "\n";
+	os << "  C function shim dispatches: " << luax_profile_counters[LUA_PROFILE_CFUNCTION_SHIM].load() << "\n";
+	os << "  intern cache misses: " << intern.misses << " (hits " << intern.hits << ")\n";
+}
+
+void luax_profile_report() {
+	if (!started) return;
+	started = false;
+
+	itimerval off{};
+	setitimer(ITIMER_PROF, &off, nullptr);
+	std::signal(SIGPROF, SIG_IGN);
+
+	// Aggregate identical stacks into flame graph lines
+	std::map<std::string, uint64_t> stacks;
+	uint64_t n_samples = 0;
+	size_t end = std::min(sample_pos.load(), SAMPLE_WORDS);
+	for (size_t i = 0; i < end;) {
+		if (sample_words[i] == 0) break;
+		size_t n = sample_words[i] - 1;
+		if (i + 1 + n > end) break;
+		std::string key;
+		for (size_t k = 0; k < n; k++) {
+			if (k) key += ';';
+			key += site_label(reinterpret_cast<const LuaProfileSite*>(sample_words[i + 1 + k]));
+		}
+		stacks[key.empty() ? "<no Lua frame>" : key]++;
+		n_samples++;
+		i += 1 + n;
+	}
+
+	std::string prefix = "luax-profile";
+	if (const char* env = std::getenv("LUAX_PROFILE_OUT"); env && *env) prefix = env;
+
+	std::ofstream folded(prefix + ".folded");
+	for (const auto& [key, count] : stacks) folded << key << " " << count << "\n";
+
+	std::ofstream counts(prefix + ".txt");
+	counts << "samples: " << n_samples << " (" << samples_dropped.load() << " dropped)\n";
+	luax_profile_dump_counts(counts);
+
+	std::cerr << "luax profile: " << n_samples << " samples written to " << prefix << ".folded and " << prefix << ".txt\n";
+}
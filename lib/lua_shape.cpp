@@ -0,0 +1,46 @@
+#include "lua_shape.hpp"
+#include "lua_value.hpp"
+
+namespace {
+
+// Bounds on the transition tree; past them tables go uncached instead of growing it
+constexpr size_t MAX_SHAPES = 1 << 16;
+constexpr size_t MAX_FANOUT = 64;
+
+std::atomic<size_t> shape_count{0};
+
+} // namespace
+
+constinit const LuaShape LuaShape::EMPTY;
+constinit const LuaShape LuaShape::UNCACHED;
+
+const LuaShape* LuaShape::add(uint64_t key_raw) const {
+	if (this == &UNCACHED) return this;
+	// Only string keys are worth a transition; integer and object keys mark data tables
+	if ((key_raw & TAG_MASK) != TAG_STRING) return &UNCACHED;
+
+	const LuaShape* head = first_child.load(std::memory_order_acquire);
+	size_t fanout = 0;
+	for (const LuaShape* c = head; c; c = c->next_sibling, ++fanout) {
+		if (c->key == key_raw) return c;
+	}
+	if (fanout >= MAX_FANOUT || shape_count.load(std::memory_order_relaxed) >= MAX_SHAPES) return &UNCACHED;
+
+	auto* child = new LuaShape();
+	child->key = key_raw;
+	child->count = count + 1;
+	for (;;) {
+		child->next_sibling = head;
+		if (first_child.compare_exchange_weak(head, child, std::memory_order_release, std::memory_order_acquire)) {
+			shape_count.fetch_add(1, std::memory_order_relaxed);
+			return child;
+		}
+		// Lost the race; the winner may have added the same key
+		for (const LuaShape* c = head; c != child->next_sibling; c = c->next_sibling) {
+			if (c->key == key_raw) {
+				delete child;
+				return c;
+			}
+		}
+	}
+}
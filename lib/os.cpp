@@ -1,5 +1,6 @@
 #include "os.hpp"
 #include "lua_object.hpp"
+#include "io.hpp"
 #include <chrono>
 #include <ctime>
 #include <iomanip>
@@ -13,6 +14,7 @@
 // os.execute
 void os_execute(const LuaValue* args, size_t n_args, LuaValueVector& out) {
 	std::string command = to_cpp_string(args[0]);
+	luax_flush_output(); // the command's output must follow ours
 	int result = std::system(command.c_str());
 	out.assign({static_cast<double>(result)});
 	return;
@@ -0,0 +1,260 @@
+#include "pool_allocator.hpp"
+#include <mutex>
+
+namespace {
+
+// Arena pages start with this many references so that allocating from an open page needs
+// no atomic update; the unused part is subtracted when the page is closed.
+constexpr std::ptrdiff_t OPEN_PAGE_REFS = LuaObjectPool::PAGE_SIZE / LuaObjectPool::ALIGNMENT;
+
+// Emptied arena pages kept for the next arena instead of going back to the OS
+constexpr size_t MAX_SPARE_PAGES = 64;
+
+std::atomic<std::size_t> slab_page_count{0};
+std::atomic<std::size_t> arena_page_count{0};
+
+} // namespace
+
+// Free blocks of exited threads, and the allocator used after a thread's pool is gone
+struct LuaPoolDepot {
+	std::mutex mtx;
+	void* buckets[LuaObjectPool::BUCKET_COUNT]{nullptr};
+	char* bump[LuaObjectPool::BUCKET_COUNT]{nullptr};
+	char* bump_end[LuaObjectPool::BUCKET_COUNT]{nullptr};
+	std::atomic<bool> has_free[LuaObjectPool::BUCKET_COUNT]{};
+	std::vector<void*> spare_pages;
+	std::size_t free_blocks = 0;
+
+	LuaPoolDepot() { spare_pages.reserve(MAX_SPARE_PAGES); }
+
+	// Never destroyed: threads can still free blocks after static destructors ran
+	static LuaPoolDepot& instance() {
+		static LuaPoolDepot* depot = new LuaPoolDepot();
+		return *depot;
+	}
+};
+
+void* LuaObjectPool::new_page() {
+	void* page = ::operator new(PAGE_SIZE, std::align_val_t(PAGE_SIZE));
+	::new (page) PageHeader();
+	return page;
+}
+
+void LuaObjectPool::free_page(PageHeader* page) noexcept {
+	page->~PageHeader();
+	::operator delete(static_cast<void*>(page), std::align_val_t(PAGE_SIZE));
+}
+
+void* LuaObjectPool::refill(ThreadPool& pool, std::size_t index) {
+	const std::size_t size = BUCKET_SIZES[index];
+
+	// Reuse what exited threads left behind before growing
+	auto& depot = LuaPoolDepot::instance();
+	if (depot.has_free[index].load(std::memory_order_relaxed)) {
+		std::lock_guard<std::mutex> lock(depot.mtx);
+		if (auto* node = static_cast<FreeNode*>(depot.buckets[index])) {
+			depot.buckets[index] = nullptr;
+			depot.has_free[index].store(false, std::memory_order_relaxed);
+			pool.buckets[index] = node->next;
+			std::size_t n = 0;
+			for (FreeNode* c = node->next; c; c = c->next) ++n;
+			pool.free_blocks[index] = n;
+			depot.free_blocks -= n + 1;
+			return node;
+		}
+	}
+
+	if (static_cast<std::size_t>(pool.bump_end[index] - pool.bump[index]) < size) {
+		char* page = static_cast<char*>(new_page());
+		slab_page_count.fetch_add(1, std::memory_order_relaxed);
+		pool.bump[index] = page + PAGE_HEADER;
+		pool.bump_end[index] = page + PAGE_SIZE;
+	}
+	void* p = pool.bump[index];
+	pool.bump[index] += size;
+	return p;
+}
+
+void* LuaObjectPool::depot_allocate(std::size_t index) {
+	auto& depot = LuaPoolDepot::instance();
+	std::lock_guard<std::mutex> lock(depot.mtx);
+	if (auto* node = static_cast<FreeNode*>(depot.buckets[index])) {
+		depot.buckets[index] = node->next;
+		--depot.free_blocks;
+		return node;
+	}
+	const std::size_t size = BUCKET_SIZES[index];
+	if (static_cast<std::size_t>(depot.bump_end[index] - depot.bump[index]) < size) {
+		char* page = static_cast<char*>(new_page());
+		slab_page_count.fetch_add(1, std::memory_order_relaxed);
+		depot.bump[index] = page + PAGE_HEADER;
+		depot.bump_end[index] = page + PAGE_SIZE;
+	}
+	void* p = depot.bump[index];
+	depot.bump[index] += size;
+	return p;
+}
+
+void LuaObjectPool::depot_deallocate(void* p, std::size_t index) noexcept {
+	auto& depot = LuaPoolDepot::instance();
+	std::lock_guard<std::mutex> lock(depot.mtx);
+	auto* node = static_cast<FreeNode*>(p);
+	node->next = static_cast<FreeNode*>(depot.buckets[index]);
+	depot.buckets[index] = node;
+	++depot.free_blocks;
+	depot.has_free[index].store(true, std::memory_order_relaxed);
+}
+
+void LuaObjectPool::cleanup_pool(ThreadPool& pool) noexcept {
+	auto& depot = LuaPoolDepot::instance();
+	for (std::size_t i = 0; i < BUCKET_COUNT; ++i) {
+		// The rest of the current slab page becomes free blocks too
+		const std::size_t size = BUCKET_SIZES[i];
+		while (static_cast<std::size_t>(pool.bump_end[i] - pool.bump[i]) >= size) {
+			auto* node = reinterpret_cast<FreeNode*>(pool.bump[i]);
+			node->next = pool.buckets[i];
+			pool.buckets[i] = node;
+			pool.bump[i] += size;
+			++pool.free_blocks[i];
+		}
+		pool.bump[i] = pool.bump_end[i] = nullptr;
+
+		FreeNode* head = pool.buckets[i];
+		if (!head) continue;
+		FreeNode* tail = head;
+		while (tail->next) tail = tail->next;
+
+		std::lock_guard<std::mutex> lock(depot.mtx);
+		tail->next = static_cast<FreeNode*>(depot.buckets[i]);
+		depot.buckets[i] = head;
+		depot.free_blocks += pool.free_blocks[i];
+		depot.has_free[i].store(true, std::memory_order_relaxed);
+		pool.buckets[i] = nullptr;
+		pool.free_blocks[i] = 0;
+	}
+}
+
+void LuaObjectPool::cleanup() noexcept {
+	if (LUA_POOL_UNLIKELY(is_destroyed())) return;
+	cleanup_pool(get_thread_pool());
+}
+
+void* LuaObjectPool::arena_allocate(LuaArena* arena, std::size_t n) {
+	return arena->allocate(n);
+}
+
+void LuaObjectPool::release_arena_block(void* p) noexcept {
+	PageHeader* page = page_of(p);
+	if (page->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) release_arena_page(page);
+}
+
+void* LuaObjectPool::acquire_arena_page() {
+	auto& depot = LuaPoolDepot::instance();
+	{
+		std::lock_guard<std::mutex> lock(depot.mtx);
+		if (!depot.spare_pages.empty()) {
+			void* page = depot.spare_pages.back();
+			depot.spare_pages.pop_back();
+			return page;
+		}
+	}
+	auto* page = static_cast<PageHeader*>(new_page());
+	page->arena = true;
+	arena_page_count.fetch_add(1, std::memory_order_relaxed);
+	return page;
+}
+
+void LuaObjectPool::release_arena_page(PageHeader* page) noexcept {
+	auto& depot = LuaPoolDepot::instance();
+	{
+		std::lock_guard<std::mutex> lock(depot.mtx);
+		if (depot.spare_pages.size() < MAX_SPARE_PAGES) {
+			depot.spare_pages.push_back(page);
+			return;
+		}
+	}
+	arena_page_count.fetch_sub(1, std::memory_order_relaxed);
+	free_page(page);
+}
+
+LuaPoolStats LuaObjectPool::stats() {
+	LuaPoolStats s;
+	for (std::size_t i = 0; i < BUCKET_COUNT; ++i) s.buckets[i].size = BUCKET_SIZES[i];
+	if (!is_destroyed()) {
+		auto& pool = get_thread_pool();
+		for (std::size_t i = 0; i < BUCKET_COUNT; ++i) {
+			s.buckets[i].allocs = pool.allocs[i];
+			s.buckets[i].frees = pool.frees[i];
+			s.buckets[i].free_blocks = pool.free_blocks[i];
+		}
+		s.large_allocs = pool.large_allocs;
+		s.large_frees = pool.large_frees;
+		s.large_bytes = pool.large_bytes;
+		s.bytes_in_use = pool.bytes_in_use;
+	}
+	s.slab_pages = slab_page_count.load(std::memory_order_relaxed);
+	s.arena_pages = arena_page_count.load(std::memory_order_relaxed);
+	s.page_size = PAGE_SIZE;
+
+	auto& depot = LuaPoolDepot::instance();
+	std::lock_guard<std::mutex> lock(depot.mtx);
+	s.spare_pages = depot.spare_pages.size();
+	s.depot_blocks = depot.free_blocks;
+	return s;
+}
+
+// --- LuaArena ---
+
+void* LuaArena::allocate(std::size_t n) {
+	const std::size_t size = (n + LuaObjectPool::ALIGNMENT - 1) & ~(LuaObjectPool::ALIGNMENT - 1);
+	if (static_cast<std::size_t>(end - bump) < size) {
+		close_page();
+		auto* page = static_cast<LuaObjectPool::PageHeader*>(LuaObjectPool::acquire_arena_page());
+		page->refs.store(1 + OPEN_PAGE_REFS, std::memory_order_relaxed);
+		pages.push_back(page);
+		bump = reinterpret_cast<char*>(page) + LuaObjectPool::PAGE_HEADER;
+		end = reinterpret_cast<char*>(page) + LuaObjectPool::PAGE_SIZE;
+	}
+	void* p = bump;
+	bump += size;
+	++page_blocks;
+	allocated += size;
+	return p;
+}
+
+void LuaArena::close_page() {
+	if (!bump) return;
+	auto* page = pages.back();
+	// Cannot reach zero: the arena's own reference is still held
+	page->refs.fetch_sub(OPEN_PAGE_REFS - static_cast<std::ptrdiff_t>(page_blocks), std::memory_order_acq_rel);
+	bump = end = nullptr;
+	page_blocks = 0;
+}
+
+void LuaArena::enter() {
+	auto& pool = LuaObjectPool::get_thread_pool();
+	previous = pool.arena;
+	pool.arena = this;
+}
+
+void LuaArena::leave() {
+	auto& pool = LuaObjectPool::get_thread_pool();
+	if (pool.arena == this) pool.arena = previous;
+	previous = nullptr;
+}
+
+LuaArena* LuaArena::exchange_active(LuaArena* arena) {
+	auto& pool = LuaObjectPool::get_thread_pool();
+	LuaArena* active = pool.arena;
+	pool.arena = arena;
+	return active;
+}
+
+void LuaArena::reset() {
+	close_page();
+	for (auto* page : pages) {
+		if (page->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) LuaObjectPool::release_arena_page(page);
+	}
+	pages.clear();
+	allocated = 0;
+}
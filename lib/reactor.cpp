@@ -0,0 +1,243 @@
+#include "reactor.hpp"
+#include "coroutine.hpp"
+#include <stdexcept>
+#include <algorithm>
+#include <deque>
+#include <unordered_map>
+#include <vector>
+#include <cerrno>
+#include <cstdint>
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <poll.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
+#endif
+
+namespace {
+	constexpr unsigned WAIT_READ = 1;
+	constexpr unsigned WAIT_WRITE = 2;
+
+	enum class WaitState { WAITING, READY, DONE };
+
+	// Lives in the frame of luax_wait_fd, which for a parked coroutine is on its own stack
+	struct Waiter {
+		LuaCoroutine* co; // null when the main line is waiting
+		unsigned events;
+		WaitState state = WaitState::WAITING;
+	};
+
+	struct FdWaiters {
+		std::vector<Waiter*> waiters;
+		bool registered = false; // added to epoll; EPOLLONESHOT disarms it after each event
+	};
+
+	class Reactor {
+	public:
+		~Reactor() {
+#ifdef __linux__
+			if (epfd >= 0) ::close(epfd);
+#endif
+		}
+
+		void add(int fd, Waiter* w) {
+			FdWaiters& st = fds[fd];
+			st.waiters.push_back(w);
+			waiting++;
+			if (w->co) parked++;
+			arm(fd, st);
+		}
+
+		// A wait that ended without the reactor resuming it (resumed by hand, or unwinding)
+		void cancel(int fd, Waiter* w) {
+			if (w->state == WaitState::WAITING) {
+				auto it = fds.find(fd);
+				if (it != fds.end()) {
+					auto& list = it->second.waiters;
+					list.erase(std::remove(list.begin(), list.end(), w), list.end());
+				}
+				waiting--;
+				if (w->co) parked--;
+			}
+			else if (w->state == WaitState::READY) {
+				ready.erase(std::remove(ready.begin(), ready.end(), w), ready.end());
+				parked--;
+			}
+			w->state = WaitState::DONE;
+		}
+
+		void forget(int fd) {
+			auto it = fds.find(fd);
+			if (it == fds.end()) return;
+#ifdef __linux__
+			if (it->second.registered) epoll_ctl(epfd, EPOLL_CTL_DEL, fd, nullptr);
+#endif
+			wake(it->second, WAIT_READ | WAIT_WRITE);
+			fds.erase(it);
+		}
+
+		size_t poll(int timeout_ms) {
+			if (ready.empty()) {
+				if (waiting == 0) return 0;
+				wait_events(timeout_ms);
+			}
+			// Coroutines woken while these run wait for the next round
+			size_t resumed = 0;
+			for (size_t n = ready.size(); n > 0 && !ready.empty(); --n) {
+				Waiter* w = ready.front();
+				ready.pop_front();
+				w->state = WaitState::DONE;
+				parked--;
+				// The waiter is gone once the coroutine runs; the coroutine holds a reference to itself
+				LuaCoroutine* co = w->co;
+				LuaValueVector out;
+				co->resume(nullptr, 0, out);
+				resumed++;
+				if (!out.empty() && out[0].index() == INDEX_BOOLEAN && !out[0].get<bool>()) {
+					throw std::runtime_error(out.size() > 1 ? to_cpp_string(out[1]) : "unknown error");
+				}
+			}
+			return resumed;
+		}
+
+		size_t pending() const { return parked; }
+
+	private:
+		std::unordered_map<int, FdWaiters> fds;
+		std::deque<Waiter*> ready; // woken coroutines, resumed by the next poll
+		size_t waiting = 0;        // waiters still registered on a descriptor
+		size_t parked = 0;         // coroutines among the waiting and ready waiters
+#ifdef __linux__
+		int epfd = -1;
+#endif
+
+		// Moves the waiters interested in events out of st: coroutines into the ready queue,
+		// the main line straight to DONE
+		void wake(FdWaiters& st, unsigned events) {
+			auto keep = st.waiters.begin();
+			for (Waiter* w : st.waiters) {
+				if (!(w->events & events)) {
+					*keep++ = w;
+					continue;
+				}
+				waiting--;
+				if (w->co) {
+					w->state = WaitState::READY;
+					ready.push_back(w);
+				}
+				else {
+					w->state = WaitState::DONE;
+				}
+			}
+			st.waiters.erase(keep, st.waiters.end());
+		}
+
+		void arm(int fd, FdWaiters& st) {
+#ifdef __linux__
+			unsigned want = 0;
+			for (Waiter* w : st.waiters) want |= w->events;
+			if (!want) return;
+			if (epfd < 0) {
+				epfd = epoll_create1(EPOLL_CLOEXEC);
+				if (epfd < 0) throw std::runtime_error("cannot create the io reactor");
+			}
+			epoll_event ev{};
+			ev.events = EPOLLONESHOT | ((want & WAIT_READ) ? EPOLLIN : 0u) | ((want & WAIT_WRITE) ? EPOLLOUT : 0u);
+			ev.data.fd = fd;
+			int rc = epoll_ctl(epfd, st.registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, fd, &ev);
+			// A stale entry: the descriptor was closed and reused, or is still registered
+			if (rc != 0 && errno == ENOENT) rc = epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+			else if (rc != 0 && errno == EEXIST) rc = epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &ev);
+			st.registered = rc == 0;
+			// Not pollable (regular files): operations on it never wait
+			if (rc != 0) wake(st, WAIT_READ | WAIT_WRITE);
+#else
+			(void)fd;
+			(void)st;
+#endif
+		}
+
+		void fired(int fd, unsigned events) {
+			auto it = fds.find(fd);
+			if (it == fds.end()) return;
+			wake(it->second, events);
+			arm(fd, it->second);
+		}
+
+		void wait_events(int timeout_ms) {
+#if defined(__linux__)
+			if (epfd < 0) return;
+			epoll_event events[256];
+			// EINTR counts as a spurious wakeup
+			int n = epoll_wait(epfd, events, 256, timeout_ms);
+			for (int i = 0; i < n; ++i) {
+				uint32_t e = events[i].events;
+				unsigned ready_for = 0;
+				if (e & (EPOLLIN | EPOLLHUP | EPOLLERR)) ready_for |= WAIT_READ;
+				if (e & (EPOLLOUT | EPOLLHUP | EPOLLERR)) ready_for |= WAIT_WRITE;
+				fired(events[i].data.fd, ready_for);
+			}
+#elif !defined(_WIN32)
+			std::vector<pollfd> pfds;
+			for (auto& [fd, st] : fds) {
+				unsigned want = 0;
+				for (Waiter* w : st.waiters) want |= w->events;
+				if (want) pfds.push_back({fd, static_cast<short>(((want & WAIT_READ) ? POLLIN : 0) | ((want & WAIT_WRITE) ? POLLOUT : 0)), 0});
+			}
+			int n = ::poll(pfds.data(), pfds.size(), timeout_ms);
+			for (int i = 0; n > 0 && i < static_cast<int>(pfds.size()); ++i) {
+				short e = pfds[i].revents;
+				unsigned ready_for = 0;
+				if (e & (POLLIN | POLLHUP | POLLERR | POLLNVAL)) ready_for |= WAIT_READ;
+				if (e & (POLLOUT | POLLHUP | POLLERR | POLLNVAL)) ready_for |= WAIT_WRITE;
+				if (ready_for) fired(pfds[i].fd, ready_for);
+			}
+#else
+			(void)timeout_ms;
+#endif
+		}
+	};
+
+	thread_local Reactor reactor;
+}
+
+void luax_wait_fd(int fd, bool write) {
+	Waiter w{nullptr, write ? WAIT_WRITE : WAIT_READ};
+#ifndef LUAX_COROUTINE_THREADS
+	// Thread-backed coroutines block their own thread instead
+	w.co = current_coroutine;
+#endif
+	struct Registration {
+		int fd;
+		Waiter* w;
+		~Registration() { reactor.cancel(fd, w); }
+	} registration{fd, &w};
+	reactor.add(fd, &w);
+
+	if (w.co) {
+		// Parked coroutines stay alive until they resume
+		struct Hold {
+			LuaCoroutine* co;
+			explicit Hold(LuaCoroutine* c) : co(c) { co->retain(); }
+			~Hold() { co->release(); }
+		} hold(w.co);
+		LuaValueVector ignored;
+		LuaCoroutine::yield(nullptr, 0, ignored);
+		return;
+	}
+	while (w.state != WaitState::DONE) reactor.poll(-1);
+}
+
+void luax_reactor_forget(int fd) {
+	reactor.forget(fd);
+}
+
+size_t luax_reactor_poll(int timeout_ms) {
+	return reactor.poll(timeout_ms);
+}
+
+size_t luax_reactor_pending() {
+	return reactor.pending();
+}
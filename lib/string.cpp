@@ -8,18 +8,100 @@
 #include <cctype>
 #include <sstream>
 #include <charconv>
+#include <cmath>
+#include <array>
+#include <bit>
+#include <list>
+#include <memory>
+#include <unordered_map>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Per-thread LRU of compiled patterns and pack formats, most recently used first
+template <typename T>
+struct CompiledCache {
+	static constexpr size_t CAPACITY = 64;
+
+	struct Entry {
+		std::string source;
+		std::shared_ptr<const T> compiled;
+	};
+	std::list<Entry> entries;
+	std::unordered_map<std::string_view, typename std::list<Entry>::iterator> index;
+
+	template <typename Compile>
+	std::shared_ptr<const T> get(std::string_view source, Compile compile) {
+		if (!entries.empty() && entries.front().source == source) return entries.front().compiled;
+		auto it = index.find(source);
+		if (it != index.end()) {
+			entries.splice(entries.begin(), entries, it->second);
+			return it->second->compiled;
+		}
+		std::shared_ptr<const T> compiled = compile(source);
+		if (entries.size() >= CAPACITY) {
+			index.erase(entries.back().source);
+			entries.pop_back();
+		}
+		entries.push_front({std::string(source), compiled});
+		index.emplace(entries.front().source, entries.begin());
+		return compiled;
+	}
+};
 
 // --- Lua Pattern Matching Engine ---
 
+// Patterns are compiled into a Program: one Item per single-character class, capture
+// bracket or back reference, with every class and set resolved to a 256-bit bitmap.
+// The program also records what each match must start with, so searches can skip
+// ahead with memchr or a vectorized literal search instead of trying every position.
 namespace LuaPattern {
 	constexpr int LUA_MAXCAPTURES = 32;
 	constexpr int CAP_UNFINISHED = -1;
 	constexpr int CAP_POSITION = -2;
 
+	struct CharSet {
+		uint64_t bits[4] = {};
+
+		void add(unsigned char c) { bits[c >> 6] |= 1ULL << (c & 63); }
+		bool has(unsigned char c) const { return (bits[c >> 6] >> (c & 63)) & 1; }
+	};
+
+	enum ItemKind : uint8_t {
+		ITEM_CHAR,       // one literal byte
+		ITEM_SET,        // '.', %a-style classes and [...] sets
+		ITEM_OPEN,       // '('
+		ITEM_POSITION,   // '()'
+		ITEM_CLOSE,      // ')'
+		ITEM_BACKREF,    // %1-%9
+		ITEM_END_ANCHOR  // '$' at the end of the pattern
+	};
+
+	struct Item {
+		ItemKind kind;
+		char quant = 0;     // '?', '*', '+', '-' or 0
+		unsigned char c = 0;
+		int16_t arg = 0;    // Set index, or capture index for back references
+	};
+
+	struct Program {
+		std::vector<Item> items;
+		std::vector<CharSet> sets;
+		bool anchored = false;
+		// Bytes every match starts with; the whole pattern when is_literal
+		std::string prefix;
+		bool is_literal = false;
+		// Set the first byte of every match belongs to, when there is no prefix
+		CharSet first;
+		bool has_first = false;
+	};
+
 	struct MatchState {
-		std::string_view src;
 		const char* src_init;
-		const char* p_end;
+		const char* src_end;
+		const Item* p_end;
+		const CharSet* sets;
 		int level;
 
 		struct {
@@ -58,62 +140,211 @@ namespace LuaPattern {
 		return (islower(cl) ? res : !res);
 	}
 
-	static bool match_class(int c, int cl) {
-		return (tolower(cl) == 'z' && c == 0) || check_class(c, cl);
+	static void add_class(CharSet& set, unsigned char cl) {
+		for (int c = 0; c < 256; ++c) {
+			if (check_class(c, cl)) set.add(static_cast<unsigned char>(c));
+		}
 	}
 
-	static bool match_bracket_class(int c, const char* p, const char* ec) {
-		bool sig = true;
-		if (*(p + 1) == '^') {
-			sig = false;
+	// [...] starting after the '['; returns the position of the closing ']'
+	static const char* compile_bracket(CharSet& set, const char* p, const char* end) {
+		bool negate = (p < end && *p == '^');
+		if (negate) p++;
+		const char* ec = p;
+		// The first byte is always part of the set, so "[]]" matches ']'
+		do {
+			if (ec >= end) throw std::runtime_error("malformed pattern (missing ']')");
+			if (*ec++ == '%') {
+				if (ec >= end) throw std::runtime_error("malformed pattern (missing ']')");
+				ec++;
+			}
+		}
+		while (ec >= end || *ec != ']');
+
+		while (p < ec) {
+			unsigned char c = static_cast<unsigned char>(*p);
+			if (c == '%') {
+				add_class(set, static_cast<unsigned char>(p[1]));
+				p += 2;
+			}
+			else if (p + 2 < ec && p[1] == '-') {
+				for (int r = c; r <= static_cast<unsigned char>(p[2]); ++r) set.add(static_cast<unsigned char>(r));
+				p += 3;
+			}
+			else {
+				set.add(c);
+				p++;
+			}
+		}
+		if (negate) {
+			for (auto& w : set.bits) w = ~w;
+		}
+		return ec;
+	}
+
+	static std::shared_ptr<const Program> compile(std::string_view pattern) {
+		auto prog = std::make_shared<Program>();
+		const char* p = pattern.data();
+		const char* end = p + pattern.size();
+		if (p < end && *p == '^') {
+			prog->anchored = true;
 			p++;
 		}
-		while (++p < ec) {
-			if (*p == '%') {
-				if (match_class(c, *++p)) return sig;
+
+		while (p < end) {
+			Item item{ITEM_CHAR};
+			switch (*p) {
+			case '(':
+				if (p + 1 < end && p[1] == ')') {
+					prog->items.push_back({ITEM_POSITION});
+					p += 2;
+				}
+				else {
+					prog->items.push_back({ITEM_OPEN});
+					p++;
+				}
+				continue;
+			case ')':
+				prog->items.push_back({ITEM_CLOSE});
+				p++;
+				continue;
+			case '$':
+				if (p + 1 == end) {
+					prog->items.push_back({ITEM_END_ANCHOR});
+					p++;
+					continue;
+				}
+				break;
+			case '%':
+				if (p + 1 == end) throw std::runtime_error("malformed pattern (ends with '%')");
+				if (isdigit(static_cast<unsigned char>(p[1]))) {
+					prog->items.push_back({ITEM_BACKREF, 0, 0, static_cast<int16_t>(p[1] - '1')});
+					p += 2;
+					continue;
+				}
+				break;
 			}
-			else if ((*(p + 1) == '-') && (p + 2 < ec)) {
-				p += 2;
-				if (*(p - 2) <= c && c <= *p) return sig;
+
+			if (*p == '.' || (*p == '%' && isalpha(static_cast<unsigned char>(p[1]))) || *p == '[') {
+				CharSet set;
+				if (*p == '.') {
+					for (auto& w : set.bits) w = ~0ULL;
+					p++;
+				}
+				else if (*p == '%') {
+					add_class(set, static_cast<unsigned char>(p[1]));
+					p += 2;
+				}
+				else {
+					p = compile_bracket(set, p + 1, end) + 1;
+				}
+				item.kind = ITEM_SET;
+				item.arg = static_cast<int16_t>(prog->sets.size());
+				prog->sets.push_back(set);
+			}
+			else {
+				// A literal byte, or an escaped non-alphanumeric one ("%.")
+				if (*p == '%') p++;
+				item.c = static_cast<unsigned char>(*p++);
+			}
+			if (p < end && (*p == '?' || *p == '*' || *p == '+' || *p == '-')) item.quant = *p++;
+			prog->items.push_back(item);
+		}
+
+		// What every match must start with; position captures consume nothing
+		prog->is_literal = !prog->anchored;
+		for (const Item& item : prog->items) {
+			if (item.kind != ITEM_CHAR || item.quant) prog->is_literal = false;
+		}
+		size_t i = 0;
+		while (i < prog->items.size() && (prog->items[i].kind == ITEM_OPEN || prog->items[i].kind == ITEM_POSITION)) i++;
+		if (prog->is_literal) i = prog->items.size();
+		for (; i < prog->items.size(); ++i) {
+			const Item& item = prog->items[i];
+			if (item.kind == ITEM_CHAR && (item.quant == 0 || item.quant == '+')) {
+				prog->prefix += static_cast<char>(item.c);
+				if (item.quant == 0) continue;
 			}
-			else if (*p == c) return sig;
+			else if (item.kind == ITEM_SET && prog->prefix.empty() && (item.quant == 0 || item.quant == '+')) {
+				prog->first = prog->sets[item.arg];
+				prog->has_first = true;
+			}
+			break;
 		}
-		return !sig;
+		if (prog->is_literal) {
+			for (const Item& item : prog->items) prog->prefix += static_cast<char>(item.c);
+		}
+		return prog;
+	}
+
+	static std::shared_ptr<const Program> get_program(std::string_view pattern) {
+		static thread_local CompiledCache<Program> cache;
+		return cache.get(pattern, compile);
 	}
 
-	static bool singlematch(const MatchState* ms, const char* s, const char* p, const char* ep) {
-		if (s >= ms->src.data() + ms->src.size()) return false;
-		int c = static_cast<unsigned char>(*s);
-		switch (*p) {
-		case '.': return true;
-		case '%': return match_class(c, *(p + 1));
-		case '[': return match_bracket_class(c, p, ep - 1);
-		default: return (*p == c);
+	// Position of the literal in [s, end), or nullptr. With SSE2, sixteen candidates at a
+	// time are filtered on the literal's first and last bytes before comparing.
+	static const char* find_literal(const char* s, const char* end, std::string_view lit) {
+		size_t n = lit.size();
+		if (n == 0) return s;
+		if (static_cast<size_t>(end - s) < n) return nullptr;
+		if (n == 1) return static_cast<const char*>(std::memchr(s, lit[0], end - s));
+		const char* last = end - n; // Last possible start
+#if defined(__SSE2__)
+		const __m128i first_c = _mm_set1_epi8(lit[0]);
+		const __m128i last_c = _mm_set1_epi8(lit[n - 1]);
+		for (; s + 16 <= last + 1; s += 16) {
+			__m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s));
+			__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + n - 1));
+			uint32_t mask = static_cast<uint32_t>(_mm_movemask_epi8(
+				_mm_and_si128(_mm_cmpeq_epi8(a, first_c), _mm_cmpeq_epi8(b, last_c))));
+			while (mask) {
+				int i = std::countr_zero(mask);
+				if (std::memcmp(s + i + 1, lit.data() + 1, n - 2) == 0) return s + i;
+				mask &= mask - 1;
+			}
+		}
+#endif
+		while (s <= last) {
+			s = static_cast<const char*>(std::memchr(s, lit[0], last - s + 1));
+			if (!s) return nullptr;
+			if (std::memcmp(s + 1, lit.data() + 1, n - 1) == 0) return s;
+			s++;
 		}
+		return nullptr;
+	}
+
+	static bool has_specials(std::string_view p) {
+		return p.find_first_of("^$*+?.([%-") != std::string_view::npos;
+	}
+
+	static inline bool singlematch(const MatchState* ms, const char* s, const Item& item) {
+		if (s >= ms->src_end) return false;
+		unsigned char c = static_cast<unsigned char>(*s);
+		return item.kind == ITEM_CHAR ? c == item.c : ms->sets[item.arg].has(c);
 	}
 
-	static const char* match(MatchState* ms, const char* s, const char* p);
+	static const char* match(MatchState* ms, const char* s, const Item* p);
 
-	static const char* max_expand(MatchState* ms, const char* s, const char* p, const char* ep) {
+	static const char* max_expand(MatchState* ms, const char* s, const Item* p) {
 		ptrdiff_t i = 0;
-		const char* s_end = ms->src.data() + ms->src.size();
-		while (s + i < s_end && singlematch(ms, s + i, p, ep)) i++;
+		while (singlematch(ms, s + i, *p)) i++;
 		while (i >= 0) {
-			if (const char* res = match(ms, s + i, ep + 1)) return res;
+			if (const char* res = match(ms, s + i, p + 1)) return res;
 			i--;
 		}
 		return nullptr;
 	}
 
-	static const char* min_expand(MatchState* ms, const char* s, const char* p, const char* ep) {
+	static const char* min_expand(MatchState* ms, const char* s, const Item* p) {
 		while (true) {
-			if (const char* res = match(ms, s, ep + 1)) return res;
-			if (singlematch(ms, s, p, ep)) s++;
+			if (const char* res = match(ms, s, p + 1)) return res;
+			if (singlematch(ms, s, *p)) s++;
 			else return nullptr;
 		}
 	}
 
-	static const char* start_capture(MatchState* ms, const char* s, const char* p, int what) {
+	static const char* start_capture(MatchState* ms, const char* s, const Item* p, int what) {
 		if (ms->level >= LUA_MAXCAPTURES) throw std::runtime_error("too many captures");
 		int level = ms->level++;
 		ms->capture[level].init = s;
@@ -123,7 +354,7 @@ namespace LuaPattern {
 		return res;
 	}
 
-	static const char* end_capture(MatchState* ms, const char* s, const char* p) {
+	static const char* end_capture(MatchState* ms, const char* s, const Item* p) {
 		int l = ms->level - 1;
 		while (l >= 0 && ms->capture[l].len != CAP_UNFINISHED) --l;
 		if (l < 0) throw std::runtime_error("invalid pattern capture");
@@ -133,64 +364,115 @@ namespace LuaPattern {
 		return res;
 	}
 
-	static const char* classend(const MatchState* ms, const char* p) {
-		switch (*p++) {
-		case '%':
-			if (p == ms->p_end) throw std::runtime_error("malformed pattern");
-			return p + 1;
-		case '[':
-			if (*p == '^') p++;
-			do {
-				if (p == ms->p_end) throw std::runtime_error("malformed pattern");
-				if (*p++ == '%' && p < ms->p_end) p++;
-			}
-			while (*p != ']');
-			return p + 1;
-		default: return p;
-		}
-	}
-
-	static const char* match(MatchState* ms, const char* s, const char* p) {
-		if (p == ms->p_end) return s;
-		const char* s_end = ms->src.data() + ms->src.size();
-
-		switch (*p) {
-		case '(': return (*(p + 1) == ')')
-			                 ? start_capture(ms, s, p + 2, CAP_POSITION)
-			                 : start_capture(ms, s, p + 1, CAP_UNFINISHED);
-		case ')': return end_capture(ms, s, p + 1);
-		case '$': if ((p + 1) == ms->p_end) return (s == s_end) ? s : nullptr;
-			break;
-		case '%':
-			if (*(p + 1) >= '0' && *(p + 1) <= '9') {
-				int l = *(p + 1) - '1';
+	static const char* match(MatchState* ms, const char* s, const Item* p) {
+		while (true) {
+			if (p == ms->p_end) return s;
+			switch (p->kind) {
+			case ITEM_OPEN: return start_capture(ms, s, p + 1, CAP_UNFINISHED);
+			case ITEM_POSITION: return start_capture(ms, s, p + 1, CAP_POSITION);
+			case ITEM_CLOSE: return end_capture(ms, s, p + 1);
+			case ITEM_END_ANCHOR: return (s == ms->src_end) ? s : nullptr;
+			case ITEM_BACKREF: {
+				int l = p->arg;
 				if (l < 0 || l >= ms->level || ms->capture[l].len == CAP_UNFINISHED) throw std::runtime_error(
 					"invalid capture index");
 				size_t len = ms->capture[l].len;
-				if (static_cast<size_t>(s_end - s) >= len && memcmp(ms->capture[l].init, s, len) == 0) return match(
-					ms, s + len, p + 2);
-				return nullptr;
+				if (static_cast<size_t>(ms->src_end - s) < len || memcmp(ms->capture[l].init, s, len) != 0) return nullptr;
+				s += len;
+				p++;
+				continue;
+			}
+			default: break;
+			}
+
+			bool m = singlematch(ms, s, *p);
+			switch (p->quant) {
+			case '?':
+				if (m) {
+					if (const char* res = match(ms, s + 1, p + 1)) return res;
+				}
+				p++;
+				continue;
+			case '*': return max_expand(ms, s, p);
+			case '+': return m ? max_expand(ms, s + 1, p) : nullptr;
+			case '-': return min_expand(ms, s, p);
+			default:
+				if (!m) return nullptr;
+				s++;
+				p++;
 			}
-			break;
 		}
+	}
 
-		const char* ep = classend(ms, p);
-		bool m = (s < s_end) && singlematch(ms, s, p, ep);
+	static void init_state(MatchState& ms, std::string_view src, const Program& prog) {
+		ms.src_init = src.data();
+		ms.src_end = src.data() + src.size();
+		ms.p_end = prog.items.data() + prog.items.size();
+		ms.sets = prog.sets.data();
+		ms.level = 0;
+	}
 
-		switch (*ep) {
-		case '?': {
-			const char* res;
-			if (m && (res = match(ms, s + 1, ep + 1))) return res;
-			return match(ms, s, ep + 1);
+	// Start of the first match at or after s (nullptr if there is none); its end goes to e
+	static const char* search(MatchState& ms, const Program& prog, const char* s, const char*& e) {
+		const char* end = ms.src_end;
+		if (prog.is_literal) {
+			ms.level = 0;
+			const char* found = find_literal(s, end, prog.prefix);
+			if (found) e = found + prog.prefix.size();
+			return found;
+		}
+		while (true) {
+			if (!prog.anchored) {
+				if (!prog.prefix.empty()) {
+					s = find_literal(s, end, prog.prefix);
+					if (!s) return nullptr;
+				}
+				else if (prog.has_first) {
+					while (s < end && !prog.first.has(static_cast<unsigned char>(*s))) s++;
+					if (s == end) return nullptr;
+				}
+			}
+			ms.level = 0;
+			if (const char* res = match(&ms, s, prog.items.data())) {
+				e = res;
+				return s;
+			}
+			if (prog.anchored || s >= end) return nullptr;
+			s++;
 		}
-		case '*': return max_expand(ms, s, p, ep);
-		case '+': return m ? max_expand(ms, s + 1, p, ep) : nullptr;
-		case '-': return min_expand(ms, s, p, ep);
-		default: return m ? match(ms, s + 1, ep) : nullptr;
+	}
+
+	// Capture i of the match [s, e); the whole match when the pattern has no captures
+	static LuaValue capture_value(const MatchState& ms, int i, const char* s, const char* e) {
+		if (i >= ms.level) {
+			if (i != 0) throw std::runtime_error("invalid capture index");
+			return std::string(s, e - s);
 		}
+		ptrdiff_t len = ms.capture[i].len;
+		if (len == CAP_UNFINISHED) throw std::runtime_error("unfinished capture");
+		if (len == CAP_POSITION) return static_cast<double>(ms.capture[i].init - ms.src_init + 1);
+		return std::string(ms.capture[i].init, len);
+	}
+
+	static void push_captures(const MatchState& ms, const char* s, const char* e, bool whole, LuaValueVector& out) {
+		int n = (ms.level == 0 && whole) ? 1 : ms.level;
+		for (int i = 0; i < n; ++i) out.push_back(capture_value(ms, i, s, e));
 	}
 }
 
+LuaCompiledPattern::LuaCompiledPattern(std::string_view pattern) : source(pattern) {
+	// Malformed patterns raise their error where they are used, not at startup
+	try {
+		program = LuaPattern::compile(pattern);
+	}
+	catch (const std::exception&) {}
+}
+
+const LuaPattern::Program& LuaCompiledPattern::get() const {
+	if (!program) LuaPattern::compile(source);
+	return *program;
+}
+
 // --- Helper Functions ---
 
 inline std::string_view get_sv(const LuaValue& v) {
@@ -231,29 +513,390 @@ std::string get_string(const LuaValue& v) {
     return "";
 }
 
-// No longer needed, using LuaObject::get_single_char instead
+// --- Binary Packing (string.pack / string.unpack) ---
 
-// Helper to extract captures directly into the output vector
-void get_captures(const LuaPattern::MatchState& ms, LuaValueVector& out) {
-	int nlevels = (ms.level == 0 && ms.capture[0].len != LuaPattern::CAP_UNFINISHED) ? 1 : ms.level;
+// Formats are parsed once into a list of fixed-size items; alignment padding is the only
+// part that depends on the data, since s and z items have a variable length.
+namespace LuaPack {
+	constexpr int MAXINTSIZE = 16;
+	constexpr int MAXALIGN = 8;
 
-	// If no explicit captures, the caller usually pushes the whole match manually if needed.
-	// But in string.match, if level == 0, we return the whole match.
-	// This function populates *captures* specifically.
+	enum Kind : uint8_t {
+		K_INT, K_UINT, K_FLOAT, K_DOUBLE, K_CHAR, K_STRING, K_ZSTR, K_PADDING, K_PADDALIGN, K_NOP
+	};
 
-	for (int i = 0; i < nlevels; ++i) {
-		ptrdiff_t len = ms.capture[i].len;
-		if (len == LuaPattern::CAP_POSITION) {
-			out.push_back(static_cast<double>((ms.capture[i].init - ms.src_init) + 1));
+	struct Item {
+		Kind kind;
+		bool little;
+		uint8_t align;  // Alignment before the item, 0 for none
+		uint32_t size;  // Fixed size in bytes (the length prefix for s)
+	};
+
+	struct Format {
+		std::vector<Item> items;
+		size_t fixed_size = 0;  // Total size when no item is aligned or variable-length
+	};
+
+	static bool is_digit(char c) { return c >= '0' && c <= '9'; }
+
+	static size_t get_num(const char*& fmt, const char* end, size_t df) {
+		if (fmt >= end || !is_digit(*fmt)) return df;
+		size_t a = 0;
+		do {
+			a = a * 10 + (*fmt++ - '0');
 		}
-		else {
-			out.push_back(std::string(ms.capture[i].init, len));
+		while (fmt < end && is_digit(*fmt) && a <= (SIZE_MAX - 9) / 10);
+		return a;
+	}
+
+	static int get_num_limit(const char*& fmt, const char* end, int df) {
+		size_t sz = get_num(fmt, end, df);
+		if (sz > MAXINTSIZE || sz <= 0) {
+			throw std::runtime_error("integral size (" + std::to_string(sz) + ") out of limits [1," +
+				std::to_string(MAXINTSIZE) + "]");
 		}
+		return static_cast<int>(sz);
+	}
+
+	struct Parser {
+		const char* fmt;
+		const char* end;
+		bool little = std::endian::native == std::endian::little;
+		int maxalign = 1;
+
+		Kind option(size_t& size) {
+			char opt = *fmt++;
+			size = 0;
+			switch (opt) {
+			case 'b': size = 1; return K_INT;
+			case 'B': size = 1; return K_UINT;
+			case 'h': size = 2; return K_INT;
+			case 'H': size = 2; return K_UINT;
+			case 'l': size = 8; return K_INT;
+			case 'L': size = 8; return K_UINT;
+			case 'j': size = 8; return K_INT;
+			case 'J': size = 8; return K_UINT;
+			case 'T': size = sizeof(size_t); return K_UINT;
+			case 'f': size = sizeof(float); return K_FLOAT;
+			case 'n': size = sizeof(double); return K_DOUBLE;
+			case 'd': size = sizeof(double); return K_DOUBLE;
+			case 'i': size = get_num_limit(fmt, end, sizeof(int)); return K_INT;
+			case 'I': size = get_num_limit(fmt, end, sizeof(int)); return K_UINT;
+			case 's': size = get_num_limit(fmt, end, sizeof(size_t)); return K_STRING;
+			case 'c':
+				size = get_num(fmt, end, static_cast<size_t>(-1));
+				if (size == static_cast<size_t>(-1)) throw std::runtime_error("missing size for format option 'c'");
+				return K_CHAR;
+			case 'z': return K_ZSTR;
+			case 'x': size = 1; return K_PADDING;
+			case 'X': return K_PADDALIGN;
+			case ' ': break;
+			case '<': little = true; break;
+			case '>': little = false; break;
+			case '=': little = std::endian::native == std::endian::little; break;
+			case '!': maxalign = get_num_limit(fmt, end, MAXALIGN); break;
+			default: throw std::runtime_error(std::string("invalid format option '") + opt + "'");
+			}
+			return K_NOP;
+		}
+	};
+
+	static std::shared_ptr<const Format> compile(std::string_view source) {
+		auto format = std::make_shared<Format>();
+		Parser parser{source.data(), source.data() + source.size()};
+		size_t total = 0;
+		bool fixed = true;
+		while (parser.fmt < parser.end) {
+			size_t size;
+			Kind kind = parser.option(size);
+			size_t align = size;
+			if (kind == K_PADDALIGN) {
+				if (parser.fmt >= parser.end || parser.option(align) == K_CHAR || align == 0)
+					throw std::runtime_error("invalid next option for option 'X'");
+			}
+			if (align <= 1 || kind == K_CHAR) align = 0;
+			else {
+				if (align > static_cast<size_t>(parser.maxalign)) align = parser.maxalign;
+				if (align & (align - 1)) throw std::runtime_error("format asks for alignment not power of 2");
+				fixed = false;
+			}
+			if (size > UINT32_MAX) throw std::runtime_error("format result too large");
+			format->items.push_back({kind, parser.little, static_cast<uint8_t>(align), static_cast<uint32_t>(size)});
+			if (kind == K_STRING || kind == K_ZSTR) fixed = false;
+			total += size;
+		}
+		format->fixed_size = fixed ? total : 0;
+		return format;
+	}
+
+	static std::shared_ptr<const Format> get_format(std::string_view source) {
+		static thread_local CompiledCache<Format> cache;
+		return cache.get(source, compile);
+	}
+
+	static inline size_t padding(size_t total, size_t align) {
+		return align ? (align - (total & (align - 1))) & (align - 1) : 0;
+	}
+
+	static void pack_int(std::string& out, uint64_t n, bool little, int size, bool negative) {
+		char buf[MAXINTSIZE];
+		for (int i = 0; i < size; ++i) {
+			unsigned char byte = i < 8 ? static_cast<unsigned char>(n >> (8 * i)) : (negative ? 0xff : 0);
+			buf[little ? i : size - 1 - i] = static_cast<char>(byte);
+		}
+		out.append(buf, size);
+	}
+
+	// Reads straight from the subject's bytes
+	static int64_t unpack_int(const char* p, bool little, int size, bool is_signed) {
+		uint64_t res = 0;
+		int limit = size <= 8 ? size : 8;
+		for (int i = limit - 1; i >= 0; --i) {
+			res = (res << 8) | static_cast<unsigned char>(p[little ? i : size - 1 - i]);
+		}
+		if (size < 8) {
+			if (is_signed) {
+				uint64_t mask = 1ULL << (size * 8 - 1);
+				res = (res ^ mask) - mask;
+			}
+		}
+		else if (size > 8) {
+			unsigned char fill = (!is_signed || static_cast<int64_t>(res) >= 0) ? 0 : 0xff;
+			for (int i = limit; i < size; ++i) {
+				if (static_cast<unsigned char>(p[little ? i : size - 1 - i]) != fill)
+					throw std::runtime_error(std::to_string(size) + "-byte integer does not fit into Lua Integer");
+			}
+		}
+		return static_cast<int64_t>(res);
+	}
+
+	template <typename F>
+	static F load_float(const char* p, bool little) {
+		char buf[sizeof(F)];
+		std::memcpy(buf, p, sizeof(F));
+		if (little != (std::endian::native == std::endian::little)) std::reverse(buf, buf + sizeof(F));
+		F f;
+		std::memcpy(&f, buf, sizeof(F));
+		return f;
+	}
+
+	template <typename F>
+	static void store_float(std::string& out, F f, bool little) {
+		char buf[sizeof(F)];
+		std::memcpy(buf, &f, sizeof(F));
+		if (little != (std::endian::native == std::endian::little)) std::reverse(buf, buf + sizeof(F));
+		out.append(buf, sizeof(F));
+	}
+
+	// Integer formats take floats only when they hold an exact integer
+	static long long pack_integer(const LuaValue& v, size_t argn) {
+		if (v.index() != INDEX_DOUBLE) return get_integer(v);
+		double d = v.get<double>();
+		if (d >= -0x1p63 && d < 0x1p63 && d == std::floor(d)) return static_cast<long long>(d);
+		throw std::runtime_error("bad argument #" + std::to_string(argn) + " to 'pack' (number has no integer representation)");
+	}
+
+	static void pack(const Format& format, const LuaValue* args, size_t n_args, LuaValueVector& out) {
+		std::string result;
+		result.reserve(format.fixed_size ? format.fixed_size : 32);
+		size_t arg = 0;
+		auto next_arg = [&]() -> const LuaValue& {
+			if (arg >= n_args) throw std::runtime_error("bad argument #" + std::to_string(arg + 2) + " to 'pack' (no value)");
+			return args[arg++];
+		};
+		for (const Item& item : format.items) {
+			result.append(padding(result.size(), item.align), '\0');
+			switch (item.kind) {
+			case K_INT:
+			case K_UINT: {
+				const LuaValue& v = next_arg();
+				long long n = pack_integer(v, arg + 1);
+				if (item.size < 8) {
+					if (item.kind == K_INT) {
+						long long lim = 1LL << (item.size * 8 - 1);
+						if (n < -lim || n >= lim) throw std::runtime_error("bad argument #" + std::to_string(arg + 1) + " to 'pack' (integer overflow)");
+					}
+					else if (static_cast<uint64_t>(n) >= (1ULL << (item.size * 8))) {
+						throw std::runtime_error("bad argument #" + std::to_string(arg + 1) + " to 'pack' (unsigned overflow)");
+					}
+				}
+				pack_int(result, static_cast<uint64_t>(n), item.little, item.size, n < 0);
+				break;
+			}
+			case K_FLOAT:
+				store_float(result, static_cast<float>(get_double(next_arg())), item.little);
+				break;
+			case K_DOUBLE:
+				store_float(result, get_double(next_arg()), item.little);
+				break;
+			case K_CHAR: {
+				std::string s = get_string(next_arg());
+				if (s.size() > item.size) throw std::runtime_error("bad argument #" + std::to_string(arg + 1) + " to 'pack' (string longer than given size)");
+				result.append(s);
+				result.append(item.size - s.size(), '\0');
+				break;
+			}
+			case K_STRING: {
+				std::string s = get_string(next_arg());
+				if (item.size < 8 && s.size() >= (1ULL << (item.size * 8)))
+					throw std::runtime_error("bad argument #" + std::to_string(arg + 1) + " to 'pack' (string length does not fit in given size)");
+				pack_int(result, s.size(), item.little, item.size, false);
+				result.append(s);
+				break;
+			}
+			case K_ZSTR: {
+				std::string s = get_string(next_arg());
+				if (s.find('\0') != std::string::npos) throw std::runtime_error("bad argument #" + std::to_string(arg + 1) + " to 'pack' (string contains zeros)");
+				result.append(s);
+				result.push_back('\0');
+				break;
+			}
+			case K_PADDING:
+				result.push_back('\0');
+				break;
+			case K_PADDALIGN:
+			case K_NOP:
+				break;
+			}
+		}
+		out.assign({std::move(result)});
+	}
+
+	static void unpack(const Format& format, std::string_view data, long long init, LuaValueVector& out) {
+		long long ld = data.size();
+		if (init < 0) init = (-init > ld) ? 0 : ld + init + 1;
+		if (init < 1 || init > ld + 1) throw std::runtime_error("bad argument #3 to 'unpack' (initial position out of string)");
+		size_t pos = init - 1;
+
+		const char* d = data.data();
+		out.clear();
+		for (const Item& item : format.items) {
+			size_t pad = padding(pos, item.align);
+			if (pad + item.size > data.size() - pos) throw std::runtime_error("bad argument #2 to 'unpack' (data string too short)");
+			pos += pad;
+			switch (item.kind) {
+			case K_INT:
+			case K_UINT:
+				out.push_back(static_cast<long long>(unpack_int(d + pos, item.little, item.size, item.kind == K_INT)));
+				break;
+			case K_FLOAT:
+				out.push_back(static_cast<double>(load_float<float>(d + pos, item.little)));
+				break;
+			case K_DOUBLE:
+				out.push_back(load_float<double>(d + pos, item.little));
+				break;
+			case K_CHAR:
+				out.push_back(std::string(d + pos, item.size));
+				break;
+			case K_STRING: {
+				uint64_t len = static_cast<uint64_t>(unpack_int(d + pos, item.little, item.size, false));
+				if (len > data.size() - pos - item.size) throw std::runtime_error("bad argument #2 to 'unpack' (data string too short)");
+				out.push_back(std::string(d + pos + item.size, len));
+				pos += len;
+				break;
+			}
+			case K_ZSTR: {
+				const void* nul = std::memchr(d + pos, '\0', data.size() - pos);
+				if (!nul) throw std::runtime_error("bad argument #2 to 'unpack' (unfinished string for format 'z')");
+				size_t len = static_cast<const char*>(nul) - (d + pos);
+				out.push_back(std::string(d + pos, len));
+				pos += len + 1;
+				break;
+			}
+			case K_PADDALIGN:
+			case K_PADDING:
+			case K_NOP:
+				break;
+			}
+			pos += item.size;
+		}
+		out.push_back(static_cast<long long>(pos + 1));
+	}
+
+	static long long packsize(const Format& format) {
+		size_t total = 0;
+		for (const Item& item : format.items) {
+			if (item.kind == K_STRING || item.kind == K_ZSTR) throw std::runtime_error("bad argument #1 to 'packsize' (variable-length format)");
+			total += padding(total, item.align) + item.size;
+			if (total > static_cast<size_t>(INT32_MAX)) throw std::runtime_error("bad argument #1 to 'packsize' (format result too large)");
+		}
+		return static_cast<long long>(total);
 	}
 }
 
+LuaPackFormat::LuaPackFormat(std::string_view format_string) : source(format_string) {
+	// Invalid formats raise their error where they are used, not at startup
+	try {
+		format = LuaPack::compile(format_string);
+	}
+	catch (const std::exception&) {}
+}
+
+const LuaPack::Format& LuaPackFormat::get() const {
+	if (!format) LuaPack::compile(source);
+	return *format;
+}
+
 // --- Library Functions ---
 
+// string.buffer([s]): LuaX extension for building strings piece by piece.
+// buf:put(...) appends strings and numbers and returns buf; buf:tostring() returns the
+// contents, buf:len() their size and buf:reset() empties the buffer.
+namespace {
+	class LuaStringBuffer : public LuaObject {
+	public:
+		std::string data;
+	};
+
+	LuaObject* string_buffer_metatable;
+
+	LuaStringBuffer* get_buffer(const LuaValue* args, size_t n_args, const char* method) {
+		if (n_args >= 1 && args[0].index() == INDEX_OBJECT) {
+			if (auto* buf = dynamic_cast<LuaStringBuffer*>(args[0].get<LuaObject*>())) return buf;
+		}
+		throw std::runtime_error(std::string("bad argument #1 to '") + method + "' (string buffer expected)");
+	}
+
+	void buffer_put(const LuaValue* args, size_t n_args, LuaValueVector& out) {
+		LuaStringBuffer* buf = get_buffer(args, n_args, "put");
+		for (size_t i = 1; i < n_args; ++i) {
+			switch (args[i].index()) {
+			case INDEX_STRING:
+			case INDEX_STRING_VIEW:
+				buf->data.append(args[i].get<std::string_view>());
+				break;
+			case INDEX_INTEGER:
+			case INDEX_DOUBLE:
+				append_to_string(args[i], buf->data);
+				break;
+			default:
+				throw std::runtime_error("bad argument #" + std::to_string(i) + " to 'put' (string expected)");
+			}
+		}
+		out.assign({args[0]});
+	}
+
+	void buffer_tostring(const LuaValue* args, size_t n_args, LuaValueVector& out) {
+		out.assign({LuaValue(get_buffer(args, n_args, "tostring")->data)});
+	}
+
+	void buffer_len(const LuaValue* args, size_t n_args, LuaValueVector& out) {
+		out.assign({LuaValue(static_cast<long long>(get_buffer(args, n_args, "len")->data.size()))});
+	}
+
+	void buffer_reset(const LuaValue* args, size_t n_args, LuaValueVector& out) {
+		get_buffer(args, n_args, "reset")->data.clear();
+		out.assign({args[0]});
+	}
+}
+
+void string_buffer(const LuaValue* args, size_t n_args, LuaValueVector& out) {
+	auto* buf = new LuaStringBuffer();
+	if (n_args >= 1 && args[0].index() != INDEX_NIL) buf->data = get_string(args[0]);
+	buf->set_metatable(string_buffer_metatable);
+	out.assign({LuaValue(static_cast<LuaObject*>(buf))});
+}
+
 // string.byte
 void string_byte(const LuaValue* args, size_t n_args, LuaValueVector& out) {
 	if (n_args == 0) [[unlikely]] return;
@@ -279,14 +922,8 @@ void string_dump(const LuaValue* args, size_t n_args, LuaValueVector& out) {
 	out.clear();
 }
 
-// string.find
-void string_find(const LuaValue* args, size_t n_args, LuaValueVector& out) {
-	if (n_args < 2) [[unlikely]] return;
-	std::string_view s = get_sv(args[0]);
-	std::string_view p = get_sv(args[1]);
-	long long init = (n_args >= 3) ? static_cast<long long>(get_double(args[2])) : 1;
-	bool plain = (n_args >= 4) ? (args[3].index() == INDEX_BOOLEAN ? args[3].get<bool>() : false) : false;
-
+// string.find / string.match
+static void str_find_aux(std::string_view s, const LuaPattern::Program& prog, long long init, bool find, LuaValueVector& out) {
 	long long len = s.length();
 	if (init < 0) init += len + 1;
 	init = std::max(1LL, init);
@@ -297,42 +934,44 @@ void string_find(const LuaValue* args, size_t n_args, LuaValueVector& out) {
 		return;
 	}
 
-	if (plain) {
-		auto pos = s.find(p, static_cast<size_t>(init - 1));
-		if (pos != std::string_view::npos) {
-			out.push_back(static_cast<double>(pos + 1));
-			out.push_back(static_cast<double>(pos + p.length()));
-			return;
+	LuaPattern::MatchState ms;
+	LuaPattern::init_state(ms, s, prog);
+	const char* e;
+	if (const char* start = LuaPattern::search(ms, prog, s.data() + init - 1, e)) {
+		if (find) {
+			out.push_back(static_cast<double>(start - s.data() + 1));
+			out.push_back(static_cast<double>(e - s.data()));
 		}
+		LuaPattern::push_captures(ms, start, e, !find, out);
+		return;
 	}
-	else {
-		LuaPattern::MatchState ms;
-		ms.src = s;
-		ms.src_init = s.data();
-		ms.p_end = p.data() + p.length();
+	out.push_back(LuaValue());
+}
 
-		const char* s_ptr = s.data() + init - 1;
-		const char* s_end = s.data() + len;
-		bool anchor = !p.empty() && p[0] == '^';
-		const char* p_eff = anchor ? p.data() + 1 : p.data();
+void string_find(const LuaValue* args, size_t n_args, LuaValueVector& out) {
+	if (n_args < 2) [[unlikely]] return;
+	std::string_view s = get_sv(args[0]);
+	std::string_view p = get_sv(args[1]);
+	long long init = (n_args >= 3) ? static_cast<long long>(get_double(args[2])) : 1;
+	bool plain = (n_args >= 4) ? (args[3].index() == INDEX_BOOLEAN ? args[3].get<bool>() : false) : false;
 
-		do {
-			ms.level = 0;
-			if (const char* res = LuaPattern::match(&ms, s_ptr, p_eff)) {
-				out.push_back(static_cast<double>(s_ptr - s.data() + 1));
-				out.push_back(static_cast<double>(res - s.data()));
-				for (int i = 0; i < ms.level; ++i) {
-					if (ms.capture[i].len == LuaPattern::CAP_POSITION)
-						out.push_back(static_cast<double>(ms.capture[i].init - ms.src_init + 1));
-					else
-						out.push_back(std::string(ms.capture[i].init, ms.capture[i].len));
-				}
+	if (plain || !LuaPattern::has_specials(p)) {
+		long long len = s.length();
+		if (init < 0) init += len + 1;
+		init = std::max(1LL, init);
+		out.clear();
+		if (init <= len + 1) {
+			if (const char* pos = LuaPattern::find_literal(s.data() + init - 1, s.data() + len, p)) {
+				out.push_back(static_cast<double>(pos - s.data() + 1));
+				out.push_back(static_cast<double>(pos - s.data() + p.length()));
 				return;
 			}
 		}
-		while (s_ptr++ < s_end && !anchor);
+		out.push_back(LuaValue());
+		return;
 	}
-	out.push_back(LuaValue());
+	auto prog = LuaPattern::get_program(p);
+	str_find_aux(s, *prog, init, true, out);
 }
 
 // string.format
@@ -394,165 +1033,76 @@ void string_format(const LuaValue* args, size_t n_args, LuaValueVector& out) {
 }
 
 // string.gmatch
-void string_gmatch(const LuaValue* args, size_t n_args, LuaValueVector& out) {
-	if (n_args < 2) [[unlikely]] return;
-	// We must copy the strings into shared_ptrs because the iterator might outlive the call
-	auto s_ptr = new std::string(get_sv(args[0]));
-	auto p_ptr = new std::string(get_sv(args[1]));
-	auto last_match_ptr = new size_t(0);
-	auto done_ptr = new bool(false);
-
-	auto iter = [s_ptr, p_ptr, last_match_ptr, done_ptr](const LuaValue*, size_t, LuaValueVector& iter_out) {
-		if (*done_ptr) return;
-
-		std::string_view s(*s_ptr);
-		std::string_view p(*p_ptr);
-
+static void str_gmatch_aux(const LuaValue& src, std::shared_ptr<const LuaPattern::Program> prog, LuaValueVector& out) {
+	// The iterator keeps the subject and the program alive; positions are offsets into it
+	auto iter = [src, prog = std::move(prog), next_pos = size_t(0), done = false](
+		const LuaValue*, size_t, LuaValueVector& iter_out) mutable {
+		iter_out.clear();
+		if (done) return;
+
+		std::string_view s = get_sv(src);
 		LuaPattern::MatchState ms;
-		ms.src = s;
-		ms.src_init = s.data();
-		ms.p_end = p.data() + p.length();
-
-		const char* s_start = s.data();
-		const char* s_end = s_start + s.length();
-		const char* curr = s_start + *last_match_ptr;
-
-		bool anchor = !p.empty() && p[0] == '^';
-		const char* p_eff = anchor ? p.data() + 1 : p.data();
-
-		while (curr <= s_end) {
-			ms.level = 0;
-			if (const char* res = LuaPattern::match(&ms, curr, p_eff)) {
-				// Update match position for next iteration
-				size_t next_pos = res - s_start;
-				if (res == curr) next_pos++; // Advance 1 if empty match
-				*last_match_ptr = next_pos;
-				if (anchor) *done_ptr = true;
-
-				iter_out.clear();
-				if (ms.level == 0) {
-					iter_out.push_back(std::string(curr, res - curr));
-				}
-				else {
-					for (int i = 0; i < ms.level; ++i) {
-						if (ms.capture[i].len == LuaPattern::CAP_POSITION)
-							iter_out.push_back(static_cast<double>(ms.capture[i].init - ms.src_init + 1));
-						else
-							iter_out.push_back(std::string(ms.capture[i].init, ms.capture[i].len));
-					}
-				}
+		LuaPattern::init_state(ms, s, *prog);
+
+		const char* curr = s.data() + next_pos;
+		const char* e;
+		if (curr <= ms.src_end) {
+			if (const char* start = LuaPattern::search(ms, *prog, curr, e)) {
+				// Advance 1 if empty match
+				next_pos = (e - s.data()) + (e == start ? 1 : 0);
+				if (prog->anchored) done = true;
+				LuaPattern::push_captures(ms, start, e, true, iter_out);
 				return;
 			}
-			if (anchor) break;
-			curr++;
 		}
-		*done_ptr = true;
+		done = true;
 	};
 
 	out.assign({make_lua_callable(std::move(iter)), LuaValue(), LuaValue()});
 }
 
-// string.gsub
-void string_gsub(const LuaValue* args, size_t n_args, LuaValueVector& out) {
-	if (n_args < 3) [[unlikely]] return;
-	std::string_view s = get_sv(args[0]);
-	std::string_view p = get_sv(args[1]);
-	const auto& repl = args[2];
-	long long max_s = (n_args >= 4) ? static_cast<long long>(get_double(args[3])) : -1;
+void string_gmatch(const LuaValue* args, size_t n_args, LuaValueVector& out) {
+	if (n_args < 2) [[unlikely]] return;
+	str_gmatch_aux(args[0], LuaPattern::get_program(get_sv(args[1])), out);
+}
 
+// string.gsub
+static void str_gsub_aux(std::string_view s, const LuaPattern::Program& prog, const LuaValue& repl, long long max_s,
+                         LuaValueVector& out) {
 	std::string result;
 	result.reserve(s.size()); // Pre-reserve to minimize reallocs
 
 	LuaPattern::MatchState ms;
-	ms.src = s;
-	ms.src_init = s.data();
-	ms.p_end = p.data() + p.length();
+	LuaPattern::init_state(ms, s, prog);
 
 	const char* s_start = s.data();
 	const char* s_end = s_start + s.length();
 	const char* curr = s_start;
 	const char* last_match_end = s_start;
-
-	bool anchor = !p.empty() && p[0] == '^';
-	const char* p_eff = anchor ? p.data() + 1 : p.data();
 	long long count = 0;
 
 	LuaValueVector callback_args; // Reused for performance
 
 	while (curr <= s_end && (max_s < 0 || count < max_s)) {
-		ms.level = 0;
-		if (const char* res = LuaPattern::match(&ms, curr, p_eff)) {
-			count++;
-			// Append non-matched part
-			result.append(last_match_end, curr - last_match_end);
-
-			// Handle replacement logic
-			std::string_view r_text;
-			bool is_string_repl = false;
-
-			switch (repl.index()) {
-				case INDEX_STRING:
-					r_text = repl.get<std::string_view>();
-					is_string_repl = true;
-					break;
-				case INDEX_STRING_VIEW:
-					r_text = repl.get<std::string_view>();
-					is_string_repl = true;
-					break;
-				case INDEX_FUNCTION: {
-					auto* r_func = repl.get<LuaCallable*>();
-					// Function replacement
-					callback_args.clear();
-					if (ms.level == 0) callback_args.push_back(std::string(curr, res - curr));
-					else {
-						for (int i = 0; i < ms.level; ++i)
-							callback_args.push_back(std::string(ms.capture[i].init, ms.capture[i].len));
-					}
-					LuaValueVector cb_res;
-					r_func->call(callback_args.data(), callback_args.size(), cb_res);
-					if (!cb_res.empty() && cb_res[0].index() != INDEX_NIL) {
-						if (cb_res[0].index() == INDEX_STRING || cb_res[0].index() == INDEX_STRING_VIEW) {
-							result.append(cb_res[0].get<std::string_view>());
-						} else {
-							append_to_string(cb_res[0], result);
-						}
-					} else {
-						result.append(curr, res - curr);
-					}
-					break;
-				}
-				case INDEX_OBJECT: {
-					auto* r_obj = repl.get<LuaObject*>();
-					// Table replacement
-					std::string key = (ms.level == 0)
-						                  ? std::string(curr, res - curr)
-						                  : std::string(ms.capture[0].init, ms.capture[0].len);
-					auto val = r_obj->get(key);
-					if (val.index() != INDEX_NIL) {
-						if (val.index() == INDEX_STRING || val.index() == INDEX_STRING_VIEW) {
-							result.append(val.get<std::string_view>());
-						} else {
-							append_to_string(val, result);
-						}
-					} else {
-						result.append(curr, res - curr);
-					}
-					break;
-				}
-				default:
-					break;
-			}
-
-			if (is_string_repl) {
+		const char* res;
+		const char* start = LuaPattern::search(ms, prog, curr, res);
+		if (!start) break;
+		count++;
+		// Append non-matched part
+		result.append(last_match_end, start - last_match_end);
+
+		switch (repl.index()) {
+			case INDEX_STRING:
+			case INDEX_STRING_VIEW: {
 				// String replacement with % captures
+				std::string_view r_text = repl.get<std::string_view>();
 				for (size_t i = 0; i < r_text.length(); ++i) {
 					if (r_text[i] == '%' && i + 1 < r_text.length()) {
 						char next = r_text[++i];
-						if (isdigit(next)) {
+						if (isdigit(static_cast<unsigned char>(next))) {
 							int cap_idx = next - '0';
-							if (cap_idx == 0) result.append(curr, res - curr);
-							else if (cap_idx <= ms.level) result.append(ms.capture[cap_idx - 1].init,
-							                                            ms.capture[cap_idx - 1].len);
+							if (cap_idx == 0) result.append(start, res - start);
+							else append_to_string(LuaPattern::capture_value(ms, cap_idx - 1, start, res), result);
 						}
 						else if (next == '%') {
 							result += '%';
@@ -566,21 +1116,62 @@ void string_gsub(const LuaValue* args, size_t n_args, LuaValueVector& out) {
 						result += r_text[i];
 					}
 				}
+				break;
 			}
-
-			last_match_end = res;
-			curr = res + (res == curr ? 1 : 0); // Avoid infinite loop on empty match
-			if (anchor) break;
-			continue;
+			case INDEX_FUNCTION: {
+				auto* r_func = repl.get<LuaCallable*>();
+				// Function replacement
+				callback_args.clear();
+				LuaPattern::push_captures(ms, start, res, true, callback_args);
+				LuaValueVector cb_res;
+				r_func->call(callback_args.data(), callback_args.size(), cb_res);
+				if (!cb_res.empty() && cb_res[0].index() != INDEX_NIL && !(cb_res[0].index() == INDEX_BOOLEAN && !cb_res[0].get<bool>())) {
+					if (cb_res[0].index() == INDEX_STRING || cb_res[0].index() == INDEX_STRING_VIEW) {
+						result.append(cb_res[0].get<std::string_view>());
+					} else {
+						append_to_string(cb_res[0], result);
+					}
+				} else {
+					result.append(start, res - start);
+				}
+				break;
+			}
+			case INDEX_OBJECT: {
+				auto* r_obj = repl.get<LuaObject*>();
+				// Table replacement, keyed by the first capture
+				auto val = r_obj->get(LuaPattern::capture_value(ms, 0, start, res));
+				if (val.index() != INDEX_NIL && !(val.index() == INDEX_BOOLEAN && !val.get<bool>())) {
+					if (val.index() == INDEX_STRING || val.index() == INDEX_STRING_VIEW) {
+						result.append(val.get<std::string_view>());
+					} else {
+						append_to_string(val, result);
+					}
+				} else {
+					result.append(start, res - start);
+				}
+				break;
+			}
+			default:
+				break;
 		}
-		if (anchor) break;
-		curr++;
+
+		last_match_end = res;
+		curr = res + (res == start ? 1 : 0); // Avoid infinite loop on empty match
+		if (prog.anchored) break;
 	}
 
 	result.append(last_match_end, s_end - last_match_end);
 	out.assign({std::move(result), static_cast<double>(count)});
 }
 
+void string_gsub(const LuaValue* args, size_t n_args, LuaValueVector& out) {
+	if (n_args < 3) [[unlikely]] return;
+	long long max_s = (n_args >= 4) ? static_cast<long long>(get_double(args[3])) : -1;
+	// Held for the whole call: a replacement function may evict it from the cache
+	auto prog = LuaPattern::get_program(get_sv(args[1]));
+	str_gsub_aux(get_sv(args[0]), *prog, args[2], max_s, out);
+}
+
 // string.len
 void string_len(const LuaValue* args, size_t n_args, LuaValueVector& out) {
 	std::string s = get_string(args[0]);
@@ -598,51 +1189,23 @@ void string_lower(const LuaValue* args, size_t n_args, LuaValueVector& out) {
 
 void string_match(const LuaValue* args, size_t n_args, LuaValueVector& out) {
 	std::string_view s = get_sv(args[0]);
-	std::string_view p = get_sv(args[1]);
 	long long init = (n_args >= 3) ? static_cast<long long>(get_double(args[2])) : 1;
-	if (init < 0) init += s.length() + 1;
-	init = std::max(1LL, init);
-
-	out.clear();
-	if (init > (long long)s.length() + 1) {
-		out.push_back(LuaValue());
-		return;
-	}
-
-	LuaPattern::MatchState ms;
-	ms.src = s;
-	ms.src_init = s.data();
-	ms.p_end = p.data() + p.length();
-
-	const char* s_ptr = s.data() + init - 1;
-	const char* s_end = s.data() + s.length();
-	bool anchor = !p.empty() && p[0] == '^';
-	const char* p_eff = anchor ? p.data() + 1 : p.data();
-
-	do {
-		ms.level = 0;
-		if (const char* res = LuaPattern::match(&ms, s_ptr, p_eff)) {
-			if (ms.level == 0) out.push_back(std::string(s_ptr, res - s_ptr));
-			else {
-				for (int i = 0; i < ms.level; ++i) {
-					if (ms.capture[i].len == LuaPattern::CAP_POSITION)
-						out.push_back((double)(ms.capture[i].init - ms.src_init + 1));
-					else
-						out.push_back(std::string(ms.capture[i].init, ms.capture[i].len));
-				}
-			}
-			return;
-		}
-	}
-	while (s_ptr++ < s_end && !anchor);
+	auto prog = LuaPattern::get_program(get_sv(args[1]));
+	str_find_aux(s, *prog, init, false, out);
+}
 
-	out.push_back(LuaValue());
+// string.pack
+void string_pack(const LuaValue* args, size_t n_args, LuaValueVector& out) {
+	if (n_args < 1) [[unlikely]] throw std::runtime_error("bad argument #1 to 'pack' (string expected)");
+	auto format = LuaPack::get_format(get_sv(args[0]));
+	LuaPack::pack(*format, args + 1, n_args - 1, out);
 }
 
-// string.pack (Stub)
-void string_pack(const LuaValue* args, size_t n_args, LuaValueVector& out) { out.clear(); }
-// string.packsize (Stub)
-void string_packsize(const LuaValue* args, size_t n_args, LuaValueVector& out) { out.clear(); }
+// string.packsize
+void string_packsize(const LuaValue* args, size_t n_args, LuaValueVector& out) {
+	if (n_args < 1) [[unlikely]] throw std::runtime_error("bad argument #1 to 'packsize' (string expected)");
+	out.assign({LuaValue(LuaPack::packsize(*LuaPack::get_format(get_sv(args[0]))))});
+}
 
 // string.rep
 void string_rep(const LuaValue* args, size_t n_args, LuaValueVector& out) {
@@ -670,6 +1233,55 @@ void string_rep(const LuaValue* args, size_t n_args, LuaValueVector& out) {
 	out.assign({std::move(res)});
 }
 
+// string.scan(s, init, class): LuaX extension for lexers. Returns the index of the first
+// byte at or after init that is outside class (#s + 1 at the end), so runs are skipped
+// without building substrings. Classes: "space" (space, \t, \r, \n), "name" (letters,
+// digits, _), "digit", "xdigit", "line" (all but \n), "dq"/"sq" (all but \ and the quote).
+namespace {
+	enum : uint8_t { SCAN_SPACE = 1, SCAN_NAME = 2, SCAN_DIGIT = 4, SCAN_XDIGIT = 8 };
+
+	constexpr std::array<uint8_t, 256> make_scan_table() {
+		std::array<uint8_t, 256> t{};
+		t[' '] = t['\t'] = t['\r'] = t['\n'] = SCAN_SPACE;
+		for (int c = 'a'; c <= 'z'; c++) t[c] = SCAN_NAME;
+		for (int c = 'A'; c <= 'Z'; c++) t[c] = SCAN_NAME;
+		t['_'] = SCAN_NAME;
+		for (int c = '0'; c <= '9'; c++) t[c] = SCAN_NAME | SCAN_DIGIT | SCAN_XDIGIT;
+		for (int c = 'a'; c <= 'f'; c++) t[c] |= SCAN_XDIGIT;
+		for (int c = 'A'; c <= 'F'; c++) t[c] |= SCAN_XDIGIT;
+		return t;
+	}
+	constexpr std::array<uint8_t, 256> scan_table = make_scan_table();
+}
+
+void string_scan(const LuaValue* args, size_t n_args, LuaValueVector& out) {
+	if (n_args < 3) [[unlikely]] throw std::runtime_error("bad argument #3 to 'scan' (string expected)");
+	std::string_view s = get_sv(args[0]);
+	std::string_view cls = get_sv(args[2]);
+	long long init = std::max(1LL, get_integer(args[1]));
+	long long len = s.length();
+	if (init > len) {
+		out.assign({LuaValue(len + 1)});
+		return;
+	}
+
+	const unsigned char* base = reinterpret_cast<const unsigned char*>(s.data());
+	const unsigned char* p = base + init - 1;
+	const unsigned char* end = base + len;
+	if (cls == "line") {
+		const void* nl = std::memchr(p, '\n', end - p);
+		p = nl ? static_cast<const unsigned char*>(nl) : end;
+	} else if (cls == "dq" || cls == "sq") {
+		unsigned char quote = cls[0] == 'd' ? '"' : '\'';
+		while (p < end && *p != quote && *p != '\\') p++;
+	} else {
+		uint8_t mask = cls == "space" ? SCAN_SPACE : cls == "name" ? SCAN_NAME : cls == "digit" ? SCAN_DIGIT : cls == "xdigit" ? SCAN_XDIGIT : 0;
+		if (!mask) [[unlikely]] throw std::runtime_error("bad argument #3 to 'scan' (invalid class '" + std::string(cls) + "')");
+		while (p < end && (scan_table[*p] & mask)) p++;
+	}
+	out.assign({LuaValue(static_cast<long long>(p - base + 1))});
+}
+
 // string.reverse
 void string_reverse(const LuaValue* args, size_t n_args, LuaValueVector& out) {
 	std::string s = get_string(args[0]);
@@ -685,8 +1297,13 @@ void string_sub(const LuaValue* args, size_t n_args, LuaValueVector& out) {
     out.assign({lua_string_sub(args[0], i, j)});
 }
 
-// string.unpack (Stub)
-void string_unpack(const LuaValue* args, size_t n_args, LuaValueVector& out) { out.clear(); }
+// string.unpack
+void string_unpack(const LuaValue* args, size_t n_args, LuaValueVector& out) {
+	if (n_args < 2) [[unlikely]] throw std::runtime_error("bad argument #2 to 'unpack' (string expected)");
+	auto format = LuaPack::get_format(get_sv(args[0]));
+	long long init = (n_args >= 3 && args[2].index() != INDEX_NIL) ? get_integer(args[2]) : 1;
+	LuaPack::unpack(*format, get_sv(args[1]), init, out);
+}
 
 // string.upper
 void string_upper(const LuaValue* args, size_t n_args, LuaValueVector& out) {
@@ -713,6 +1330,37 @@ void lua_string_gsub(const LuaValue& str, const LuaValue& pattern, const LuaValu
 	string_gsub(args, 3, out);
 }
 
+void lua_string_gmatch(const LuaValue& str, const LuaValue& pattern, LuaValueVector& out) {
+	LuaValue args[] = {str, pattern};
+	string_gmatch(args, 2, out);
+}
+
+void lua_string_match(const LuaValue& str, const LuaCompiledPattern& pattern, LuaValueVector& out) {
+	str_find_aux(get_sv(str), pattern.get(), 1, false, out);
+}
+
+void lua_string_find(const LuaValue& str, const LuaCompiledPattern& pattern, LuaValueVector& out) {
+	str_find_aux(get_sv(str), pattern.get(), 1, true, out);
+}
+
+void lua_string_gsub(const LuaValue& str, const LuaCompiledPattern& pattern, const LuaValue& replacement,
+                     LuaValueVector& out) {
+	str_gsub_aux(get_sv(str), pattern.get(), replacement, -1, out);
+}
+
+void lua_string_gmatch(const LuaValue& str, const LuaCompiledPattern& pattern, LuaValueVector& out) {
+	pattern.get();
+	str_gmatch_aux(str, pattern.program, out);
+}
+
+void lua_string_unpack(const LuaPackFormat& format, const LuaValue& data, const LuaValue& init, LuaValueVector& out) {
+	LuaPack::unpack(format.get(), get_sv(data), init.index() == INDEX_NIL ? 1 : get_integer(init), out);
+}
+
+long long lua_string_packsize(const LuaPackFormat& format) {
+	return LuaPack::packsize(format.get());
+}
+
 void lua_string_byte(const LuaValue& str, long long i, long long j, LuaValueVector& out) {
     std::string_view s = get_sv(str);
     long long len = static_cast<long long>(s.length());
@@ -750,6 +1398,7 @@ LuaObject* create_string_library() {
 	if (lib) return lib;
 
 	lib = new LuaObject();
+	lib->set("buffer", LUA_C_FUNC(string_buffer));
 	lib->set("byte", LUA_C_FUNC(string_byte));
 	lib->set("char", LUA_C_FUNC(string_char));
 	lib->set("dump", LUA_C_FUNC(string_dump));
@@ -764,9 +1413,19 @@ LuaObject* create_string_library() {
 	lib->set("packsize", LUA_C_FUNC(string_packsize));
 	lib->set("rep", LUA_C_FUNC(string_rep));
 	lib->set("reverse", LUA_C_FUNC(string_reverse));
+	lib->set("scan", LUA_C_FUNC(string_scan));
 	lib->set("sub", LUA_C_FUNC(string_sub));
 	lib->set("unpack", LUA_C_FUNC(string_unpack));
 	lib->set("upper", LUA_C_FUNC(string_upper));
 
+	// Methods shared by all string.buffer objects
+	string_buffer_metatable = new LuaObject();
+	string_buffer_metatable->set("put", LUA_C_FUNC(buffer_put));
+	string_buffer_metatable->set("tostring", LUA_C_FUNC(buffer_tostring));
+	string_buffer_metatable->set("len", LUA_C_FUNC(buffer_len));
+	string_buffer_metatable->set("reset", LUA_C_FUNC(buffer_reset));
+	string_buffer_metatable->set("__index", string_buffer_metatable);
+	string_buffer_metatable->retain(); // referenced from the static pointer
+
 	return lib;
 }
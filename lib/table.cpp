@@ -3,6 +3,8 @@
 #include <vector>
 #include <algorithm>
 #include <string>
+#include <cstring>
+#include <cstdint>
 
 // table.unpack(list [, i [, j]])
 void table_unpack(const LuaValue* args, size_t n_args, LuaValueVector& out) {
@@ -25,7 +27,13 @@ void table_unpack(const LuaValue* args, size_t n_args, LuaValueVector& out) {
 	out.clear();
 	if (i > j) return;
 
-	// Optimization: If the range is within our current vector, use push_back directly
+	// A range inside the array part is copied in one pass
+	if (i >= 1 && j <= static_cast<long long>(table->array_part.size())) {
+		out.assign(table->array_part.begin() + (i - 1), table->array_part.begin() + j);
+		return;
+	}
+
+	out.reserve(static_cast<size_t>(std::min(j - i + 1, 1LL << 20)));
 	for (long long k = i; k <= j; ++k) {
 		if (k >= 1 && k <= static_cast<long long>(table->array_part.size())) {
 			out.push_back(table->array_part[k - 1]);
@@ -37,53 +45,173 @@ void table_unpack(const LuaValue* args, size_t n_args, LuaValueVector& out) {
 	}
 }
 
+namespace {
+
+// Arrays that table.sort can order by unboxed keys
+enum class SortKind { INTEGERS, DOUBLES, NUMBERS, STRINGS, GENERIC };
+
+SortKind classify_for_sort(const LuaValue* items, size_t n) {
+	bool has_int = false, has_double = false, has_string = false;
+	for (size_t i = 0; i < n; ++i) {
+		switch (items[i].index()) {
+			case INDEX_INTEGER: has_int = true; break;
+			case INDEX_DOUBLE: {
+				double d = items[i].get<double>();
+				if (d != d) return SortKind::GENERIC; // NaN has no order
+				has_double = true;
+				break;
+			}
+			case INDEX_STRING: has_string = true; break;
+			default: return SortKind::GENERIC;
+		}
+	}
+	// Mixing strings and numbers is an error, which the generic path reports
+	if (has_string) return (has_int || has_double) ? SortKind::GENERIC : SortKind::STRINGS;
+	if (has_int && has_double) return SortKind::NUMBERS;
+	return has_int ? SortKind::INTEGERS : SortKind::DOUBLES;
+}
+
+constexpr size_t RADIX_SORT_MIN = 256;
+
+// LSD radix sort on the low `bytes` bytes of each key; a pass on a byte that every key
+// shares is skipped, so small ranges cost only a few passes
+void radix_sort(std::vector<uint64_t>& keys, int bytes) {
+	size_t n = keys.size();
+	std::vector<uint64_t> scratch(n);
+	size_t counts[8][256] = {};
+	for (uint64_t k : keys) {
+		for (int b = 0; b < bytes; ++b) counts[b][(k >> (8 * b)) & 0xFF]++;
+	}
+
+	uint64_t* src = keys.data();
+	uint64_t* dst = scratch.data();
+	for (int b = 0; b < bytes; ++b) {
+		size_t* c = counts[b];
+		int shift = 8 * b;
+		if (c[(src[0] >> shift) & 0xFF] == n) continue;
+		size_t sum = 0;
+		for (int i = 0; i < 256; ++i) {
+			size_t count = c[i];
+			c[i] = sum;
+			sum += count;
+		}
+		for (size_t i = 0; i < n; ++i) {
+			uint64_t k = src[i];
+			dst[c[(k >> shift) & 0xFF]++] = k;
+		}
+		std::swap(src, dst);
+	}
+	if (src != keys.data()) std::copy(src, src + n, keys.data());
+}
+
+void sort_keys(std::vector<uint64_t>& keys, int bytes) {
+	if (keys.size() >= RADIX_SORT_MIN) radix_sort(keys, bytes);
+	else std::sort(keys.begin(), keys.end());
+}
+
+constexpr uint64_t INT48_SIGN = 1ULL << 47;
+constexpr uint64_t DOUBLE_SIGN = 1ULL << 63;
+
+// Integers and doubles hold no references, so the sorted keys are written back as raw values
+void sort_integers(LuaValue* items, size_t n) {
+	std::vector<uint64_t> keys(n);
+	for (size_t i = 0; i < n; ++i) keys[i] = (items[i].raw_data() & PAYLOAD_MASK) ^ INT48_SIGN;
+	sort_keys(keys, 6);
+	for (size_t i = 0; i < n; ++i) items[i] = LuaValue::from_raw(TAG_INTEGER | (keys[i] ^ INT48_SIGN));
+}
+
+// IEEE bits made to compare as unsigned integers: negatives are flipped, positives get the sign bit
+void sort_doubles(LuaValue* items, size_t n) {
+	std::vector<uint64_t> keys(n);
+	for (size_t i = 0; i < n; ++i) {
+		uint64_t bits = items[i].raw_data();
+		keys[i] = (bits & DOUBLE_SIGN) ? ~bits : (bits ^ DOUBLE_SIGN);
+	}
+	sort_keys(keys, 8);
+	for (size_t i = 0; i < n; ++i) {
+		uint64_t k = keys[i];
+		items[i] = LuaValue::from_raw((k & DOUBLE_SIGN) ? (k ^ DOUBLE_SIGN) : ~k);
+	}
+}
+
+// Integers fit in 48 bits, so comparing them as doubles is exact
+void sort_numbers(LuaValue* items, size_t n) {
+	std::vector<std::pair<double, uint64_t>> keys(n);
+	for (size_t i = 0; i < n; ++i) keys[i] = {items[i].get<double>(), items[i].raw_data()};
+	std::sort(keys.begin(), keys.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+	for (size_t i = 0; i < n; ++i) items[i] = LuaValue::from_raw(keys[i].second);
+}
+
+// Strings compare by their first 8 bytes as one big-endian integer, then by memcmp.
+// Short strings live inside the value, so the keys refer to the unmoved array by index.
+void sort_strings(std::vector<LuaValue, PoolAllocator<LuaValue>>& items) {
+	struct Key {
+		uint64_t prefix;
+		std::string_view sv;
+		size_t index;
+	};
+	size_t n = items.size();
+	std::vector<Key> keys(n);
+	for (size_t i = 0; i < n; ++i) {
+		std::string_view sv = items[i].get<std::string_view>();
+		uint64_t prefix = 0;
+		std::memcpy(&prefix, sv.data(), std::min<size_t>(sv.size(), 8));
+		keys[i] = {__builtin_bswap64(prefix), sv, i};
+	}
+	std::sort(keys.begin(), keys.end(), [](const Key& a, const Key& b) {
+		if (a.prefix != b.prefix) return a.prefix < b.prefix;
+		return a.sv < b.sv;
+	});
+
+	std::vector<LuaValue, PoolAllocator<LuaValue>> sorted;
+	sorted.reserve(n);
+	for (const Key& k : keys) sorted.push_back(std::move(items[k.index]));
+	items.swap(sorted);
+}
+
+} // namespace
+
 // table.sort(list [, comp])
 void table_sort(const LuaValue* args, size_t n_args, LuaValueVector& out) {
 	auto table = get_object(args[0]);
-	if (!table || table->array_part.empty()) {
-		out.assign({LuaValue()});
+	out.clear();
+	if (!table || table->array_part.empty()) return;
+
+	// table.sort usually only sorts the array part (1 to #list)
+	// Since we are using std::vector, we sort the array_part directly.
+	auto& items = table->array_part;
+	if (n_args >= 2 && args[1].index() != INDEX_NIL) {
+		const LuaValue& comp = args[1];
+		LuaValueVector comp_buffer;
+		std::sort(items.begin(), items.end(), [&](const LuaValue& a, const LuaValue& b) {
+			return is_lua_truthy(lua_call2(comp, comp_buffer, a, b));
+		});
 		return;
 	}
 
-	LuaValue comp_func_val = (n_args >= 2) ? args[1] : LuaValue();
-	LuaCallable* comp_func = nullptr;
-	switch (comp_func_val.index()) {
-		case INDEX_FUNCTION:
-			comp_func = comp_func_val.get<LuaCallable*>();
-			break;
-		default:
+	switch (classify_for_sort(items.data(), items.size())) {
+		case SortKind::INTEGERS: sort_integers(items.data(), items.size()); break;
+		case SortKind::DOUBLES: sort_doubles(items.data(), items.size()); break;
+		case SortKind::NUMBERS: sort_numbers(items.data(), items.size()); break;
+		case SortKind::STRINGS: sort_strings(items); break;
+		case SortKind::GENERIC:
+			std::sort(items.begin(), items.end(), [](const LuaValue& a, const LuaValue& b) { return lua_less_than(a, b); });
 			break;
 	}
-
-	// table.sort usually only sorts the array part (1 to #list)
-	// Since we are using std::vector, we sort the array_part directly.
-	std::sort(table->array_part.begin(), table->array_part.end(),
-	          [&](const LuaValue& a, const LuaValue& b) {
-		          if (comp_func) {
-			          LuaValueVector comp_buffer;
-			          comp_buffer.clear();
-			          LuaValue func_args[] = {a, b};
-			          comp_func->call(func_args, 2, comp_buffer);
-			          return !comp_buffer.empty() && is_lua_truthy(comp_buffer[0]);
-		          }
-		          return lua_less_than(a, b);
-	          });
-
-	out.clear();
 }
 
 // table.pack(...)
 void table_pack(const LuaValue* args, size_t n_args, LuaValueVector& out) {
 	auto new_table = new LuaObject();
 
-	// Efficiently populate the vector
-	new_table->array_part.reserve(n_args);
-	for (size_t i = 0; i < n_args; ++i) {
-		new_table->array_part.push_back(args[i]);
+	new_table->array_part.assign(args, args + n_args);
+	// set_item never stores a trailing nil in the array part
+	while (!new_table->array_part.empty() && new_table->array_part.back().index() == INDEX_NIL) {
+		new_table->array_part.pop_back();
 	}
 
 	// Lua's table.pack also sets the "n" field to the number of arguments
-	new_table->set("n", static_cast<double>(n_args));
+	new_table->set("n", static_cast<long long>(n_args));
 
 	out.assign({new_table});
 }
@@ -103,6 +231,29 @@ void table_move(const LuaValue* args, size_t n_args, LuaValueVector& out) {
 		return;
 	}
 
+	// Within array parts (the destination may extend its array) the range is copied in bulk.
+	// Stores into the array part never consult __newindex, but a nil in the source range is
+	// read through __index: with an __index metamethod, a range with holes takes the element-wise loop.
+	long long n = e - f + 1;
+	auto holes_use_index = [&]() {
+		if (!a1->metatable || !a1->metatable->find_metamethod(TM_INDEX)) return false;
+		return std::any_of(a1->array_part.begin() + (f - 1), a1->array_part.begin() + e,
+			[](const LuaValue& v) { return v.index() == INDEX_NIL; });
+	};
+	if (f >= 1 && e <= static_cast<long long>(a1->array_part.size()) &&
+		t >= 1 && t <= static_cast<long long>(a2->array_part.size()) + 1 && !holes_use_index()) {
+		auto& dst = a2->array_part;
+		if (t - 1 + n > static_cast<long long>(dst.size())) dst.resize(static_cast<size_t>(t - 1 + n));
+		auto src_begin = a1->array_part.begin() + (f - 1);
+		auto src_end = a1->array_part.begin() + e;
+		auto dst_begin = dst.begin() + (t - 1);
+		if (a1 == a2 && t > f) std::copy_backward(src_begin, src_end, dst_begin + n);
+		else std::copy(src_begin, src_end, dst_begin);
+		while (!dst.empty() && dst.back().index() == INDEX_NIL) dst.pop_back();
+		out.assign({a2});
+		return;
+	}
+
 	// To handle overlapping moves (like moving 1..3 to 2..4), we collect first
 	LuaValueVector range;
 	range.reserve(static_cast<size_t>(e - f + 1));
@@ -127,12 +278,69 @@ void table_concat(const LuaValue* args, size_t n_args, LuaValueVector& out) {
 	long long i = (n_args >= 3) ? get_long_long(args[2]) : 1;
 	long long j = (n_args >= 4) ? get_long_long(args[3]) : static_cast<long long>(table->array_part.size());
 
+	// Inside the array part no user code runs, so the result length is known up front:
+	// strings are measured, other values are formatted once into `formatted`
+	if (i >= 1 && j <= static_cast<long long>(table->array_part.size())) {
+		const LuaValue* items = table->array_part.data();
+		std::string formatted;
+		std::vector<size_t> formatted_ends;
+		size_t total = i <= j ? sep.size() * static_cast<size_t>(j - i) : 0;
+		for (long long k = i; k <= j; ++k) {
+			const LuaValue& val = items[k - 1];
+			if (val.index() == INDEX_STRING) {
+				total += val.get<std::string_view>().size();
+			}
+			else if (val.index() == INDEX_NIL) {
+				throw std::runtime_error("invalid value (nil) at index " + std::to_string(k) + " in table.concat");
+			}
+			else {
+				append_to_string(val, formatted);
+				formatted_ends.push_back(formatted.size());
+			}
+		}
+		total += formatted.size();
+
+		auto fill = [&](char* dst) {
+			size_t next_formatted = 0;
+			size_t formatted_pos = 0;
+			for (long long k = i; k <= j; ++k) {
+				if (k > i) {
+					std::memcpy(dst, sep.data(), sep.size());
+					dst += sep.size();
+				}
+				const LuaValue& val = items[k - 1];
+				std::string_view piece;
+				if (val.index() == INDEX_STRING) {
+					piece = val.get<std::string_view>();
+				}
+				else {
+					size_t end = formatted_ends[next_formatted++];
+					piece = std::string_view(formatted).substr(formatted_pos, end - formatted_pos);
+					formatted_pos = end;
+				}
+				std::memcpy(dst, piece.data(), piece.size());
+				dst += piece.size();
+			}
+		};
+
+		if (total <= STRING_INLINE_MAX) {
+			char buffer[STRING_INLINE_MAX];
+			fill(buffer);
+			out.assign({lua_make_string(std::string_view(buffer, total))});
+		}
+		else {
+			LuaString* result = LuaString::create(std::string_view(""), total);
+			fill(result->chars());
+			result->len = total;
+			result->chars()[total] = '\0';
+			out.assign({lua_adopt_string(result)});
+		}
+		return;
+	}
+
 	std::string result;
 	for (long long k = i; k <= j; ++k) {
-		LuaValue val = (k >= 1 && k <= (long long)table->array_part.size())
-			               ? table->array_part[k - 1]
-			               : table->get_item(static_cast<double>(k));
-
+		LuaValue val = table->get_item(static_cast<double>(k));
 		if (val.index() == INDEX_NIL) {
 			throw std::runtime_error("invalid value (nil) at index " + std::to_string(k) + " in table.concat");
 		}
@@ -143,6 +351,17 @@ void table_concat(const LuaValue* args, size_t n_args, LuaValueVector& out) {
 	out.assign({result});
 }
 
+// table.create(narr [, nhash]) / table.new(narr, nhash)
+void table_create(const LuaValue* args, size_t n_args, LuaValueVector& out) {
+	long long narr = (n_args >= 1) ? get_long_long(args[0]) : 0;
+	long long nhash = (n_args >= 2 && args[1].index() != INDEX_NIL) ? get_long_long(args[1]) : 0;
+	if (narr < 0 || nhash < 0) [[unlikely]] throw std::runtime_error("bad argument to 'table.create' (size out of range)");
+
+	auto new_table = new LuaObject();
+	new_table->reserve(static_cast<size_t>(narr), static_cast<size_t>(nhash));
+	out.assign({new_table});
+}
+
 // table.insert([list,] [pos,] value)
 void table_insert(const LuaValue* args, size_t n_args, LuaValueVector& out) {
 	auto table = get_object(args[0]);
@@ -196,11 +415,13 @@ LuaObject* create_table_library() {
 
 	table_lib = new LuaObject();
 	table_lib->set("concat", LUA_C_FUNC(table_concat));
+	table_lib->set("create", LUA_C_FUNC(table_create));
 	table_lib->set("insert", LUA_C_FUNC(table_insert));
 	table_lib->set("pack", LUA_C_FUNC(table_pack));
 	table_lib->set("unpack", LUA_C_FUNC(table_unpack));
 	table_lib->set("remove", LUA_C_FUNC(table_remove));
 	table_lib->set("move", LUA_C_FUNC(table_move));
+	table_lib->set("new", LUA_C_FUNC(table_create));
 	table_lib->set("sort", LUA_C_FUNC(table_sort));
 
 	return table_lib;
@@ -4,341 +4,477 @@
 #include <stdexcept>
 #include <algorithm>
 #include <cmath>
+#include <bit>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+#if defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define LUAX_UTF8_NEON 1
+#endif
+
+namespace {
+
+constexpr uint32_t MAXUNICODE = 0x10FFFF;
+constexpr uint32_t MAXUTF = 0x7FFFFFFF;
+
+inline bool is_cont(unsigned char c) { return (c & 0xC0) == 0x80; }
+
+// Position p of s is a continuation byte; the end of the string is not
+inline bool cont_at(std::string_view s, size_t p) {
+	return p < s.size() && is_cont(static_cast<unsigned char>(s[p]));
+}
 
-// Helper function to encode a single Unicode codepoint to UTF-8
-std::string encode_utf8(int codepoint) {
-	std::string result;
-	if (codepoint < 0x80) {
-		result += static_cast<char>(codepoint);
-	}
-	else if (codepoint < 0x800) {
-		result += static_cast<char>(0xC0 | (codepoint >> 6));
-		result += static_cast<char>(0x80 | (codepoint & 0x3F));
-	}
-	else if (codepoint < 0x10000) {
-		result += static_cast<char>(0xE0 | (codepoint >> 12));
-		result += static_cast<char>(0x80 | ((codepoint >> 6) & 0x3F));
-		result += static_cast<char>(0x80 | (codepoint & 0x3F));
-	}
-	else if (codepoint < 0x110000) {
-		result += static_cast<char>(0xF0 | (codepoint >> 18));
-		result += static_cast<char>(0x80 | ((codepoint >> 12) & 0x3F));
-		result += static_cast<char>(0x80 | ((codepoint >> 6) & 0x3F));
-		result += static_cast<char>(0x80 | (codepoint & 0x3F));
+// Length of the all-ASCII run at the start of [s, s + n), 32 or 16 bytes at a time
+size_t ascii_prefix(const char* s, size_t n) {
+	size_t i = 0;
+#if defined(__AVX2__)
+	for (; i + 32 <= n; i += 32) {
+		__m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + i));
+		uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(v));
+		if (mask) return i + std::countr_zero(mask);
+	}
+#endif
+#if defined(__SSE2__)
+	for (; i + 16 <= n; i += 16) {
+		__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i));
+		uint32_t mask = static_cast<uint32_t>(_mm_movemask_epi8(v));
+		if (mask) return i + std::countr_zero(mask);
+	}
+#elif defined(LUAX_UTF8_NEON)
+	for (; i + 16 <= n; i += 16) {
+		if (vmaxvq_u8(vld1q_u8(reinterpret_cast<const uint8_t*>(s + i))) >= 0x80) break;
+	}
+#endif
+	for (; i < n; ++i) {
+		if (static_cast<unsigned char>(s[i]) >= 0x80) return i;
+	}
+	return n;
+}
+
+// Decodes the sequence at s, as Lua's utf8_decode does; strict rejects surrogates and values
+// past U+10FFFF. Returns the next position, or nullptr if the sequence is invalid.
+const char* decode(const char* s, const char* end, uint32_t& code, bool strict) {
+	static const uint32_t limits[] = {~0u, 0x80, 0x800, 0x10000u, 0x200000u, 0x4000000u};
+	unsigned int c = static_cast<unsigned char>(s[0]);
+	uint32_t res = 0;
+	if (c < 0x80) {
+		res = c;
 	}
 	else {
-		throw std::runtime_error("Invalid Unicode codepoint");
-	}
-	return result;
+		int count = 0;
+		for (; c & 0x40; c <<= 1) {
+			if (s + count + 1 >= end) return nullptr;
+			unsigned int cc = static_cast<unsigned char>(s[++count]);
+			if (!is_cont(cc)) return nullptr;
+			res = (res << 6) | (cc & 0x3F);
+		}
+		if (count > 5) return nullptr;
+		res |= static_cast<uint32_t>(c & 0x7F) << (count * 5);
+		if (res > MAXUTF || res < limits[count]) return nullptr;
+		s += count;
+	}
+	if (strict && (res > MAXUNICODE || (0xD800u <= res && res <= 0xDFFFu))) return nullptr;
+	code = res;
+	return s + 1;
 }
 
-// Helper function to get the length of a UTF-8 character from its leading byte
-int get_utf8_char_length(unsigned char byte) {
-	if ((byte & 0x80) == 0x00) return 1; // 0xxxxxxx
-	if ((byte & 0xE0) == 0xC0) return 2; // 110xxxxx
-	if ((byte & 0xF0) == 0xE0) return 3; // 1110xxxx
-	if ((byte & 0xF8) == 0xF0) return 4; // 11110xxx
-	return 0; // Invalid UTF-8 start byte
+#if defined(__SSSE3__) || defined(LUAX_UTF8_NEON)
+// Strict UTF-8 validation of 16 bytes at a time with three nibble lookups per byte pair
+// (Keiser and Lemire, "Validating UTF-8 in less than one instruction per byte"). Each table
+// entry holds the errors its nibble allows; a byte pair is invalid when all three agree.
+constexpr uint8_t TOO_SHORT = 1 << 0;  // lead byte not followed by a continuation
+constexpr uint8_t TOO_LONG = 1 << 1;   // continuation after ASCII
+constexpr uint8_t OVERLONG_3 = 1 << 2;
+constexpr uint8_t TOO_LARGE = 1 << 3;
+constexpr uint8_t SURROGATE = 1 << 4;
+constexpr uint8_t OVERLONG_2 = 1 << 5;
+constexpr uint8_t TOO_LARGE_1000 = 1 << 6;
+constexpr uint8_t OVERLONG_4 = 1 << 6;
+constexpr uint8_t TWO_CONTS = 1 << 7;
+constexpr uint8_t CARRY = TOO_SHORT | TOO_LONG | TWO_CONTS;
+
+alignas(16) constexpr uint8_t BYTE_1_HIGH[16] = {
+	TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+	TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,
+	TOO_SHORT | OVERLONG_2,
+	TOO_SHORT,
+	TOO_SHORT | OVERLONG_3 | SURROGATE,
+	TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4,
+};
+alignas(16) constexpr uint8_t BYTE_1_LOW[16] = {
+	CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4,
+	CARRY | OVERLONG_2,
+	CARRY,
+	CARRY,
+	CARRY | TOO_LARGE,
+	CARRY | TOO_LARGE | TOO_LARGE_1000,
+	CARRY | TOO_LARGE | TOO_LARGE_1000,
+	CARRY | TOO_LARGE | TOO_LARGE_1000,
+	CARRY | TOO_LARGE | TOO_LARGE_1000,
+	CARRY | TOO_LARGE | TOO_LARGE_1000,
+	CARRY | TOO_LARGE | TOO_LARGE_1000,
+	CARRY | TOO_LARGE | TOO_LARGE_1000,
+	CARRY | TOO_LARGE | TOO_LARGE_1000,
+	CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE,
+	CARRY | TOO_LARGE | TOO_LARGE_1000,
+	CARRY | TOO_LARGE | TOO_LARGE_1000,
+};
+alignas(16) constexpr uint8_t BYTE_2_HIGH[16] = {
+	TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+	TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4,
+	TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE,
+	TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+	TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+	TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+};
+// A block ending in these lead bytes needs the next block to complete it
+alignas(16) constexpr uint8_t INCOMPLETE_MAX[16] = {
+	255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 0xEF, 0xDF, 0xBF,
+};
+
+#if defined(__SSSE3__)
+using Block = __m128i;
+inline Block load(const char* p) { return _mm_loadu_si128(reinterpret_cast<const Block*>(p)); }
+inline Block table(const uint8_t* t) { return _mm_load_si128(reinterpret_cast<const Block*>(t)); }
+inline Block lookup(Block t, Block nibbles) { return _mm_shuffle_epi8(t, nibbles); }
+inline Block high_nibbles(Block v) { return _mm_and_si128(_mm_srli_epi16(v, 4), _mm_set1_epi8(0x0F)); }
+inline Block low_nibbles(Block v) { return _mm_and_si128(v, _mm_set1_epi8(0x0F)); }
+template <int N> inline Block prev(Block v, Block before) { return _mm_alignr_epi8(v, before, 16 - N); }
+inline Block sat_sub(Block a, Block b) { return _mm_subs_epu8(a, b); }
+inline Block splat(uint8_t c) { return _mm_set1_epi8(static_cast<char>(c)); }
+inline Block zero() { return _mm_setzero_si128(); }
+inline Block band(Block a, Block b) { return _mm_and_si128(a, b); }
+inline Block bor(Block a, Block b) { return _mm_or_si128(a, b); }
+inline Block bxor(Block a, Block b) { return _mm_xor_si128(a, b); }
+inline bool any(Block v) { return _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_setzero_si128())) != 0xFFFF; }
+inline bool is_ascii(Block v) { return _mm_movemask_epi8(v) == 0; }
+// Bytes that start a character: ASCII and lead bytes, not continuations
+inline size_t count_starts(Block v) {
+	return static_cast<size_t>(std::popcount(static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpgt_epi8(v, _mm_set1_epi8(-65))))));
+}
+#else
+using Block = uint8x16_t;
+inline Block load(const char* p) { return vld1q_u8(reinterpret_cast<const uint8_t*>(p)); }
+inline Block table(const uint8_t* t) { return vld1q_u8(t); }
+inline Block lookup(Block t, Block nibbles) { return vqtbl1q_u8(t, nibbles); }
+inline Block high_nibbles(Block v) { return vshrq_n_u8(v, 4); }
+inline Block low_nibbles(Block v) { return vandq_u8(v, vdupq_n_u8(0x0F)); }
+template <int N> inline Block prev(Block v, Block before) { return vextq_u8(before, v, 16 - N); }
+inline Block sat_sub(Block a, Block b) { return vqsubq_u8(a, b); }
+inline Block splat(uint8_t c) { return vdupq_n_u8(c); }
+inline Block zero() { return vdupq_n_u8(0); }
+inline Block band(Block a, Block b) { return vandq_u8(a, b); }
+inline Block bor(Block a, Block b) { return vorrq_u8(a, b); }
+inline Block bxor(Block a, Block b) { return veorq_u8(a, b); }
+inline bool any(Block v) { return vmaxvq_u8(v) != 0; }
+inline bool is_ascii(Block v) { return vmaxvq_u8(v) < 0x80; }
+inline size_t count_starts(Block v) {
+	return vaddvq_u8(vandq_u8(vcgtq_s8(vreinterpretq_s8_u8(v), vdupq_n_s8(-65)), vdupq_n_u8(1)));
 }
+#endif
+
+// Error bits for a block, given the block before it
+inline Block block_errors(Block input, Block before) {
+	Block prev1 = prev<1>(input, before);
+	Block special = band(band(lookup(table(BYTE_1_HIGH), high_nibbles(prev1)), lookup(table(BYTE_1_LOW), low_nibbles(prev1))),
+		lookup(table(BYTE_2_HIGH), high_nibbles(input)));
+	// Third and fourth bytes of a sequence must be continuations, matched by TWO_CONTS above
+	Block third = sat_sub(prev<2>(input, before), splat(0xE0 - 0x80));
+	Block fourth = sat_sub(prev<3>(input, before), splat(0xF0 - 0x80));
+	return bxor(band(bor(third, fourth), splat(0x80)), special);
+}
+
+// Checks that [s, s + n) is strict UTF-8 and counts its characters; false on any error
+bool validate_and_count(const char* s, size_t n, size_t& count) {
+	Block before = zero();
+	Block error = zero();
+	Block incomplete = zero();
+	size_t chars = 0;
+	size_t i = 0;
+	auto step = [&](Block input) {
+		if (is_ascii(input)) {
+			error = bor(error, incomplete);
+			incomplete = zero();
+			chars += 16;
+		}
+		else {
+			error = bor(error, block_errors(input, before));
+			incomplete = sat_sub(input, table(INCOMPLETE_MAX));
+			chars += count_starts(input);
+		}
+		before = input;
+	};
+	for (; i + 16 <= n; i += 16) {
+		step(load(s + i));
+		if ((i & 1023) == 0 && any(error)) return false;
+	}
+	if (i < n) {
+		// The tail is padded with NUL, which also reports a sequence cut off by the end
+		alignas(16) char tail[16] = {};
+		std::memcpy(tail, s + i, n - i);
+		step(load(tail));
+		chars -= 16 - (n - i);
+	}
+	error = bor(error, incomplete);
+	if (any(error)) return false;
+	count = chars;
+	return true;
+}
+#endif
 
-// Helper function to decode a single UTF-8 character from a string
-int decode_utf8(const std::string& s, size_t& offset) {
-	if (offset >= s.length()) {
-		return -1; // No more characters
+std::string_view check_string(const LuaValue* args, size_t n_args, int arg, const char* fname) {
+	if (n_args > static_cast<size_t>(arg - 1)) {
+		const LuaValue& v = args[arg - 1];
+		if (v.index() == INDEX_STRING || v.index() == INDEX_STRING_VIEW) return v.get<std::string_view>();
 	}
+	throw std::runtime_error("bad argument #" + std::to_string(arg) + " to '" + fname + "' (string expected)");
+}
 
-	unsigned char byte1 = static_cast<unsigned char>(s[offset]);
-	const int len = get_utf8_char_length(byte1);
+long long opt_integer(const LuaValue* args, size_t n_args, int arg, long long def) {
+	if (n_args < static_cast<size_t>(arg) || args[arg - 1].is_nil()) return def;
+	return get_long_long(args[arg - 1]);
+}
 
-	if (len == 0 || offset + len > s.length()) {
-		// Invalid UTF-8 sequence or incomplete character
-		// For robustness, we might want to advance by 1 byte and return a replacement char
-		offset++;
-		return 0xFFFD; // Unicode replacement character
-	}
+bool opt_boolean(const LuaValue* args, size_t n_args, int arg) {
+	return n_args >= static_cast<size_t>(arg) && is_lua_truthy(args[arg - 1]);
+}
 
-	int codepoint = 0;
-	if (len == 1) {
-		codepoint = byte1;
-	}
-	else if (len == 2) {
-		codepoint = (byte1 & 0x1F) << 6;
-		codepoint |= (static_cast<unsigned char>(s[offset + 1]) & 0x3F);
-	}
-	else if (len == 3) {
-		codepoint = (byte1 & 0x0F) << 12;
-		codepoint |= (static_cast<unsigned char>(s[offset + 1]) & 0x3F) << 6;
-		codepoint |= (static_cast<unsigned char>(s[offset + 2]) & 0x3F);
-	}
-	else {
-		codepoint = (byte1 & 0x07) << 18;
-		codepoint |= (static_cast<unsigned char>(s[offset + 1]) & 0x3F) << 12;
-		codepoint |= (static_cast<unsigned char>(s[offset + 2]) & 0x3F) << 6;
-		codepoint |= (static_cast<unsigned char>(s[offset + 3]) & 0x3F);
+// Negative positions count from the end of a string of len bytes
+long long posrelat(long long pos, size_t len) {
+	if (pos >= 0) return pos;
+	if (0u - static_cast<size_t>(pos) > len) return 0;
+	return static_cast<long long>(len) + pos + 1;
+}
+
+[[noreturn]] void arg_error(int arg, const char* fname, const char* msg) {
+	throw std::runtime_error("bad argument #" + std::to_string(arg) + " to '" + fname + "' (" + msg + ")");
+}
+
+// Counted strings remember the answer
+bool is_ascii_string(const LuaValue& v, std::string_view s) {
+	if (is_counted_string(v.raw_data())) {
+		auto* ls = reinterpret_cast<LuaString*>(v.raw_data() & PAYLOAD_MASK);
+		if (ls->ascii == LuaString::ASCII_UNKNOWN) {
+			ls->ascii = ascii_prefix(s.data(), s.size()) == s.size() ? LuaString::ASCII_YES : LuaString::ASCII_NO;
+		}
+		return ls->ascii == LuaString::ASCII_YES;
 	}
-	offset += len;
-	return codepoint;
+	return ascii_prefix(s.data(), s.size()) == s.size();
+}
+
+} // namespace
+
+// Helper function to encode a single codepoint (up to 0x7FFFFFFF, as Lua allows) to UTF-8
+std::string encode_utf8(long long codepoint) {
+	std::string result;
+	uint32_t x = static_cast<uint32_t>(codepoint);
+	if (x < 0x80) {
+		result += static_cast<char>(x);
+		return result;
+	}
+	char buf[8];
+	int n = 1;
+	uint32_t mfb = 0x3f; // Largest value that fits in the first byte
+	do {
+		buf[8 - (n++)] = static_cast<char>(0x80 | (x & 0x3f));
+		x >>= 6;
+		mfb >>= 1;
+	} while (x > mfb);
+	buf[8 - n] = static_cast<char>((~mfb << 1) | x);
+	result.assign(buf + 8 - n, n);
+	return result;
 }
 
 // utf8.char (integer codepoint(s) to string)
 void utf8_char(const LuaValue* args, size_t n_args, LuaValueVector& out) {
 	std::string result_str;
 	for (size_t i = 0; i < n_args; ++i) {
-		LuaValue cp_val = args[i];
-		switch (cp_val.index()) {
-			case INDEX_NIL:
-				goto end_loop; // break the loop
-			case INDEX_DOUBLE:
-				result_str += encode_utf8(static_cast<int>(cp_val.get<double>()));
-				break;
-			case INDEX_INTEGER:
-				result_str += encode_utf8(static_cast<int>(cp_val.get<long long>()));
-				break;
-			default:
-				throw std::runtime_error("bad argument #" + std::to_string(i + 1) + " to 'char' (number expected)");
+		if (args[i].index() != INDEX_INTEGER && args[i].index() != INDEX_DOUBLE) {
+			arg_error(static_cast<int>(i + 1), "char", "number expected");
 		}
+		long long code = get_long_long(args[i]);
+		if (code < 0 || code > static_cast<long long>(MAXUTF)) arg_error(static_cast<int>(i + 1), "char", "value out of range");
+		result_str += encode_utf8(code);
 	}
-end_loop:
 	out.assign({result_str});
-	return;
 }
 
-// utf8.charpattern
-void utf8_charpattern(const LuaValue* args, size_t n_args, LuaValueVector& out) {
-	out.assign({std::string("[\0-\x7F\xC2-\xF4][\x80-\xBF]*")});
-	return;
-}
-
-// utf8.codepoint (string to integer codepoint(s))
+// utf8.codepoint(s [, i [, j [, lax]]]): codes of the characters starting in bytes i..j
 void utf8_codepoint(const LuaValue* args, size_t n_args, LuaValueVector& out) {
-	LuaValue s_val = args[0];
-	std::string s;
-	switch (s_val.index()) {
-		case INDEX_STRING: s = std::string(s_val.get<std::string_view>()); break;
-		case INDEX_STRING_VIEW: s = std::string(s_val.get<std::string_view>()); break;
-		default:
-			throw std::runtime_error("bad argument #1 to 'codepoint' (string expected)");
-	}
+	std::string_view s = check_string(args, n_args, 1, "codepoint");
+	long long posi = posrelat(opt_integer(args, n_args, 2, 1), s.size());
+	long long pose = posrelat(opt_integer(args, n_args, 3, posi), s.size());
+	bool strict = !opt_boolean(args, n_args, 4);
+	if (posi < 1) arg_error(2, "codepoint", "out of bounds");
+	if (pose > static_cast<long long>(s.size())) arg_error(3, "codepoint", "out of bounds");
 
-	double i_double = 1.0;
-	if (n_args >= 2) {
-		switch (args[1].index()) {
-			case INDEX_DOUBLE: i_double = args[1].get<double>(); break;
-			case INDEX_INTEGER: i_double = static_cast<double>(args[1].get<long long>()); break;
-			default: break;
-		}
-	}
-	int i = static_cast<int>(i_double);
-
-	double j_double = i_double;
-	if (n_args >= 3) {
-		switch (args[2].index()) {
-			case INDEX_DOUBLE: j_double = args[2].get<double>(); break;
-			case INDEX_INTEGER: j_double = static_cast<double>(args[2].get<long long>()); break;
-			default: break;
-		}
-	}
-	int j = static_cast<int>(j_double);
-	size_t current_byte_offset = 0;
-
-	// Iterate through the string to find the starting byte offset for the i-th character
-	size_t start_byte_offset = 0;
-	for (int k = 1; k < i; ++k) {
-		if (current_byte_offset >= s.length()) {
-			out.assign({});
-			return; // i is out of bounds
-		}
-		size_t prev_offset = current_byte_offset;
-		decode_utf8(s, current_byte_offset); // Just advance offset
-		if (current_byte_offset == prev_offset) { // If decode_utf8 didn't advance, it's an error or end
-			{
-				out.assign({});
-				return;
-			};
-		}
-	}
-	start_byte_offset = current_byte_offset;
-
-	// Now extract codepoints from i to j
-	current_byte_offset = start_byte_offset;
 	out.clear();
-	for (int k = i; k <= j; ++k) {
-		if (current_byte_offset >= s.length()) {
-			break; // Reached end of string
-		}
-		size_t prev_offset = current_byte_offset;
-		int codepoint = decode_utf8(s, current_byte_offset);
-		if (current_byte_offset == prev_offset) { // If decode_utf8 didn't advance, it's an error or end
-			break;
-		}
-		out.push_back(LuaValue(static_cast<double>(codepoint)));
+	if (posi > pose) return;
+	const char* p = s.data() + posi - 1;
+	const char* se = s.data() + pose;
+	const char* end = s.data() + s.size();
+	out.reserve(static_cast<size_t>(pose - posi + 1));
+	while (p < se) {
+		size_t run = ascii_prefix(p, se - p);
+		for (size_t k = 0; k < run; ++k) out.push_back(static_cast<long long>(static_cast<unsigned char>(p[k])));
+		p += run;
+		if (p >= se) break;
+		uint32_t code;
+		p = decode(p, end, code, strict);
+		if (!p) throw std::runtime_error("invalid UTF-8 code");
+		out.push_back(static_cast<long long>(code));
 	}
 }
 
-// utf8.codes (iterator for codepoints)
+// Iterator of utf8.codes: the state is the string, the control the previous position
+template <bool Strict>
 void utf8_codes_iterator(const LuaValue* args, size_t n_args, LuaValueVector& out) {
-	LuaValue s_val = args[0];
-	std::string s;
-	switch (s_val.index()) {
-		case INDEX_STRING: s = std::string(s_val.get<std::string_view>()); break;
-		case INDEX_STRING_VIEW: s = std::string(s_val.get<std::string_view>()); break;
-		default:
-			out.assign({LuaValue()});
-			return;
+	std::string_view s = check_string(args, n_args, 1, "codes");
+	unsigned long long n = static_cast<unsigned long long>(get_long_long(args[1]));
+	if (n < s.size()) {
+		while (cont_at(s, n)) n++; // Skip the rest of the previous character
 	}
-
-	LuaValue offset_val = args[1];
-	size_t offset = 0;
-	switch (offset_val.index()) {
-		case INDEX_DOUBLE: offset = static_cast<size_t>(offset_val.get<double>()); break;
-		case INDEX_INTEGER: offset = static_cast<size_t>(offset_val.get<long long>()); break;
-		default: break;
-	}
-
-	if (offset >= s.length()) {
-		out.assign({LuaValue()});
-		return;
-	}
-
-	size_t original_offset = offset;
-	int codepoint = decode_utf8(s, offset);
-
-	if (offset > original_offset) {
-		out.assign({LuaValue(static_cast<double>(offset)), LuaValue(static_cast<double>(codepoint))});
-		return;
-	}
-	else {
+	if (n >= s.size()) {
 		out.assign({LuaValue()});
 		return;
 	}
+	uint32_t code;
+	const char* next = decode(s.data() + n, s.data() + s.size(), code, Strict);
+	if (!next || cont_at(s, next - s.data())) throw std::runtime_error("invalid UTF-8 code");
+	out.assign({LuaValue(static_cast<long long>(n + 1)), LuaValue(static_cast<long long>(code))});
 }
 
+// utf8.codes(s [, lax])
 void utf8_codes(const LuaValue* args, size_t n_args, LuaValueVector& out) {
-	LuaValue s_val = args[0];
-	if (s_val.index() != INDEX_STRING && s_val.index() != INDEX_STRING_VIEW) {
+	std::string_view s = check_string(args, n_args, 1, "codes");
+	if (cont_at(s, 0)) arg_error(1, "codes", "invalid UTF-8 code");
+	bool lax = opt_boolean(args, n_args, 2);
+	out.assign({lax ? LUA_C_FUNC(utf8_codes_iterator<false>) : LUA_C_FUNC(utf8_codes_iterator<true>), args[0], LuaValue(0LL)});
+}
+
+std::string_view lua_utf8_codes_subject(const LuaValue& s) {
+	if (s.index() != INDEX_STRING && s.index() != INDEX_STRING_VIEW) {
 		throw std::runtime_error("bad argument #1 to 'codes' (string expected)");
 	}
-	out.assign({LUA_C_FUNC(utf8_codes_iterator), s_val, LuaValue(0.0)});
-	return;
+	std::string_view sv = s.get<std::string_view>();
+	if (cont_at(sv, 0)) arg_error(1, "codes", "invalid UTF-8 code");
+	return sv;
+}
+
+size_t lua_utf8_codes_step(std::string_view s, size_t pos, long long& code) {
+	uint32_t c;
+	const char* next = decode(s.data() + pos, s.data() + s.size(), c, true);
+	if (!next || cont_at(s, next - s.data())) throw std::runtime_error("invalid UTF-8 code");
+	code = c;
+	return next - s.data();
 }
 
-// utf8.len (length of UTF-8 string)
+// utf8.len(s [, i [, j [, lax]]]): characters starting in bytes i..j, or fail and the
+// position of the first invalid byte
 void utf8_len(const LuaValue* args, size_t n_args, LuaValueVector& out) {
-	LuaValue s_val = args[0];
-	std::string s;
-	switch (s_val.index()) {
-		case INDEX_STRING: s = std::string(s_val.get<std::string_view>()); break;
-		case INDEX_STRING_VIEW: s = std::string(s_val.get<std::string_view>()); break;
-		default:
-			throw std::runtime_error("bad argument #1 to 'len' (string expected)");
+	std::string_view s = check_string(args, n_args, 1, "len");
+	long long len = static_cast<long long>(s.size());
+	long long posi = posrelat(opt_integer(args, n_args, 2, 1), s.size());
+	long long posj = posrelat(opt_integer(args, n_args, 3, -1), s.size());
+	bool strict = !opt_boolean(args, n_args, 4);
+	if (!(1 <= posi && --posi <= len)) arg_error(2, "len", "initial position out of bounds");
+	if (!(--posj < len)) arg_error(3, "len", "final position out of bounds");
+
+	if (posi > posj) {
+		out.assign({LuaValue(0LL)});
+		return;
 	}
-
-	size_t len = 0;
-	size_t offset = 0;
-	while (offset < s.length()) {
-		size_t prev_offset = offset;
-		decode_utf8(s, offset);
-		if (offset == prev_offset) { // Should not happen with valid UTF-8, but for safety
-			offset++; // Advance by one byte to avoid infinite loop
+	if (is_ascii_string(args[0], s)) {
+		out.assign({LuaValue(posj - posi + 1)});
+		return;
+	}
+#if defined(__SSSE3__) || defined(LUAX_UTF8_NEON)
+	// Through the end of the string, valid text is counted without decoding it
+	size_t counted;
+	if (strict && posj == len - 1 && validate_and_count(s.data() + posi, s.size() - posi, counted)) {
+		out.assign({LuaValue(static_cast<long long>(counted))});
+		return;
+	}
+#endif
+
+	const char* p = s.data() + posi;
+	const char* stop = s.data() + posj;
+	const char* end = s.data() + s.size();
+	long long n = 0;
+	while (p <= stop) {
+		size_t run = ascii_prefix(p, stop - p + 1);
+		n += static_cast<long long>(run);
+		p += run;
+		if (p > stop) break;
+		uint32_t code;
+		const char* next = decode(p, end, code, strict);
+		if (!next) {
+			out.assign({LuaValue(), LuaValue(static_cast<long long>(p - s.data() + 1))});
+			return;
 		}
-		len++;
+		p = next;
+		n++;
 	}
-	out.assign({LuaValue(static_cast<double>(len))});
-	return;
+	out.assign({LuaValue(n)});
 }
 
-// utf8.offset (byte offset of n-th character)
+// utf8.offset(s, n [, i]): byte position where the n-th character counted from byte i starts
 void utf8_offset(const LuaValue* args, size_t n_args, LuaValueVector& out) {
-	LuaValue s_val = args[0];
-	std::string s;
-	switch (s_val.index()) {
-		case INDEX_STRING: s = std::string(s_val.get<std::string_view>()); break;
-		case INDEX_STRING_VIEW: s = std::string(s_val.get<std::string_view>()); break;
-		default:
-			throw std::runtime_error("bad argument #1 to 'offset' (string expected)");
-	}
-
-	LuaValue n_val = (n_args >= 2) ? args[1] : LuaValue();
-	int n = 0;
-	switch (n_val.index()) {
-		case INDEX_DOUBLE: n = static_cast<int>(n_val.get<double>()); break;
-		case INDEX_INTEGER: n = static_cast<int>(n_val.get<long long>()); break;
-		default:
-			throw std::runtime_error("bad argument #2 to 'offset' (number expected)");
-	}
-
-	// Optional third argument: pos (starting position in bytes)
-	LuaValue pos_val = (n_args >= 3) ? args[2] : LuaValue();
-	size_t byte_offset = 0;
-	switch (pos_val.index()) {
-		case INDEX_DOUBLE: byte_offset = static_cast<size_t>(pos_val.get<double>()) - 1; break;
-		case INDEX_INTEGER: byte_offset = static_cast<size_t>(pos_val.get<long long>()) - 1; break;
-		default: break;
-	}
-
-	if (pos_val.index() != INDEX_NIL) {
-		if (byte_offset >= s.length()) {
-			out.assign({LuaValue()});
-			return; // pos is out of bounds
+	std::string_view s = check_string(args, n_args, 1, "offset");
+	if (n_args < 2 || (args[1].index() != INDEX_INTEGER && args[1].index() != INDEX_DOUBLE)) {
+		arg_error(2, "offset", "number expected");
+	}
+	long long len = static_cast<long long>(s.size());
+	long long n = get_long_long(args[1]);
+	long long posi = posrelat(opt_integer(args, n_args, 3, n >= 0 ? 1 : len + 1), s.size());
+	if (!(1 <= posi && --posi <= len)) arg_error(3, "offset", "position out of bounds");
+
+	if (n != 0 && cont_at(s, posi)) throw std::runtime_error("initial position is a continuation byte");
+	if (n != 0 && is_ascii_string(args[0], s)) {
+		// Every byte is a character
+		if (n > 0) {
+			long long moves = std::min(n - 1, len - posi);
+			posi += moves;
+			n -= moves + 1;
 		}
-		// Adjust byte_offset to be the start of a UTF-8 character
-		while (byte_offset > 0 && (static_cast<unsigned char>(s[byte_offset]) & 0xC0) == 0x80) {
-			byte_offset--;
+		else {
+			long long moves = std::min(-n, posi);
+			posi -= moves;
+			n += moves;
 		}
 	}
-
-	if (n == 0) {
-		// Find the byte offset of the character *after* the last character
-		size_t current_offset = 0;
-		while (current_offset < s.length()) {
-			size_t prev_offset = current_offset;
-			decode_utf8(s, current_offset);
-			if (current_offset == prev_offset) { // Should not happen with valid UTF-8
-				current_offset++;
-			}
-		}
-		out.assign({LuaValue(static_cast<double>(current_offset + 1))});
-		return; // Lua is 1-based
+	else if (n == 0) {
+		while (posi > 0 && cont_at(s, posi)) posi--;
 	}
-
-	size_t current_byte_offset = byte_offset;
-
-	if (n > 0) {
-		int char_count = 0;
-		while (current_byte_offset < s.length()) {
-			char_count++;
-			if (char_count == n) {
-				out.assign({LuaValue(static_cast<double>(current_byte_offset + 1))});
-				return; // Lua is 1-based
-			}
-			size_t prev_offset = current_byte_offset;
-			decode_utf8(s, current_byte_offset);
-			if (current_byte_offset == prev_offset) { // Should not happen with valid UTF-8
-				current_byte_offset++;
-			}
+	else if (n < 0) {
+		while (n < 0 && posi > 0) {
+			do {
+				posi--;
+			} while (posi > 0 && cont_at(s, posi));
+			n++;
 		}
 	}
-	else { // n < 0, count from the end
-		std::vector<size_t> char_start_offsets;
-		size_t temp_offset = 0;
-		while (temp_offset < s.length()) {
-			char_start_offsets.push_back(temp_offset);
-			size_t prev_offset = temp_offset;
-			decode_utf8(s, temp_offset);
-			if (temp_offset == prev_offset) { // Should not happen with valid UTF-8
-				temp_offset++;
-			}
-		}
-
-		unsigned long abs_n = std::abs(n);
-		if (abs_n <= char_start_offsets.size()) {
-			out.assign({LuaValue(static_cast<double>(char_start_offsets[char_start_offsets.size() - abs_n] + 1))});
-			return;
+	else {
+		n--; // The first character is the one at posi
+		while (n > 0 && posi < len) {
+			do {
+				posi++;
+			} while (cont_at(s, posi));
+			n--;
 		}
 	}
 
-	out.assign({LuaValue()});
-	return; // nil for out of bounds
+	if (n == 0) out.assign({LuaValue(posi + 1)});
+	else out.assign({LuaValue()});
 }
 
 LuaObject* create_utf8_library() {
@@ -347,7 +483,7 @@ LuaObject* create_utf8_library() {
 
 	utf8_lib = new LuaObject();
 	utf8_lib->set("char", LUA_C_FUNC(utf8_char));
-	utf8_lib->set("charpattern", std::string("[%z\x01-\x7F\xC2-\xF4][\x80-\xBF]*"));
+	utf8_lib->set("charpattern", std::string("[%z\x01-\x7F\xC2-\xFD][\x80-\xBF]*"));
 	utf8_lib->set("codes", LUA_C_FUNC(utf8_codes));
 	utf8_lib->set("codepoint", LUA_C_FUNC(utf8_codepoint));
 	utf8_lib->set("len", LUA_C_FUNC(utf8_len));
@@ -76,6 +76,11 @@ function TranslatorContext:new(translator, for_header, current_module_object_nam
 	ctx.string_counts = {}        -- Content -> Number of occurrences
 	ctx.strings_to_cache = {}     -- Set of strings that passed the threshold
 	ctx.global_identifier_caches = {}
+	ctx.field_caches = {}         -- Inline cache variables, one per field access site
+	ctx.pattern_caches = {}       -- Constant pattern -> compiled pattern variable
+	ctx.pack_formats = {}         -- Constant string.pack format -> parsed format variable
+	ctx.profile_sites = {}        -- --profile: site definitions, one per generated function
+	ctx.capture_frames = {}       -- Heap closures being translated, innermost last (see note_capture)
 	ctx.current_return_stmt = is_main_script and "goto luax_main_exit;" or "return out_result;"
 	ctx.uses_ret_buf = false
 	ctx.stmt_stack = {{}} 
@@ -130,7 +135,32 @@ function TranslatorContext:declare_variable(name, info)
 end
 
 function TranslatorContext:is_declared(name)
-	return self.declared_variables[name]
+	local info = self.declared_variables[name]
+	if info and #self.capture_frames > 0 then self:note_capture(name, info) end
+	return info
+end
+
+-- C++ name of the traced copy a closure keeps of a captured local, nil when it holds no LuaValue
+local function traced_capture_name(info)
+	if info.is_ptr then return info.ptr_name end
+	if info.scalarized or info.is_direct_callable or info.module_global then return nil end
+	if info.cpp_type and info.cpp_type ~= "LuaValue" then return nil end
+	return info.cpp_name
+end
+
+-- A local declared before a closure's body that the body refers to is one of its captures.
+-- Naming it in the capture hook only forces a capture the [=] lambda would make anyway.
+function TranslatorContext:note_capture(name, info)
+	local cpp_name = traced_capture_name(info)
+	if not cpp_name then return end
+	for i = #self.capture_frames, 1, -1 do
+		local frame = self.capture_frames[i]
+		if frame.scope[name] ~= info then break end
+		if not frame.seen[cpp_name] then
+			frame.seen[cpp_name] = true
+			table.insert(frame.names, cpp_name)
+		end
+	end
 end
 
 function TranslatorContext:to_long_long(expr, tp)
@@ -155,13 +185,24 @@ end
 function TranslatorContext:to_string_view(expr, tp)
 	if tp == "std::string_view" then return expr end
 	if tp == "std::string" then return "std::string_view(" .. expr .. ")" end
-	return "get_string_view(" .. expr .. ")"
+	-- Short strings live inside the LuaValue, so the view needs a holder that outlives the statement.
+	-- Views only outlive their block when built from literals, which never get here (see infer_node_type).
+	local holder = "sv_hold_" .. self:get_unique_id()
+	self:add_statement("LuaValue " .. holder .. " = " .. expr .. ";\n")
+	return "get_string_view(" .. holder .. ")"
 end
 
-function TranslatorContext:getCppType(var_name, init_tp)
-	local analysis = self.var_types and self.var_types[var_name]
-	if not analysis then return "LuaValue" end
+-- Converts a value of type tp to cpp_type
+function TranslatorContext:convert(expr, tp, cpp_type)
+	if cpp_type == "long long" then return self:to_long_long(expr, tp) end
+	if cpp_type == "double" then return self:to_double(expr, tp) end
+	if cpp_type == "bool" then return self:to_bool(expr, tp) end
+	if cpp_type == "std::string_view" then return self:to_string_view(expr, tp) end
+	return expr
+end
 
+-- C++ type able to hold every type in the set
+local function cpp_type_of_set(analysis)
 	local has_int = analysis["long long"]
 	local has_double = analysis["double"]
 	local has_bool = analysis["bool"]
@@ -190,6 +231,12 @@ function TranslatorContext:getCppType(var_name, init_tp)
 	return "LuaValue"
 end
 
+function TranslatorContext:getCppType(var_name, init_tp)
+	local analysis = self.var_types and self.var_types[var_name]
+	if not analysis then return "LuaValue" end
+	return cpp_type_of_set(analysis)
+end
+
 function TranslatorContext:is_reassigned(name)
 	return self.reassigned_vars and self.reassigned_vars[name]
 end
@@ -250,6 +297,35 @@ function TranslatorContext:get_string_cache(s)
 	return self.string_literals[s], "LuaValue"
 end
 
+-- Constant patterns are compiled once, when the program starts
+function TranslatorContext:get_pattern_cache(s)
+	if not self.pattern_caches[s] then
+		local safe_s = s:gsub("[^%a%d]", "_")
+		if #safe_s > 20 then safe_s = safe_s:sub(1, 20) end
+		self.pattern_caches[s] = "_cache_pat_" .. safe_s .. "_" .. self:get_unique_id()
+	end
+	return self.pattern_caches[s]
+end
+
+-- Constant string.unpack/packsize formats are parsed once, when the program starts
+function TranslatorContext:get_pack_format(s)
+	if not self.pack_formats[s] then
+		local safe_s = s:gsub("[^%a%d]", "_")
+		if #safe_s > 20 then safe_s = safe_s:sub(1, 20) end
+		self.pack_formats[s] = "_cache_fmt_" .. safe_s .. "_" .. self:get_unique_id()
+	end
+	return self.pack_formats[s]
+end
+
+-- Each constant-key field access gets its own inline cache (shape + slot)
+function TranslatorContext:get_field_cache(s)
+	local safe_s = s:gsub("[^%a%d]", "_")
+	if #safe_s > 20 then safe_s = safe_s:sub(1, 20) end
+	local var = "_ic_" .. safe_s .. "_" .. self:get_unique_id()
+	table.insert(self.field_caches, var)
+	return var
+end
+
 function TranslatorContext:get_global_cache(name)
 	local count = self.string_counts[name] or 0
 	
@@ -358,9 +434,18 @@ local function build_args_code(ctx, node, start_index, depth, self_arg)
 		end
 	end
 	
+	-- f(...) passes the caller's varargs through as they are
+	if has_complex_args and count == start_index and not self_arg and children[count][1] == "varargs" then
+		local k = ctx.current_function_fixed_params_count
+		local span_var = "varargs_" .. ctx:get_unique_id()
+		ctx:add_statement("LuaValueSpan " .. span_var .. "(args + (n_args > " .. k .. " ? " .. k .. " : n_args), n_args > " .. k .. " ? n_args - " .. k .. " : 0);\n")
+		return span_var, true, 1
+	end
+	
 	if has_complex_args then
+		-- Argument lists of unknown length borrow a pooled buffer instead of allocating
 		local vec_var = "args_vec_" .. ctx:get_unique_id()
-		ctx:add_statement("LuaValueVector " .. vec_var .. "; ")
+		ctx:add_statement("LuaRetBufGuard " .. vec_var .. "_guard; LuaValueVector& " .. vec_var .. " = " .. vec_var .. "_guard.buf; ")
 		ctx:add_statement(vec_var .. ".reserve(" .. (count - start_index + 1 + (self_arg and 1 or 0)) .. ");\n")
 		
 		if self_arg then
@@ -381,31 +466,49 @@ local function build_args_code(ctx, node, start_index, depth, self_arg)
 		return vec_var, true, (count - start_index + 1 + (self_arg and 1 or 0))
 	else
 		local arg_list = {}
+		local arg_types = {}
 		local arg_count = 0
 		
 		if self_arg then
 			table.insert(arg_list, self_arg)
+			table.insert(arg_types, "LuaValue")
 			arg_count = arg_count + 1
 		end
 		
 		for i = start_index, count do
-			local arg_val = translate_node(ctx, children[i], depth + 1)
+			local arg_val, arg_tp = translate_typed_node(ctx, children[i], depth + 1)
 			table.insert(arg_list, arg_val)
+			table.insert(arg_types, arg_tp)
 			arg_count = arg_count + 1
 		end
 		
-		return table.concat(arg_list, ", "), false, arg_count
+		return table.concat(arg_list, ", "), false, arg_count, arg_types
 	end
 end
 
-local function translate_assignment_target(ctx, var_node, value_code, depth)
+-- Slot of a scalar-replaced table: the local and its type
+local function scalar_slot(ctx, node)
+	local use = ctx.scalar_uses and ctx.scalar_uses[node]
+	if not use then return nil end
+	local shape = ctx.scalar_tables[use.decl]
+	if use.key then return shape.names[use.key], shape.types[use.key] or "LuaValue" end
+	if use.index then return shape.items .. "[" .. (use.index - 1) .. "]", "LuaValue" end
+	return nil
+end
+
+local function translate_assignment_target(ctx, var_node, value_code, depth, value_tp)
+	local slot, slot_tp = scalar_slot(ctx, var_node)
+	if slot then
+		return slot .. " = " .. ctx:convert(value_code, value_tp or "LuaValue", slot_tp) .. ";\n"
+	end
 	if var_node[1] == "member_expression" then
 		local base_node = var_node[5][1]
 		local member_node = var_node[5][2]
 		local translated_base = translate_node(ctx, base_node, depth + 1)
 		local member_name = member_node[3]
 		local member_cache_var = ctx:get_string_cache(member_name)
-		return "get_object(" .. translated_base .. ")->set(" .. member_cache_var .. ", " .. value_code .. ");\n"
+		local field_cache_var = ctx:get_field_cache(member_name)
+		return "get_object(" .. translated_base .. ")->set_field(" .. member_cache_var .. ", " .. value_code .. ", " .. field_cache_var .. ");\n"
 	elseif var_node[1] == "table_index_expression" then
 		local base_node = var_node[5][1]
 		local index_node = var_node[5][2]
@@ -418,11 +521,12 @@ local function translate_assignment_target(ctx, var_node, value_code, depth)
 		local cpp_name
 		
 		if not ctx:is_declared(var_name) then
-			cpp_name = ctx:declare_variable(var_name)
-			
 			if ctx.is_main_script then
+				cpp_name = ctx:declare_variable(var_name)
 				declaration_prefix = "LuaValue "
 			else
+				-- Namespace scope: closures refer to it without capturing it
+				cpp_name = ctx:declare_variable(var_name, { module_global = true })
 				ctx:add_module_global_var(var_name)
 			end
 		else
@@ -699,6 +803,11 @@ end)
 
 register_handler("unary_expression", function(ctx, node, depth)
 	local operator = node[2]
+	local use = ctx.scalar_uses and ctx.scalar_uses[node]
+	if use then
+		local shape = ctx.scalar_tables[use.decl]
+		return "lua_stack_array_length(" .. shape.items .. ", " .. shape.n .. ")", "long long"
+	end
 	local translated_operand, op_type = translate_typed_node(ctx, node[5][1], depth + 1)
 	
 	if operator == "-" then
@@ -730,16 +839,29 @@ register_handler("member_expression", function(ctx, node, depth)
 		end
 	end
 	
+	local slot, slot_tp = scalar_slot(ctx, node)
+	if slot then return slot, slot_tp end
+	
 	local base_code = translate_node(ctx, base_node, depth + 1)
 	local member_name = member_node[3]
-	local member_expr = ctx:get_string_expr(member_name)
+	local member_cache_var = ctx:get_string_cache(member_name)
+	local field_cache_var = ctx:get_field_cache(member_name)
 	
-	return "lua_get_member(" .. base_code .. ", " .. member_expr .. ")"
+	return "lua_get_member(" .. base_code .. ", " .. member_cache_var .. ", " .. field_cache_var .. ")"
 end)
 
 register_handler("table_index_expression", function(ctx, node, depth)
 	local base_node = node[5][1]
 	local index_node = node[5][2]
+	local slot, slot_tp = scalar_slot(ctx, node)
+	if slot then return slot, slot_tp end
+	local use = ctx.scalar_uses and ctx.scalar_uses[node]
+	if use then
+		local shape = ctx.scalar_tables[use.decl]
+		local index_code, index_tp = translate_typed_node(ctx, index_node, depth + 1)
+		if index_tp ~= "long long" then index_code = "LuaValue(" .. index_code .. ")" end
+		return "lua_stack_array_get(" .. shape.items .. ", " .. shape.n .. ", " .. index_code .. ")"
+	end
 	local translated_base = translate_node(ctx, base_node, depth + 1)
 	local translated_index = translate_node(ctx, index_node, depth + 1)
 	return "lua_get_member(" .. translated_base .. ", " .. translated_index .. ")"
@@ -852,11 +974,13 @@ register_handler("table_constructor", function(ctx, node, depth)
 
 	if has_complex then
 		for _, stmt in ipairs(complex_statements) do
-			if stmt[1] == "multiret" then
+			if stmt[1] == "multiret" and stmt[2][1] == "varargs" then
+				-- {...} copies the caller's arguments straight into the array part
+				local k = ctx.current_function_fixed_params_count
+				ctx:add_statement("if (n_args > " .. k .. ") " .. temp_table_var .. "->copy_into_array(" .. stmt[3] .. ", args + " .. k .. ", n_args - " .. k .. ");\n")
+			elseif stmt[1] == "multiret" then
 				local varargs_buf = translate_node(ctx, stmt[2], depth + 1, { multiret = true })
-				ctx:add_statement("for (size_t i = 0; i < " .. varargs_buf .. ".size(); ++i) {\n")
-				ctx:add_statement("  " .. temp_table_var .. "->set_item(LuaValue(static_cast<long long>(" .. stmt[3] .. " + i)), std::move(" .. varargs_buf .. "[i]));\n")
-				ctx:add_statement("}\n")
+				ctx:add_statement(temp_table_var .. "->move_into_array(" .. stmt[3] .. ", " .. varargs_buf .. ".data(), " .. varargs_buf .. ".size());\n")
 			end
 		end
 	end
@@ -874,23 +998,34 @@ BuiltinCallHandlers["print"] = function(ctx, node, depth, opts)
 	local children = node[5]
 	local count = #children
 	
+	-- One buffered write for the whole line; the fixed arguments are evaluated before a multiret tail
+	local fixed = {}
+	local rest_buf = nil
+	local function fixed_args()
+		if #fixed == 0 then return "nullptr, 0" end
+		local args_arr = "args_" .. ctx:get_unique_id()
+		ctx:add_statement("const LuaValue " .. args_arr .. "[] = {" .. table.concat(fixed, ", ") .. "};\n")
+		return args_arr .. ", " .. #fixed
+	end
+	
+	local call_args
 	for i = 2, count do
 		local arg_node = children[i]
 		
 		if i == count and (is_multiret(arg_node) or is_table_unpack_call(arg_node)) then
-			local ret_buf = translate_node(ctx, arg_node, depth + 1, { multiret = true })
-			ctx:add_statement("for (size_t k = 0; k < " .. ret_buf .. ".size(); ++k) { ")
-				ctx:add_statement("if (k > 0) std::cout << \"\\t\"; ")
-			ctx:add_statement("print_value(" .. ret_buf .. "[k]); } ")
+			call_args = fixed_args()
+			rest_buf = translate_node(ctx, arg_node, depth + 1, { multiret = true })
 		else
-			local translated_arg = translate_node(ctx, arg_node, depth + 1)
-			ctx:add_statement("print_value(" .. translated_arg .. ");")
-			if i < count then
-				ctx:add_statement("std::cout << \"\\t\";")
-			end
+			table.insert(fixed, (translate_node(ctx, arg_node, depth + 1)))
 		end
 	end
-	ctx:add_statement("std::cout << std::endl;\n")
+	
+	if rest_buf then
+		call_args = call_args .. ", " .. rest_buf .. ".data(), " .. rest_buf .. ".size()"
+	else
+		call_args = fixed_args()
+	end
+	ctx:add_statement("luax_print(" .. call_args .. ");\n")
 	
 	if opts.discard then
 		return ""
@@ -948,6 +1083,37 @@ end
 
 BuiltinCallHandlers["unpack"] = BuiltinCallHandlers["table.unpack"]
 
+-- select over the current function's own varargs reads them in place
+BuiltinCallHandlers["select"] = function(ctx, node, depth, opts)
+	local children = node[5]
+	if #children ~= 3 or children[3][1] ~= "varargs" or ctx:is_declared("select") then return nil end
+	local k = ctx.current_function_fixed_params_count
+	local index_node = children[2]
+	
+	if index_node[1] == "string" and index_node[2] == "#" then
+		local expr = "static_cast<long long>(n_args > " .. k .. " ? n_args - " .. k .. " : 0)"
+		if opts.discard then return "" end
+		if opts.multiret then
+			ctx:add_statement(ctx:use_ret_buf() .. ".assign(1, " .. expr .. ");\n")
+			return ctx:use_ret_buf()
+		end
+		return expr, "long long"
+	end
+	
+	local index_code, index_tp = translate_typed_node(ctx, index_node, depth + 1)
+	local n_code = ctx:to_long_long(index_code, index_tp)
+	if opts.multiret then
+		ctx:add_statement("lua_select_varargs(args, n_args, " .. k .. ", " .. n_code .. ", " .. ctx:use_ret_buf() .. ");\n")
+		return ctx:use_ret_buf()
+	end
+	local expr = "lua_select_vararg(args, n_args, " .. k .. ", " .. n_code .. ")"
+	if opts.discard then
+		ctx:add_statement(expr .. ";\n")
+		return ""
+	end
+	return expr
+end
+
 BuiltinCallHandlers["require"] = function(ctx, node, depth, opts)
 	local module_name_node = node[5][2]
 	if module_name_node and module_name_node[1] == "string" then
@@ -987,10 +1153,21 @@ end
 
 local StringMethodHandlers = {}
 
-local function handle_string_method(method_name, ctx, node, base_node, depth, opts)
+-- method_call: base_node is the receiver of base:method(...) rather than the first argument of string.method
+local function handle_string_method(method_name, ctx, node, base_node, depth, opts, method_call)
+	-- init, plain and the gsub count go through the library call
+	local pattern_node = node[5][3]
+	local n_args = (method_name == "gsub") and 4 or 3
+	if not pattern_node or node[5][n_args + 1] then return nil end
+
 	ctx:capture_start() 
 	local base_code = translate_node(ctx, base_node, depth + 1)
-	local pattern_code = translate_node(ctx, node[5][3], depth + 1)
+	local pattern_code
+	if pattern_node[1] == "string" then
+		pattern_code = ctx:get_pattern_cache(pattern_node[2])
+	else
+		pattern_code = translate_node(ctx, pattern_node, depth + 1)
+	end
 	local replacement_code = (method_name == "gsub") and translate_node(ctx, node[5][4], depth + 1) or nil
 	
 	local sub_statements = ctx:capture_end()
@@ -1003,6 +1180,16 @@ local function handle_string_method(method_name, ctx, node, base_node, depth, op
 		call_stmt = "lua_string_find("..base_code..", "..pattern_code..", " .. ctx:use_ret_buf() .. ");\n"
 	elseif method_name == "gsub" then
 		call_stmt = "lua_string_gsub("..base_code..", "..pattern_code..", "..replacement_code..", " .. ctx:use_ret_buf() .. ");\n"
+	elseif method_name == "gmatch" and method_call then
+		-- Only a string receiver takes the library path; anything else dispatches its own gmatch
+		local recv = "gm_recv_" .. ctx:get_unique_id()
+		local pattern_value = pattern_node[1] == "string" and translate_node(ctx, pattern_node, depth + 1) or pattern_code
+		local method_cache_var = ctx:get_string_cache(method_name) .. ", " .. ctx:get_field_cache(method_name)
+		ctx:add_statement("LuaValue " .. recv .. " = " .. base_code .. ";\n")
+		call_stmt = "if (" .. recv .. ".index() == INDEX_STRING) [[likely]] lua_string_gmatch(" .. recv .. ", " .. pattern_code .. ", " .. ctx:use_ret_buf() .. ");\n" ..
+			"else { LuaValue " .. recv .. "_args[] = {" .. recv .. ", " .. pattern_value .. "}; call_lua_value(lua_get_member(" .. recv .. ", " .. method_cache_var .. "), " .. recv .. "_args, 2, " .. ctx:use_ret_buf() .. "); }\n"
+	elseif method_name == "gmatch" then
+		call_stmt = "lua_string_gmatch("..base_code..", "..pattern_code..", " .. ctx:use_ret_buf() .. ");\n"
 	end
 	
 	ctx:add_statement(call_stmt)
@@ -1032,6 +1219,7 @@ end
 StringMethodHandlers["match"] = function(ctx, node, base_node, depth, opts) return handle_string_method("match", ctx, node, base_node, depth, opts) end
 StringMethodHandlers["find"] = function(ctx, node, base_node, depth, opts) return handle_string_method("find", ctx, node, base_node, depth, opts) end
 StringMethodHandlers["gsub"] = function(ctx, node, base_node, depth, opts) return handle_string_method("gsub", ctx, node, base_node, depth, opts) end
+StringMethodHandlers["gmatch"] = function(ctx, node, base_node, depth, opts) return handle_string_method("gmatch", ctx, node, base_node, depth, opts) end
 
 register_handler("call_expression", function(ctx, node, depth, opts)
 	local func_node = node[5][1]
@@ -1058,8 +1246,8 @@ register_handler("call_expression", function(ctx, node, depth, opts)
 	if func_node[1] == "identifier" then
 		local handler = BuiltinCallHandlers[func_node[3]]
 		if handler then
-			local result = handler(ctx, node, depth, opts)
-			if result then return result end
+			local result, result_tp = handler(ctx, node, depth, opts)
+			if result then return result, result_tp end
 		end
 	end
 	
@@ -1089,7 +1277,7 @@ register_handler("call_expression", function(ctx, node, depth, opts)
 		end
 	end
 	
-	local args_code, is_vector, num_args = build_args_code(ctx, node, 2, depth, nil)
+	local args_code, is_vector, num_args, arg_types = build_args_code(ctx, node, 2, depth, nil)
 	local translated_func_access
 	local is_known_local = false
 	local is_direct_callable = false
@@ -1120,9 +1308,59 @@ register_handler("call_expression", function(ctx, node, depth, opts)
 	
 	-- Direct callable path: call the auto lambda directly without virtual dispatch
 	if is_direct_callable then
-		if not opts.multiret and not is_vector and num_args <= 3 and direct_callable_info.has_specialized then
+		-- Recursive functions are called through their bundle, which every entry receives first
+		local rec = direct_callable_info.rec
+		local function entry_call(entry_name, member, call_args)
+			if rec then
+				return rec .. "." .. member .. "(" .. rec .. (call_args ~= "" and (", " .. call_args) or "") .. ")"
+			end
+			return entry_name .. "(" .. call_args .. ")"
+		end
+		
+		-- Fixed-count entry for callers that only pick results by position
+		if opts.multiret and opts.fixed_results and direct_callable_info.pack_name then
+			local call_args
+			if is_vector then
+				call_args = args_code .. ".data(), " .. args_code .. ".size()"
+			elseif args_code == "" then
+				call_args = "nullptr, 0"
+			else
+				local args_arr = "args_" .. ctx:get_unique_id()
+				ctx:add_statement("const LuaValue " .. args_arr .. "[] = {" .. args_code .. "};\n")
+				call_args = args_arr .. ", " .. num_args
+			end
+			local pack_var = "pack_" .. ctx:get_unique_id()
+			ctx:add_statement("auto " .. pack_var .. " = " .. entry_call(direct_callable_info.pack_name, "p", call_args) .. ";\n")
+			return pack_var
+		end
+		
+		-- Unboxed entry: every unboxed parameter needs an argument of exactly that type
+		local use_typed = direct_callable_info.typed_name and not opts.multiret and not is_vector and num_args == #direct_callable_info.typed_params
+		if use_typed then
+			for i, p_type in ipairs(direct_callable_info.typed_params) do
+				if p_type ~= "LuaValue" and arg_types[i] ~= p_type then
+					use_typed = false
+					break
+				end
+			end
+		end
+		
+		if use_typed then
+			local call_expr = entry_call(direct_callable_info.typed_name, "t", args_code)
+			local ret_type = direct_callable_info.typed_return
+			if opts.no_temp then
+				return call_expr, ret_type
+			elseif opts.discard then
+				ctx:add_statement(call_expr .. ";\n")
+				return ""
+			else
+				local temp_var = "call_res_" .. ctx:get_unique_id()
+				ctx:add_statement(ret_type .. " " .. temp_var .. " = " .. call_expr .. ";\n")
+				return temp_var, ret_type
+			end
+		elseif not opts.multiret and not is_vector and num_args <= 3 and direct_callable_info.has_specialized then
 			-- Use the specialized lambda for single-return, small arity calls
-			local call_expr = direct_callable_info.specialized_name .. "(" .. args_code .. ")"
+			local call_expr = entry_call(direct_callable_info.specialized_name, "s", args_code)
 			if opts.no_temp then
 				return call_expr, "LuaValue"
 			elseif opts.discard then
@@ -1136,13 +1374,13 @@ register_handler("call_expression", function(ctx, node, depth, opts)
 		else
 			-- Use the variadic lambda directly
 			if is_vector then
-				ctx:add_statement(translated_func_access .. "(" .. args_code .. ".data(), " .. args_code .. ".size(), " .. ctx:use_ret_buf() .. ");\n")
+				ctx:add_statement(entry_call(translated_func_access, "v", args_code .. ".data(), " .. args_code .. ".size(), " .. ctx:use_ret_buf()) .. ";\n")
 			elseif args_code == "" then
-				ctx:add_statement(translated_func_access .. "(nullptr, 0, " .. ctx:use_ret_buf() .. ");\n")
+				ctx:add_statement(entry_call(translated_func_access, "v", "nullptr, 0, " .. ctx:use_ret_buf()) .. ";\n")
 			else
 				local args_arr = "args_" .. ctx:get_unique_id()
 				ctx:add_statement("const LuaValue " .. args_arr .. "[] = {" .. args_code .. "};\n")
-				ctx:add_statement(translated_func_access .. "(" .. args_arr .. ", " .. num_args .. ", " .. ctx:use_ret_buf() .. ");\n")
+				ctx:add_statement(entry_call(translated_func_access, "v", args_arr .. ", " .. num_args .. ", " .. ctx:use_ret_buf()) .. ";\n")
 			end
 			
 			if opts.discard then
@@ -1215,6 +1453,7 @@ local MethodCallHandlers = {}
 MethodCallHandlers["match"] = function(ctx, node, base_node, depth, opts) return handle_string_method("match", ctx, node, base_node, depth, opts) end
 MethodCallHandlers["find"] = function(ctx, node, base_node, depth, opts) return handle_string_method("find", ctx, node, base_node, depth, opts) end
 MethodCallHandlers["gsub"] = function(ctx, node, base_node, depth, opts) return handle_string_method("gsub", ctx, node, base_node, depth, opts) end
+MethodCallHandlers["gmatch"] = function(ctx, node, base_node, depth, opts) return handle_string_method("gmatch", ctx, node, base_node, depth, opts, true) end
 
 StringMethodHandlers["byte"] = function(ctx, node, base_node, depth, opts) return MethodCallHandlers["byte"](ctx, node, base_node, depth, opts) end
 StringMethodHandlers["sub"] = function(ctx, node, base_node, depth, opts) return MethodCallHandlers["sub"](ctx, node, base_node, depth, opts) end
@@ -1339,7 +1578,7 @@ register_handler("method_call_expression", function(ctx, node, depth, opts)
 	end
 	
 	local base_code = translate_node(ctx, base_node, depth + 1)
-	local method_cache_var = ctx:get_string_cache(method_name)
+	local method_cache_var = ctx:get_string_cache(method_name) .. ", " .. ctx:get_field_cache(method_name)
 	
 	local args_code, is_vector, num_args = build_args_code(ctx, node, 3, depth, base_code)
 	
@@ -1423,10 +1662,36 @@ register_handler("local_declaration", function(ctx, node, depth)
 				val = ctx:to_string_view(val, tp)
 			end
 			
-			cpp_code = cpp_code .. stmts
+			cpp_code = cpp_code .. stmts .. ctx:flush_statements()
 			cpp_code = cpp_code .. cpp_type .. " " .. var_name .. " = " .. val .. ";\n"
 			ctx:declare_variable(var_name_lua, cpp_type)
 			return cpp_code
+		elseif ctx.scalar_tables and ctx.scalar_tables[node] then
+			-- Non-escaping table: one local per field, or a local array for list items
+			local shape = ctx.scalar_tables[node]
+			local id = ctx:get_unique_id()
+			local values = {}
+			for _, field in ipairs(expr_node[5]) do
+				local value_node = field[5][2] or field[5][1]
+				local val, tp = translate_typed_node(ctx, value_node, depth + 1)
+				cpp_code = cpp_code .. ctx:flush_statements()
+				if shape.kind == "record" then
+					local key = field[5][1][3]
+					local cpp_type = shape.types[key] or "LuaValue"
+					local cpp_name = var_name .. "_" .. key .. "_" .. id
+					shape.names = shape.names or {}
+					shape.names[key] = cpp_name
+					cpp_code = cpp_code .. cpp_type .. " " .. cpp_name .. " = " .. ctx:convert(val, tp, cpp_type) .. ";\n"
+				else
+					table.insert(values, val)
+				end
+			end
+			if shape.kind == "array" then
+				shape.items = var_name .. "_items_" .. id
+				cpp_code = cpp_code .. "LuaValue " .. shape.items .. "[" .. shape.n .. "] = {" .. table.concat(values, ", ") .. "};\n"
+			end
+			ctx:declare_variable(var_node[3], { scalarized = true })
+			return cpp_code
 		elseif expr_node[1] == "table_constructor" then
 			local val, tp = translate_typed_node(ctx, expr_node, depth + 1)
 			local stmts = ctx:flush_statements()
@@ -1466,7 +1731,7 @@ register_handler("local_declaration", function(ctx, node, depth)
 	for i = 1, num_exprs do
 		local expr_node = expr_list_node[5][i]
 		if has_function_call_expr and i == first_call_expr_index then
-			local ret_buf = translate_node(ctx, expr_node, depth + 1, { multiret = true })
+			local ret_buf = translate_node(ctx, expr_node, depth + 1, { multiret = true, fixed_results = true })
 			local stmts = ctx:flush_statements()
 			cpp_code = cpp_code .. stmts
 			function_call_results_var = ret_buf
@@ -1506,13 +1771,38 @@ register_handler("local_declaration", function(ctx, node, depth)
 			initial_value_code = ctx:to_string_view(initial_value_code, tp)
 		end
 		
-		cpp_code = cpp_code .. cpp_type .. " " .. var_name .. " = " .. initial_value_code .. ";\n"
+		cpp_code = cpp_code .. ctx:flush_statements() .. cpp_type .. " " .. var_name .. " = " .. initial_value_code .. ";\n"
 		ctx:declare_variable(var_node[3], cpp_type)
 	end
 	
 	return cpp_code
 end)
 
+-- s = s .. a .. b on a LuaValue local appends to s in place (see lua_concat_into), so
+-- building a string in a loop does not copy it on every iteration
+local function translate_concat_accumulate(ctx, var_node, expr_node, depth)
+	if var_node[1] ~= "identifier" or expr_node[1] ~= "binary_expression" or expr_node[2] ~= ".." then return nil end
+	local first = expr_node[5][1]
+	if first[1] ~= "identifier" or first[3] ~= var_node[3] then return nil end
+	local decl = ctx:is_declared(var_node[3])
+	if not decl or (decl.cpp_type and decl.cpp_type ~= "LuaValue") then return nil end
+
+	local parts = {}
+	local current = expr_node[5][2]
+	while current[1] == "binary_expression" and current[2] == ".." do
+		table.insert(parts, (translate_typed_node(ctx, current[5][1], depth + 1)))
+		current = current[5][2]
+	end
+	table.insert(parts, (translate_typed_node(ctx, current, depth + 1)))
+
+	local cpp_name = decl.cpp_name or sanitize_cpp_identifier(var_node[3])
+	local stmts = ctx:flush_statements()
+	if #parts == 1 then
+		return stmts .. cpp_name .. " = lua_concat(std::move(" .. cpp_name .. "), " .. parts[1] .. ");\n"
+	end
+	return stmts .. cpp_name .. " = lua_concat_append(std::move(" .. cpp_name .. "), " .. table.concat(parts, ", ") .. ");\n"
+end
+
 register_handler("assignment", function(ctx, node, depth)
 	local var_list_node = node[5][1]
 	local expr_list_node = node[5][2]
@@ -1521,6 +1811,11 @@ register_handler("assignment", function(ctx, node, depth)
 	local num_exprs = #(expr_list_node[5] or empty_table)
 	
 	local cpp_code = ctx:flush_statements()
+
+	if num_vars == 1 and num_exprs == 1 then
+		local accumulate = translate_concat_accumulate(ctx, var_list_node[5][1], expr_list_node[5][1], depth)
+		if accumulate then return cpp_code .. accumulate end
+	end
 	
 	local function_call_results_var = nil
 	local has_function_call_expr = false
@@ -1541,7 +1836,7 @@ register_handler("assignment", function(ctx, node, depth)
 	for i = 1, num_exprs do
 		local expr_node = expr_list_node[5][i]
 		if has_function_call_expr and i == first_call_expr_index then
-			local ret_buf = translate_node(ctx, expr_node, depth + 1, { multiret = true })
+			local ret_buf = translate_node(ctx, expr_node, depth + 1, { multiret = true, fixed_results = true })
 			local stmts = ctx:flush_statements()
 			cpp_code = cpp_code .. stmts
 			function_call_results_var = ret_buf
@@ -1589,10 +1884,10 @@ register_handler("assignment", function(ctx, node, depth)
 				
 				target_code = cpp_name .. " = " .. final_value .. ";\n"
 			else
-				target_code = translate_assignment_target(ctx, var_node, value_code, depth)
+				target_code = translate_assignment_target(ctx, var_node, value_code, depth, tp)
 			end
 		else
-			target_code = translate_assignment_target(ctx, var_node, value_code, depth)
+			target_code = translate_assignment_target(ctx, var_node, value_code, depth, tp)
 		end
 		
 		local stmts = ctx:flush_statements()
@@ -1606,8 +1901,30 @@ end)
 -- Function Declaration Handlers
 --------------------------------------------------------------------------------
 
-local function translate_function_body(ctx, node, depth)
+-- --profile: every entry of a function pushes the same static site on the shadow stack
+local function profile_prologue(ctx, name, line)
+	local source = ctx.translator.profile_source
+	if not source then return "" end
+	local site = "luax_prof_site_" .. ctx:get_unique_id()
+	table.insert(ctx.profile_sites, "static LuaProfileSite " .. site .. "(\"" .. escape_cpp_string(name) .. "\", \"" .. escape_cpp_string(source) .. "\", " .. (line or 0) .. ");\n")
+	return "    LuaProfileScope _prof_scope(" .. site .. ");\n"
+end
+
+local function profile_function_name(node)
+	local meta = node[6] or empty_table
+	if not node[3] then return "<anonymous>" end
+	if meta.method_name then
+		return node[3] .. (node[1] == "method_declaration" and ":" or ".") .. meta.method_name
+	end
+	return node[3]
+end
+
+-- traced: the lambdas go into a heap closure, which reports its captures to the cycle collector
+local function translate_function_body(ctx, node, depth, signature, rec_param, pack_count, traced)
+	local prof = profile_prologue(ctx, profile_function_name(node), (node[6] or empty_table).line)
 	ctx:capture_start()
+	-- Recursive entries take their bundle as a leading generic parameter
+	local rec_prefix = rec_param and ("auto& " .. rec_param) or nil
 
 	local params_node = node[5][1]
 	local body_node = node[5][2]
@@ -1616,6 +1933,11 @@ local function translate_function_body(ctx, node, depth)
 	ctx.current_function_fixed_params_count = 0
 	
 	local saved_scope = ctx:save_scope()
+	local frame = nil
+	if traced then
+		frame = { scope = saved_scope, names = {}, seen = {} }
+		table.insert(ctx.capture_frames, frame)
+	end
 	
 	local params_extraction = ""
 	local param_index_offset = 0
@@ -1653,12 +1975,17 @@ local function translate_function_body(ctx, node, depth)
 		for _, p in ipairs(params_node[5]) do if p[1] == "varargs" then has_vararg = true break end end
 	end
 
+	local params_scope = ctx:save_scope()
 	local saved_return_stmt = ctx.current_return_stmt
 	local saved_specialized_mode = ctx.specialized_return_mode
 	
+	local saved_typed_return = ctx.typed_return_type
+	local saved_pack_count = ctx.pack_return_count
 	local saved_uses_ret_buf = ctx.uses_ret_buf
+	ctx.pack_return_count = nil
 	ctx.uses_ret_buf = false
 	ctx.specialized_return_mode = false
+	ctx.typed_return_type = nil
 	ctx.current_return_stmt = "return;"
 	local body_code = translate_node(ctx, body_node, depth + 1, { no_braces = true })
 	local body_stmts = ctx:capture_end()
@@ -1668,12 +1995,6 @@ local function translate_function_body(ctx, node, depth)
 	local combined_body = body_code .. body_stmts
 	local has_terminal_return = combined_body:match("return[^;]*;%s*$")
 	
-	local var_lambda = "[=](const LuaValue* args, size_t n_args, LuaValueVector& out_result) mutable -> void {\n" .. buffer_decl .. params_extraction .. combined_body
-	if not has_terminal_return then
-		var_lambda = var_lambda .. "\n    out_result.clear();"
-	end
-	var_lambda = var_lambda .. "\n}"
-	
 	local spec_lambda = nil
 	if arity <= 3 and not has_vararg then
 		local spec_saved_scope = {}
@@ -1687,12 +2008,12 @@ local function translate_function_body(ctx, node, depth)
 			ctx:declare_variable("self")
 		end
 
-		local spec_params_list = ""
+		local spec_params_list = rec_prefix or ""
 		local spec_params_extraction = ""
 		for i = 1, arity do
 			local p_name = param_names[i]
 			local cpp_p_name = ctx:declare_variable(p_name)
-			spec_params_list = spec_params_list .. (i > 1 and ", " or "") .. "const LuaValue& __a" .. i
+			spec_params_list = spec_params_list .. (spec_params_list ~= "" and ", " or "") .. "const LuaValue& __a" .. i
 			spec_params_extraction = spec_params_extraction .. "    LuaValue " .. cpp_p_name .. " = __a" .. i .. ";\n"
 		end
 		
@@ -1711,28 +2032,121 @@ local function translate_function_body(ctx, node, depth)
 			terminal_return = "\n    return LuaValue(std::monostate{});\n"
 		end
 		
-		spec_lambda = "[=](" .. spec_params_list .. ") mutable -> LuaValue {\n" .. 
-					spec_buffer_decl .. spec_params_extraction .. 
-					spec_combined .. 
+		spec_lambda = { spec_params_list, prof .. spec_buffer_decl .. spec_params_extraction .. spec_combined .. terminal_return .. "}" }
+	end
+	if frame then table.remove(ctx.capture_frames) end
+
+	-- Captures are known once every entry has been translated
+	local capture_hook, capture_hold = "", ""
+	local captures = frame and table.concat(frame.names, ", ") or ""
+	if captures ~= "" then
+		capture_hook = "    if (args == luax_gc_visit_args) [[unlikely]] { luax_trace_captures(n_args, " .. captures .. "); return; }\n"
+		capture_hold = "    luax_hold_captures(" .. captures .. ");\n"
+	end
+
+	local var_lambda = "[=](" .. (rec_prefix and (rec_prefix .. ", ") or "") .. "const LuaValue* args, size_t n_args, LuaValueVector& out_result) mutable -> void {\n" .. capture_hook .. prof .. buffer_decl .. params_extraction .. combined_body
+	if not has_terminal_return then
+		var_lambda = var_lambda .. "\n    out_result.clear();"
+	end
+	var_lambda = var_lambda .. "\n}"
+	if spec_lambda then
+		spec_lambda = "[=](" .. spec_lambda[1] .. ") mutable -> LuaValue {\n" .. capture_hold .. spec_lambda[2]
+	end
+
+	-- Unboxed entry: parameters and result use the types inferred across the module
+	local typed_lambda = nil
+	if signature then
+		local typed_saved_scope = {}
+		for k, v in pairs(saved_scope) do
+			typed_saved_scope[k] = v
+		end
+		ctx:restore_scope(typed_saved_scope)
+		ctx:capture_start()
+
+		local typed_params = { rec_prefix }
+		for i = 1, arity do
+			local p_type = signature.params[i]
+			table.insert(typed_params, p_type .. " " .. ctx:declare_variable(param_names[i], p_type))
+		end
+
+		local boxed_return = signature.ret == "LuaValue"
+		ctx.uses_ret_buf = false
+		ctx.specialized_return_mode = true
+		ctx.typed_return_type = signature.ret
+		ctx.current_return_stmt = boxed_return and "return LuaValue();" or "return {};"
+
+		local typed_body_code = translate_node(ctx, body_node, depth + 1, { no_braces = true })
+		local typed_body_stmts = ctx:capture_end()
+		local typed_combined = typed_body_code .. typed_body_stmts
+
+		local typed_buffer_decl = ctx.uses_ret_buf and ("    LuaRetBufGuard _ret_buf_guard; LuaValueVector& _func_ret_buf = _ret_buf_guard.buf;\n") or ""
+
+		-- Unboxed results are only inferred when every path returns, so this only quiets the compiler
+		local terminal_return = ""
+		if not typed_combined:match("return%s+[^;]+;%s*$") then
+			terminal_return = boxed_return and "\n    return LuaValue(std::monostate{});\n" or "\n    return {};\n"
+		end
+
+		typed_lambda = "[=](" .. table.concat(typed_params, ", ") .. ") mutable -> " .. signature.ret .. " {\n" ..
+					prof .. typed_buffer_decl .. typed_combined ..
+					terminal_return .. "}"
+	end
+
+	-- Fixed-count entry: the results come back by value, not through out_result
+	local pack_lambda = nil
+	if pack_count then
+		local pack_scope = {}
+		for k, v in pairs(params_scope) do
+			pack_scope[k] = v
+		end
+		ctx:restore_scope(pack_scope)
+		ctx:capture_start()
+
+		ctx.uses_ret_buf = false
+		ctx.specialized_return_mode = false
+		ctx.typed_return_type = nil
+		ctx.pack_return_count = pack_count
+		ctx.current_return_stmt = "return {};"
+
+		local pack_body_code = translate_node(ctx, body_node, depth + 1, { no_braces = true })
+		local pack_body_stmts = ctx:capture_end()
+		local pack_combined = pack_body_code .. pack_body_stmts
+
+		local pack_buffer_decl = ctx.uses_ret_buf and ("    LuaRetBufGuard _ret_buf_guard; LuaValueVector& _func_ret_buf = _ret_buf_guard.buf;\n") or ""
+
+		-- Every path returns, so this only quiets the compiler
+		local terminal_return = ""
+		if not pack_combined:match("return%s+[^;]+;%s*$") then
+			terminal_return = "\n    return {};\n"
+		end
+
+		pack_lambda = "[=](" .. (rec_prefix and (rec_prefix .. ", ") or "") .. "const LuaValue* args, size_t n_args) mutable -> LuaValuePack<" .. pack_count .. "> {\n" ..
+					prof .. pack_buffer_decl .. params_extraction .. pack_combined ..
 					terminal_return .. "}"
 	end
 
 	ctx.uses_ret_buf = saved_uses_ret_buf
+	ctx.typed_return_type = saved_typed_return
+	ctx.pack_return_count = saved_pack_count
 	ctx.specialized_return_mode = saved_specialized_mode
 	ctx.current_return_stmt = saved_return_stmt
 	ctx:restore_scope(saved_scope)
 	ctx.current_function_fixed_params_count = prev_param_count
 	
-	return var_lambda, spec_lambda, arity
+	return var_lambda, spec_lambda, arity, typed_lambda, pack_lambda, captures ~= ""
 end
 
-register_handler("function_expression", function(ctx, node, depth)
-	local var_lambda, spec_lambda, arity = translate_function_body(ctx, node, depth)
+-- Heap closure for the lambdas of translate_function_body
+local function closure_expression(var_lambda, spec_lambda, arity, traced)
 	if spec_lambda then
-		return "make_specialized_callable<" .. arity .. ">(" .. var_lambda .. ", " .. spec_lambda .. ")"
-	else
-		return "make_lua_callable(" .. var_lambda .. ")"
+		return (traced and "make_specialized_closure<" or "make_specialized_callable<") .. arity .. ">(" .. var_lambda .. ", " .. spec_lambda .. ")"
 	end
+	return (traced and "make_lua_closure(" or "make_lua_callable(") .. var_lambda .. ")"
+end
+
+register_handler("function_expression", function(ctx, node, depth)
+	local var_lambda, spec_lambda, arity, _, _, traced = translate_function_body(ctx, node, depth, nil, nil, nil, true)
+	return closure_expression(var_lambda, spec_lambda, arity, traced)
 end)
 
 register_handler("function_declaration", function(ctx, node, depth)
@@ -1741,20 +2155,51 @@ register_handler("function_declaration", function(ctx, node, depth)
 	local is_local = node:meta().is_local
 	local is_non_escaping = is_local and func_name and ctx.non_escaping_functions and ctx.non_escaping_functions[func_name]
 
-	-- Non-escaping path: skip shared_ptr pre-declaration
+	-- Non-escaping path: skip the upvalue box pre-declaration
 	if is_local and func_name and not is_non_escaping then
 		ptr_name = func_name .. "_ptr_" .. ctx:get_unique_id()
 		local sanitized_var_name = sanitize_cpp_identifier(func_name)
 		ctx:declare_variable(sanitized_var_name, { is_ptr = true, ptr_name = ptr_name })
 	end
 	
-	local var_lambda, spec_lambda, arity = translate_function_body(ctx, node, depth)
+	-- Only worth an extra entry point when something is unboxed
+	local signature = is_non_escaping and ctx.function_signatures and ctx.function_signatures[node]
+	if signature and signature.ret == "LuaValue" then
+		local any_unboxed = false
+		for _, p_type in ipairs(signature.params) do
+			if p_type ~= "LuaValue" then any_unboxed = true break end
+		end
+		if not any_unboxed then signature = nil end
+	end
 	
 	-- Non-escaping local functions: emit direct auto lambdas
 	if is_non_escaping then
 		local var_name = sanitize_cpp_identifier(func_name)
 		local spec_name = var_name .. "_spec_" .. ctx:get_unique_id()
-		local decl_info = { is_direct_callable = true, has_specialized = (spec_lambda ~= nil), specialized_name = spec_name }
+		local typed_name = signature and (var_name .. "_typed_" .. ctx:get_unique_id()) or nil
+		local pack_count = ctx.fixed_return_counts and ctx.fixed_return_counts[node]
+		local pack_name = pack_count and (var_name .. "_pack_" .. ctx:get_unique_id()) or nil
+		local params_list = node[5][1][5] or empty_table
+		local has_vararg = false
+		for _, p in ipairs(params_list) do if p[1] == "varargs" then has_vararg = true break end end
+		local decl_info = { is_direct_callable = true, has_specialized = (#params_list <= 3 and not has_vararg), specialized_name = spec_name }
+		if signature then
+			decl_info.typed_name = typed_name
+			decl_info.typed_params = signature.params
+			decl_info.typed_return = signature.ret
+		end
+		decl_info.pack_name = pack_name
+		
+		-- A recursive function is in scope in its own body; its calls there go through the bundle parameter
+		local is_recursive = ctx.recursive_functions and ctx.recursive_functions[node]
+		local rec_param = nil
+		if is_recursive then
+			rec_param = "_rec_" .. var_name
+			decl_info.rec = rec_param
+			ctx:declare_variable(func_name, decl_info)
+		end
+		
+		local var_lambda, spec_lambda, arity, typed_lambda, pack_lambda = translate_function_body(ctx, node, depth, signature or nil, rec_param, pack_count)
 		ctx:declare_variable(func_name, decl_info)
 		
 		local prev_stmts = ctx:flush_statements()
@@ -1762,15 +2207,37 @@ register_handler("function_declaration", function(ctx, node, depth)
 		if spec_lambda then
 			result = result .. "auto " .. spec_name .. " = " .. spec_lambda .. ";\n"
 		end
+		if typed_lambda then
+			result = result .. "auto " .. typed_name .. " = " .. typed_lambda .. ";\n"
+		end
+		if pack_lambda then
+			result = result .. "auto " .. pack_name .. " = " .. pack_lambda .. ";\n"
+		end
+		if is_recursive then
+			-- The entries held by value, so closures that capture the bundle stay self-contained
+			local bundle = var_name .. "_rec_" .. ctx:get_unique_id()
+			local members = { "decltype(" .. var_name .. ") v;" }
+			local inits = { var_name }
+			if spec_lambda then
+				table.insert(members, "decltype(" .. spec_name .. ") s;")
+				table.insert(inits, spec_name)
+			end
+			if typed_lambda then
+				table.insert(members, "decltype(" .. typed_name .. ") t;")
+				table.insert(inits, typed_name)
+			end
+			if pack_lambda then
+				table.insert(members, "decltype(" .. pack_name .. ") p;")
+				table.insert(inits, pack_name)
+			end
+			result = result .. "struct { " .. table.concat(members, " ") .. " } " .. bundle .. "{" .. table.concat(inits, ", ") .. "};\n"
+			decl_info.rec = bundle
+		end
 		return result
 	end
 	
-	local callable_expr
-	if spec_lambda then
-		callable_expr = "make_specialized_callable<" .. arity .. ">(" .. var_lambda .. ", " .. spec_lambda .. ")"
-	else
-		callable_expr = "make_lua_callable(" .. var_lambda .. ")"
-	end
+	local var_lambda, spec_lambda, arity, _, _, traced = translate_function_body(ctx, node, depth, nil, nil, nil, true)
+	local callable_expr = closure_expression(var_lambda, spec_lambda, arity, traced)
 	
 	if is_local and func_name then
 		local var_name = sanitize_cpp_identifier(func_name)
@@ -1784,7 +2251,7 @@ register_handler("function_declaration", function(ctx, node, depth)
 		local prev_stmts = ctx:flush_statements()
 		if is_local then
 			local var_name = sanitize_cpp_identifier(func_name)
-			return prev_stmts .. "auto " .. ptr_name .. " = std::make_shared<LuaValue>();\n" ..
+			return prev_stmts .. "LuaUpvalueRef " .. ptr_name .. ";\n" ..
 				"*" .. ptr_name .. " = " .. callable_expr .. ";\n" ..
 				"LuaValue " .. var_name .. " = *" .. ptr_name .. ";\n"
 		else
@@ -1796,13 +2263,8 @@ register_handler("function_declaration", function(ctx, node, depth)
 end)
 
 register_handler("method_declaration", function(ctx, node, depth)
-	local var_lambda, spec_lambda, arity = translate_function_body(ctx, node, depth)
-	local callable_expr
-	if spec_lambda then
-		callable_expr = "make_specialized_callable<" .. arity .. ">(" .. var_lambda .. ", " .. spec_lambda .. ")"
-	else
-		callable_expr = "make_lua_callable(" .. var_lambda .. ")"
-	end
+	local var_lambda, spec_lambda, arity, _, _, traced = translate_function_body(ctx, node, depth, nil, nil, nil, true)
+	local callable_expr = closure_expression(var_lambda, spec_lambda, arity, traced)
 	
 	local prev_stmts = ctx:flush_statements()
 	
@@ -1917,9 +2379,26 @@ register_handler("return_statement", function(ctx, node, depth)
 	local cpp_code = ctx:flush_statements()
 	
 	if expr_list_node and #(expr_list_node[5] or empty_table) > 0 then
-		if ctx.specialized_return_mode then
+		if ctx.pack_return_count then
+			local values = {}
+			for _, expr_node in ipairs(expr_list_node[5]) do
+				table.insert(values, translate_node(ctx, expr_node, depth + 1))
+				cpp_code = cpp_code .. ctx:flush_statements()
+			end
+			return cpp_code .. "return LuaValuePack<" .. ctx.pack_return_count .. ">{" .. table.concat(values, ", ") .. "};\n"
+		elseif ctx.specialized_return_mode then
 			local expr_node = expr_list_node[5][1]
-			local val = translate_node(ctx, expr_node, depth + 1)
+			local val, tp = translate_typed_node(ctx, expr_node, depth + 1)
+			local ret_type = ctx.typed_return_type
+			if ret_type == "long long" then
+				val = ctx:to_long_long(val, tp)
+			elseif ret_type == "double" then
+				val = ctx:to_double(val, tp)
+			elseif ret_type == "bool" then
+				val = ctx:to_bool(val, tp)
+			elseif ret_type == "std::string_view" then
+				val = ctx:to_string_view(val, tp)
+			end
 			local stmts = ctx:flush_statements()
 			return cpp_code .. stmts .. "return " .. val .. ";\n"
 		else
@@ -1938,7 +2417,8 @@ register_handler("return_statement", function(ctx, node, depth)
 				
 				if is_last and val == RET_BUF_NAME then
 					if num_exprs == 1 then
-                        push_stmts = push_stmts .. "out_result = std::move(" .. RET_BUF_NAME .. ");\n"
+                        -- Swapping keeps both pooled buffers' capacity
+                        push_stmts = push_stmts .. "out_result.swap(" .. RET_BUF_NAME .. ");\n"
                     else
                         push_stmts = push_stmts .. "out_result.insert(out_result.end(), std::make_move_iterator(" .. RET_BUF_NAME .. ".begin()), std::make_move_iterator(" .. RET_BUF_NAME .. ".end()));\n"
                     end
@@ -1964,6 +2444,39 @@ end)
 -- For Loop Handlers
 --------------------------------------------------------------------------------
 
+-- A loop body that fills a table, as T[i] = v or T[#T + 1] = v, gets a capacity hint
+-- before the loop; returns the table's identifier and "range" or "append"
+local function find_loop_fill_target(ctx, body_node, loop_var)
+	local statements = body_node and body_node[5] or empty_table
+	local shadowed = {}
+	for _, stmt in ipairs(statements) do
+		if stmt[1] == "local_declaration" then
+			for _, var_node in ipairs(stmt[5][1][5] or empty_table) do shadowed[var_node[3]] = true end
+		elseif stmt[1] == "function_declaration" and stmt[3] then
+			shadowed[stmt[3]] = true
+		end
+	end
+	for _, stmt in ipairs(statements) do
+		local targets = stmt[1] == "assignment" and stmt[5][1][5] or empty_table
+		if #targets == 1 and targets[1][1] == "table_index_expression" then
+			local base, index = targets[1][5][1], targets[1][5][2]
+			local name = base[1] == "identifier" and base[3]
+			local decl = name and name ~= loop_var and not shadowed[name] and ctx:is_declared(name)
+			if decl and not decl.scalarized and ctx:get_variable_cpp_type(name) == "LuaValue" then
+				if index[1] == "identifier" and index[3] == loop_var then return base, "range" end
+				if index[1] == "binary_expression" and index[2] == "+" then
+					local len, one = index[5][1], index[5][2]
+					if len[1] == "unary_expression" and len[2] == "#" and len[5][1][1] == "identifier"
+						and len[5][1][3] == name and one[1] == "integer" and tonumber(one[2]) == 1 then
+						return base, "append"
+					end
+				end
+			end
+		end
+	end
+	return nil
+end
+
 register_handler("for_numeric_statement", function(ctx, node, depth)
 	local prev_stmts = ctx:flush_statements()
 	
@@ -2012,6 +2525,13 @@ register_handler("for_numeric_statement", function(ctx, node, depth)
 	local step_var = "step_" .. loop_id
 	
 	local cpp_type = is_integer_loop and "long long" or "double"
+	-- The table is named before the loop variable can shadow it
+	local fill_code, fill_kind = nil, nil
+	if is_integer_loop and known_step == 1 then
+		local fill_node
+		fill_node, fill_kind = find_loop_fill_target(ctx, body_node, var_raw_name)
+		if fill_node then fill_code = translate_node(ctx, fill_node, depth + 1) end
+	end
 	ctx:declare_variable(var_raw_name, cpp_type)
 
 	local start_cpp = is_integer_loop and ctx:to_long_long(start_val, start_type) or ctx:to_double(start_val, start_type)
@@ -2025,6 +2545,12 @@ register_handler("for_numeric_statement", function(ctx, node, depth)
 	
 	cpp_block = cpp_block .. "    const " .. cpp_type .. " " .. stop_var .. " = " .. end_cpp .. ";\n"
 	cpp_block = cpp_block .. "    const " .. cpp_type .. " " .. step_var .. " = " .. step_cpp .. ";\n"
+	if fill_code then
+		local first_var = "first_" .. loop_id
+		cpp_block = cpp_block .. "    const long long " .. first_var .. " = " .. start_cpp .. ";\n"
+		cpp_block = cpp_block .. "    lua_table_reserve_" .. fill_kind .. "(" .. fill_code .. ", " .. first_var .. ", " .. stop_var .. ");\n"
+		start_cpp = first_var
+	end
 	
 	local comparison = ""
 	if known_step then
@@ -2104,6 +2630,38 @@ register_handler("for_generic_statement", function(ctx, node, depth)
 		return table.concat(parts)
 	end
 
+	-- for p, c in utf8.codes(s): decode in place instead of calling the iterator per character
+	local codes_call = #(expr_list_node[5] or empty_table) == 1 and expr_list_node[5][1]
+	if codes_call and codes_call[1] == "call_expression" and #codes_call[5] == 2 and #loop_vars <= 2 then
+		local callee = codes_call[5][1]
+		if callee[1] == "member_expression" and callee[5][1][1] == "identifier" and callee[5][1][3] == "utf8"
+			and callee[5][2][3] == "codes" and not ctx:is_declared("utf8")
+			and not (ctx.overrides and ctx.overrides["utf8"]) and not is_multiret(codes_call[5][2]) then
+			local subject = translate_node(ctx, codes_call[5][2], depth + 1)
+			table.insert(parts, ctx:flush_statements())
+			local id = ctx:get_unique_id()
+			local str_var = "utf8_str_" .. id
+			local view_var = "utf8_view_" .. id
+			local pos_var = "utf8_pos_" .. id
+			local next_var = "utf8_next_" .. id
+			local code_var = "utf8_code_" .. id
+			table.insert(parts, "LuaValue " .. str_var .. " = " .. subject .. ";\n")
+			table.insert(parts, "std::string_view " .. view_var .. " = lua_utf8_codes_subject(" .. str_var .. ");\n")
+			table.insert(parts, "for (size_t " .. pos_var .. " = 0, " .. next_var .. "; " .. pos_var .. " < " .. view_var .. ".size(); " .. pos_var .. " = " .. next_var .. ") {\n")
+			table.insert(parts, "    long long " .. code_var .. ";\n")
+			table.insert(parts, "    " .. next_var .. " = lua_utf8_codes_next(" .. view_var .. ", " .. pos_var .. ", " .. code_var .. ");\n")
+			if #loop_vars >= 1 then
+				table.insert(parts, "    LuaValue " .. loop_vars[1] .. " = static_cast<long long>(" .. pos_var .. " + 1);\n")
+			end
+			if #loop_vars >= 2 then
+				table.insert(parts, "    LuaValue " .. loop_vars[2] .. " = " .. code_var .. ";\n")
+			end
+			table.insert(parts, translate_node(ctx, body_node, depth + 1, { no_braces = true }))
+			table.insert(parts, "\n}\n}\n")
+			return table.concat(parts)
+		end
+	end
+
 	if #(expr_list_node[5] or empty_table) == 1 and (expr_list_node[5][1][1] == "call_expression" or expr_list_node[5][1][1] == "method_call_expression") then
 		local iterator_call_buf = translate_node(ctx, expr_list_node[5][1], depth + 1, { multiret = true })
 		local stmts = ctx:flush_statements()
@@ -2169,6 +2727,28 @@ local function emit_cache_declarations(ctx)
 		local_code = local_code .. "static const LuaValue " .. var .. " = _G->get_item(\"" .. name .. "\");\n"
 	end
 
+	local sorted_patterns = {}
+	for p, _ in pairs(ctx.pattern_caches) do table.insert(sorted_patterns, p) end
+	table.sort(sorted_patterns)
+	for _, p in ipairs(sorted_patterns) do
+		global_code = global_code .. "static const LuaCompiledPattern " .. ctx.pattern_caches[p] .. "(std::string_view(\"" .. escape_cpp_string(p) .. "\", " .. #p .. "));\n"
+	end
+
+	local sorted_formats = {}
+	for f, _ in pairs(ctx.pack_formats) do table.insert(sorted_formats, f) end
+	table.sort(sorted_formats)
+	for _, f in ipairs(sorted_formats) do
+		global_code = global_code .. "static const LuaPackFormat " .. ctx.pack_formats[f] .. "(std::string_view(\"" .. escape_cpp_string(f) .. "\", " .. #f .. "));\n"
+	end
+
+	for _, var in ipairs(ctx.field_caches) do
+		global_code = global_code .. "static thread_local LuaFieldCache " .. var .. ";\n"
+	end
+
+	for _, decl in ipairs(ctx.profile_sites) do
+		global_code = global_code .. decl
+	end
+
 	return global_code, local_code
 end
 
@@ -2200,33 +2780,286 @@ local function tree_contains_identifier(node, name)
 	return false
 end
 
+-- Helper: Check if a subtree assigns to the identifier with the given name
+local function tree_assigns_identifier(node, name)
+	if not node or type(node) ~= "table" then return false end
+	if node[1] == "assignment" then
+		for _, var_node in ipairs(node[5][1][5] or empty_table) do
+			if var_node[1] == "identifier" and var_node[3] == name then return true end
+		end
+	end
+	local children = node[5]
+	if children then
+		for i = 1, #children do
+			if tree_assigns_identifier(children[i], name) then return true end
+		end
+	end
+	return false
+end
+
+-- Helper: Check if a closure nested in the subtree refers to the given name
+local function referenced_in_nested_function(node, name)
+	if not node or type(node) ~= "table" then return false end
+	if node[1] == "function_declaration" or node[1] == "method_declaration" then
+		return tree_contains_identifier(node, name)
+	end
+	local children = node[5]
+	if children then
+		for i = 1, #children do
+			if referenced_in_nested_function(children[i], name) then return true end
+		end
+	end
+	return false
+end
+
+-- Helper: Check that every path through a block ends in a return statement
+local function block_always_returns(block)
+	local stmts = block and block[5]
+	local last = stmts and stmts[#stmts]
+	if not last then return false end
+	if last[1] == "return_statement" then return true end
+	if last[1] == "if_statement" then
+		local has_else = false
+		for _, clause in ipairs(last[5] or empty_table) do
+			local body
+			if clause[1] == "else_clause" then
+				has_else = true
+				body = clause[5][1]
+			else
+				body = clause[5][2]
+			end
+			if not block_always_returns(body) then return false end
+		end
+		return has_else
+	end
+	return false
+end
+
+-- Most results a function returns in a fixed-size pack
+local MAX_PACKED_RESULTS = 8
+
+-- Helper: The number of values every return of a function body gives, when all returns
+-- (closures aside) give the same fixed count of at least two and every path returns
+local function fixed_return_count(body_node)
+	if not block_always_returns(body_node) then return nil end
+	local count = nil
+	local function visit(node)
+		if not node or type(node) ~= "table" then return true end
+		local tag = node[1]
+		if tag == "function_declaration" or tag == "method_declaration" or tag == "function_expression" then return true end
+		if tag == "return_statement" then
+			local exprs = node[5] and node[5][1] and node[5][1][5] or empty_table
+			local last = exprs[#exprs]
+			if not last or (count and #exprs ~= count) or is_multiret(last) or is_table_unpack_call(last) then return false end
+			count = #exprs
+		end
+		local children = node[5]
+		if children then
+			for i = 1, #children do
+				if not visit(children[i]) then return false end
+			end
+		end
+		return true
+	end
+	if visit(body_node) and count and count >= 2 and count <= MAX_PACKED_RESULTS then return count end
+	return nil
+end
+
+-- Largest constructor replaced by scalars
+local MAX_SCALAR_FIELDS = 16
+
+-- Shape of a constructor that could live in locals: only name keys, or only list items
+local function scalar_table_shape(expr_node)
+	if expr_node[1] ~= "table_constructor" then return nil end
+	local fields = expr_node[5] or empty_table
+	if #fields == 0 or #fields > MAX_SCALAR_FIELDS then return nil end
+	local is_record = fields[1][5][2] ~= nil
+	local keys = {}
+	for _, field in ipairs(fields) do
+		if field[1] ~= "table_field" then return nil end
+		local key, value = field[5][1], field[5][2]
+		if is_record then
+			if not value or key[1] ~= "identifier" or keys[key[3]] then return nil end
+			keys[key[3]] = true
+		elseif value or is_multiret(key) or is_table_unpack_call(key) then
+			return nil
+		end
+	end
+	if is_record then return { kind = "record", keys = keys } end
+	return { kind = "array", n = #fields }
+end
+
+-- Helper: Collect the uses of a table local that scalar replacement can rewrite. Returns
+-- false on any other use: the name on its own, a method call, a closure capture, a key
+-- outside the shape, a computed write or a redeclaration.
+local function collect_scalar_uses(node, name, shape, uses, is_target)
+	if not node or type(node) ~= "table" then return true end
+	local tag = node[1]
+	local children = node[5]
+	if tag == "identifier" then return node[3] ~= name end
+	if tag == "function_declaration" or tag == "method_declaration" or tag == "function_expression" then
+		return node[3] ~= name and not tree_contains_identifier(node, name)
+	end
+
+	local base = children and children[1]
+	local on_table = base and base[1] == "identifier" and base[3] == name
+	if tag == "member_expression" and on_table then
+		if shape.kind ~= "record" or not shape.keys[children[2][3]] then return false end
+		uses[node] = { key = children[2][3] }
+		return true
+	elseif tag == "table_index_expression" and on_table then
+		if shape.kind ~= "array" then return false end
+		local index_node = children[2]
+		local k = (index_node[1] == "integer" or index_node[1] == "number") and tonumber(index_node[2])
+		if k and k % 1 == 0 and k >= 1 and k <= shape.n then
+			uses[node] = { index = math.floor(k) }
+			return true
+		end
+		if is_target then return false end
+		uses[node] = { dynamic = true }
+		return collect_scalar_uses(index_node, name, shape, uses)
+	elseif tag == "unary_expression" and node[2] == "#" and on_table then
+		if shape.kind ~= "array" then return false end
+		uses[node] = { length = true }
+		return true
+	elseif tag == "call_expression" and base and base[1] == "member_expression" then
+		-- A field called as a function may expect the table as its receiver
+		local callee_base = base[5][1]
+		if callee_base[1] == "identifier" and callee_base[3] == name then return false end
+	elseif tag == "assignment" then
+		for _, var_node in ipairs(children[1][5] or empty_table) do
+			if not collect_scalar_uses(var_node, name, shape, uses, true) then return false end
+		end
+		return collect_scalar_uses(children[2], name, shape, uses)
+	end
+
+	if children then
+		for i = 1, #children do
+			if not collect_scalar_uses(children[i], name, shape, uses) then return false end
+		end
+	end
+	return true
+end
+
+-- Escape analysis for tables: `local t = {...}` in a block whose every later use reads or
+-- writes a known slot is replaced by one local per slot. The local's scope is the rest of
+-- the block (and the condition of an enclosing repeat).
+local function find_scalar_tables(ast)
+	local tables = {}                -- local_declaration -> shape
+	local uses = {}                  -- use node -> { decl = local_declaration, key | index | dynamic | length }
+
+	local function consider(stmt, siblings, first, tail)
+		local var_list = stmt[5][1][5]
+		local expr_list = stmt[5][2] and stmt[5][2][5]
+		if #var_list ~= 1 or not expr_list or #expr_list ~= 1 then return end
+		local shape = scalar_table_shape(expr_list[1])
+		if not shape then return end
+		local name = var_list[1][3]
+		local found = {}
+		for j = first, #siblings do
+			if not collect_scalar_uses(siblings[j], name, shape, found) then return end
+		end
+		if tail and not collect_scalar_uses(tail, name, shape, found) then return end
+		tables[stmt] = shape
+		for use_node, use in pairs(found) do
+			use.decl = stmt
+			uses[use_node] = use
+		end
+	end
+
+	local function visit(node, tail)
+		if not node or type(node) ~= "table" then return end
+		local children = node[5]
+		if not children then return end
+		if node[1] == "block" then
+			for i, stmt in ipairs(children) do
+				if stmt[1] == "local_declaration" then consider(stmt, children, i + 1, tail) end
+			end
+		end
+		for i = 1, #children do
+			visit(children[i], node[1] == "repeat_until_statement" and i == 1 and children[2] or nil)
+		end
+	end
+
+	visit(ast, nil)
+	return tables, uses
+end
+
+-- Types a specialized signature may use unboxed
+local UNBOXED_TYPES = { ["long long"] = true, ["double"] = true, ["bool"] = true, ["std::string_view"] = true }
+
+local function single_unboxed_type(set)
+	local found = nil
+	for t in pairs(set) do
+		if found or not UNBOXED_TYPES[t] then return nil end
+		found = t
+	end
+	return found
+end
+
+local function same_signatures(a, b)
+	for fn, sa in pairs(a) do
+		local sb = b[fn]
+		if not sb or sa.ret == nil or sa.ret ~= sb.ret then return false end
+		for i, t in ipairs(sa.params) do
+			if sb.params[i] ~= t then return false end
+		end
+	end
+	for fn in pairs(b) do
+		if not a[fn] then return false end
+	end
+	return true
+end
+
+-- Type set of a parameter whose signature is not inferred yet
+local PENDING_TYPE = {}
+
+-- Passes over the module before the inferred signatures are abandoned
+local MAX_SIGNATURE_PASSES = 6
+
 local function analyze_overrides(ast, ctx)
 	local overrides = { math = false, string = false, os = false }
-	local reassigned_vars = {}
-	local var_types = {}
-	ctx.string_counts = {}
+	local reassigned_vars
+	local var_types
 
 	-- Escape analysis state
-	local local_functions = {}      -- name -> function_declaration node
-	local escaping_functions = {}   -- name -> true
+	local local_functions           -- name -> function_declaration node
+	local escaping_functions        -- name -> true
+	local ambiguous_functions       -- name -> true when several local functions share it
+	local non_references            -- identifier nodes that only name something (callee, field, declaration)
+
+	-- Signature inference state
+	local call_sites                -- name -> list of { n = argument count, types = {...} }
+	local return_types              -- function node -> list of returned types
+	local signatures = {}           -- function node -> { params = {...}, ret = type } of the previous pass
+	local optimistic = false        -- first pass: no signatures yet, every local call is pending
+
+	-- Scalar replacement state
+	local scalar_tables, scalar_uses = find_scalar_tables(ast)
+	local field_sets                -- local_declaration -> key -> set of stored types
+	local field_types               -- local_declaration -> key -> type of the previous pass (nil: all boxed)
+
+	-- infer_node_type returns nil for a pending value: the result of a local function whose
+	-- return type is not known yet. Pending values add nothing where types are merged.
 
 	local function infer_node_type(node, current_var_types)
 		if not node then return "LuaValue" end
 		local tag = node[1]
-		
+
 		if tag == "integer" then return "long long"
 		elseif tag == "number" then return "double"
 		elseif tag == "boolean" then return "bool"
 		elseif tag == "string" then return "std::string_view"
 		elseif tag == "table_constructor" then return "LuaObject"
 		elseif tag == "function_declaration" then return "LuaObject"
-		
+
 		elseif tag == "identifier" then
 			local name = node[3]
 			if name == "true" or name == "false" then return "bool" end
 			if name == "nil" then return "LuaValue" end
 
 			local types = current_var_types[name]
+			if types == PENDING_TYPE then return nil end
 			if types then
 				local count = 0
 				local last_t
@@ -2237,7 +3070,7 @@ local function analyze_overrides(ast, ctx)
 				if count == 1 then return last_t end
 			end
 			return "LuaValue"
-	
+
 		elseif tag == "binary_expression" then
 			local op = node[2]
 			if op == "==" or op == "~=" or op == "<" or op == ">" or op == "<=" or op == ">=" then
@@ -2246,6 +3079,10 @@ local function analyze_overrides(ast, ctx)
 
 			local left = infer_node_type(node[5][1], current_var_types)
 			local right = infer_node_type(node[5][2], current_var_types)
+			-- A pending operand takes the other operand's type
+			if left == nil then left = right end
+			if right == nil then right = left end
+			if left == nil then return nil end
 
 			if op == "and" or op == "or" then
 				if left == right then return left end
@@ -2254,13 +3091,20 @@ local function analyze_overrides(ast, ctx)
 				end
 				return "LuaValue"
 			end
-	
+
 			if (left == "long long" or left == "double") and (right == "long long" or right == "double") then
 				if op == "/" or op == "^" then return "double" end
 				if left == "double" or right == "double" then return "double" end
 				return "long long"
 			end
 			if op == ".." then return "LuaValue" end
+		elseif tag == "member_expression" then
+			-- Replaced fields read as what the previous pass stored in them
+			local use = scalar_uses[node]
+			if use then
+				if not field_types then return "LuaValue" end
+				return field_types[use.decl] and field_types[use.decl][use.key]
+			end
 		elseif tag == "unary_expression" then
 			local op = node[2]
 			if op == "not" then return "bool" end
@@ -2287,12 +3131,19 @@ local function analyze_overrides(ast, ctx)
 					if member[3] == "sub" or member[3] == "format" or member[3] == "char" then return "LuaValue" end
 				end
 			elseif func_node[1] == "identifier" then
+				-- Local functions return what the previous pass inferred for them
+				local fn = tag == "call_expression" and local_functions[func_node[3]]
+				if fn then
+					local sig = signatures[fn]
+					-- A view returned by the call is a temporary; keep the result boxed
+					if sig then return sig.ret == "std::string_view" and "LuaValue" or sig.ret end
+					if optimistic then return nil end
+				end
 				if func_node[3] == "tonumber" then return "double" end
 				if func_node[3] == "tostring" then return "LuaValue" end
-				if func_node[3] == "type" then return "std::string_view" end
 			end
 		end
-		
+
 		return "LuaValue"
 	end
 
@@ -2303,124 +3154,327 @@ local function analyze_overrides(ast, ctx)
 		end
 	end
 
-	local function scan(node, current_var_types)
+	local function scan(node, current_var_types, current_function)
 		if not node or type(node) ~= "table" then return end
-		
+
 		local tag = node[1]
 		if tag == "string" then
 			local s = node[2]
 			ctx.string_counts[s] = (ctx.string_counts[s] or 0) + 1
-		
+
 		elseif tag == "identifier" then
 			local name = node[3]
 			if not (name == "true" or name == "false" or name == "nil") then
 				ctx.string_counts[name] = (ctx.string_counts[name] or 0) + 1
 			end
+			-- Escape: any use of a local function other than calling it
+			if not non_references[node] then
+				mark_if_escaping(node)
+			end
 
 		elseif tag == "member_expression" or tag == "method_call_expression" then
 			local member_node = node[5][2]
 			if member_node and member_node[3] then
 				local s = member_node[3]
 				ctx.string_counts[s] = (ctx.string_counts[s] or 0) + 1
+				non_references[member_node] = true
 			end
-		
+
 		elseif tag == "local_declaration" then
 			local var_list = node[5][1][5]
 			local expr_list = node[5][2] and node[5][2][5] or {}
 			for i, var_node in ipairs(var_list) do
 				local name = var_node[3]
+				non_references[var_node] = true
 				local tp = "LuaValue"
 				if i <= #expr_list then
 					tp = infer_node_type(expr_list[i], current_var_types)
 				end
 				if not var_types[name] then var_types[name] = {} end
-				var_types[name][tp] = true
+				if tp then var_types[name][tp] = true end
 				current_var_types[name] = var_types[name]
 			end
-		
+			if scalar_tables[node] and scalar_tables[node].kind == "record" then
+				local sets = {}
+				for _, field in ipairs(expr_list[1][5]) do
+					local set = {}
+					local tp = infer_node_type(field[5][2], current_var_types)
+					if tp then set[tp] = true end
+					sets[field[5][1][3]] = set
+				end
+				field_sets[node] = sets
+			end
+
 		elseif tag == "assignment" then
 			local var_list = node[5][1][5]
 			local expr_list = node[5][2][5]
 			for i, var_node in ipairs(var_list) do
 				if var_node[1] == "identifier" then
 					local name = var_node[3]
+					non_references[var_node] = true
 					reassigned_vars[name] = true
 					local tp = "LuaValue"
 					if i <= #expr_list then
 						tp = infer_node_type(expr_list[i], current_var_types)
 					end
 					if not var_types[name] then var_types[name] = {} end
-					var_types[name][tp] = true
+					if tp then var_types[name][tp] = true end
 					current_var_types[name] = var_types[name]
+				elseif scalar_uses[var_node] and scalar_uses[var_node].key then
+					local use = scalar_uses[var_node]
+					local tp = "LuaValue"
+					if i <= #expr_list then
+						tp = infer_node_type(expr_list[i], current_var_types)
+					end
+					if tp then field_sets[use.decl][use.key][tp] = true end
 				end
-				-- Escape: value assigned to table member/index
-				if (var_node[1] == "member_expression" or var_node[1] == "table_index_expression") and i <= #expr_list then
-					mark_if_escaping(expr_list[i])
-				end
 			end
+
+		elseif tag == "parameter_list" then
+			for _, param_node in ipairs(node[5] or empty_table) do
+				non_references[param_node] = true
+			end
+
+		elseif tag == "table_field" and node[5] and node[5][2] then
+			non_references[node[5][1]] = true
 		end
 
 		-- Escape: function_declaration tracks local functions
 		if tag == "function_declaration" then
 			if node[6] and node[6].is_local and node[3] then
+				if local_functions[node[3]] and local_functions[node[3]] ~= node then
+					ambiguous_functions[node[3]] = true
+				end
 				local_functions[node[3]] = node
 			end
 		end
 
-		-- Escape: call arguments (not callee) that are local function identifiers
+		-- Call sites of local functions: argument count and types
 		if tag == "call_expression" and node[5] then
-			for i = 2, #node[5] do
-				mark_if_escaping(node[5][i])
+			local func_node = node[5][1]
+			if func_node[1] == "identifier" then
+				non_references[func_node] = true
+				local sites = call_sites[func_node[3]]
+				if not sites then
+					sites = {}
+					call_sites[func_node[3]] = sites
+				end
+				local site = { n = #node[5] - 1, types = {} }
+				for i = 2, #node[5] do
+					site.types[i - 1] = infer_node_type(node[5][i], current_var_types) or false
+				end
+				table.insert(sites, site)
 			end
 		end
-		if tag == "method_call_expression" and node[5] then
-			for i = 3, #node[5] do
-				mark_if_escaping(node[5][i])
+
+		-- Return types of the enclosing function (only the first value is typed)
+		if tag == "return_statement" and current_function then
+			local list = return_types[current_function]
+			if not list then
+				list = {}
+				return_types[current_function] = list
+			end
+			local expr_list = node[5] and node[5][1]
+			if expr_list and expr_list[5] and #expr_list[5] > 0 then
+				table.insert(list, infer_node_type(expr_list[5][1], current_var_types) or false)
+			else
+				table.insert(list, "LuaValue")
 			end
 		end
 
-		-- Escape: return statement values
-		if tag == "return_statement" and node[5] then
-			local expr_list = node[5][1]
-			if expr_list and expr_list[5] then
-				for _, expr in ipairs(expr_list[5]) do
-					mark_if_escaping(expr)
+		local child_var_types = current_var_types
+		if tag == "function_declaration" or tag == "method_declaration" then
+			current_function = node
+			-- Parameters of a specialized function take their inferred types inside its body;
+			-- before the first signatures exist, those of local functions are pending
+			local sig = signatures[node]
+			if sig or (optimistic and node[6] and node[6].is_local and node[3]) then
+				child_var_types = setmetatable({}, { __index = current_var_types })
+				for i, param_node in ipairs(node[5][1][5] or empty_table) do
+					child_var_types[param_node[3]] = sig and { [sig.params[i]] = true } or PENDING_TYPE
 				end
 			end
-		end
-
-		-- Escape: table field values
-		if tag == "table_field" and node[5] then
-			local value_node = node[5][2] or node[5][1]
-			mark_if_escaping(value_node)
+		elseif tag == "for_numeric_statement" then
+			-- The loop variable is an integer when the start, limit and step all are
+			local var_node = node[5][1]
+			non_references[var_node] = true
+			local loop_type = "long long"
+			for i = 2, #node[5] - 1 do
+				if infer_node_type(node[5][i], current_var_types) ~= "long long" then loop_type = "LuaValue" end
+			end
+			child_var_types = setmetatable({ [var_node[3]] = { [loop_type] = true } }, { __index = current_var_types })
 		end
 
 		local children = node[5]
 		if children then
-			for i = 1, #children do 
-				scan(children[i], current_var_types) 
+			for i = 1, #children do
+				scan(children[i], child_var_types, current_function)
 			end
 		end
 	end
-	
-	scan(ast, {})
 
-	-- Build non_escaping_functions: local functions that don't escape and aren't self-recursive
-	local non_escaping_functions = {}
-	for name, func_node in pairs(local_functions) do
-		if not escaping_functions[name] and not reassigned_vars[name] then
-			-- Check for self-recursion: does the function body reference its own name?
-			local body_node = func_node[5] and func_node[5][2]
-			if body_node and not tree_contains_identifier(body_node, name) then
+	-- Build non_escaping_functions: local functions that are only ever called. A recursive
+	-- one can only call itself, since any other use of its name counts as an escape.
+	local function find_non_escaping()
+		local non_escaping_functions = {}
+		for name, func_node in pairs(local_functions) do
+			if not escaping_functions[name] and not reassigned_vars[name] then
 				non_escaping_functions[name] = true
 			end
 		end
+		return non_escaping_functions
+	end
+
+	local function run_pass(prev_signatures, prev_field_types, is_optimistic)
+		reassigned_vars = {}
+		var_types = {}
+		local_functions = {}
+		escaping_functions = {}
+		ambiguous_functions = {}
+		non_references = {}
+		call_sites = {}
+		return_types = {}
+		signatures = prev_signatures
+		field_sets = {}
+		field_types = prev_field_types
+		optimistic = is_optimistic
+		ctx.string_counts = {}
+		scan(ast, {}, nil)
+		return find_non_escaping()
+	end
+
+	-- Parameter types come from every call site, return types from every return statement
+	local function infer_signatures(non_escaping_functions)
+		local result = {}
+		for name in pairs(non_escaping_functions) do
+			local func_node = local_functions[name]
+			local body_node = func_node[5][2]
+			local params = {}
+			local has_vararg = false
+			for i, param_node in ipairs(func_node[5][1][5] or empty_table) do
+				if param_node[1] ~= "identifier" then
+					has_vararg = true
+					break
+				end
+				local set = {}
+				for _, site in ipairs(call_sites[name] or empty_table) do
+					if i > site.n then
+						set["LuaValue"] = true
+					elseif site.types[i] then
+						set[site.types[i]] = true
+					end
+				end
+				local tp = single_unboxed_type(set) or "LuaValue"
+				-- A reassigned parameter may change type; a captured view may outlive the call
+				if tp ~= "LuaValue" and tree_assigns_identifier(body_node, param_node[3]) then tp = "LuaValue" end
+				if tp == "std::string_view" and referenced_in_nested_function(body_node, param_node[3]) then tp = "LuaValue" end
+				params[i] = tp
+			end
+
+			if not has_vararg and not ambiguous_functions[name] then
+				-- The return type only holds if the body was scanned with these parameter types
+				local assumed = signatures[func_node]
+				local params_changed = not assumed
+				for i, tp in ipairs(params) do
+					if assumed and assumed.params[i] ~= tp then params_changed = true end
+				end
+
+				local ret
+				if not block_always_returns(body_node) then
+					ret = "LuaValue"
+				elseif params_changed then
+					ret = nil
+				else
+					local set, pending = {}, false
+					for _, t in ipairs(return_types[func_node] or empty_table) do
+						if t then set[t] = true else pending = true end
+					end
+					if pending and next(set) == nil then
+						ret = nil
+					else
+						ret = single_unboxed_type(set) or "LuaValue"
+					end
+				end
+				result[func_node] = { params = params, ret = ret }
+			end
+		end
+		return result
+	end
+
+	-- A replaced field holds every type stored in it; nil while only pending values are
+	local function infer_field_types()
+		local result = {}
+		for decl, sets in pairs(field_sets) do
+			local types = {}
+			for key, set in pairs(sets) do
+				if next(set) ~= nil then types[key] = cpp_type_of_set(set) end
+			end
+			result[decl] = types
+		end
+		return result
+	end
+
+	local function same_field_types(a, b)
+		for decl, shape in pairs(scalar_tables) do
+			if shape.kind == "record" then
+				for key in pairs(shape.keys) do
+					local ta = a[decl] and a[decl][key]
+					if ta == nil or ta ~= (b[decl] and b[decl][key]) then return false end
+				end
+			end
+		end
+		return true
+	end
+
+	-- Iterate to a fixpoint: each pass assumes the signatures and field types of the previous one
+	local non_escaping_functions = run_pass({}, {}, true)
+	local inferred = infer_signatures(non_escaping_functions)
+	local inferred_fields = infer_field_types()
+	local converged = false
+	for _ = 1, MAX_SIGNATURE_PASSES do
+		non_escaping_functions = run_pass(inferred, inferred_fields, false)
+		local next_inferred = infer_signatures(non_escaping_functions)
+		local next_fields = infer_field_types()
+		if same_signatures(inferred, next_inferred) and same_field_types(inferred_fields, next_fields) then
+			converged = true
+			break
+		end
+		inferred = next_inferred
+		inferred_fields = next_fields
+	end
+	if not converged then
+		inferred = {}
+		non_escaping_functions = run_pass(inferred, nil, false)
+		inferred_fields = infer_field_types()
 	end
 
 	ctx.overrides = overrides
 	ctx.reassigned_vars = reassigned_vars
 	ctx.var_types = var_types
 	ctx.non_escaping_functions = non_escaping_functions
+	ctx.function_signatures = inferred
+	ctx.scalar_tables = scalar_tables
+	ctx.scalar_uses = scalar_uses
+	for decl, shape in pairs(scalar_tables) do
+		shape.types = inferred_fields[decl] or {}
+	end
+
+	-- Recursive ones among them: does the function body reference its own name?
+	local recursive_functions = {}
+	for name in pairs(non_escaping_functions) do
+		local func_node = local_functions[name]
+		if tree_contains_identifier(func_node[5][2], name) then
+			recursive_functions[func_node] = true
+		end
+	end
+	ctx.recursive_functions = recursive_functions
+
+	local fixed_return_counts = {}
+	for name in pairs(non_escaping_functions) do
+		local func_node = local_functions[name]
+		fixed_return_counts[func_node] = fixed_return_count(func_node[5][2])
+	end
+	ctx.fixed_return_counts = fixed_return_counts
 end
 
 --------------------------------------------------------------------------------
@@ -2582,6 +3636,38 @@ BuiltinCallHandlers["string.char"] = function(ctx, node, depth, opts)
 	return nil
 end
 
+-- Constant formats: the format is parsed once and each call decodes straight from the bytes
+BuiltinCallHandlers["string.unpack"] = function(ctx, node, depth, opts)
+	if ctx.overrides and ctx.overrides.string then return nil end
+	local call_args = get_call_args(node)
+	if #call_args < 2 or #call_args > 3 or call_args[1][1] ~= "string" or is_multiret(call_args[#call_args]) then return nil end
+	local format_var = ctx:get_pack_format(call_args[1][2])
+	local data = translate_node(ctx, call_args[2], depth + 1)
+	local init = call_args[3] and translate_node(ctx, call_args[3], depth + 1) or "LuaValue()"
+	ctx:add_statement("lua_string_unpack(" .. format_var .. ", " .. data .. ", " .. init .. ", " .. ctx:use_ret_buf() .. ");\n")
+
+	if opts.discard then return "" end
+	if opts.multiret then return ctx:use_ret_buf() end
+	local temp_var = "unpack_res_" .. ctx:get_unique_id()
+	ctx:add_statement("LuaValue " .. temp_var .. " = get_return_value(" .. ctx:use_ret_buf() .. ", 0);\n")
+	return temp_var
+end
+
+BuiltinCallHandlers["string.packsize"] = function(ctx, node, depth, opts)
+	if ctx.overrides and ctx.overrides.string then return nil end
+	local call_args = get_call_args(node)
+	if #call_args ~= 1 or call_args[1][1] ~= "string" then return nil end
+	local expr = "lua_string_packsize(" .. ctx:get_pack_format(call_args[1][2]) .. ")"
+
+	if opts.discard then return expr end
+	if opts.multiret then
+		ctx:add_statement(ctx:use_ret_buf() .. ".assign(1, LuaValue(" .. expr .. "));\n")
+		return ctx:use_ret_buf()
+	else
+		return expr, "long long"
+	end
+end
+
 --------------------------------------------------------------------------------
 -- OS Library Inlining
 --------------------------------------------------------------------------------
@@ -2654,10 +3740,11 @@ function CppTranslator:translate_recursive(ast_root, file_name, for_header, curr
 		if for_header then
 			return header .. "\n// Main script header\n", ctx
 		else
+			local prof = profile_prologue(ctx, "main chunk", 0)
 			local global_cache_decls, local_cache_decls = emit_cache_declarations(ctx)
 			local buffer_decl = "    LuaValueVector out_result; out_result.reserve(8);\n    LuaRetBufGuard _ret_buf_guard; LuaValueVector& _func_ret_buf = _ret_buf_guard.buf;\n"
 			local main_function_start = "int main(int argc, char* argv[]) {\n" ..
-										"init_G(argc, argv);\n" .. local_cache_decls .. buffer_decl
+										"init_G(argc, argv);\n" .. prof .. local_cache_decls .. buffer_decl
 			local main_function_end = "\n    goto luax_main_exit;\nluax_main_exit:\n    luax_cleanup();\n    return 0;\n}"
 			return header .. global_cache_decls .. main_function_start .. generated_code .. main_function_end, ctx
 		end
@@ -2702,9 +3789,10 @@ function CppTranslator:translate_recursive(ast_root, file_name, for_header, curr
 				load_function_body = load_function_body .. "    return out_result;\n"
 			end
 			
+			local prof = profile_prologue(ctx, "module " .. file_name, 0)
 			local global_cache_decls, local_cache_decls = emit_cache_declarations(ctx)
 			local buffer_decl = "    LuaValueVector out_result; out_result.reserve(8);\n    LuaRetBufGuard _ret_buf_guard; LuaValueVector& _func_ret_buf = _ret_buf_guard.buf;\n"
-			local load_function_definition = "LuaValueVector load() {\n" .. local_cache_decls .. buffer_decl .. load_function_body .. "}\n"
+			local load_function_definition = "LuaValueVector load() {\n" .. prof .. local_cache_decls .. buffer_decl .. load_function_body .. "}\n"
 			return header .. cpp_header .. global_cache_decls .. global_var_definitions .. namespace_start .. load_function_definition .. namespace_end, ctx
 		end
 	end
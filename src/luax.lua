@@ -17,6 +17,13 @@ local do_compile = true
 local input_lua_file = nil
 local path_to_out_file = nil
 local no_format = false
+local thread_coroutines = false
+local refcount_mode = "plain"
+local use_runtime_cache = true
+local use_lto = false
+local profile_mode = false
+local pgo_command = nil
+local translate_unit = nil -- Set when this process translates one file for a parent build
 
 -- Argument Parsing
 local function print_usage()
@@ -29,7 +36,13 @@ Options:
   -b, --build-dir <dir>  Directory for intermediate files (default: "build")
   -t, --translate-only   Only generate C++ files, do not compile.
   -r, --raw              Do not format C++ files.
-  -k, --keep             Preserve generated source/object files after compilation.
+  -k, --keep             Preserve generated source files after compilation.
+      --thread-coroutines  Build coroutines on OS threads instead of user-space stacks.
+      --refcount <mode>    Reference counting: plain (default), atomic or biased.
+      --no-runtime-cache   Compile the runtime into the program instead of linking the cached libluax.a.
+      --lto                Enable link-time optimization across the program and the runtime.
+      --pgo <command>      Build instrumented, run <command> (a shell command using the built program), then rebuild with the profile.
+      --profile            Sample Lua-level stacks and count calls; the program writes luax-profile.folded/.txt at exit.
   -h, --help             Show this help message.
 ]], cmd))
 	os.exit(0)
@@ -51,6 +64,32 @@ while i <= #arg do
 		i = i + 1
 	elseif a == "-r" or a == "--raw" then
 		no_format = true
+	elseif a == "--thread-coroutines" then
+		thread_coroutines = true
+	elseif a == "--refcount" then
+		refcount_mode = arg[i+1]
+		i = i + 1
+		if refcount_mode ~= "plain" and refcount_mode ~= "atomic" and refcount_mode ~= "biased" then
+			print("Error: --refcount expects plain, atomic or biased")
+			os.exit(1)
+		end
+	elseif a == "--no-runtime-cache" then
+		use_runtime_cache = false
+	elseif a == "--lto" then
+		use_lto = true
+	elseif a == "--profile" then
+		profile_mode = true
+	elseif a == "--pgo" then
+		pgo_command = arg[i+1]
+		i = i + 1
+		if not pgo_command then
+			print("Error: --pgo expects a training command")
+			os.exit(1)
+		end
+	elseif a == "--translate-unit" then
+		translate_unit = {name = arg[i+2], is_main = (arg[i+3] == "main")}
+		input_lua_file = arg[i+1]
+		i = i + 3
 	elseif a == "-h" or a == "--help" then
 		print_usage()
 	elseif not input_lua_file then
@@ -91,15 +130,38 @@ local function run_command(command_str, error_message)
 	end
 end
 
-local function is_uptodate(src, dst)
-	local cmd = "test -e " .. dst .. " && test " .. dst .. " -nt " .. src
+local function shell_quote(s)
+	return "'" .. s:gsub("'", "'\\''") .. "'"
+end
+
+local function file_exists(path)
+	local f = io.open(path, "r")
+	if f then f:close() end
+	return f ~= nil
+end
+
+local function command_succeeds(cmd)
 	local success, _, exit_code = os.execute(cmd)
 	if type(success) == "boolean" then return success and (exit_code == 0) end
 	return success == 0
 end
 
+-- Helper: SHA-1 of each readable file, keyed by the path as given
+local function hash_files(paths)
+	local hashes = {}
+	if #paths == 0 then return hashes end
+	local quoted = {}
+	for _, path in ipairs(paths) do table.insert(quoted, shell_quote(path)) end
+	local p = io.popen("sha1sum " .. table.concat(quoted, " ") .. " 2>/dev/null")
+	local out = p:read("*a")
+	p:close()
+	for h, path in out:gmatch("(%x+)  ([^\n]*)") do hashes[path] = h end
+	return hashes
+end
+
 local function translate_file(lua_file_path, output_file_name, is_main_entry, should_format)
 	local translate_object = cpp_translator:new()
+	if profile_mode then translate_object.profile_source = lua_file_path end
 
 	print("Transpiling " .. lua_file_path .. " at " .. os.clock() .. "...")
 	local file = io.open(lua_file_path, "r")
@@ -174,7 +236,25 @@ local function find_dependencies(lua_file_path)
 	return dependencies
 end
 
-local function generate_cmake(output_path, generated_basenames)
+local function write_text_file(path, lines)
+	local file = io.open(path, "w")
+	if not file then error("Could not write to " .. path) end
+	file:write(table.concat(lines, "\n"))
+	file:close()
+end
+
+-- Where prebuilt runtimes are kept between builds
+local function get_runtime_cache_dir()
+	local dir = os.getenv("LUAX_CACHE_DIR")
+	if dir and dir ~= "" then return get_abs_path(dir) end
+	local xdg = os.getenv("XDG_CACHE_HOME")
+	if xdg and xdg ~= "" then return xdg .. "/luax" end
+	local home = os.getenv("HOME")
+	if home and home ~= "" then return home .. "/.cache/luax" end
+	return get_abs_path(BUILD_DIR) .. "/luax_cache"
+end
+
+local function generate_cmake(output_path, generated_basenames, pgo_dir)
 	local cmake_path = BUILD_DIR .. "/CMakeLists.txt"
 	local luax_root = get_abs_path(script_dir)
 	local abs_target = get_abs_path(output_path)
@@ -184,7 +264,9 @@ local function generate_cmake(output_path, generated_basenames)
 	local lib_cpp_files = {
 		"lib/lua_object.cpp", "lib/math.cpp", "lib/string.cpp", "lib/table.cpp",
 		"lib/os.cpp", "lib/io.cpp", "lib/package.cpp", "lib/utf8.cpp",
-		"lib/init.cpp", "lib/debug.cpp", "lib/coroutine.cpp"
+		"lib/init.cpp", "lib/debug.cpp", "lib/coroutine.cpp", "lib/gc.cpp",
+		"lib/lua_hash_map.cpp", "lib/lua_shape.cpp", "lib/pool_allocator.cpp",
+		"lib/arena.cpp", "lib/lua_profile.cpp", "lib/reactor.cpp"
 	}
 
 	local lib_srcs = {}
@@ -194,28 +276,234 @@ local function generate_cmake(output_path, generated_basenames)
 	for _, basename in ipairs(generated_basenames) do table.insert(gen_srcs, '"' .. basename .. ".cpp" .. '"') end
 
 	local compile_opts = "-O3 -march=native"
+	if thread_coroutines then compile_opts = compile_opts .. " -DLUAX_COROUTINE_THREADS" end
+	if refcount_mode ~= "plain" then compile_opts = compile_opts .. " -DLUAX_REFCOUNT_" .. refcount_mode:upper() end
+	if profile_mode then compile_opts = compile_opts .. " -DLUAX_PROFILE" end
 
 	local cmake_content = {
-		"cmake_minimum_required(VERSION 3.10)",
+		"cmake_minimum_required(VERSION 3.16)",
 		"project(LuaX_Generated_Project LANGUAGES CXX)",
 		"set(CMAKE_CXX_STANDARD 20)",
 		"add_compile_options(" .. compile_opts .. ")",
 		"include_directories(\"" .. luax_root .. "include\")",
 		"set(LIB_SOURCES " .. table.concat(lib_srcs, "\n    ") .. ")",
 		"set(GEN_SOURCES " .. table.concat(gen_srcs, "\n    ") .. ")",
-		"add_executable(" .. target_name .. " ${LIB_SOURCES} ${GEN_SOURCES})",
-		"target_link_libraries(" .. target_name .. " stdc++fs)",
-		"set_target_properties(" .. target_name .. " PROPERTIES RUNTIME_OUTPUT_DIRECTORY \"" .. target_dir .. "\")"
 	}
+	local lto_cmake = {
+		"include(CheckIPOSupported)",
+		"check_ipo_supported(RESULT _luax_ipo OUTPUT _luax_ipo_output)",
+		"if(NOT _luax_ipo)",
+		"    message(FATAL_ERROR \"--lto is not supported by this toolchain: ${_luax_ipo_output}\")",
+		"endif()",
+		"set(CMAKE_INTERPROCEDURAL_OPTIMIZATION ON)",
+	}
+	if use_lto then
+		for _, line in ipairs(lto_cmake) do table.insert(cmake_content, line) end
+	end
 
-	local file = io.open(cmake_path, "w")
-	file:write(table.concat(cmake_content, "\n"))
-	file:close()
+	-- LUAX_PGO is set by the driver for each stage. Clang writes raw profiles that are merged
+	-- before use; GCC reads the .gcda files directly, matched by object path.
+	local pgo_cmake = {
+		"set(LUAX_PGO_DIR \"" .. pgo_dir .. "\")",
+		"if(LUAX_PGO STREQUAL \"generate\")",
+		"    add_compile_options(\"-fprofile-generate=${LUAX_PGO_DIR}\")",
+		"    add_link_options(\"-fprofile-generate=${LUAX_PGO_DIR}\")",
+		"elseif(LUAX_PGO STREQUAL \"use\")",
+		"    if(CMAKE_CXX_COMPILER_ID MATCHES \"Clang\")",
+		"        string(REGEX MATCH \"^[0-9]+\" _luax_major \"${CMAKE_CXX_COMPILER_VERSION}\")",
+		"        find_program(LUAX_LLVM_PROFDATA NAMES llvm-profdata-${_luax_major} llvm-profdata HINTS \"${CMAKE_CXX_COMPILER}/..\")",
+		"        if(NOT LUAX_LLVM_PROFDATA)",
+		"            message(FATAL_ERROR \"--pgo with clang needs llvm-profdata\")",
+		"        endif()",
+		"        file(GLOB _luax_profiles \"${LUAX_PGO_DIR}/*.profraw\")",
+		"        execute_process(COMMAND \"${LUAX_LLVM_PROFDATA}\" merge \"-output=${LUAX_PGO_DIR}/default.profdata\" ${_luax_profiles} RESULT_VARIABLE _luax_result)",
+		"        if(NOT _luax_result EQUAL 0)",
+		"            message(FATAL_ERROR \"Merging the training profiles failed\")",
+		"        endif()",
+		"        add_compile_options(\"-fprofile-use=${LUAX_PGO_DIR}/default.profdata\" -Wno-profile-instr-unprofiled)",
+		"    else()",
+		"        add_compile_options(\"-fprofile-use=${LUAX_PGO_DIR}\" -fprofile-partial-training -Wno-missing-profile)",
+		"    endif()",
+		"endif()",
+	}
+	for _, line in ipairs(pgo_cmake) do table.insert(cmake_content, line) end
+
+	-- A PGO build profiles the runtime together with the program, so it is never shared
+	if use_runtime_cache and not pgo_command then
+		-- The runtime is its own project, built once per compiler, flags and runtime sources.
+		-- It is configured from here so that it uses the compiler this project found.
+		run_command("mkdir -p " .. BUILD_DIR .. "/luax_runtime")
+		write_text_file(BUILD_DIR .. "/luax_runtime/CMakeLists.txt", {
+			"cmake_minimum_required(VERSION 3.16)",
+			"project(LuaX_Runtime LANGUAGES CXX)",
+			"set(CMAKE_CXX_STANDARD 20)",
+			"add_compile_options(" .. compile_opts .. ")",
+			"include_directories(\"" .. luax_root .. "include\")",
+			use_lto and table.concat(lto_cmake, "\n") or "",
+			"add_library(luax STATIC " .. table.concat(lib_srcs, "\n    ") .. ")",
+			"set_target_properties(luax PROPERTIES ARCHIVE_OUTPUT_DIRECTORY \"${CMAKE_BINARY_DIR}\")",
+		})
+
+		local runtime_cmake = {
+			"set(LUAX_RUNTIME_FLAGS \"" .. compile_opts .. (use_lto and " lto" or "") .. "\")",
+			"set(_luax_key \"${CMAKE_CXX_COMPILER}|${CMAKE_CXX_COMPILER_ID}|${CMAKE_CXX_COMPILER_VERSION}|${LUAX_RUNTIME_FLAGS}\")",
+			"file(GLOB _luax_runtime_files \"" .. luax_root .. "lib/*.cpp\" \"" .. luax_root .. "include/*.hpp\")",
+			"list(SORT _luax_runtime_files)",
+			"foreach(_f ${_luax_runtime_files})",
+			"    file(SHA1 \"${_f}\" _h)",
+			"    string(APPEND _luax_key \"|${_h}\")",
+			"endforeach()",
+			"string(SHA1 _luax_hash \"${_luax_key}\")",
+			"string(SUBSTRING \"${_luax_hash}\" 0 16 _luax_hash)",
+			"set(LUAX_RUNTIME_DIR \"" .. get_runtime_cache_dir() .. "/runtime-${CMAKE_CXX_COMPILER_ID}-${CMAKE_CXX_COMPILER_VERSION}-${_luax_hash}\")",
+			"set(LUAX_RUNTIME_LIB \"${LUAX_RUNTIME_DIR}/libluax.a\")",
+			"if(NOT EXISTS \"${LUAX_RUNTIME_LIB}\")",
+			"    message(STATUS \"Building LuaX runtime into ${LUAX_RUNTIME_DIR}\")",
+			-- Concurrent builds each use their own tree; the rename into the cache is atomic
+			"    string(RANDOM LENGTH 8 _luax_tmp)",
+			"    set(_luax_build \"${LUAX_RUNTIME_DIR}.build-${_luax_tmp}\")",
+			"    execute_process(COMMAND \"${CMAKE_COMMAND}\" -S \"${CMAKE_CURRENT_SOURCE_DIR}/luax_runtime\" -B \"${_luax_build}\" \"-DCMAKE_CXX_COMPILER=${CMAKE_CXX_COMPILER}\" RESULT_VARIABLE _luax_result)",
+			"    if(_luax_result EQUAL 0)",
+			"        execute_process(COMMAND \"${CMAKE_COMMAND}\" --build \"${_luax_build}\" -j RESULT_VARIABLE _luax_result)",
+			"    endif()",
+			"    if(NOT _luax_result EQUAL 0)",
+			"        file(REMOVE_RECURSE \"${_luax_build}\")",
+			"        message(FATAL_ERROR \"Building the LuaX runtime failed\")",
+			"    endif()",
+			"    file(MAKE_DIRECTORY \"${LUAX_RUNTIME_DIR}\")",
+			"    file(RENAME \"${_luax_build}/libluax.a\" \"${LUAX_RUNTIME_LIB}\")",
+			"    file(REMOVE_RECURSE \"${_luax_build}\")",
+			"endif()",
+			"add_library(luax_runtime STATIC IMPORTED)",
+			"set_target_properties(luax_runtime PROPERTIES IMPORTED_LOCATION \"${LUAX_RUNTIME_LIB}\")",
+			"add_executable(" .. target_name .. " ${GEN_SOURCES})",
+			"target_link_libraries(" .. target_name .. " luax_runtime stdc++fs)",
+		}
+		for _, line in ipairs(runtime_cmake) do table.insert(cmake_content, line) end
+	else
+		table.insert(cmake_content, "add_executable(" .. target_name .. " ${LIB_SOURCES} ${GEN_SOURCES})")
+		table.insert(cmake_content, "target_link_libraries(" .. target_name .. " stdc++fs)")
+	end
+
+	-- With one generated file the header is parsed once anyway
+	if #generated_basenames > 1 then
+		table.insert(cmake_content, "target_precompile_headers(" .. target_name .. " PRIVATE \"" .. luax_root .. "include/lua_value.hpp\" \"" .. luax_root .. "include/lua_object.hpp\")")
+	end
+	table.insert(cmake_content, "set_target_properties(" .. target_name .. " PROPERTIES RUNTIME_OUTPUT_DIRECTORY \"" .. target_dir .. "\")")
+
+	write_text_file(cmake_path, cmake_content)
+end
+
+local function run_cmake(binary_dir, pgo_stage)
+	binary_dir = shell_quote(binary_dir)
+	run_command("cmake -S " .. BUILD_DIR .. " -B " .. binary_dir .. " -DLUAX_PGO=" .. pgo_stage, "CMake configuration failed.")
+	run_command("cmake --build " .. binary_dir .. " -j", "Compilation failed.")
+end
+
+-- ============================================================================
+-- BUILD CACHE
+-- ============================================================================
+-- Each project keeps a manifest, copies of its generated files and its CMake
+-- binary tree under the cache directory, so they survive the removal of BUILD_DIR.
+-- A unit is retranslated only when its key changes: the source hash, the hash of
+-- the translator, the output flags and the names of the modules it requires
+-- (the only part of another module a translation sees is its load() interface).
+
+local function get_project_cache_dir()
+	local abs_build = get_abs_path(BUILD_DIR)
+	return get_runtime_cache_dir() .. "/projects/" .. abs_build:gsub("[^%w%-_.]", "_")
+end
+
+local function load_manifest(path)
+	local manifest = {sources = {}, units = {}}
+	local f = io.open(path, "r")
+	if not f then return manifest end
+	for line in f:lines() do
+		local fields = {}
+		for field in (line .. "\t"):gmatch("([^\t]*)\t") do table.insert(fields, field) end
+		if fields[1] == "S" then
+			local deps = {}
+			for k = 4, #fields - 1, 2 do table.insert(deps, {name = fields[k], path = fields[k + 1]}) end
+			manifest.sources[fields[2]] = {hash = fields[3], deps = deps}
+		elseif fields[1] == "U" then
+			manifest.units[fields[2]] = fields[3]
+		end
+	end
+	f:close()
+	return manifest
 end
 
-local function run_cmake()
-	run_command("cmake -S " .. BUILD_DIR .. " -B " .. BUILD_DIR, "CMake configuration failed.")
-	run_command("cmake --build " .. BUILD_DIR .. " -j", "Compilation failed.")
+local function save_manifest(path, manifest)
+	local lines = {}
+	for src, entry in pairs(manifest.sources) do
+		local fields = {"S", src, entry.hash}
+		for _, dep in ipairs(entry.deps) do
+			table.insert(fields, dep.name)
+			table.insert(fields, dep.path)
+		end
+		table.insert(lines, table.concat(fields, "\t"))
+	end
+	for name, key in pairs(manifest.units) do table.insert(lines, "U\t" .. name .. "\t" .. key) end
+	table.sort(lines)
+	table.insert(lines, "")
+	write_text_file(path, lines)
+end
+
+local function get_translator_hash()
+	local files = {}
+	if is_running_native then
+		local p = io.popen("command -v " .. shell_quote(arg[0]) .. " 2>/dev/null")
+		table.insert(files, p:read("*l") or arg[0])
+		p:close()
+	else
+		for _, m in ipairs({"src.cpp_translator", "src.translator", "src.tokenizer", "src.node", "src.formatter"}) do
+			table.insert(files, package.searchpath(m, package.path) or m)
+		end
+	end
+	local hashes = hash_files(files)
+	local parts = {}
+	for _, f in ipairs(files) do
+		-- Without a hash the translator cannot be told apart, so nothing is reused
+		if not hashes[f] then return nil end
+		table.insert(parts, hashes[f])
+	end
+	return table.concat(parts, ",")
+end
+
+local function get_worker_count()
+	local p = io.popen("nproc 2>/dev/null")
+	local n = tonumber(p:read("*l") or "")
+	p:close()
+	return n or 1
+end
+
+local function self_command()
+	if is_running_native then return shell_quote(arg[0]) end
+	return shell_quote(arg[-1] or "lua5.4") .. " " .. shell_quote(arg[0])
+end
+
+-- Translates the stale units, in parallel child processes when there are several
+local function translate_units(units, should_format)
+	local workers = get_worker_count()
+	if #units == 1 or workers == 1 then
+		for _, u in ipairs(units) do translate_file(u.path, u.name, u.is_main, should_format) end
+		return
+	end
+	local base = self_command() .. " -b " .. shell_quote(BUILD_DIR)
+	if keep_files then base = base .. " -k" end
+	if no_format then base = base .. " -r" end
+	if profile_mode then base = base .. " --profile" end
+	for first = 1, #units, workers do
+		local script = {}
+		for k = first, math.min(first + workers - 1, #units) do
+			local u = units[k]
+			table.insert(script, base .. " --translate-unit " .. shell_quote(u.path) .. " " .. shell_quote(u.name) .. " " .. (u.is_main and "main" or "module") .. " & p" .. k .. "=$!")
+		end
+		table.insert(script, "s=0")
+		for k = first, math.min(first + workers - 1, #units) do table.insert(script, "wait $p" .. k .. " || s=1") end
+		table.insert(script, "exit $s")
+		run_command("sh -c " .. shell_quote(table.concat(script, "; ")), "Translation failed.")
+	end
 end
 
 -- ============================================================================
@@ -224,44 +512,106 @@ end
 
 run_command("mkdir -p " .. BUILD_DIR)
 
+if translate_unit then
+	translate_file(input_lua_file, translate_unit.name, translate_unit.is_main, keep_files and (not no_format))
+	os.exit(0)
+end
+
+local project_cache = get_project_cache_dir()
+local manifest_path = project_cache .. "/manifest"
+run_command("mkdir -p " .. shell_quote(project_cache .. "/src"))
+local manifest = load_manifest(manifest_path)
+local translator_hash = get_translator_hash()
+
 local files_to_translate = {}
-local queue = {input_lua_file}
-local visited = {[input_lua_file] = true}
+local source_hashes = {}
 local main_basename = path_to_out_file:match("([^/]+)$") or "main"
 files_to_translate[input_lua_file] = main_basename
 
-local head = 1
-while head <= #queue do
-	local current_file = queue[head]
-	head = head + 1
-	local deps = find_dependencies(current_file)
-	for _, dep in ipairs(deps) do
-		if not visited[dep.path] then
-			visited[dep.path] = true
-			files_to_translate[dep.path] = dep.name:gsub("%.", "_")
-			table.insert(queue, dep.path)
+-- Walk the require graph a level at a time, hashing each level in one go and
+-- rescanning only the files whose contents changed
+local level = {input_lua_file}
+local visited = {[input_lua_file] = true}
+local deps_of = {}
+while #level > 0 do
+	local hashes = hash_files(level)
+	local next_level = {}
+	for _, current_file in ipairs(level) do
+		local h = hashes[current_file] or ""
+		source_hashes[current_file] = h
+		local cached = manifest.sources[current_file]
+		local deps
+		if cached and h ~= "" and cached.hash == h then
+			deps = cached.deps
+			for _, dep in ipairs(cached.deps) do
+				if not file_exists(dep.path) then deps = nil end
+			end
+		end
+		deps = deps or find_dependencies(current_file)
+		manifest.sources[current_file] = {hash = h, deps = deps}
+		deps_of[current_file] = deps
+		for _, dep in ipairs(deps) do
+			if not visited[dep.path] then
+				visited[dep.path] = true
+				files_to_translate[dep.path] = dep.name:gsub("%.", "_")
+				table.insert(next_level, dep.path)
+			end
 		end
 	end
+	level = next_level
 end
 
 local generated_basenames = {}
+local stale = {}
+local should_format = keep_files and (not no_format)
 
 for file_path, output_name in pairs(files_to_translate) do
 	table.insert(generated_basenames, output_name)
-	local cpp_out = BUILD_DIR .. "/" .. output_name .. ".cpp"
+	local is_main_entry = (file_path == input_lua_file)
+	local dep_names = {}
+	for _, dep in ipairs(deps_of[file_path]) do table.insert(dep_names, dep.name) end
+	table.sort(dep_names)
+	local key = table.concat({source_hashes[file_path], translator_hash or "", output_name, is_main_entry and "main" or "module",
+		should_format and "fmt" or "raw", profile_mode and "profile" or "", table.concat(dep_names, ",")}, "|")
 
-	if is_uptodate(file_path, cpp_out) then
+	local cpp_out = BUILD_DIR .. "/" .. output_name .. ".cpp"
+	local cached_cpp = project_cache .. "/src/" .. output_name .. ".cpp"
+	local reusable = translator_hash and source_hashes[file_path] ~= "" and manifest.units[output_name] == key
+	if reusable and not file_exists(cpp_out) then
+		-- Restoring with the old timestamps keeps the compiled objects current
+		reusable = file_exists(cached_cpp) and command_succeeds("cp -p " .. shell_quote(cached_cpp) .. " " .. shell_quote(project_cache .. "/src/" .. output_name .. ".hpp") .. " " .. shell_quote(BUILD_DIR .. "/"))
+	end
+	if reusable then
 		print("Up to date: " .. output_name)
 	else
-		local is_main_entry = (file_path == input_lua_file)
-		translate_file(file_path, output_name, is_main_entry, keep_files and (not no_format))
+		manifest.units[output_name] = key
+		table.insert(stale, {path = file_path, name = output_name, is_main = is_main_entry})
+	end
+end
+
+if #stale > 0 then
+	translate_units(stale, should_format)
+	for _, u in ipairs(stale) do
+		local prefix = shell_quote(BUILD_DIR .. "/" .. u.name)
+		run_command("cp -p " .. prefix .. ".cpp " .. prefix .. ".hpp " .. shell_quote(project_cache .. "/src/"), "Could not update the build cache.")
 	end
 end
+save_manifest(manifest_path, manifest)
+table.sort(generated_basenames)
 
-generate_cmake(path_to_out_file, generated_basenames)
+local pgo_dir = project_cache .. "/pgo"
+generate_cmake(path_to_out_file, generated_basenames, pgo_dir)
 
 if do_compile then
-	run_cmake()
+	if pgo_command then
+		run_command("rm -rf " .. shell_quote(pgo_dir))
+		run_cmake(project_cache .. "/cmake", "generate")
+		print("Training with: " .. pgo_command)
+		run_command(pgo_command, "PGO training command failed.")
+		run_cmake(project_cache .. "/cmake", "use")
+	else
+		run_cmake(project_cache .. "/cmake", "OFF")
+	end
 	if not keep_files then
             run_command("rm -rf " .. BUILD_DIR)
             print("Cleaned up intermediate files.")
@@ -4,6 +4,18 @@
 
 local byte = string.byte
 local sub = string.sub
+local find = string.find
+
+-- Run scanning: LuaX provides string.scan natively; under a reference interpreter the
+-- same spans come from anchored patterns. Either way no substring is built.
+local SCAN_PATTERNS = {
+	space = "^[ \t\r\n]*", name = "^[%w_]*", digit = "^%d*", xdigit = "^%x*",
+	line = "^[^\n]*", dq = '^[^"\\]*', sq = "^[^'\\]*"
+}
+local scan = string.scan or function(s, init, class)
+	local _, e = find(s, SCAN_PATTERNS[class], init)
+	return e + 1
+end
 
 -- Pre-calculate byte constants for performance
 local BYTE_0 = 48 -- byte('0')
@@ -88,373 +100,221 @@ local OP_AND      = { "operator", "and" }
 local OP_OR       = { "operator", "or" }
 local OP_NOT      = { "operator", "not" }
 
+local KEYWORDS = {
+	["local"] = KW_LOCAL, ["function"] = KW_FUNCTION, ["return"] = KW_RETURN, ["end"] = KW_END,
+	["if"] = KW_IF, ["then"] = KW_THEN, ["else"] = KW_ELSE, ["elseif"] = KW_ELSEIF,
+	["while"] = KW_WHILE, ["for"] = KW_FOR, ["do"] = KW_DO, ["and"] = OP_AND, ["or"] = OP_OR,
+	["not"] = OP_NOT, ["goto"] = KW_GOTO, ["break"] = KW_BREAK, ["repeat"] = KW_REPEAT, ["until"] = KW_UNTIL
+}
+
+-- Tokens are never modified by the parser, so punctuation and operators are shared
+local function fixed(type, value) return { type, value } end
+local TOK = {
+	["+"] = fixed("operator", "+"), ["-"] = fixed("operator", "-"), ["*"] = fixed("operator", "*"),
+	["/"] = fixed("operator", "/"), ["//"] = fixed("operator", "//"), ["%"] = fixed("operator", "%"),
+	["#"] = fixed("operator", "#"), ["&"] = fixed("operator", "&"),
+	["|"] = fixed("operator", "|"), ["~"] = fixed("operator", "~"), ["<<"] = fixed("operator", "<<"),
+	[">>"] = fixed("operator", ">>"), ["=="] = fixed("operator", "=="), ["~="] = fixed("operator", "~="),
+	["<="] = fixed("operator", "<="), [">="] = fixed("operator", ">="), ["<"] = fixed("operator", "<"),
+	[">"] = fixed("operator", ">"), ["="] = fixed("operator", "="), [".."] = fixed("operator", ".."),
+	["("] = fixed("paren", "("), [")"] = fixed("paren", ")"), ["{"] = fixed("brace", "{"),
+	["}"] = fixed("brace", "}"), ["["] = fixed("square_bracket", "["), ["]"] = fixed("square_bracket", "]"),
+	["::"] = fixed("label_delimiter", "::"), [":"] = fixed("colon", ":"), ["."] = fixed("dot", "."),
+	["..."] = fixed("varargs", "..."), [","] = fixed("comma", ",")
+}
+
 local Tokenizer = {}
 
 function Tokenizer.tokenize(parser)
 	local code = parser.code
 	local tokens = parser[1]
 	local len = #code
+	-- Source line of each 'function' keyword, by token index (profiling metadata)
+	local function_lines = parser.function_lines
+	local line, line_pos = 1, 1
+	-- One shared token per distinct identifier
+	local names = {}
+	local n = #tokens
 
-	
 	local current_pos = parser.position
 	while current_pos <= len do
 		-- Optimized: Use byte access instead of substring
 		-- In native mode, this maps to efficient lua_string_byte_at -> long long
-		local char_byte = code:byte(current_pos) 
-		local token_processed = false 
-		
+		local char_byte = code:byte(current_pos)
+
 		-- Must handle nil (EOF) gracefully if loop condition doesn't catch it
 		if not char_byte then break end
 
 		if is_whitespace(char_byte) then
-			current_pos = current_pos + 1
-			token_processed = true
+			current_pos = scan(code, current_pos + 1, "space")
 		elseif is_digit(char_byte) then
 			local start_pos = current_pos
-			local is_float = false
-			
-			-- Check for hexadecimal literal
-			local is_hex = false
-			if char_byte == BYTE_0 and current_pos + 1 <= len then
-				local next_byte = code:byte(current_pos + 1)
-				if next_byte == BYTE_x or next_byte == BYTE_X then
-					is_hex = true
-					current_pos = current_pos + 2 -- Consume '0x'
-					local hex_start_pos = current_pos
-					while current_pos <= len do
-						local hex_byte = code:byte(current_pos)
-						if not hex_byte then break end
-						if (hex_byte >= BYTE_0 and hex_byte <= BYTE_9) or
-						   (hex_byte >= BYTE_a and hex_byte <= BYTE_f) or
-						   (hex_byte >= BYTE_A and hex_byte <= BYTE_F) then
-							current_pos = current_pos + 1
-						else
-							break
-						end
-					end
-					local hex_val_str = sub(code, hex_start_pos, current_pos - 1)
-					if #hex_val_str == 0 then
-						error("Malformed hexadecimal number")
-					end
-					-- Convert hex string to decimal number
-					local decimal_val = tonumber(hex_val_str, 16)
-					table.insert(tokens, { "integer", decimal_val })
-					token_processed = true
+			local next_byte = code:byte(current_pos + 1)
+			if char_byte == BYTE_0 and (next_byte == BYTE_x or next_byte == BYTE_X) then
+				-- Hexadecimal literal
+				local hex_start_pos = current_pos + 2 -- Consume '0x'
+				current_pos = scan(code, hex_start_pos, "xdigit")
+				if current_pos == hex_start_pos then
+					error("Malformed hexadecimal number")
 				end
-			end
-
-			if not is_hex then
-				-- Original decimal number parsing
-				while current_pos <= len do
-					local current_byte = code:byte(current_pos)
-					if is_digit(current_byte) then
-						current_pos = current_pos + 1
-					elseif current_byte == BYTE_DOT and not is_float then
-						is_float = true
-						current_pos = current_pos + 1
-					else
-						break
-					end
-				end
-				local val = sub(code, start_pos, current_pos - 1)
+				-- Convert hex string to decimal number
+				n = n + 1
+				tokens[n] = { "integer", tonumber(sub(code, hex_start_pos, current_pos - 1), 16) }
+			else
+				-- Decimal: digits with at most one '.'
+				current_pos = scan(code, current_pos, "digit")
+				local is_float = code:byte(current_pos) == BYTE_DOT
 				if is_float then
-					table.insert(tokens, { "number", val })
-				else
-					table.insert(tokens, { "integer", val })
+					current_pos = scan(code, current_pos + 1, "digit")
 				end
-				token_processed = true
+				n = n + 1
+				tokens[n] = { is_float and "number" or "integer", sub(code, start_pos, current_pos - 1) }
 			end
-			
 		elseif is_alpha(char_byte) then
 			local start_pos = current_pos
-			current_pos = current_pos + 1
-			while current_pos <= len do
-				local c_byte = code:byte(current_pos)
-				if is_alpha(c_byte) or is_digit(c_byte) then
-					current_pos = current_pos + 1
-				else
-					break
+			current_pos = scan(code, current_pos + 1, "name")
+			local value = sub(code, start_pos, current_pos - 1)
+			local keyword = KEYWORDS[value]
+			n = n + 1
+			if keyword then
+				tokens[n] = keyword
+				if keyword == KW_FUNCTION then
+					local _, newlines = sub(code, line_pos, start_pos - 1):gsub("\n", "")
+					line, line_pos = line + newlines, start_pos
+					function_lines[n] = line
 				end
+			else
+				local token = names[value]
+				if not token then
+					token = { "identifier", value }
+					names[value] = token
+				end
+				tokens[n] = token
 			end
-			local value = sub(code, start_pos, current_pos - 1)
-			if value == "local" then table.insert(tokens, KW_LOCAL)
-			elseif value == "function" then table.insert(tokens, KW_FUNCTION)
-			elseif value == "return" then table.insert(tokens, KW_RETURN)
-			elseif value == "end" then table.insert(tokens, KW_END)
-			elseif value == "if" then table.insert(tokens, KW_IF)
-			elseif value == "then" then table.insert(tokens, KW_THEN)
-			elseif value == "else" then table.insert(tokens, KW_ELSE)
-			elseif value == "elseif" then table.insert(tokens, KW_ELSEIF)
-			elseif value == "while" then table.insert(tokens, KW_WHILE)
-			elseif value == "for" then table.insert(tokens, KW_FOR)
-			elseif value == "do" then table.insert(tokens, KW_DO)
-			elseif value == "and" then table.insert(tokens, OP_AND)
-			elseif value == "or" then table.insert(tokens, OP_OR)
-			elseif value == "not" then table.insert(tokens, OP_NOT)
-			elseif value == "goto" then table.insert(tokens, KW_GOTO)
-			elseif value == "break" then table.insert(tokens, KW_BREAK)
-			elseif value == "repeat" then table.insert(tokens, KW_REPEAT)
-			elseif value == "until" then table.insert(tokens, KW_UNTIL)
-			else table.insert(tokens, { "identifier", value }) end
-			token_processed = true
-
 		elseif char_byte == BYTE_MINUS then
-			if current_pos + 1 <= len and code:byte(current_pos + 1) == BYTE_MINUS then
+			if code:byte(current_pos + 1) == BYTE_MINUS then
 				-- Start of comment: consume '--'
-				current_pos = current_pos + 2 
-				
-				local next_byte = code:byte(current_pos)
-				
-				-- Check for long comment start: --[
-				if next_byte == BYTE_LBRACKET then
-					current_pos = current_pos + 1 -- consume first '['
-					local num_equals = 0
-					-- Count equals signs
-					while current_pos <= len and code:byte(current_pos) == BYTE_EQUALS do
-						num_equals = num_equals + 1
-						current_pos = current_pos + 1
+				current_pos = current_pos + 2
+				local long_end = nil
+
+				-- Check for long comment start: --[ followed by '='s and '['
+				if code:byte(current_pos) == BYTE_LBRACKET then
+					local eq_end = current_pos + 1
+					while code:byte(eq_end) == BYTE_EQUALS do eq_end = eq_end + 1 end
+					if code:byte(eq_end) == BYTE_LBRACKET then
+						long_end = "]" .. string.rep("=", eq_end - current_pos - 1) .. "]"
+						current_pos = eq_end + 1
 					end
-					
-					local second_bracket_byte = code:byte(current_pos)
-					
-					if second_bracket_byte == BYTE_LBRACKET then
-						-- Confirmed multi-line comment: --[=[...]=]
-						current_pos = current_pos + 1 -- consume second '['
-						
-						-- Determine expected closing sequence
-						local expected_end = ']'
-						for i = 1, num_equals do
-							expected_end = expected_end .. '='
-						end
-						expected_end = expected_end .. ']'
-						local end_len = #expected_end
-						
-						local comment_end_found = false
-						while current_pos <= len do
-							-- Check for the closing sequence, ensuring we don't index past the end
-							if current_pos + end_len - 1 <= len then
-								if code:sub(current_pos, current_pos + end_len - 1) == expected_end then
-									current_pos = current_pos + end_len
-									comment_end_found = true
-									break
-								end
-							end
-							current_pos = current_pos + 1
-						end
-						
-						if not comment_end_found then
-							error("Unclosed multi-line comment")
-						end
-					else
-						-- Not a valid long comment start (e.g., --[a or --[=a). Treat as single line.
-						while current_pos <= len and code:byte(current_pos) ~= BYTE_LF do
-							current_pos = current_pos + 1
-						end
+				end
+
+				if long_end then
+					-- Multi-line comment: --[=[...]=]
+					local close_pos = find(code, long_end, current_pos, true)
+					if not close_pos then
+						error("Unclosed multi-line comment")
 					end
+					current_pos = close_pos + #long_end
 				else
-					-- Standard single-line comment: --
-					while current_pos <= len and code:byte(current_pos) ~= BYTE_LF do
-						current_pos = current_pos + 1
-					end
+					-- Single-line comment (also --[ and --[=a): up to the newline
+					current_pos = scan(code, current_pos, "line")
 				end
 			else
-				table.insert(tokens, { "operator", "-" })
-				current_pos = current_pos + 1
-			end
-			token_processed = true
-		elseif char_byte == BYTE_PLUS or char_byte == BYTE_STAR or char_byte == BYTE_HASH or char_byte == BYTE_PERCENT then
-			-- Reconstruct char for value since tokens store strings
-			table.insert(tokens, { "operator", string.char(char_byte) })
-			current_pos = current_pos + 1
-			token_processed = true
-		elseif char_byte == BYTE_SLASH then
-			-- Check for floor division //
-			if current_pos < len and code:byte(current_pos + 1) == BYTE_SLASH then
-				table.insert(tokens, { "operator", "//" })
-				current_pos = current_pos + 2
-			else
-				table.insert(tokens, { "operator", "/" })
+				n = n + 1
+				tokens[n] = TOK["-"]
 				current_pos = current_pos + 1
 			end
-			token_processed = true
-		elseif char_byte == BYTE_AMPERSAND then
-			table.insert(tokens, { "operator", "&" })
-			current_pos = current_pos + 1
-			token_processed = true
-		elseif char_byte == BYTE_PIPE then
-			table.insert(tokens, { "operator", "|" })
-			current_pos = current_pos + 1
-			token_processed = true
-		elseif char_byte == BYTE_EQUALS then
-			if current_pos < len and code:byte(current_pos + 1) == BYTE_EQUALS then
-				table.insert(tokens, { "operator", "==" })
-				current_pos = current_pos + 2
-			else
-				table.insert(tokens, { "operator", "=" })
-				current_pos = current_pos + 1
-			end
-			token_processed = true
-		elseif char_byte == BYTE_GT then
-			if current_pos < len and code:byte(current_pos + 1) == BYTE_EQUALS then
-				table.insert(tokens, { "operator", ">=" })
-				current_pos = current_pos + 2
-			elseif current_pos < len and code:byte(current_pos + 1) == BYTE_GT then
-				-- Right shift >>
-				table.insert(tokens, { "operator", ">>" })
-				current_pos = current_pos + 2
-			else
-				table.insert(tokens, { "operator", ">" })
-				current_pos = current_pos + 1
-			end
-			token_processed = true
-		elseif char_byte == BYTE_LT then
-			if current_pos < len and code:byte(current_pos + 1) == BYTE_EQUALS then
-				table.insert(tokens, { "operator", "<=" })
-				current_pos = current_pos + 2
-			elseif current_pos < len and code:byte(current_pos + 1) == BYTE_LT then
-				-- Left shift <<
-				table.insert(tokens, { "operator", "<<" })
-				current_pos = current_pos + 2
-			else
-				table.insert(tokens, { "operator", "<" })
-				current_pos = current_pos + 1
-			end
-			token_processed = true
-		elseif char_byte == BYTE_TILDE then
-			if current_pos < len and code:byte(current_pos + 1) == BYTE_EQUALS then
-				table.insert(tokens, { "operator", "~=" })
-				current_pos = current_pos + 2
-			else
-				-- ~ is bitwise NOT (unary) or bitwise XOR (binary) in Lua 5.3+
-				table.insert(tokens, { "operator", "~" })
-				current_pos = current_pos + 1
-			end
-			token_processed = true
-		elseif char_byte == BYTE_LPAREN or char_byte == BYTE_RPAREN then
-			table.insert(tokens, { "paren", string.char(char_byte) })
-			current_pos = current_pos + 1
-			token_processed = true
 		elseif char_byte == BYTE_DOUBLE_QUOTE or char_byte == BYTE_SINGLE_QUOTE then
 			local quote_byte = char_byte
+			local run_class = quote_byte == BYTE_DOUBLE_QUOTE and "dq" or "sq"
 			current_pos = current_pos + 1 -- consume the opening quote
 			local buffer = {}
-			local start_pos = current_pos
 			while current_pos <= len do
+				-- Copy everything up to the next quote or backslash in one piece
+				local stop = scan(code, current_pos, run_class)
+				if stop > current_pos then
+					buffer[#buffer + 1] = sub(code, current_pos, stop - 1)
+				end
+				current_pos = stop
 				local char_in_byte = code:byte(current_pos)
 				if char_in_byte == BYTE_BACKSLASH then
 					current_pos = current_pos + 1 -- consume '\'
 					local escaped_byte = code:byte(current_pos)
-					if escaped_byte == BYTE_n then table.insert(buffer, '\n')
-					elseif escaped_byte == BYTE_t then table.insert(buffer, '\t')
-					elseif escaped_byte == BYTE_r then table.insert(buffer, '\r')
-					elseif escaped_byte == BYTE_b then table.insert(buffer, '\b')
-					elseif escaped_byte == BYTE_f then table.insert(buffer, '\f')
-					elseif escaped_byte == BYTE_a_esc then table.insert(buffer, '\a')
-					elseif escaped_byte == BYTE_v then table.insert(buffer, '\v')
-					elseif escaped_byte == BYTE_BACKSLASH then table.insert(buffer, '\\')
-					elseif escaped_byte == BYTE_DOUBLE_QUOTE then table.insert(buffer, '\"')
-					elseif escaped_byte == BYTE_SINGLE_QUOTE then table.insert(buffer, "'" )
+					if escaped_byte == BYTE_n then buffer[#buffer + 1] = '\n'
+					elseif escaped_byte == BYTE_t then buffer[#buffer + 1] = '\t'
+					elseif escaped_byte == BYTE_r then buffer[#buffer + 1] = '\r'
+					elseif escaped_byte == BYTE_b then buffer[#buffer + 1] = '\b'
+					elseif escaped_byte == BYTE_f then buffer[#buffer + 1] = '\f'
+					elseif escaped_byte == BYTE_a_esc then buffer[#buffer + 1] = '\a'
+					elseif escaped_byte == BYTE_v then buffer[#buffer + 1] = '\v'
+					elseif escaped_byte == BYTE_BACKSLASH then buffer[#buffer + 1] = '\\'
+					elseif escaped_byte == BYTE_DOUBLE_QUOTE then buffer[#buffer + 1] = '\"'
+					elseif escaped_byte == BYTE_SINGLE_QUOTE then buffer[#buffer + 1] = "'"
 					-- Add other escape sequences as needed (e.g., \ddd, \xdd, \u{hhhh})
-					else table.insert(buffer, string.char(escaped_byte)) 
+					elseif escaped_byte then buffer[#buffer + 1] = string.char(escaped_byte)
 					end
 					current_pos = current_pos + 1
 				elseif char_in_byte == quote_byte then
 					current_pos = current_pos + 1 -- consume the closing quote
 					break
-				else
-					table.insert(buffer, string.char(char_in_byte))
-					current_pos = current_pos + 1
 				end
 			end
-			table.insert(tokens, { "string", table.concat(buffer) })
-			token_processed = true
+			n = n + 1
+			tokens[n] = { "string", table.concat(buffer) }
 		elseif char_byte == BYTE_LBRACKET then
 			-- Check for long string: [[ ... ]] or [=[ ... ]=]
 			local next_pos = current_pos + 1
-			local num_equals = 0
-			while next_pos <= len and code:byte(next_pos) == BYTE_EQUALS do
-				num_equals = num_equals + 1
+			while code:byte(next_pos) == BYTE_EQUALS do
 				next_pos = next_pos + 1
 			end
 
 			if code:byte(next_pos) == BYTE_LBRACKET then
 				-- Confirmed long string start
-				current_pos = next_pos + 1 -- Move past the opening [===[
-				local content_start = current_pos
-				
-				-- Define the closing delimiter: ] followed by same num of =, then ]
-				local expected_end = "]" .. string.rep("=", num_equals) .. "]"
-				local end_len = #expected_end
-				local closing_found = false
-
-				while current_pos <= len do
-					if code:sub(current_pos, current_pos + end_len - 1) == expected_end then
-						local content_end = current_pos - 1
-						local content = code:sub(content_start, content_end)
-
-						-- Lua Rule: If the first character of the content is a newline, it's ignored
-						if content:byte(1) == BYTE_LF then
-							content = content:sub(2)
-						elseif content:sub(1, 2) == "\r\n" then
-							content = content:sub(3)
-						end
-
-						table.insert(tokens, { "string", content })
-						current_pos = current_pos + end_len
-						closing_found = true
-						break
-					end
-					current_pos = current_pos + 1
+				local content_start = next_pos + 1 -- Move past the opening [===[
+				-- The closing delimiter: ] followed by same num of =, then ]
+				local expected_end = "]" .. string.rep("=", next_pos - current_pos - 1) .. "]"
+				local close_pos = find(code, expected_end, content_start, true)
+				if not close_pos then
+					error("Unfinished long string near position " .. content_start)
 				end
+				local content = sub(code, content_start, close_pos - 1)
 
-				if not closing_found then
-					error("Unfinished long string near position " .. content_start)
+				-- Lua Rule: If the first character of the content is a newline, it's ignored
+				if content:byte(1) == BYTE_LF then
+					content = content:sub(2)
+				elseif content:sub(1, 2) == "\r\n" then
+					content = content:sub(3)
 				end
+
+				n = n + 1
+				tokens[n] = { "string", content }
+				current_pos = close_pos + #expected_end
 			else
 				-- It's just a regular square bracket
-				table.insert(tokens, { "square_bracket", "[" })
-				current_pos = current_pos + 1
-			end
-			token_processed = true
-		elseif char_byte == BYTE_RBRACKET then
-			-- Regular square bracket
-			table.insert(tokens, { "square_bracket", "]" })
-			current_pos = current_pos + 1
-			token_processed = true
-		elseif char_byte == BYTE_LBRACE or char_byte == BYTE_RBRACE then
-			table.insert(tokens, { "brace", string.char(char_byte) })
-			current_pos = current_pos + 1
-			token_processed = true
-		elseif char_byte == BYTE_COLON then
-			-- Check for label delimiter (::)
-			if current_pos + 1 <= len and code:byte(current_pos + 1) == BYTE_COLON then
-				table.insert(tokens, { "label_delimiter", "::" })
-				current_pos = current_pos + 2
-			else
-				table.insert(tokens, { "colon", ":" })
+				n = n + 1
+				tokens[n] = TOK["["]
 				current_pos = current_pos + 1
 			end
-			token_processed = true
-		elseif char_byte == BYTE_DOT then
-			if current_pos + 2 <= len and code:sub(current_pos + 1, current_pos + 2) == '..' then
-				table.insert(tokens, { "varargs", "..." })
+		else
+			-- Punctuation and operators: the longest of three, two or one characters
+			local token = nil
+			local next_byte = code:byte(current_pos + 1)
+			if char_byte == BYTE_DOT and next_byte == BYTE_DOT and code:byte(current_pos + 2) == BYTE_DOT then
+				token = TOK["..."]
 				current_pos = current_pos + 3
-			elseif current_pos + 1 <= len and code:byte(current_pos + 1) == BYTE_DOT then
-				table.insert(tokens, { "operator", ".." })
-				current_pos = current_pos + 2
 			else
-				table.insert(tokens, { "dot", "." })
-				current_pos = current_pos + 1
+				if next_byte then token = TOK[sub(code, current_pos, current_pos + 1)] end
+				if token then
+					current_pos = current_pos + 2
+				else
+					token = TOK[string.char(char_byte)]
+					current_pos = current_pos + 1
+				end
+			end
+			-- Other characters are ignored for now
+			if token then
+				n = n + 1
+				tokens[n] = token
 			end
-			token_processed = true
-		elseif char_byte == BYTE_COMMA then
-			table.insert(tokens, { "comma", "," })
-			current_pos = current_pos + 1
-			token_processed = true
-		else
-			-- For now, ignore other characters
-			current_pos = current_pos + 1
-			token_processed = true
 		end
 	end
 	parser.position = current_pos
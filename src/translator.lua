@@ -14,6 +14,7 @@ function Parser:new(code)
 	local instance = setmetatable({{}, 1}, Parser)
 	instance.code = code
 	instance.position = 1
+	instance.function_lines = {}
 	
 	-- Label Scoping Initialization
 	math.randomseed(os.time() + (#code * 100)) -- Simple seed based on time and code length
@@ -340,7 +341,7 @@ function Parser:parse_primary_expression()
 		node = self:parse_table_constructor()
 	elseif token[1] == "keyword" and token[2] == "function" then
 		self[2] = self[2] + 1 -- consume 'function'
-		node = self:parse_function_body_content()
+		node = self:parse_function_body_content(self.function_lines[self[2] - 1])
 	elseif token[1] == "varargs" then
 		self[2] = self[2] + 1 -- consume ...
 		node = Node:new("varargs", "...", "...")
@@ -749,9 +750,11 @@ function Parser:parse_if_statement()
 	return if_node
 end
 
-function Parser:parse_function_body_content()
+-- line: where the 'function' keyword is, taken by the caller before it parses any name
+function Parser:parse_function_body_content(line)
 	local t13 = self[1][self[2]]
 	local function_node = Node:new("function_declaration")
+	function_node:meta().line = line
 
 	-- ENTER NEW SCOPE: Push current label scope to stack and create fresh one
 	table.insert(self.label_scope_stack, self.label_scope)
@@ -813,6 +816,7 @@ function Parser:parse_function_body_content()
 end
 
 function Parser:parse_function_declaration(is_local)
+	local line = self.function_lines[self[2] - 1] -- the 'function' keyword was just consumed
 	local name_token = peek(self)
 	if name_token and name_token[1] == "identifier" then
 		local function_node = Node:new("function_declaration")
@@ -834,7 +838,8 @@ function Parser:parse_function_declaration(is_local)
 				end
 			end
 		end
-		local function_body_node = self:parse_function_body_content()
+		local function_body_node = self:parse_function_body_content(line)
+		function_node:meta().line = line
 		if function_body_node[5] and #function_body_node[5] >= 2 then
 			function_node:AddChildren(function_body_node[5][1], function_body_node[5][2])
 		else
@@ -843,7 +848,7 @@ function Parser:parse_function_declaration(is_local)
 		return function_node
 	elseif name_token and name_token[2] == '(' then
 		-- This is an anonymous function, directly parse its body and return the node
-		return self:parse_function_body_content()
+		return self:parse_function_body_content(line)
 	else
 		error("Expected function name or '(' after 'function'")
 	end
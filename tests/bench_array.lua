@@ -0,0 +1,17 @@
+-- Array reads and writes through integer indexes
+local n = tonumber(arg[1]) or 1000000
+local a = {}
+for i = 1, n do
+    a[i] = i
+end
+
+local sum = 0
+for pass = 1, 20 do
+    for i = 1, #a do
+        sum = sum + a[i]
+    end
+    for i = 1, #a, 2 do
+        a[i] = a[i] + 1
+    end
+end
+print(sum)
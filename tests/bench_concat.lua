@@ -0,0 +1,19 @@
+-- Concatenation in loops, through table.concat and string.format
+local n = tonumber(arg[1]) or 200000
+
+local s = ""
+for i = 1, n // 10 do
+    s = s .. i .. ","
+end
+
+local parts = {}
+for i = 1, n do
+    parts[#parts + 1] = "item" .. i
+end
+local joined = table.concat(parts, ";")
+
+local len = 0
+for i = 1, n do
+    len = len + #string.format("%d:%s", i, "x")
+end
+print(#s, #joined, len)
@@ -0,0 +1,24 @@
+-- Resume/yield round trips through coroutine.wrap and coroutine.resume
+local n = tonumber(arg[1]) or 500000
+
+local gen = coroutine.wrap(function()
+    for i = 1, n do
+        coroutine.yield(i)
+    end
+end)
+local sum = 0
+for _ = 1, n do
+    sum = sum + gen()
+end
+
+local co = coroutine.create(function(a)
+    while true do
+        a = coroutine.yield(a * 2)
+    end
+end)
+local acc = 0
+for i = 1, n do
+    local _, v = coroutine.resume(co, i)
+    acc = acc + v
+end
+print(sum, acc)
@@ -0,0 +1,26 @@
+-- Writing and reading back a temporary file line by line (buffered and mapped) and in bulk
+local n = tonumber(arg[1]) or 200000
+local path = os.tmpname()
+
+local f = io.open(path, "w")
+for i = 1, n do
+    f:write("line ", i, "\n")
+end
+f:close()
+
+local count = 0
+for line in io.lines(path) do
+    count = count + #line
+end
+
+local mapped = io.open(path, "rm")
+for line in mapped:lines() do
+    count = count + #line
+end
+mapped:close()
+
+f = io.open(path, "r")
+local all = f:read("a")
+f:close()
+os.remove(path)
+print(count, #all)
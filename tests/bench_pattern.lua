@@ -0,0 +1,18 @@
+-- string.find, string.match, string.gmatch and string.gsub over generated lines
+local n = tonumber(arg[1]) or 200000
+local lines = {}
+for i = 1, n do
+    lines[i] = "key" .. i .. " = " .. (i * 7) .. " ; comment " .. (i % 13)
+end
+
+local found, total, words, replaced = 0, 0, 0, 0
+for i = 1, n do
+    local line = lines[i]
+    if line:find("comment 7", 1, true) then found = found + 1 end
+    local k, v = line:match("^(%w+)%s*=%s*(%d+)")
+    if k then total = total + tonumber(v) end
+    for _ in line:gmatch("%a+") do words = words + 1 end
+    local _, count = line:gsub("%d", "#")
+    replaced = replaced + count
+end
+print(found, total, words, replaced)
@@ -0,0 +1,245 @@
+--[[ Benchmark suite: builds each benchmark with LuaX, times it against a reference
+interpreter and reports median and variance, optionally as JSON.
+
+Run from the repository root:
+  lua5.4 tests/run_benchmarks.lua [options] [name ...]
+
+Options:
+  --iterations <n>   Timed runs per benchmark (default: 5)
+  --warmup <n>       Untimed runs before timing (default: 1)
+  --luax <cmd>       Translator command (default: "lua5.4 src/luax.lua")
+  --lua <cmd>        Reference interpreter, or "none" (default: "lua5.4")
+  --build-dir <dir>  Where benchmarks are built (default: "build_bench")
+  --json <file>      Write the results as JSON
+  --compare <file>   Fail when a median is slower than in this earlier JSON report
+  --threshold <f>    Allowed slowdown for --compare (default: 0.10)
+]]
+
+local SUITE = {
+	{name = "call", script = "tests/bench_call.lua"},
+	{name = "math", script = "tests/bench_math.lua"},
+	{name = "table_field", script = "tests/bench_table.lua", args = "10000000"},
+	{name = "table_array", script = "tests/bench_array.lua", check = true},
+	{name = "pattern", script = "tests/bench_pattern.lua", check = true},
+	{name = "concat", script = "tests/bench_concat.lua", check = true},
+	{name = "coroutine", script = "tests/bench_coroutine.lua", check = true},
+	{name = "io", script = "tests/bench_io.lua", check = true},
+	-- Translating the translator, natively and under the reference interpreter
+	{name = "self_compile", script = "src/luax.lua", self_compile = true},
+}
+
+local iterations = 5
+local warmup = 1
+local luax_cmd = "lua5.4 src/luax.lua"
+local lua_cmd = "lua5.4"
+local build_dir = "build_bench"
+local json_path = nil
+local compare_path = nil
+local threshold = 0.10
+local filters = {}
+
+local i = 1
+while i <= #arg do
+	local a = arg[i]
+	if a == "--iterations" then
+		iterations = tonumber(arg[i + 1]) or iterations
+		i = i + 1
+	elseif a == "--warmup" then
+		warmup = tonumber(arg[i + 1]) or warmup
+		i = i + 1
+	elseif a == "--luax" then
+		luax_cmd = arg[i + 1]
+		i = i + 1
+	elseif a == "--lua" then
+		lua_cmd = arg[i + 1]
+		i = i + 1
+	elseif a == "--build-dir" then
+		build_dir = arg[i + 1]
+		i = i + 1
+	elseif a == "--json" then
+		json_path = arg[i + 1]
+		i = i + 1
+	elseif a == "--compare" then
+		compare_path = arg[i + 1]
+		i = i + 1
+	elseif a == "--threshold" then
+		threshold = tonumber(arg[i + 1]) or threshold
+		i = i + 1
+	else
+		filters[a] = true
+	end
+	i = i + 1
+end
+if lua_cmd == "none" then lua_cmd = nil end
+
+local function shell_quote(s)
+	return "'" .. s:gsub("'", "'\\''") .. "'"
+end
+
+local function run(cmd)
+	local success, _, exit_code = os.execute(cmd)
+	if type(success) == "boolean" then return success and (exit_code == 0) end
+	return success == 0
+end
+
+local function capture(cmd)
+	local p = io.popen(cmd .. " 2>&1")
+	local out = p:read("*a")
+	p:close()
+	return out
+end
+
+-- Wall-clock seconds for one run; prep runs first and is not timed
+local function time_command(cmd, prep)
+	local script = (prep and (prep .. "; ") or "") ..
+		"s=$(date +%s%N); " .. cmd .. " >/dev/null 2>&1 || exit 1; e=$(date +%s%N); echo $((e - s))"
+	local p = io.popen("sh -c " .. shell_quote(script))
+	local out = p:read("*a")
+	p:close()
+	local ns = tonumber(out:match("(%d+)"))
+	if not ns then error("Benchmark command failed: " .. cmd) end
+	return ns / 1e9
+end
+
+local function stats(samples)
+	local sorted = {}
+	for k, v in ipairs(samples) do sorted[k] = v end
+	table.sort(sorted)
+	local n = #sorted
+	local median = (n % 2 == 1) and sorted[(n + 1) // 2] or (sorted[n // 2] + sorted[n // 2 + 1]) / 2
+	local sum = 0
+	for _, v in ipairs(sorted) do sum = sum + v end
+	local mean = sum / n
+	local sq = 0
+	for _, v in ipairs(sorted) do sq = sq + (v - mean) ^ 2 end
+	local variance = n > 1 and sq / (n - 1) or 0
+	return {median = median, mean = mean, variance = variance, stdev = math.sqrt(variance), min = sorted[1], max = sorted[n], samples = samples}
+end
+
+local function measure(cmd, prep)
+	for _ = 1, warmup do time_command(cmd, prep) end
+	local samples = {}
+	for k = 1, iterations do samples[k] = time_command(cmd, prep) end
+	return stats(samples)
+end
+
+-- Builds a benchmark and returns the commands to time
+local function prepare(bench)
+	local exe = build_dir .. "/" .. bench.name
+	local build = luax_cmd .. " " .. shell_quote(bench.script) .. " -b " .. shell_quote(exe .. "_build") .. " -o " .. shell_quote(exe)
+	print("Building " .. bench.name .. "...")
+	if not run(build .. " >/dev/null") then error("Building " .. bench.name .. " failed: " .. build) end
+
+	local args = bench.args and (" " .. bench.args) or ""
+	if not bench.self_compile then
+		return "./" .. exe .. args, lua_cmd and (lua_cmd .. " " .. shell_quote(bench.script) .. args)
+	end
+	-- Each run starts from an empty translation cache
+	local out = build_dir .. "/self_out"
+	local cache = build_dir .. "/self_cache"
+	local flags = " -t src/luax.lua -b " .. shell_quote(out) .. " -o " .. shell_quote(out .. "/luax")
+	local prep = "rm -rf " .. shell_quote(out) .. " " .. shell_quote(cache) .. "; export LUAX_CACHE_DIR=" .. shell_quote(cache)
+	return "./" .. exe .. flags, lua_cmd and (lua_cmd .. " src/luax.lua" .. flags), prep
+end
+
+local function json_number(v)
+	if v ~= v or v == math.huge or v == -math.huge then return "null" end
+	return string.format("%.9g", v)
+end
+
+local function json_stats(s)
+	local samples = {}
+	for k, v in ipairs(s.samples) do samples[k] = json_number(v) end
+	return string.format('{"median": %s, "mean": %s, "variance": %s, "stdev": %s, "min": %s, "max": %s, "samples": [%s]}',
+		json_number(s.median), json_number(s.mean), json_number(s.variance), json_number(s.stdev),
+		json_number(s.min), json_number(s.max), table.concat(samples, ", "))
+end
+
+local function json_string(s)
+	return '"' .. s:gsub('[%c"\\]', function(c) return string.format("\\u%04x", c:byte()) end) .. '"'
+end
+
+local function write_json(path, results)
+	local entries = {}
+	for _, r in ipairs(results) do
+		local fields = {'"name": ' .. json_string(r.name), '"luax": ' .. json_stats(r.luax)}
+		if r.reference then
+			table.insert(fields, '"reference": ' .. json_stats(r.reference))
+			table.insert(fields, '"speedup": ' .. json_number(r.reference.median / r.luax.median))
+		end
+		if r.check ~= nil then table.insert(fields, '"output_matches": ' .. tostring(r.check)) end
+		table.insert(entries, "    {" .. table.concat(fields, ", ") .. "}")
+	end
+	local f = io.open(path, "w")
+	if not f then error("Could not write to " .. path) end
+	f:write("{\n")
+	f:write('  "luax": ' .. json_string(luax_cmd) .. ",\n")
+	f:write('  "reference": ' .. (lua_cmd and json_string(lua_cmd) or "null") .. ",\n")
+	f:write('  "iterations": ' .. iterations .. ",\n")
+	f:write('  "warmup": ' .. warmup .. ",\n")
+	f:write('  "benchmarks": [\n' .. table.concat(entries, ",\n") .. "\n  ]\n")
+	f:write("}\n")
+	f:close()
+end
+
+-- Reads the LuaX medians back from a report written by write_json
+local function read_medians(path)
+	local f = io.open(path, "r")
+	if not f then error("Could not open " .. path) end
+	local text = f:read("*a")
+	f:close()
+	local medians = {}
+	for name, median in text:gmatch('"name": "([^"]*)", "luax": {"median": ([^,]+),') do
+		medians[name] = tonumber(median)
+	end
+	return medians
+end
+
+run("mkdir -p " .. shell_quote(build_dir))
+
+local results = {}
+local failed = false
+for _, bench in ipairs(SUITE) do
+	if next(filters) == nil or filters[bench.name] then
+		local luax_run, ref_run, prep = prepare(bench)
+		local r = {name = bench.name}
+		if bench.check and ref_run then
+			r.check = capture(luax_run) == capture(ref_run)
+			if not r.check then failed = true end
+		end
+		print("Timing " .. bench.name .. "...")
+		r.luax = measure(luax_run, prep)
+		if ref_run then r.reference = measure(ref_run, prep) end
+		table.insert(results, r)
+	end
+end
+
+print(string.format("\n%-14s %12s %10s %12s %10s %9s", "benchmark", "luax (s)", "stdev", "lua (s)", "stdev", "speedup"))
+for _, r in ipairs(results) do
+	local ref = r.reference
+	print(string.format("%-14s %12.4f %10.4f %12s %10s %9s%s", r.name, r.luax.median, r.luax.stdev,
+		ref and string.format("%.4f", ref.median) or "-", ref and string.format("%.4f", ref.stdev) or "-",
+		ref and string.format("%.2fx", ref.median / r.luax.median) or "-",
+		r.check == false and "  OUTPUT MISMATCH" or ""))
+end
+
+if json_path then
+	write_json(json_path, results)
+	print("\nWrote " .. json_path)
+end
+
+if compare_path then
+	local old = read_medians(compare_path)
+	print(string.format("\nCompared with %s (threshold %.0f%%):", compare_path, threshold * 100))
+	for _, r in ipairs(results) do
+		local before = old[r.name]
+		if before then
+			local change = r.luax.median / before - 1
+			local regressed = change > threshold
+			if regressed then failed = true end
+			print(string.format("%-14s %+7.1f%%%s", r.name, change * 100, regressed and "  REGRESSION" or ""))
+		end
+	end
+end
+
+os.exit(failed and 1 or 0)
@@ -13,3 +13,23 @@ print(result)
 -- Test multiple library accesses in same scope
 local x = math.floor(3.7) + math.ceil(2.3)
 print(x)
+
+-- Dynamically built keys go through the string intern cache
+local t = {}
+for i = 1, 2000 do t["field_" .. (i % 100)] = i end
+local stats = debug.internstats()
+assert(stats.entries >= 100, "intern pool entries")
+assert(stats.hits + stats.misses > 0, "intern lookups counted")
+assert(stats.shards >= 1 and stats.cachesize >= 256, "intern shards and cache")
+
+-- The same keys again are served by the per-thread cache
+for i = 1, 2000 do t["field_" .. (i % 100)] = i end
+local again = debug.internstats()
+assert(again.hits - stats.hits >= 1000, "repeated lookups hit the cache")
+
+-- More distinct keys than the cache holds replace entries, and the cache grows
+local wide = {}
+for i = 1, 20000 do wide["wide_key_" .. i] = i end
+local after = debug.internstats()
+assert(after.evictions > again.evictions, "a full cache evicts")
+assert(after.cachesize > stats.cachesize, "a missing cache grows")
@@ -104,4 +104,35 @@ assert_equal(r_nest, "inner_yield", "Outer yielded inner's value")
 s_nest, r_nest = coroutine.resume(co_outer)
 assert_equal(r_nest, "inner_done", "Outer returned inner's result")
 
+-- 6. Many short-lived generators (stackful backend reuses pooled stacks)
+print("\n--- Test 6: Many Generators ---")
+local function range(n)
+    return coroutine.wrap(function()
+        for i = 1, n do coroutine.yield(i) end
+    end)
+end
+
+local total = 0
+for _ = 1, 20000 do
+    local gen = range(3)
+    total = total + gen() + gen()
+    -- Abandoned while suspended; its stack must unwind and return to the pool
+end
+assert_equal(total, 60000, "Sum over abandoned generators")
+
+-- 7. status and running from inside a coroutine
+print("\n--- Test 7: Status and Running ---")
+local co_self
+co_self = coroutine.create(function()
+    local running, is_main = coroutine.running()
+    assert_true(running == co_self, "coroutine.running returns the current coroutine")
+    assert_true(not is_main, "coroutine.running is not main inside a coroutine")
+    assert_equal(coroutine.status(co_self), "running", "Status is running from inside")
+    local s_again, msg_again = coroutine.resume(co_self)
+    assert_true(not s_again, "Cannot resume a running coroutine")
+end)
+coroutine.resume(co_self)
+local _, main_flag = coroutine.running()
+assert_true(main_flag, "coroutine.running reports main outside coroutines")
+
 print("\nAll Comprehensive Coroutine Tests Passed!")
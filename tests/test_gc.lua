@@ -0,0 +1,170 @@
+-- tests/test_gc.lua
+
+print("Starting Cycle Collector Test")
+
+local function assert_equal(a, b, msg)
+    if a ~= b then
+        print("FAILED: " .. msg .. " (Expected " .. tostring(b) .. ", got " .. tostring(a) .. ")")
+        os.exit(1)
+    end
+end
+
+collectgarbage("collect")
+local base = collectgarbage("count")
+assert_equal(type(base), "number", "count returns a number")
+
+-- Self references, back pointers and self-indexing metatables
+local function make_garbage(n)
+    for i = 1, n do
+        local node = {}
+        node.self = node
+        local child = { parent = node }
+        node.child = child
+        local mt = {}
+        mt.__index = mt
+        setmetatable(node, mt)
+    end
+end
+
+collectgarbage("stop")
+make_garbage(20000)
+collectgarbage("restart")
+local grown = collectgarbage("count")
+collectgarbage("collect")
+local after = collectgarbage("count")
+print(string.format("count: base %.1f KB, grown %.1f KB, after collect %.1f KB", base, grown, after))
+if after > base + (grown - base) / 4 then
+    print("FAILED: cyclic garbage was not reclaimed")
+    os.exit(1)
+end
+
+-- Live cycles must survive
+local ring = {}
+ring.next = { next = { next = ring } }
+ring.value = 42
+collectgarbage("collect")
+assert_equal(ring.next.next.next.value, 42, "live ring survives a collection")
+
+local proto = { greet = function() return "hi" end }
+proto.__index = proto
+local obj = setmetatable({}, { __index = proto })
+collectgarbage("collect")
+assert_equal(obj.greet(), "hi", "inline metatable survives a collection")
+
+-- Cycles through closures: a function capturing its table, a local function calling itself
+local function make_closure_garbage(n)
+    for i = 1, n do
+        local node = { id = i }
+        node.self = node
+        node.get = function() return node.id end
+        local function walk(k)
+            if k > 0 then return walk(k - 1) end
+            return node
+        end
+        node.walk = walk
+    end
+end
+
+local tables_before = debug.memstats().tables
+collectgarbage("stop")
+make_closure_garbage(5000)
+collectgarbage("restart")
+collectgarbage("collect")
+if debug.memstats().tables > tables_before + 500 then
+    print("FAILED: cycles through closures were not reclaimed")
+    os.exit(1)
+end
+
+local counter = { n = 0 }
+counter.bump = function() counter.n = counter.n + 1 return counter.n end
+local function countdown(k) if k > 0 then return countdown(k - 1) end return counter end
+counter.countdown = countdown
+collectgarbage("collect")
+assert_equal(counter.bump(), 1, "a live closure cycle survives a collection")
+assert_equal(counter.countdown(3).n, 1, "a live recursive local function survives a collection")
+
+-- A step scans one candidate of a cycle while another waits in the buffer: the waiting one
+-- is coloured by the scan and must become a candidate again when its count drops
+collectgarbage("stop")
+collectgarbage("collect")
+local tables_start = debug.memstats().tables
+do
+    local b, c = {}, {}
+    b.a = { b = b }
+    c.b = b
+    local fillers = {}
+    for i = 1, 63 do fillers[i] = {} end
+    collectgarbage("collect")
+    local t = c
+    t = nil
+    for i = 1, 63 do local f = fillers[i] end
+    t = b
+    t = nil
+    collectgarbage("step", 1)
+end
+collectgarbage("collect")
+collectgarbage("restart")
+assert_equal(debug.memstats().tables, tables_start, "a cycle coloured by an earlier step is reclaimed")
+
+-- Incremental steps finish the cycle eventually
+make_garbage(5000)
+local steps = 0
+repeat steps = steps + 1 until collectgarbage("step") or steps > 1000
+assert_equal(collectgarbage("step"), true, "step reports a finished cycle")
+
+collectgarbage("stop")
+assert_equal(collectgarbage("isrunning"), false, "stop")
+collectgarbage("restart")
+assert_equal(collectgarbage("isrunning"), true, "restart")
+
+-- Arena scopes: everything built inside is released with the scope, results stay valid
+local kept = {}
+local function handle(n)
+    local rows = {}
+    for i = 1, n do rows[i] = { id = i, name = "row" .. i } end
+    kept[#kept + 1] = rows[n]
+    return #rows, rows[1]
+end
+for request = 1, 20 do
+    local count, first = arena.run(handle, 500)
+    assert_equal(count, 500, "arena.run returns the results")
+    assert_equal(first.name, "row1", "a result outlives its arena")
+end
+assert_equal(kept[20].id, 500, "a table kept from an arena scope")
+assert_equal(pcall(arena.run, function() error("boom") end), false, "errors propagate out of arena.run")
+
+-- A coroutine that yields inside arena.run takes its arena with it
+local co = coroutine.wrap(function()
+    return arena.run(function()
+        local rows = {}
+        for i = 1, 100 do rows[i] = { i } end
+        coroutine.yield()
+        return #rows
+    end)
+end)
+co()
+local pages = debug.memstats().arenapages
+local outside = {}
+for i = 1, 2000 do outside[i] = { i } end
+assert_equal(debug.memstats().arenapages, pages, "the resumer does not allocate from a suspended arena")
+assert_equal(co(), 100, "the arena scope resumes with its coroutine")
+
+-- Allocator counters
+local before = debug.memstats()
+local held = {}
+for i = 1, 100 do held[i] = { i } end
+local after = debug.memstats()
+assert(after.tables >= before.tables + 100, "memstats counts live tables")
+assert(after.buckets[1].size == 32 and #after.buckets == 8, "memstats size classes")
+assert(after.inuse > 0 and collectgarbage("count") > 0, "bytes in use")
+local map, live = {}, debug.memstats().tables
+for i = 1, 200 do map[{}] = i end
+for k in pairs(map) do map[k] = nil end
+assert_equal(next(map), nil, "every key removed during traversal")
+assert(debug.memstats().tables <= live + 1, "removed keys are released")
+assert_equal(debug.memstats(map).hash, 0, "hash part counts live entries")
+local parts = debug.memstats({ 1, 2, 3, x = 1 })
+assert_equal(parts.array, 3, "array part length")
+assert_equal(parts.small, 1, "small part length")
+
+print("Cycle Collector Test Passed")
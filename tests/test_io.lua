@@ -40,6 +40,26 @@ end
 assert(count == 3)
 os.remove("test_lines.txt")
 
+-- Test "m" mode: reads come from a memory mapping
+print("Testing mapped reads...")
+local f_map = io.open("test_map.txt", "w")
+f_map:write("alpha\nbeta\n 12.5 tail\nend")
+f_map:close()
+
+f_map = io.open("test_map.txt", "rm")
+assert(f_map:read("l") == "alpha")
+assert(f_map:read("L") == "beta\n")
+assert(f_map:read("n") == 12.5)
+assert(f_map:read(3) == " ta")
+assert(f_map:read("a") == "il\nend")
+assert(f_map:read("l") == nil)
+assert(f_map:seek("set", 6) == 6)
+local mapped = {}
+for line in f_map:lines() do table.insert(mapped, line) end
+assert(#mapped == 3 and mapped[1] == "beta" and mapped[3] == "end")
+f_map:close()
+os.remove("test_map.txt")
+
 -- Test io.flush
 print("Testing io.flush...")
 io.write("Flushing stdout... ")
@@ -53,4 +73,24 @@ f_buf:setvbuf("no")
 f_buf:write("Unbuffered")
 f_buf:close()
 
+-- Test buffered writes: numbers, long strings, and reading back after seek
+print("Testing buffered writes...")
+local f_w = io.tmpfile()
+local long = string.rep("x", 100000)
+f_w:write("a", 1, " ", 2.5, "\n", long, "\n")
+for i = 1, 1000 do f_w:write(i, ",") end
+assert(f_w:seek("cur") == 7 + #long + 1 + 3893)
+f_w:seek("set", 0)
+assert(f_w:read("l") == "a1 2.5")
+assert(#f_w:read("l") == #long)
+assert(f_w:read(4) == "1,2,")
+f_w:setvbuf("line")
+f_w:seek("end", 0)
+f_w:write("last\n")
+f_w:seek("set", 0)
+assert(#f_w:read("a") == 7 + #long + 1 + 3893 + 5)
+f_w:close()
+io.write("print and io.write ", "share ")
+print("one buffer")
+
 print("All tests passed!")
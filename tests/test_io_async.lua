@@ -0,0 +1,89 @@
+print("Testing non-blocking pipes...")
+
+-- Main line: a read waits for the pipe (driving the reactor) and behaves like a blocking one
+local p = io.popen("echo hello; sleep 0.1; echo world; echo 42 7", "rn")
+assert(p:read("l") == "hello")
+assert(p:read("L") == "world\n")
+assert(p:read("n") == 42)
+assert(p:read("a") == " 7\n")
+assert(p:read("a") == nil)
+assert(p:close() == true)
+assert(io.popen("exit 3", "rn"):close() == nil)
+
+-- Coroutines park on their pipes, so the commands run at the same time
+local start = os.time()
+local results = {}
+local tasks = {}
+for i = 1, 100 do
+	tasks[i] = function()
+		local pipe = io.popen("sleep 1; echo " .. i, "rn")
+		results[i] = tonumber(pipe:read("l"))
+		pipe:close()
+	end
+end
+io.run(table.unpack(tasks))
+for i = 1, 100 do assert(results[i] == i) end
+assert(os.time() - start < 10, "pipes were read one after another")
+
+-- A writer filling its pipe and a line reader share the loop
+local lines = {}
+io.run(function()
+	local out = io.popen("wc -c > /dev/null", "wn")
+	out:write(string.rep("x", 1 << 20), "tail")
+	out:close()
+end, function()
+	for line in io.popen("for i in 1 2 3; do echo line$i; sleep 0.05; done", "rn"):lines() do
+		lines[#lines + 1] = line
+	end
+end)
+assert(table.concat(lines, ",") == "line1,line2,line3")
+
+-- Closing while another coroutine's write waits for the pipe sends that write first
+local counted = os.tmpname()
+local sink = io.popen("sleep 0.2; wc -c > " .. counted, "wn")
+local closed
+io.run(function()
+	sink:write(string.rep("x", 1 << 20))
+end, function()
+	sink:write("tail")
+	closed = sink:close()
+end)
+assert(closed == true)
+local count_file = io.open(counted, "r")
+assert(tonumber(count_file:read("a")) == (1 << 20) + 4)
+count_file:close()
+os.remove(counted)
+
+-- Two readers on one pipe: the second takes bytes while the first waits for the end of its line
+local shared = io.popen("printf ab; sleep 0.2; printf c; sleep 0.2; printf 'd\\nnext\\n'", "rn")
+local first, second
+io.run(function()
+	first = shared:read("l")
+end, function()
+	second = shared:read(2)
+end)
+assert(second == "ab" and first == "cd")
+assert(shared:read("l") == "next")
+assert(shared:close() == true)
+
+-- A parked coroutine yields to its resumer with no values; io.poll finishes it
+local co = coroutine.create(function()
+	local pipe = io.popen("sleep 0.2; echo late", "rn")
+	local line = pipe:read("l")
+	pipe:close()
+	return line
+end)
+local ok, value = coroutine.resume(co)
+assert(ok and value == nil and coroutine.status(co) == "suspended")
+assert(io.poll(0) == 1)
+while io.poll() > 0 do end
+assert(coroutine.status(co) == "dead")
+
+-- Errors raised by a resumed coroutine come out of io.run
+local ok2, err = pcall(io.run, function()
+	io.popen("sleep 0.1", "rn"):read("a")
+	error("task failed")
+end)
+assert(not ok2 and tostring(err):find("task failed"))
+
+print("non-blocking pipe tests passed")
@@ -56,4 +56,57 @@ mytable4.another_key = "another_value" -- Should trigger __newindex (table)
 print("mytable4.another_key (should be nil):", mytable4.another_key)
 print("storage_table.another_key (should be 'another_value'):", storage_table.another_key)
 
+-- Field sites shared by tables of different layouts (inline caches must not mix them up)
+local Point = {}
+Point.__index = Point
+function Point.new(x, y) return setmetatable({x = x, y = y}, Point) end
+function Point:len2() return self.x * self.x + self.y * self.y end
+
+local shapes = {Point.new(1, 2), setmetatable({y = 5, x = 3}, Point), setmetatable({x = 4}, Point), {x = 6, y = 7}}
+local sum = 0
+for round = 1, 3 do
+    for _, p in ipairs(shapes) do
+        p.x = p.x + 1
+        sum = sum + p.x + (p.y or 0)
+    end
+end
+assert(sum == 108, "field sum across layouts")
+assert(Point.new(3, 4):len2() == 25, "method through __index")
+
+-- The cached field disappears when removed, and __index sees later changes
+local p = Point.new(1, 1)
+p.x = nil
+assert(p.x == nil, "removed field")
+Point.x = 99
+assert(p.x == 99, "removed field falls back to __index")
+Point.len2 = function() return -1 end
+assert(p:len2() == -1, "replaced method")
+
+-- Metamethods are cached on the metatable and follow later changes to it
+local Base = {kind = "base"}
+local Derived = {kind = "derived"}
+local Class = {__index = Base}
+local objs = {}
+for i = 1, 3 do objs[i] = setmetatable({}, Class) end
+assert(objs[1].kind == "base", "cached __index")
+for i = 1, 20 do Class["extra" .. i] = i end
+Class.__index = Derived
+assert(objs[2].kind == "derived", "replaced __index")
+Class.__index = nil
+assert(objs[3].kind == nil, "removed __index")
+
+Class.__len = function() return 42 end
+Class.__lt = function(a, b) return rawequal(a, objs[1]) end
+Class.__concat = function(a, b) return "joined" end
+Class.__call = function(self, x) return x * 2 end
+assert(#objs[1] == 42, "__len")
+assert(objs[1] < objs[2] and not (objs[2] < objs[1]), "__lt")
+assert(objs[1] .. "x" == "joined", "__concat")
+assert(objs[1](21) == 42, "__call")
+
+-- Metamethods are raw fields: the metatable's own __index does not supply them
+local Shared = {__len = function() return 7 end}
+local Lookup = setmetatable({}, {__index = Shared})
+assert(#setmetatable({}, Lookup) == 0, "metamethods are looked up raw")
+
 print("--- Metamethods Test Complete ---")
@@ -11,4 +11,33 @@ end
 
 local empty_t = {}
 local k_empty, v_empty = next(empty_t)
-print("next(empty_t):", k_empty, v_empty)
\ No newline at end of file
+print("next(empty_t):", k_empty, v_empty)
+-- Clearing fields while traversing a large table
+local big = {}
+for i = 1, 500 do big["field" .. i] = i end
+big[1000] = "sparse"
+big[2.0] = "two"
+local seen, cleared = 0, 0
+for key, _ in pairs(big) do
+    seen = seen + 1
+    if seen % 2 == 0 then
+        big[key] = nil
+        cleared = cleared + 1
+    end
+end
+assert(seen == 502, "pairs visited " .. seen .. " entries")
+local left = 0
+for _ in pairs(big) do left = left + 1 end
+assert(left == seen - cleared, "entries left after clearing")
+local keys = {}
+for i = 1, 100 do keys["k" .. i] = i end
+keys[3.0] = "three"
+keys[-7.0] = "minus seven"
+assert(keys[3] == "three" and keys[3.0] == "three", "integral float key is the integer key")
+assert(keys[-7] == "minus seven", "negative integral float key")
+keys[3] = nil
+assert(keys[3.0] == nil, "integer key removes the float key")
+local found = 0
+for key in pairs(keys) do if key == 3 or key == -7 then found = found + 1 end end
+assert(found == 1, "one slot per normalised key")
+print("next: large table traversal ok")
@@ -1,4 +1,5 @@
 -- tests/test_parallel.lua
+-- Build with: lua5.4 src/luax.lua --refcount biased tests/test_parallel.lua (or --refcount atomic)
 
 print("Starting Parallel Coroutine Stress Test")
 
@@ -50,4 +51,77 @@ for i, co in ipairs(threads) do
     end
 end
 
+-- Fan out many more tasks than workers, including tasks that spawn and await their own children
+local function fan_out(id)
+    local children = {}
+    for k = 1, 4 do
+        local child = coroutine.create_parallel(worker_func)
+        coroutine.resume(child, k, 100)
+        children[k] = child
+    end
+    local total = 0
+    for k = 1, 4 do
+        local ok, sum = coroutine.await(children[k])
+        total = total + sum
+    end
+    return total, id
+end
+
+local many = {}
+for i = 1, 2000 do
+    local co = coroutine.create_parallel(fan_out)
+    coroutine.resume(co, i)
+    many[i] = co
+end
+
+for i = 1, #many do
+    local success, total, id = coroutine.await(many[i])
+    assert_equal(success, true, "Fan-out task " .. i .. " success")
+    assert_equal(total, 4 * 5050, "Fan-out task " .. i .. " total")
+    assert_equal(id, i, "Fan-out task " .. i .. " id")
+end
+
+-- Tasks reading the same table through a captured local
+local lookup = {}
+for k = 1, 100 do lookup[k] = { value = k } end
+local function read_lookup()
+    local total = 0
+    for k = 1, #lookup do total = total + lookup[k].value end
+    return total
+end
+local readers = {}
+for i = 1, 16 do
+    readers[i] = coroutine.create_parallel(read_lookup)
+    coroutine.resume(readers[i])
+end
+for i = 1, #readers do
+    local success, total = coroutine.await(readers[i])
+    assert_equal(success, true, "Reader " .. i .. " success")
+    assert_equal(total, 5050, "Reader " .. i .. " total")
+end
+
+-- A global defined after the first task has started is handed to later tasks as well
+late_global = {}
+for k = 1, 100 do late_global[k] = { value = k } end
+local late_readers = {}
+for i = 1, 16 do
+    late_readers[i] = coroutine.create_parallel(function()
+        local total = 0
+        for k = 1, #late_global do total = total + late_global[k].value end
+        return total
+    end)
+    coroutine.resume(late_readers[i])
+end
+for i = 1, #late_readers do
+    local success, total = coroutine.await(late_readers[i])
+    assert_equal(success, true, "Late global reader " .. i .. " success")
+    assert_equal(total, 5050, "Late global reader " .. i .. " total")
+end
+
+local failing = coroutine.create_parallel(function() error("task failed") end)
+coroutine.resume(failing)
+local ok, err = coroutine.await(failing)
+assert_equal(ok, false, "Failing task reports failure")
+assert_equal(string.find(err, "task failed") ~= nil, true, "Failing task error message")
+
 print("PASSED: Parallel stress test completed successfully.")
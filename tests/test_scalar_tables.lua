@@ -0,0 +1,84 @@
+-- Tables that never escape their function are kept in locals
+
+local function length(x, y)
+    local v = {x = x, y = y}
+    return math.sqrt(v.x * v.x + v.y * v.y)
+end
+print(length(3, 4)) -- Expected: 5.0
+
+-- Fields can be rewritten, and widen from integer to float
+local function centroid(n)
+    local c = {x = 0, y = 0, label = "c"}
+    for i = 1, n do
+        c.x = c.x + i
+        c.y = c.y + i / 2
+    end
+    return c.label .. " " .. c.x .. " " .. c.y
+end
+print(centroid(4)) -- Expected: c 10 5.0
+
+-- Array-only tables: constant and computed indexes, length
+local function sum3(a, b, c)
+    local items = {a, b, c}
+    local total = 0
+    for i = 1, #items do
+        total = total + items[i]
+    end
+    items[2] = nil
+    return total, items[1], items[2], items[4], items[1.0]
+end
+print(sum3(1, 2, 3)) -- Expected: 6 1 nil nil 1
+
+local function trailing()
+    local t = {1, 2, 3}
+    t[3] = nil
+    return #t
+end
+print(trailing()) -- Expected: 2
+
+-- Escaping tables keep their identity
+local function make()
+    local p = {x = 1}
+    return p
+end
+local q = make()
+q.x = q.x + 1
+print(q.x) -- Expected: 2
+
+local function capture()
+    local p = {n = 0}
+    local function bump() p.n = p.n + 1 end
+    bump()
+    bump()
+    return p.n
+end
+print(capture()) -- Expected: 2
+
+-- Anonymous closures see later writes too
+local function capture_expression()
+    local p = {x = 0}
+    local f = function() return p.x end
+    p.x = 5
+    return f()
+end
+print(capture_expression()) -- Expected: 5
+do
+    local p = {x = 0}; local f = function() return p.x end; p.x = 5; print(f()) -- Expected: 5
+end
+
+-- A key outside the constructor keeps the table
+local function grow()
+    local p = {x = 1}
+    p.y = 2
+    return p.x + p.y
+end
+print(grow()) -- Expected: 3
+
+-- Redeclaring the name keeps the table
+local function shadow()
+    local p = {x = 1}
+    local r = p.x
+    local p = {x = 10}
+    return r + p.x
+end
+print(shadow()) -- Expected: 11
@@ -5,4 +5,84 @@ assert(string.len(s) == 11, "string.len failed")
 assert(string.byte(s) == 104, "string.byte failed") 
 local s2 = s .. "!"
 assert(s2 == "hello world!", "Concatenation failed")
+
+-- Short and long strings from different sources compare and index alike
+local line = "GET /index.html 200"
+local verb = string.sub(line, 1, 3)
+assert(verb == "GET", "short substring equality failed")
+local counts = {}
+for word in string.gmatch(line, "%S+") do counts[word] = (counts[word] or 0) + 1 end
+assert(counts["GET"] == 1 and counts["200"] == 1 and counts["/index.html"] == 1, "gmatch keys failed")
+assert(counts[verb] == 1, "substring as table key failed")
+assert(("ab" .. "c") == "abc" and ("abc" .. "def") == "abcdef", "short concat equality failed")
+assert(#"" == 0 and ("" .. "") == "", "empty string failed")
+
+local acc = ""
+for i = 1, 1000 do acc = acc .. "x" end
+assert(#acc == 1000 and string.sub(acc, 995) == "xxxxxx", "repeated append failed")
+
+-- string.scan (LuaX extension) skips runs of a character class
+if string.scan then
+	local src = "local x_1 = 0x1F -- done\nnext"
+	assert(string.scan(src, 1, "name") == 6, "scan name failed")
+	assert(string.scan(src, 6, "space") == 7, "scan space failed")
+	assert(string.scan(src, 15, "xdigit") == 17, "scan xdigit failed")
+	assert(string.scan(src, 18, "line") == 25, "scan line failed")
+	assert(string.scan('ab\\"', 1, "dq") == 3, "scan dq failed")
+	assert(string.scan(src, #src + 1, "name") == #src + 1, "scan at end failed")
+end
+-- Compiled patterns: constant and dynamic, literal prefixes, sets and plain finds
+local log = "2024-01-02 ERROR disk full; 2024-01-03 WARN cpu hot; 2024-01-04 ERROR net down"
+local errors = {}
+for day, msg in log:gmatch("%d+%-%d+%-(%d+) ERROR ([^;]+)") do errors[#errors + 1] = day .. "=" .. msg end
+assert(table.concat(errors, ",") == "02=disk full,04=net down", "gmatch with captures failed")
+local lexer = { gmatch = function(self, p) return function() end end }
+local tokens = 0
+for _ in lexer:gmatch("%a+") do tokens = tokens + 1 end
+assert(tokens == 0, "gmatch on a table calls its own method")
+local level = "WARN"
+assert(log:match(level .. " (%a+)") == "cpu", "dynamic pattern failed")
+assert(select(2, log:gsub("ERROR", "E")) == 2, "literal gsub failed")
+assert(log:find("a.b", 1, true) == nil and ("x.y"):find(".", 1, true) == 2, "plain find failed")
+assert(("[tag]"):match("%[(.-)%]") == "tag" and ("a]b"):match("[]]") == "]", "bracket sets failed")
+assert(("hello hello"):match("(h%a+) %1") == "hello", "back reference failed")
+assert(string.gsub("abc", "%w", "%0%0") == "aabbcc", "whole match replacement failed")
+assert(select("#", ("aaa"):find("()a()")) == 4, "position captures failed")
+assert(not pcall(string.match, "a", "[a"), "malformed pattern not reported")
+-- string.pack / string.unpack round trips
+local frame = string.pack("<I2 i4 s1 z d", 513, -7, "hdr", "body", 2.5)
+assert(#frame == 2 + 4 + 1 + 3 + 5 + 8, "pack size failed")
+local kind, delta, name, payload, ratio, next_pos = string.unpack("<I2 i4 s1 z d", frame)
+assert(kind == 513 and delta == -7 and name == "hdr" and payload == "body" and ratio == 2.5, "unpack failed")
+assert(next_pos == #frame + 1, "unpack position failed")
+assert(string.unpack(">I2", frame, 1) == 0x0102, "big-endian unpack failed")
+assert(string.unpack("<i2", string.char(255, 255)) == -1 and string.unpack("B", string.char(255)) == 255, "sign extension failed")
+assert(string.packsize("!<i1i8") == 16 and string.packsize("i4i4") == 8, "packsize failed")
+local fmt = "<i3"
+assert(string.unpack(fmt, string.pack(fmt, -100000)) == -100000, "dynamic format failed")
+assert(string.unpack("<i4", string.pack("<i4", 3.0)) == 3, "integral float packs as integer")
+local ok, err = pcall(string.pack, "<i4", 1.5)
+assert(not ok and err:find("no integer representation"), "non-integral float rejected")
+assert(not pcall(string.pack, "i1", 200), "pack overflow not reported")
+assert(not pcall(string.unpack, "i4", "abc"), "short data not reported")
+-- Accumulating with s = s .. a .. b appends in place but keeps value semantics
+local out = ""
+local snapshot
+for i = 1, 100 do
+	out = out .. i .. ","
+	if i == 50 then snapshot = out end
+end
+assert(#out == 292 and out:sub(1, 6) == "1,2,3," and out:sub(-4) == "100,", "accumulate failed")
+assert(#snapshot == 141 and snapshot:sub(-3) == "50,", "accumulate snapshot changed")
+out = out .. out
+assert(#out == 584, "self append failed")
+
+-- string.buffer (LuaX extension)
+if string.buffer then
+	local buf = string.buffer("[")
+	for i = 1, 3 do buf:put(i, i < 3 and "," or "") end
+	buf:put("]")
+	assert(buf:tostring() == "[1,2,3]" and buf:len() == 7, "string.buffer failed")
+	assert(buf:reset():put("x"):tostring() == "x", "string.buffer reset failed")
+end
 print("PASS: String tests")
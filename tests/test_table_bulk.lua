@@ -0,0 +1,60 @@
+-- table.create / table.new and the bulk array paths of move, concat, unpack and pack
+
+local t = table.create(100)
+print(#t, next(t)) -- Expected: 0 nil
+for i = 1, 100 do t[i] = i * 2 end
+print(#t, t[1], t[100]) -- Expected: 100 2 200
+
+local h = table.new(0, 16)
+for i = 1, 16 do h["k" .. i] = i end
+print(h.k1, h.k16) -- Expected: 1 16
+assert(not pcall(table.create, -1))
+
+-- Loops that fill or append to a table reserve it first
+local squares = {}
+for i = 1, 10 do squares[i] = i * i end
+print(#squares, squares[10]) -- Expected: 10 100
+local list = {"a"}
+for i = 1, 4 do list[#list + 1] = i end
+print(table.concat(list, ",")) -- Expected: a,1,2,3,4
+local partial = {}
+for i = 1, 1000 do
+    if i > 3 then break end
+    partial[i] = i
+end
+print(#partial) -- Expected: 3
+
+-- Overlapping moves within one table go either way
+local m = {1, 2, 3, 4, 5}
+table.move(m, 1, 3, 2)
+print(table.concat(m, " ")) -- Expected: 1 1 2 3 5
+table.move(m, 2, 5, 1)
+print(table.concat(m, " ")) -- Expected: 1 2 3 5 5
+local dst = table.move({1, 2, 3}, 1, 3, 3, {9, 9})
+print(table.concat(dst, " ")) -- Expected: 9 9 1 2 3
+-- Holes in the source are read through __index
+local holey = setmetatable({1, nil, 3}, { __index = function(_, k) return "idx" .. k end })
+local filled = table.move(holey, 1, 3, 1, {})
+print(filled[1], filled[2], filled[3]) -- Expected: 1 idx2 3
+assert(filled[2] == "idx2")
+
+print(table.concat({"ab", 1, 2.5, "a longer piece"}, ", ")) -- Expected: ab, 1, 2.5, a longer piece
+print(table.concat({1, 2, 3}, "", 3, 2) == "") -- Expected: true
+assert(not pcall(table.concat, {1, nil, 3}, ",", 1, 3))
+
+print(table.unpack({1, 2, 3, 4}, 2, 3)) -- Expected: 2 3
+print(table.unpack({1, 2}, 2, 4)) -- Expected: 2 nil nil
+
+local function collect(...)
+    local args = {...}
+    return #args, args[1], args[select("#", ...)]
+end
+print(collect(7, 8, 9)) -- Expected: 3 7 9
+local function after(first, ...)
+    local rest = {first, ...}
+    return #rest, rest[2]
+end
+print(after(1, 2, 3)) -- Expected: 3 2
+
+local p = table.pack(1, nil, 3)
+print(p.n, math.type(p.n), p[3]) -- Expected: 3 integer 3
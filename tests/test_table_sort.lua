@@ -0,0 +1,53 @@
+-- table.sort picks a specialized sort from the array's contents
+
+local function is_sorted(t, lt)
+    lt = lt or function(a, b) return a < b end
+    for i = 2, #t do
+        if lt(t[i], t[i - 1]) then return false end
+    end
+    return true
+end
+
+-- Integers, including negatives and values near the 48-bit limit (radix sort above 256 elements)
+local ints = {}
+for i = 1, 1000 do ints[i] = (i * 7919) % 1001 - 500 end
+ints[1], ints[2] = 140737488355327, -140737488355328
+table.sort(ints)
+assert(is_sorted(ints) and ints[1] == -140737488355328 and ints[1000] == 140737488355327)
+assert(math.type(ints[500]) == "integer")
+
+-- Doubles, with negative zero and infinities
+local floats = {}
+for i = 1, 500 do floats[i] = ((i * 37) % 101 - 50) / 4 end
+floats[1], floats[2], floats[3] = -0.0, math.huge, -math.huge
+table.sort(floats)
+assert(is_sorted(floats) and floats[1] == -math.huge and floats[500] == math.huge)
+
+-- Integers and floats together keep their subtypes
+local mixed = {3, 1.5, 2, 0.5, 1}
+table.sort(mixed)
+print(table.concat(mixed, " ")) -- Expected: 0.5 1 1.5 2 3
+print(math.type(mixed[2]), math.type(mixed[3])) -- Expected: integer float
+
+-- Strings, short and long, sharing prefixes
+local words = {"banana", "apple", "applesauce", "b", "", "apple pie", "app", "zebra", "banana split"}
+table.sort(words)
+print(table.concat(words, ",")) -- Expected: ,app,apple,apple pie,applesauce,b,banana,banana split,zebra
+
+-- Custom comparators
+local desc = {5, 3, 9, 1, 7}
+table.sort(desc, function(a, b) return a > b end)
+print(table.concat(desc, " ")) -- Expected: 9 7 5 3 1
+
+local records = {{name = "c", n = 2}, {name = "a", n = 3}, {name = "b", n = 1}}
+table.sort(records, function(x, y) return x.n < y.n end)
+print(records[1].name, records[2].name, records[3].name) -- Expected: b c a
+
+-- Values without a specialized order fall back to metamethods
+local mt = {__lt = function(a, b) return a.v < b.v end}
+local objs = {}
+for i = 1, 20 do objs[i] = setmetatable({v = (i * 13) % 20}, mt) end
+table.sort(objs)
+assert(is_sorted(objs, function(a, b) return a.v < b.v end))
+
+assert(not pcall(table.sort, {1, "x", 2}))
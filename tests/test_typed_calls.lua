@@ -0,0 +1,100 @@
+-- Local functions called with consistent argument types get unboxed entry points
+
+local function add(a, b)
+    return a + b
+end
+
+local sum = 0
+for i = 1, 1000 do
+    sum = add(sum, i)
+end
+print(sum, math.type(sum)) -- Expected: 500500 integer
+
+local function scale(x, f)
+    return x * f
+end
+local acc = 0.0
+for i = 1, 10 do
+    acc = acc + scale(1.5, 2.0)
+end
+print(acc, math.type(acc)) -- Expected: 30.0 float
+
+-- String parameters are passed as views
+local function greet(name)
+    return "hello " .. name
+end
+print(greet("lua")) -- Expected: hello lua
+
+-- Mixed call sites keep the boxed parameter
+local function twice(v)
+    return v * 2
+end
+print(twice(3), twice(2.5)) -- Expected: 6 5.0
+
+-- Falling off the end still returns nil
+local function maybe(n)
+    if n > 0 then
+        return n
+    end
+end
+print(maybe(4), maybe(-1)) -- Expected: 4 nil
+
+-- Multiple results go through the boxed entry
+local function pair(n)
+    return n, n + 1
+end
+local p, q = pair(7)
+print(p, q, pair(1)) -- Expected: 7 8 1 2
+
+-- Boolean results stay booleans
+local function is_even(n)
+    return n % 2 == 0
+end
+local evens = 0
+for i = 1, 10 do
+    if is_even(i) then evens = evens + 1 end
+end
+print(evens) -- Expected: 5
+
+-- Recursive local functions call themselves directly
+local function fib(n)
+    if n < 2 then
+        return n
+    end
+    return fib(n - 1) + fib(n - 2)
+end
+print(fib(20)) -- Expected: 6765
+
+local function walk(t, depth)
+    local total = depth
+    for _, child in ipairs(t) do
+        total = total + walk(child, depth + 1)
+    end
+    return total
+end
+print(walk({{}, {{}, {}}}, 0)) -- Expected: 6
+
+-- Closures inside a recursive function can call it too
+local function depth_of(t)
+    local best = 0
+    for _, c in ipairs(t) do
+        local get = function() return depth_of(c) end
+        local d = get()
+        if d > best then best = d end
+    end
+    return best + 1
+end
+print(depth_of({{}, {{}}})) -- Expected: 3
+
+-- Short string results outlive the call that produced them
+local function label(n)
+    if n > 0 then return "pos" end
+    return "neg"
+end
+local kinds = {}
+for i = 1, 3 do
+    local k = type(kinds)
+    local l = label(i - 2)
+    kinds[i] = function() return k .. ":" .. l end
+end
+print(kinds[1](), kinds[3]()) -- Expected: table:neg table:pos
@@ -1,4 +1,58 @@
 local s = "hello, world"
 for p, c in utf8.codes(s) do
   print(p, c)
-end
\ No newline at end of file
+end
+
+-- Byte positions and integer codes, lowered loop against the iterator
+local text = "aé€𝄞"
+local lowered = {}
+for p, c in utf8.codes(text) do lowered[#lowered + 1] = p .. ":" .. c end
+assert(table.concat(lowered, " ") == "1:97 2:233 4:8364 7:119070")
+local iter, state, init = utf8.codes(text)
+local called = {}
+for p, c in iter, state, init do called[#called + 1] = p .. ":" .. c end
+assert(table.concat(called, " ") == table.concat(lowered, " "))
+assert(math.type(select(2, iter(state, 0))) == "integer")
+assert(not pcall(function() for _ in utf8.codes("a\x80") do end end))
+assert(not pcall(utf8.codes, "\x80a"))
+
+-- len
+local mixed = "héllo wörld"
+assert(utf8.len(mixed) == 11)
+assert(utf8.len(mixed, 2, 3) == 1)
+local n, pos = utf8.len(mixed, 3)
+assert(n == nil and pos == 3)
+n, pos = utf8.len("ab\xffcd")
+assert(n == nil and pos == 3)
+assert(utf8.len("abc", 4) == 0)
+assert(not pcall(utf8.len, "abc", 5))
+assert(utf8.len(string.rep("x", 100) .. "é" .. string.rep("y", 100)) == 201)
+assert(utf8.len("\xED\xA0\x80") == nil)
+assert(utf8.len("\xED\xA0\x80", 1, -1, true) == 1)
+
+-- codepoint
+local cps = {utf8.codepoint(mixed, 1, -1)}
+assert(#cps == 11 and cps[2] == 233 and cps[8] == 246)
+assert(utf8.codepoint(mixed, 2) == 233)
+assert(not pcall(utf8.codepoint, mixed, 3))
+
+-- offset
+assert(utf8.offset(mixed, 3) == 4)
+assert(utf8.offset(mixed, -1) == 13)
+assert(utf8.offset(mixed, 0, 3) == 2)
+assert(utf8.offset(mixed, 20) == nil)
+assert(not pcall(utf8.offset, mixed, 1, 3))
+local ascii = "hello world, plain"
+assert(utf8.offset(ascii, 5) == 5)
+assert(utf8.offset(ascii, 19) == 19)
+assert(utf8.offset(ascii, 20) == nil)
+assert(utf8.offset(ascii, -3) == 16)
+assert(utf8.offset(ascii, -19) == nil)
+
+-- char
+assert(utf8.char(72, 233, 0x1D11E) == "Hé𝄞")
+assert(#utf8.char(0x7FFFFFFF) == 6)
+assert(not pcall(utf8.char, 0x80000000))
+assert(("é€"):match(utf8.charpattern) == "é")
+
+print("utf8 tests passed")
@@ -6,4 +6,30 @@ function do_something_else(...)
     return ...
 end
 
-print(do_something(do_something_else(1,2,3,4,5)))
\ No newline at end of file
+print(do_something(do_something_else(1,2,3,4,5)))
+
+-- Varargs passed on and counted in place
+local function count(...)
+    return select('#', ...)
+end
+local function forward(first, ...)
+    return count(...)
+end
+print(forward(1, 2, nil, 4), forward(1)) -- Expected: 3 0
+
+local function nth(n, ...)
+    return select(n, ...)
+end
+print(nth(2, "a", "b", "c")) -- Expected: b c
+print(nth(-1, "a", "b", "c")) -- Expected: c
+
+-- Functions that always return the same number of values
+local function divmod(a, b)
+    if a < b then
+        return 0, a
+    end
+    local q, r = divmod(a - b, b)
+    return q + 1, r
+end
+local q, r, extra = divmod(17, 5)
+print(q, r, extra) -- Expected: 3 2 nil